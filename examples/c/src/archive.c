@@ -0,0 +1,370 @@
+#include "./archive.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef FOCAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include "./sha256.h"
+
+#define ARCHIVE_MAGIC "focas-archive 1"
+#define HEX_SIZE (SHA256_SIZE * 2 + 1)
+
+// cut at the first line end after the gear hash of the last 64 bytes has
+// its top 13 bits clear past CHUNK_MIN, giving ~8 KiB chunks on typical nc
+// programs
+#define CHUNK_MIN 2048
+#define CHUNK_MAX 65536
+#define CHUNK_BITS 13
+
+struct chunk_ref {
+  char hash[HEX_SIZE];
+  size_t len;
+};
+
+struct archive_writer {
+  char root[256];
+  int compress;
+  char *buf;
+  size_t fill;
+  uint64_t gear;
+  int cut;
+  Sha256 whole;
+  struct chunk_ref *refs;
+  size_t nrefs;
+  size_t cap;
+  ArchiveStats stats;
+  int failed;
+};
+
+static uint64_t gear_table[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+static void init_gear(void) {
+  // splitmix64, fixed seed so boundaries are stable across runs and hosts
+  uint64_t x = 0x666f636173ULL;
+  for (int i = 0; i < 256; i++) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    gear_table[i] = z ^ (z >> 31);
+  }
+}
+
+static int make_dir(const char *path) {
+  return mkdir(path, 0755) != 0 && errno != EEXIST;
+}
+
+static void chunk_path(const char *root, const char *hash, const char *ext,
+                       char *path, size_t size) {
+  snprintf(path, size, "%s/chunks/%.2s/%s%s", root, hash, hash, ext);
+}
+
+/* write through a temporary file, so concurrent writers of the same chunk
+ * or manifest never expose a partial file */
+static int write_atomic(const char *path, const void *data, size_t len) {
+  char tmp[600];
+  FILE *fp;
+  int fd;
+
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+  if ((fd = mkstemp(tmp)) < 0) return 1;
+  if ((fp = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    unlink(tmp);
+    return 1;
+  }
+  if (fwrite(data, 1, len, fp) != len || fclose(fp) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  chmod(tmp, 0644);
+  if (rename(tmp, path) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+static int store_chunk(ArchiveWriter *w, const char *hash) {
+  char path[600];
+  char dir[400];
+  const void *data = w->buf;
+  size_t len = w->fill;
+  const char *ext = "";
+  int ret;
+
+  chunk_path(w->root, hash, "", path, sizeof(path));
+  if (access(path, F_OK) == 0) return 0;
+  chunk_path(w->root, hash, ".zst", path, sizeof(path));
+  if (access(path, F_OK) == 0) return 0;
+
+  snprintf(dir, sizeof(dir), "%s/chunks/%.2s", w->root, hash);
+  if (make_dir(dir)) {
+    fprintf(stderr, "unable to create directory \"%s\"\n", dir);
+    return 1;
+  }
+
+#ifdef FOCAS_ZSTD
+  void *packed = NULL;
+  if (w->compress) {
+    size_t bound = ZSTD_compressBound(len);
+    if ((packed = malloc(bound)) != NULL) {
+      size_t n = ZSTD_compress(packed, bound, w->buf, len, 3);
+      if (!ZSTD_isError(n) && n < len) {
+        data = packed;
+        len = n;
+        ext = ".zst";
+      }
+    }
+  }
+#endif
+
+  chunk_path(w->root, hash, ext, path, sizeof(path));
+  ret = write_atomic(path, data, len);
+  if (ret) fprintf(stderr, "unable to write chunk \"%s\"\n", path);
+  w->stats.new_chunks++;
+  w->stats.stored += len;
+#ifdef FOCAS_ZSTD
+  free(packed);
+#endif
+  return ret;
+}
+
+static int flush_chunk(ArchiveWriter *w) {
+  unsigned char digest[SHA256_SIZE];
+  struct chunk_ref *ref;
+  Sha256 ctx;
+
+  if (w->fill == 0) return 0;
+  if (w->nrefs == w->cap) {
+    size_t cap = w->cap ? w->cap * 2 : 64;
+    struct chunk_ref *tmp = realloc(w->refs, cap * sizeof(*tmp));
+    if (tmp == NULL) return 1;
+    w->refs = tmp;
+    w->cap = cap;
+  }
+  ref = &w->refs[w->nrefs++];
+  sha256_init(&ctx);
+  sha256_update(&ctx, w->buf, w->fill);
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, ref->hash);
+  ref->len = w->fill;
+  w->stats.chunks++;
+
+  if (store_chunk(w, ref->hash)) return 1;
+  w->fill = 0;
+  w->gear = 0;
+  w->cut = 0;
+  return 0;
+}
+
+ArchiveWriter *archive_open(const char *root, int compress) {
+  ArchiveWriter *w = calloc(1, sizeof(*w));
+  char dir[300];
+
+  if (w == NULL || (w->buf = malloc(CHUNK_MAX)) == NULL) {
+    free(w);
+    return NULL;
+  }
+  snprintf(w->root, sizeof(w->root), "%s", root);
+  snprintf(dir, sizeof(dir), "%s/chunks", root);
+  if (make_dir(root) || make_dir(dir)) {
+    fprintf(stderr, "unable to create archive \"%s\"\n", root);
+    archive_abort(w);
+    return NULL;
+  }
+#ifndef FOCAS_ZSTD
+  if (compress) fprintf(stderr, "built without zstd, storing uncompressed\n");
+#endif
+  w->compress = compress;
+  // backup jobs open writers from several threads
+  pthread_once(&gear_once, init_gear);
+  sha256_init(&w->whole);
+  return w;
+}
+
+int archive_write(const char *buf, size_t len, void *writer) {
+  ArchiveWriter *w = writer;
+
+  if (w->failed) return 1;
+  sha256_update(&w->whole, buf, len);
+  w->stats.bytes += len;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)buf[i];
+    w->buf[w->fill++] = (char)c;
+    w->gear = (w->gear << 1) + gear_table[c];
+    // a hash match inside the first CHUNK_MIN bytes would cut at the first
+    // line end after them, not at a content defined boundary
+    if (w->fill >= CHUNK_MIN && (w->gear >> (64 - CHUNK_BITS)) == 0)
+      w->cut = 1;
+    if ((c == '\n' && w->cut) || w->fill == CHUNK_MAX) {
+      if (flush_chunk(w)) {
+        w->failed = 1;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+void archive_abort(ArchiveWriter *w) {
+  if (w == NULL) return;
+  free(w->refs);
+  free(w->buf);
+  free(w);
+}
+
+int archive_commit(ArchiveWriter *w, const char *manifest,
+                   ArchiveStats *stats) {
+  unsigned char digest[SHA256_SIZE];
+  char hex[HEX_SIZE];
+  char *text;
+  size_t size;
+  size_t n;
+  int ret = 1;
+
+  if (w->failed || flush_chunk(w)) goto done;
+  sha256_final(&w->whole, digest);
+  sha256_hex(digest, hex);
+
+  size = 128 + w->nrefs * (HEX_SIZE + 24);
+  if ((text = malloc(size)) == NULL) goto done;
+  n = (size_t)snprintf(text, size, "%s\nsize %zu\nsha256 %s\n", ARCHIVE_MAGIC,
+                       w->stats.bytes, hex);
+  for (size_t i = 0; i < w->nrefs; i++) {
+    n += (size_t)snprintf(text + n, size - n, "%s %zu\n", w->refs[i].hash,
+                          w->refs[i].len);
+  }
+  if ((ret = write_atomic(manifest, text, n)) != 0)
+    fprintf(stderr, "unable to write manifest \"%s\"\n", manifest);
+  free(text);
+
+done:
+  if (stats) *stats = w->stats;
+  archive_abort(w);
+  return ret;
+}
+
+int archive_is_manifest(const char *path) {
+  char line[32] = "";
+  FILE *fp = fopen(path, "r");
+
+  if (fp == NULL) return 0;
+  if (fgets(line, sizeof(line), fp) == NULL) line[0] = '\0';
+  fclose(fp);
+  return strncmp(line, ARCHIVE_MAGIC "\n", sizeof(ARCHIVE_MAGIC)) == 0;
+}
+
+/* read chunk `hash` of `len` bytes into `out` and check its hash */
+static int load_chunk(const char *root, const char *hash, size_t len,
+                      char *out) {
+  unsigned char digest[SHA256_SIZE];
+  char hex[HEX_SIZE];
+  char path[600];
+  Sha256 ctx;
+  FILE *fp;
+  size_t n;
+
+  chunk_path(root, hash, "", path, sizeof(path));
+  if ((fp = fopen(path, "rb")) != NULL) {
+    n = fread(out, 1, len, fp);
+    if (fgetc(fp) != EOF) n = len + 1;
+    fclose(fp);
+  } else {
+#ifdef FOCAS_ZSTD
+    long packed_len;
+    char *packed;
+
+    chunk_path(root, hash, ".zst", path, sizeof(path));
+    if ((fp = fopen(path, "rb")) == NULL) {
+      fprintf(stderr, "missing chunk %s\n", hash);
+      return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    packed_len = ftell(fp);
+    rewind(fp);
+    if (packed_len <= 0 || (packed = malloc((size_t)packed_len)) == NULL) {
+      fclose(fp);
+      return 1;
+    }
+    n = fread(packed, 1, (size_t)packed_len, fp);
+    fclose(fp);
+    n = n == (size_t)packed_len ? ZSTD_decompress(out, len, packed, n) : 0;
+    free(packed);
+    if (ZSTD_isError(n)) n = 0;
+#else
+    fprintf(stderr, "missing chunk %s (compressed chunks need zstd)\n", hash);
+    return 1;
+#endif
+  }
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, out, n <= len ? n : len);
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, hex);
+  if (n != len || strcmp(hex, hash) != 0) {
+    fprintf(stderr, "corrupt chunk %s\n", hash);
+    return 1;
+  }
+  return 0;
+}
+
+int archive_read(const char *root, const char *manifest, char **data,
+                 size_t *len) {
+  unsigned char digest[SHA256_SIZE];
+  char expected[HEX_SIZE];
+  char hash[HEX_SIZE];
+  char hex[HEX_SIZE];
+  char line[256];
+  char *out = NULL;
+  size_t size;
+  size_t off = 0;
+  size_t n;
+  Sha256 ctx;
+  FILE *fp;
+
+  if ((fp = fopen(manifest, "r")) == NULL) {
+    fprintf(stderr, "unable to read manifest \"%s\"\n", manifest);
+    return 1;
+  }
+  if (fgets(line, sizeof(line), fp) == NULL ||
+      strcmp(line, ARCHIVE_MAGIC "\n") != 0 ||
+      fscanf(fp, "size %zu\nsha256 %64s\n", &size, expected) != 2 ||
+      (out = malloc(size ? size : 1)) == NULL) {
+    fprintf(stderr, "invalid manifest \"%s\"\n", manifest);
+    fclose(fp);
+    return 1;
+  }
+  while (fscanf(fp, "%64s %zu\n", hash, &n) == 2) {
+    if (n > size - off || load_chunk(root, hash, n, out + off)) {
+      fprintf(stderr, "unable to restore \"%s\"\n", manifest);
+      free(out);
+      fclose(fp);
+      return 1;
+    }
+    off += n;
+  }
+  fclose(fp);
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, out, off);
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, hex);
+  if (off != size || strcmp(hex, expected) != 0) {
+    fprintf(stderr, "\"%s\" does not match its checksum\n", manifest);
+    free(out);
+    return 1;
+  }
+  *data = out;
+  *len = size;
+  return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef FW_ARCHIVE_H
+#define FW_ARCHIVE_H
+
+#include <stddef.h>
+
+/* content addressed store for uploaded data. input is cut into chunks at
+ * line ends chosen by the content of the line, so an edit only changes the
+ * chunks around it. each chunk is stored once under its sha256 in
+ * <root>/chunks, a manifest lists the chunks that make up one upload. */
+
+typedef struct archive_stats {
+  size_t bytes;              // input size
+  size_t stored;             // bytes written for new chunks
+  unsigned long chunks;
+  unsigned long new_chunks;  // chunks not already in the store
+} ArchiveStats;
+
+typedef struct archive_writer ArchiveWriter;
+
+/* compress requires a build with zstd, otherwise chunks are stored raw */
+ArchiveWriter *archive_open(const char *root, int compress);
+/* upload_sink_fn compatible, `writer` is the ArchiveWriter */
+int archive_write(const char *buf, size_t len, void *writer);
+/* flush the last chunk and write the manifest, frees the writer */
+int archive_commit(ArchiveWriter *w, const char *manifest,
+                   ArchiveStats *stats);
+void archive_abort(ArchiveWriter *w);
+
+int archive_is_manifest(const char *path);
+/* reassemble the data listed in `manifest`, checking every chunk and the
+ * whole against their hashes. *data is malloc'd. */
+int archive_read(const char *root, const char *manifest, char **data,
+                 size_t *len);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef FW_BACKOFF_H
+#define FW_BACKOFF_H
+
+#include <time.h>
+
+/* consecutive EW_BUFFER / EW_BUSY responses before a transfer gives up,
+ * roughly a minute with the default cap */
+#define BACKOFF_MAX_ATTEMPTS 1000
+
+/* 2^attempt * base, capped at max */
+static inline long backoff_delay(unsigned long attempt, long base, long max) {
+  long d = base << (attempt < 16 ? attempt : 16);
+  return d > max || d <= 0 ? max : d;
+}
+
+/* sleep 2^attempt * base_us, capped at max_us, instead of spinning on a
+ * controller that is not ready yet */
+static inline void backoff_sleep(unsigned long attempt, long base_us,
+                                 long max_us) {
+  long us = backoff_delay(attempt, base_us, max_us);
+  struct timespec ts;
+
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  nanosleep(&ts, NULL);
+}
+
+#endif
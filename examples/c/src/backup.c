@@ -0,0 +1,464 @@
+#include "./backup.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./archive.h"
+#include "./download.h"
+#include "./fwabi.h"
+#include "./ratelimit.h"
+#include "./upload.h"
+#include "fwlib32.h"
+
+const BackupOptions default_backup_options = {
+    0, BACKUP_ALL, 8, 0, 10, ".", "//CNC_MEM/USER/PATH1/", "", 0};
+
+/* cnc_upstart4 / cnc_dwnstart4 data types backed up besides programs */
+static const struct {
+  int item;
+  short type;
+  const char *name;
+} data_files[] = {
+    {BACKUP_PARAMETERS, 2, "parameters"},
+    {BACKUP_OFFSETS, 1, "tool-offsets"},
+    {BACKUP_OFFSETS, 5, "work-offsets"},
+};
+
+#define MANIFEST_BUCKETS 4096
+
+struct entry {
+  struct entry *next;
+  char key[];
+};
+
+/* completed "machine\titem" pairs, loaded from and appended to a file */
+struct manifest {
+  pthread_mutex_t lock;
+  FILE *fp;
+  struct entry *buckets[MANIFEST_BUCKETS];
+};
+
+struct run {
+  const Machine *machines;
+  int count;
+  const BackupOptions *opts;
+  struct manifest manifest;
+  RateLimit rl;
+  pthread_mutex_t lock;
+  int next;
+  int failed;
+};
+
+/* per transfer state for the progress / chunk callbacks */
+struct transfer {
+  RateLimit *rl;
+  size_t bytes;
+};
+
+static unsigned long hash(const char *s) {
+  unsigned long h = 5381;
+  while (*s) h = h * 33 + (unsigned char)*s++;
+  return h;
+}
+
+static int manifest_has(struct manifest *m, const char *key) {
+  struct entry *e;
+  int found = 0;
+
+  pthread_mutex_lock(&m->lock);
+  for (e = m->buckets[hash(key) % MANIFEST_BUCKETS]; e; e = e->next) {
+    if (strcmp(e->key, key) == 0) {
+      found = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&m->lock);
+  return found;
+}
+
+static void manifest_insert(struct manifest *m, const char *key) {
+  size_t n = strlen(key) + 1;
+  struct entry *e = malloc(sizeof(*e) + n);
+  unsigned long b = hash(key) % MANIFEST_BUCKETS;
+
+  if (e == NULL) return;
+  memcpy(e->key, key, n);
+  e->next = m->buckets[b];
+  m->buckets[b] = e;
+}
+
+static int manifest_add(struct manifest *m, const char *key) {
+  int ret = 0;
+
+  pthread_mutex_lock(&m->lock);
+  manifest_insert(m, key);
+  // one line per transfer, flushed so a killed run loses at most one
+  if (fprintf(m->fp, "%s\n", key) < 0 || fflush(m->fp) != 0 ||
+      fsync(fileno(m->fp)) != 0) {
+    ret = 1;
+  }
+  pthread_mutex_unlock(&m->lock);
+  return ret;
+}
+
+static int manifest_open(struct manifest *m, const char *path) {
+  char line[512];
+  FILE *fp;
+
+  memset(m, 0, sizeof(*m));
+  pthread_mutex_init(&m->lock, NULL);
+  if ((fp = fopen(path, "r")) != NULL) {
+    while (fgets(line, sizeof(line), fp)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (*line) manifest_insert(m, line);
+    }
+    fclose(fp);
+  }
+  if ((m->fp = fopen(path, "a")) == NULL) {
+    fprintf(stderr, "unable to open manifest \"%s\"\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+static void manifest_close(struct manifest *m) {
+  for (int i = 0; i < MANIFEST_BUCKETS; i++) {
+    struct entry *e = m->buckets[i];
+    while (e) {
+      struct entry *next = e->next;
+      free(e);
+      e = next;
+    }
+  }
+  if (m->fp) fclose(m->fp);
+  pthread_mutex_destroy(&m->lock);
+}
+
+static int make_dir(const char *path) {
+  if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "unable to create directory \"%s\"\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+static void throttle_upload(const UploadStats *stats, void *ctx) {
+  struct transfer *t = ctx;
+  ratelimit_take(t->rl, stats->bytes - t->bytes);
+  t->bytes = stats->bytes;
+}
+
+static void throttle_download(const DownloadChunk *chunk, void *ctx) {
+  struct transfer *t = ctx;
+  ratelimit_take(t->rl, chunk->len);
+}
+
+/* upload into the chunk store, `path` gets the archive manifest */
+static int backup_archived(struct run *r, const Machine *m,
+                           unsigned short libh, short type, const char *name,
+                           const char *item, const char *path,
+                           const UploadOptions *opts) {
+  ArchiveWriter *w = archive_open(r->opts->archive, r->opts->compress);
+  ArchiveStats as;
+  UploadStats stats;
+
+  if (w == NULL) return 1;
+  if (upload_stream(libh, type, name, archive_write, w, opts, &stats)) {
+    archive_abort(w);
+    return 1;
+  }
+  if (archive_commit(w, path, &as)) return 1;
+  printf("%s: %s %zu bytes, %lu of %lu chunks new (%.1f KB/s)\n", m->name,
+         item, stats.bytes, as.new_chunks, as.chunks, stats.rate / 1024);
+  return 0;
+}
+
+/* upload into `path` through a temporary file so a partial transfer is never
+ * mistaken for a complete one, and record it in the manifest */
+static int backup_one(struct run *r, const Machine *m, unsigned short libh,
+                      short type, const char *name, const char *item,
+                      const char *path) {
+  UploadOptions opts = default_upload_options;
+  struct transfer t = {&r->rl, 0};
+  UploadStats stats;
+  char key[512];
+  char tmp[512];
+
+  snprintf(key, sizeof(key), "%s\t%s", m->name, item);
+  if (manifest_has(&r->manifest, key)) return 0;
+
+  opts.progress = throttle_upload;
+  opts.ctx = &t;
+  if (*r->opts->archive) {
+    if (backup_archived(r, m, libh, type, name, item, path, &opts)) {
+      fprintf(stderr, "%s: failed to back up %s\n", m->name, item);
+      return 1;
+    }
+    return manifest_add(&r->manifest, key);
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.part", path);
+  if (upload_to_file(libh, type, name, tmp, &opts, &stats) ||
+      rename(tmp, path) != 0) {
+    fprintf(stderr, "%s: failed to back up %s\n", m->name, item);
+    unlink(tmp);
+    return 1;
+  }
+  printf("%s: %s %zu bytes (%.1f KB/s)\n", m->name, item, stats.bytes,
+         stats.rate / 1024);
+  return manifest_add(&r->manifest, key);
+}
+
+static int restore_one(struct run *r, const Machine *m, unsigned short libh,
+                       short type, const char *folder, const char *item,
+                       const char *path) {
+  DownloadOptions opts = default_download_options;
+  struct transfer t = {&r->rl, 0};
+  DownloadStats stats;
+  char key[512];
+  int ret;
+
+  snprintf(key, sizeof(key), "%s\t%s", m->name, item);
+  if (manifest_has(&r->manifest, key)) return 0;
+
+  opts.on_chunk = throttle_download;
+  opts.ctx = &t;
+  if (archive_is_manifest(path)) {
+    // chunks are verified against their hashes before anything is sent
+    char *data;
+    size_t len;
+    if (!*r->opts->archive) {
+      fprintf(stderr, "%s: %s is archived, the chunk store is required\n",
+              m->name, item);
+      return 1;
+    }
+    if (archive_read(r->opts->archive, path, &data, &len)) {
+      fprintf(stderr, "%s: failed to restore %s\n", m->name, item);
+      return 1;
+    }
+    ret = download_buffer(libh, type, folder, data, len, &opts, &stats);
+    free(data);
+  } else {
+    ret = download_file(libh, type, folder, path, &opts, &stats);
+  }
+  if (ret) {
+    fprintf(stderr, "%s: failed to restore %s\n", m->name, item);
+    return 1;
+  }
+  printf("%s: %s %zu bytes (%.1f KB/s)\n", m->name, item, stats.bytes,
+         stats.rate / 1024);
+  return manifest_add(&r->manifest, key);
+}
+
+static int backup_programs(struct run *r, const Machine *m,
+                           unsigned short libh, const char *dir) {
+  Fw32Prgdir3 progs[32];
+  long top = 0;
+  int ret = 0;
+  char name[512];
+  char item[64];
+  char path[512];
+
+  for (;;) {
+    short num = sizeof(progs) / sizeof(progs[0]);
+    short err = cnc_rdprogdir3(libh, 1, &top, &num, (PRGDIR3 *)progs);
+    if (err != EW_OK) {
+      fprintf(stderr, "%s: failed to read program directory (%d)\n",
+              m->name, err);
+      return 1;
+    }
+    if (num <= 0) break;
+    for (short i = 0; i < num; i++) {
+      snprintf(name, sizeof(name), "%sO%04d", r->opts->folder,
+               (int)progs[i].number);
+      snprintf(item, sizeof(item), "O%04d", (int)progs[i].number);
+      if (snprintf(path, sizeof(path), "%s/O%04d.nc", dir,
+                   (int)progs[i].number) >= (int)sizeof(path)) {
+        fprintf(stderr, "%s: path too long: %s/%s.nc\n", m->name, dir, item);
+        ret = 1;
+        continue;
+      }
+      ret |= backup_one(r, m, libh, 0, name, item, path);
+    }
+    top = progs[num - 1].number + 1;
+  }
+  return ret;
+}
+
+static int restore_programs(struct run *r, const Machine *m,
+                            unsigned short libh, const char *dir) {
+  struct dirent *de;
+  DIR *d;
+  int ret = 0;
+  char path[512];
+
+  if ((d = opendir(dir)) == NULL) return 0;
+  while ((de = readdir(d)) != NULL) {
+    size_t n = strlen(de->d_name);
+    if (n < 4 || strcmp(de->d_name + n - 3, ".nc") != 0) continue;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >=
+        (int)sizeof(path)) {
+      fprintf(stderr, "%s: path too long: %s/%s\n", m->name, dir,
+              de->d_name);
+      ret = 1;
+      continue;
+    }
+    ret |= restore_one(r, m, libh, 0, r->opts->folder, de->d_name, path);
+  }
+  closedir(d);
+  return ret;
+}
+
+static int transfer_machine(struct run *r, const Machine *m) {
+  const BackupOptions *opts = r->opts;
+  unsigned short libh;
+  int ret = 0;
+  short err;
+  char dir[512];
+  char path[600];
+
+  snprintf(dir, sizeof(dir), "%s/%s", opts->dir, m->name);
+  if (!opts->restore && make_dir(dir)) return 1;
+
+  if ((err = cnc_allclibhndl3(m->ip, m->port, opts->timeout, &libh)) !=
+      EW_OK) {
+    fprintf(stderr, "%s: failed to connect to %s:%d (%d)\n", m->name, m->ip,
+            m->port, err);
+    return 1;
+  }
+
+  for (size_t i = 0; i < sizeof(data_files) / sizeof(data_files[0]); i++) {
+    if (!(opts->items & data_files[i].item)) continue;
+    snprintf(path, sizeof(path), "%s/%s.dat", dir, data_files[i].name);
+    if (!opts->restore) {
+      ret |= backup_one(r, m, libh, data_files[i].type, "",
+                        data_files[i].name, path);
+    } else if (access(path, R_OK) == 0) {
+      ret |= restore_one(r, m, libh, data_files[i].type, "",
+                         data_files[i].name, path);
+    }
+  }
+
+  if (opts->items & BACKUP_PROGRAMS) {
+    snprintf(path, sizeof(path), "%s/programs", dir);
+    if (!opts->restore) {
+      ret |= make_dir(path) || backup_programs(r, m, libh, path);
+    } else {
+      ret |= restore_programs(r, m, libh, path);
+    }
+  }
+
+  if (cnc_freelibhndl(libh) != EW_OK)
+    fprintf(stderr, "%s: failed to free library handle\n", m->name);
+  return ret;
+}
+
+static void *worker(void *arg) {
+  struct run *r = arg;
+
+  for (;;) {
+    int i;
+    pthread_mutex_lock(&r->lock);
+    i = r->next++;
+    pthread_mutex_unlock(&r->lock);
+    if (i >= r->count) break;
+
+    if (transfer_machine(r, &r->machines[i])) {
+      pthread_mutex_lock(&r->lock);
+      r->failed++;
+      pthread_mutex_unlock(&r->lock);
+    }
+  }
+  return NULL;
+}
+
+int run_backup(const Machine *machines, int count, const BackupOptions *opts) {
+  struct run r;
+  pthread_t *threads;
+  int jobs = opts->jobs < 1 ? 1 : opts->jobs;
+  int started = 0;
+  char path[300];
+
+  if (count <= 0) return 0;
+  if (jobs > count) jobs = count;
+  if (make_dir(opts->dir)) return count;
+
+  memset(&r, 0, sizeof(r));
+  r.machines = machines;
+  r.count = count;
+  r.opts = opts;
+  snprintf(path, sizeof(path), "%s/%s.manifest", opts->dir,
+           opts->restore ? "restore" : "backup");
+  if (manifest_open(&r.manifest, path)) {
+    manifest_close(&r.manifest);
+    return count;
+  }
+  ratelimit_init(&r.rl, opts->bandwidth);
+  pthread_mutex_init(&r.lock, NULL);
+
+  if ((threads = calloc(jobs, sizeof(pthread_t))) != NULL) {
+    for (; started < jobs; started++) {
+      if (pthread_create(&threads[started], NULL, worker, &r) != 0) break;
+    }
+  }
+  if (started == 0) {
+    // no threads available, do the work on this one
+    worker(&r);
+  }
+  for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+  free(threads);
+
+  pthread_mutex_destroy(&r.lock);
+  ratelimit_destroy(&r.rl);
+  manifest_close(&r.manifest);
+  return r.failed;
+}
+
+int read_machines(const char *path, Machine **machines, int *count) {
+  Machine *list = NULL;
+  int n = 0;
+  int cap = 0;
+  int lineno = 0;
+  char line[512];
+  FILE *fp;
+
+  if ((fp = fopen(path, "r")) == NULL) {
+    fprintf(stderr, "unable to read machines file \"%s\"\n", path);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    Machine m = {"", "", 8193};
+    int fields;
+
+    lineno++;
+    line[strcspn(line, "#\n")] = '\0';
+    fields = sscanf(line, "%63s %99s %d", m.name, m.ip, &m.port);
+    if (fields <= 0) continue;
+    if (fields < 2 || m.port < 1 || m.port > 65535) {
+      fprintf(stderr, "%s:%d: expected \"name ip [port]\"\n", path, lineno);
+      free(list);
+      fclose(fp);
+      return 1;
+    }
+    if (n == cap) {
+      Machine *tmp = realloc(list, (cap = cap ? cap * 2 : 16) * sizeof(*tmp));
+      if (tmp == NULL) {
+        free(list);
+        fclose(fp);
+        return 1;
+      }
+      list = tmp;
+    }
+    list[n++] = m;
+  }
+  fclose(fp);
+  *machines = list;
+  *count = n;
+  return 0;
+}
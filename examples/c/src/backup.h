@@ -0,0 +1,41 @@
+#ifndef FW_BACKUP_H
+#define FW_BACKUP_H
+
+typedef struct machine {
+  char name[64];
+  char ip[100];
+  int port;
+} Machine;
+
+enum backup_item {
+  BACKUP_PROGRAMS = 1,
+  BACKUP_PARAMETERS = 2,
+  BACKUP_OFFSETS = 4,
+  BACKUP_ALL = 7,
+};
+
+typedef struct backup_options {
+  int restore;         // download from `dir` instead of uploading into it
+  int items;           // mask of enum backup_item
+  int jobs;            // machines transferred concurrently
+  double bandwidth;    // bytes per second across all machines, 0 = no cap
+  long timeout;        // cnc_allclibhndl3 timeout in seconds
+  char dir[256];       // backup root, one directory per machine
+  char folder[256];    // program folder on the cnc
+  char archive[256];   // chunk store, files in `dir` become manifests
+  int compress;        // zstd compress new chunks in the store
+} BackupOptions;
+
+extern const BackupOptions default_backup_options;
+
+/* read "name ip [port]" lines, '#' starts a comment. *machines is
+ * allocated and must be freed by the caller. */
+int read_machines(const char *path, Machine **machines, int *count);
+
+/* back up or restore every machine with at most opts->jobs handles open at
+ * once and one transfer per handle. completed transfers are recorded in a
+ * manifest in opts->dir and skipped when the run is repeated, so an
+ * interrupted run can be resumed. returns the number of failed machines. */
+int run_backup(const Machine *machines, int count, const BackupOptions *opts);
+
+#endif
@@ -0,0 +1,138 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./backup.h"
+#include "fwlib32.h"
+
+static struct option options[] = {{"machines", required_argument, NULL, 'm'},
+                                  {"dir", required_argument, NULL, 'd'},
+                                  {"jobs", required_argument, NULL, 'j'},
+                                  {"bandwidth", required_argument, NULL, 'b'},
+                                  {"items", required_argument, NULL, 'i'},
+                                  {"folder", required_argument, NULL, 'f'},
+                                  {"timeout", required_argument, NULL, 't'},
+                                  {"archive", required_argument, NULL, 'a'},
+                                  {"compress", no_argument, NULL, 'z'},
+                                  {NULL, 0, NULL, 0}};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s backup|restore --machines=<file> [--dir=<backup dir>] "
+          "[--jobs=<machines at once>] [--bandwidth=<KB/s>] "
+          "[--items=programs,parameters,offsets] [--folder=<cnc folder>] "
+          "[--timeout=<seconds>] [--archive=<chunk store> [--compress]]\n",
+          name);
+}
+
+static int parse_items(const char *arg, int *items) {
+  char buf[100];
+  char *tok;
+  char *save;
+
+  snprintf(buf, sizeof(buf), "%s", arg);
+  *items = 0;
+  for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    if (strcmp(tok, "programs") == 0) {
+      *items |= BACKUP_PROGRAMS;
+    } else if (strcmp(tok, "parameters") == 0) {
+      *items |= BACKUP_PARAMETERS;
+    } else if (strcmp(tok, "offsets") == 0) {
+      *items |= BACKUP_OFFSETS;
+    } else {
+      fprintf(stderr, "unknown item: \"%s\"\n", tok);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  BackupOptions opts = default_backup_options;
+  const char *machines_file = NULL;
+  Machine *machines;
+  int count;
+  int failed;
+  int c;
+  int i = 0;
+  int tmp;
+
+  if (argc < 2 || (strcmp(argv[1], "backup") != 0 &&
+                   strcmp(argv[1], "restore") != 0)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  opts.restore = strcmp(argv[1], "restore") == 0;
+  optind = 2;
+
+  while ((c = getopt_long(argc, argv, "", options, &i)) != -1) {
+    switch (c) {
+      case 'm':
+        machines_file = optarg;
+        break;
+      case 'd':
+        snprintf(opts.dir, sizeof(opts.dir), "%s", optarg);
+        break;
+      case 'f':
+        snprintf(opts.folder, sizeof(opts.folder), "%s", optarg);
+        break;
+      case 'j':
+        if ((tmp = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid jobs: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        opts.jobs = tmp;
+        break;
+      case 'b':
+        if ((tmp = atoi(optarg)) < 0) {
+          fprintf(stderr, "invalid bandwidth: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        opts.bandwidth = tmp * 1024.0;
+        break;
+      case 't':
+        if ((tmp = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid timeout: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        opts.timeout = tmp;
+        break;
+      case 'a':
+        snprintf(opts.archive, sizeof(opts.archive), "%s", optarg);
+        break;
+      case 'z':
+        opts.compress = 1;
+        break;
+      case 'i':
+        if (parse_items(optarg, &opts.items)) return EXIT_FAILURE;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (machines_file == NULL) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (read_machines(machines_file, &machines, &count)) {
+    return EXIT_FAILURE;
+  }
+
+  if (cnc_startupprocess(0, "focas.log") != EW_OK) {
+    fprintf(stderr, "Failed to create required log file!\n");
+    free(machines);
+    return EXIT_FAILURE;
+  }
+
+  failed = run_backup(machines, count, &opts);
+  printf("%d of %d machines %s\n", count - failed, count,
+         opts.restore ? "restored" : "backed up");
+
+  cnc_exitprocess();
+  free(machines);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
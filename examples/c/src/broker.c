@@ -0,0 +1,660 @@
+#include "./broker.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "./backoff.h"
+#include "./callstats.h"
+#include "./clock.h"
+#include "./fwabi.h"
+#include "fwlib32.h"
+
+// axes of a single cnc_rdposition
+#define MAX_POSITION_AXES 32
+
+const BrokerOptions default_broker_options = {
+    // id, status, position, spindle, dynamic, pmc, program number, write
+    {60000, 100, 50, 100, 50, 50, 500, 0},
+    10,
+    64,
+    1000,
+    60000,
+};
+
+struct client {
+  int fd;
+  int dead;
+  size_t len;
+  unsigned char in[sizeof(BrokerRequest) + BROKER_MAX_DATA];
+};
+
+struct waiter {
+  struct client *client;
+  uint32_t id;
+};
+
+enum call_state { CALL_QUEUED, CALL_DONE };
+
+struct call {
+  struct call *next;    // in the list of its machine
+  struct call *queued;  // machine queue, then the done list of the broker
+  struct machine *machine;
+  BrokerOp op;
+  void *args;
+  size_t args_size;
+  enum call_state state;
+  double time;  // when the result arrived
+  short err;
+  size_t size;
+  unsigned char *data;
+  struct waiter *waiters;
+  size_t nwait;
+  size_t capwait;
+};
+
+struct machine {
+  Broker *broker;
+  char host[BROKER_HOST_LEN];
+  unsigned short port;
+  struct call *calls;  // in flight and recent results, loop thread only
+
+  // owned by the machine thread
+  pthread_t thread;
+  unsigned short libh;
+  int connected;
+  short connect_err;     // of the last failed cnc_allclibhndl3
+  unsigned long failed;  // cnc_allclibhndl3 in a row
+  double retry_at;
+
+  // guarded by the broker lock
+  pthread_cond_t cond;
+  struct call *head;
+  struct call *tail;
+  int stop;
+};
+
+struct broker {
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int listen_fd;
+  int wake[2];
+  atomic_int stop;
+  BrokerOptions opts;
+
+  pthread_mutex_t lock;
+  struct call *done;  // finished by the machine threads, oldest first
+  struct call *done_tail;
+  BrokerStats stats;
+
+  struct machine **machines;
+  size_t nmachines;
+  struct client **clients;
+  size_t nclients;
+};
+
+/* start and end are byte addresses whatever the data type, D0 .. D9 is
+ * five words */
+static size_t pmc_length(const BrokerPmcArgs *a) {
+  if (a->data_type < 0 || a->data_type > 5 || a->data_type == 3 ||
+      a->end < a->start)
+    return 0;
+  return 8 + (size_t)(a->end - a->start + 1);
+}
+
+/* the FOCAS call of each op, for callstats.h */
+static const char *op_functions[BROKER_OPS] = {
+    "cnc_rdcncid",   "cnc_statinfo", "cnc_rdposition", "cnc_rdspeed",
+    "cnc_rddynamic2", "pmc_rdpmcrng", "cnc_rdprgnum",  "pmc_wrpmcrng"};
+
+/* runs on the machine thread */
+static short focas(unsigned short h, struct call *c) {
+  short ret;
+
+  switch (c->op) {
+    case BROKER_READ_ID: {
+      c->size = 4 * sizeof(uint32_t);
+      return cnc_rdcncid(h, (unsigned long *)c->data);
+    }
+    case BROKER_READ_STATUS:
+      c->size = sizeof(ODBST);
+      return cnc_statinfo(h, (ODBST *)c->data);
+    case BROKER_READ_POSITION: {
+      BrokerPositionArgs *a = c->args;
+      short num = a->num;
+      if (num < 1 || num > MAX_POSITION_AXES) return EW_LENGTH;
+      ret = cnc_rdposition(h, a->axis, &num, (ODBPOS *)c->data);
+      c->size = (num > 0 ? num : 0) * sizeof(Fw32Pos);
+      return ret;
+    }
+    case BROKER_READ_SPINDLE:
+      c->size = sizeof(Fw32Speed);
+      return cnc_rdspeed(h, *(short *)c->args, (ODBSPEED *)c->data);
+    case BROKER_READ_DYNAMIC:
+      c->size = sizeof(Fw32Dy2);
+      return cnc_rddynamic2(h, *(short *)c->args, sizeof(Fw32Dy2),
+                            (ODBDY2 *)c->data);
+    case BROKER_READ_PMC: {
+      BrokerPmcArgs *a = c->args;
+      c->size = pmc_length(a);
+      if (c->size == 0 || c->size > BROKER_MAX_DATA) return EW_LENGTH;
+      return pmc_rdpmcrng(h, a->adr_type, a->data_type, a->start, a->end,
+                          c->size, (IODBPMC *)c->data);
+    }
+    case BROKER_READ_PROGRAM_NUMBER:
+      c->size = sizeof(ODBPRO);
+      return cnc_rdprgnum(h, (ODBPRO *)c->data);
+    case BROKER_WRITE_PMC:
+      c->size = 0;
+      if (c->args_size < 8) return EW_LENGTH;
+      return pmc_wrpmcrng(h, c->args_size, c->args);
+    default:
+      c->size = 0;
+      return EW_FUNC;
+  }
+}
+
+static void execute(struct machine *m, struct call *c) {
+  unsigned long long t;
+
+  if (!m->connected) {
+    const BrokerOptions *o = &m->broker->opts;
+
+    c->size = 0;
+    // a machine that is down is not asked again for every request
+    if (m->failed > 1 && now() < m->retry_at) {
+      c->err = m->connect_err;
+      return;
+    }
+    c->err = cnc_allclibhndl3(m->host, m->port, o->timeout, &m->libh);
+    if (c->err != EW_OK) {
+      // the next request tries again once, then the wait starts
+      m->connect_err = c->err;
+      if (++m->failed > 1)
+        m->retry_at = now() + backoff_delay(m->failed - 2, o->retry_ms,
+                                            o->max_retry_ms) / 1e3;
+      return;
+    }
+    m->failed = 0;
+    m->connected = 1;
+  }
+  t = callstats_now();
+  c->err = focas(m->libh, c);
+  if ((unsigned)c->op < BROKER_OPS)
+    callstats_record(op_functions[c->op], m->libh, t, c->err);
+  if (c->err != EW_OK) c->size = 0;
+  // connect again on the next call
+  if (c->err == EW_SOCKET || c->err == EW_HANDLE) {
+    cnc_freelibhndl(m->libh);
+    m->connected = 0;
+  }
+}
+
+static void *machine_thread(void *arg) {
+  struct machine *m = arg;
+  Broker *b = m->broker;
+  struct call *c;
+
+  pthread_mutex_lock(&b->lock);
+  for (;;) {
+    while (m->head == NULL && !m->stop) pthread_cond_wait(&m->cond, &b->lock);
+    if (m->stop) break;
+    c = m->head;
+    if ((m->head = c->queued) == NULL) m->tail = NULL;
+    pthread_mutex_unlock(&b->lock);
+
+    execute(m, c);
+
+    pthread_mutex_lock(&b->lock);
+    // in the order they were made, a write after a read makes it stale
+    c->queued = NULL;
+    if (b->done_tail)
+      b->done_tail->queued = c;
+    else
+      b->done = c;
+    b->done_tail = c;
+    b->stats.calls++;
+    if (c->err != EW_OK) b->stats.errors++;
+    if (write(b->wake[1], "c", 1) < 0) {
+      // the pipe is full, the loop thread is going to drain it anyway
+    }
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  if (m->connected) cnc_freelibhndl(m->libh);
+  return NULL;
+}
+
+static void free_call(struct call *c) {
+  free(c->args);
+  free(c->data);
+  free(c->waiters);
+  free(c);
+}
+
+static void unlink_call(struct call *c) {
+  struct call **p = &c->machine->calls;
+
+  while (*p != c) p = &(*p)->next;
+  *p = c->next;
+  free_call(c);
+}
+
+static struct machine *find_machine(Broker *b, const char *host,
+                                    unsigned short port) {
+  struct machine *m;
+  struct machine **tmp;
+
+  for (size_t i = 0; i < b->nmachines; i++) {
+    m = b->machines[i];
+    if (m->port == port && strcmp(m->host, host) == 0) return m;
+  }
+
+  tmp = realloc(b->machines, (b->nmachines + 1) * sizeof(*tmp));
+  if (tmp == NULL || (m = calloc(1, sizeof(*m))) == NULL) {
+    if (tmp) b->machines = tmp;
+    return NULL;
+  }
+  b->machines = tmp;
+  m->broker = b;
+  snprintf(m->host, sizeof(m->host), "%s", host);
+  m->port = port;
+  pthread_cond_init(&m->cond, NULL);
+  if (pthread_create(&m->thread, NULL, machine_thread, m) != 0) {
+    fprintf(stderr, "Failed to start the thread of %s:%d!\n", host, port);
+    pthread_cond_destroy(&m->cond);
+    free(m);
+    return NULL;
+  }
+  b->machines[b->nmachines++] = m;
+  pthread_mutex_lock(&b->lock);
+  b->stats.machines++;
+  pthread_mutex_unlock(&b->lock);
+  return m;
+}
+
+static void send_reply(struct client *cl, uint32_t id, short err, int cached,
+                       const void *data, size_t size) {
+  BrokerReply r = {size, id, err, cached};
+  struct iovec iov[2] = {{&r, sizeof(r)}, {(void *)data, size}};
+  struct msghdr msg = {0};
+  size_t left = sizeof(r) + size;
+  ssize_t n;
+
+  if (cl->dead) return;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = size ? 2 : 1;
+  while (left > 0) {
+    if ((n = sendmsg(cl->fd, &msg, MSG_NOSIGNAL)) < 0) {
+      if (errno == EINTR) continue;
+      cl->dead = 1;
+      return;
+    }
+    left -= n;
+    // a partial send, move the vectors past what went out
+    while (msg.msg_iovlen && (size_t)n >= msg.msg_iov->iov_len) {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen) {
+      msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+}
+
+static int add_waiter(struct call *c, struct client *cl, uint32_t id) {
+  if (c->nwait == c->capwait) {
+    size_t cap = c->capwait ? 2 * c->capwait : 4;
+    struct waiter *tmp = realloc(c->waiters, cap * sizeof(*tmp));
+    if (tmp == NULL) return 1;
+    c->waiters = tmp;
+    c->capwait = cap;
+  }
+  c->waiters[c->nwait].client = cl;
+  c->waiters[c->nwait].id = id;
+  c->nwait++;
+  return 0;
+}
+
+static int same_call(const struct call *c, BrokerOp op, const void *args,
+                     size_t size) {
+  return c->op == op && c->args_size == size &&
+         (size == 0 || memcmp(c->args, args, size) == 0);
+}
+
+/* results of a machine older than their staleness window */
+static void drop_stale(Broker *b, struct machine *m, double t) {
+  struct call *c = m->calls;
+  struct call *next;
+
+  for (; c; c = next) {
+    next = c->next;
+    if (c->state == CALL_DONE &&
+        (t - c->time) * 1000 >= b->opts.stale_ms[c->op])
+      unlink_call(c);
+  }
+}
+
+static void count(Broker *b, unsigned long *stat) {
+  pthread_mutex_lock(&b->lock);
+  (*stat)++;
+  pthread_mutex_unlock(&b->lock);
+}
+
+static void handle_request(Broker *b, struct client *cl,
+                           const BrokerRequest *req, const void *args) {
+  char host[BROKER_HOST_LEN];
+  struct machine *m;
+  struct call *c;
+
+  count(b, &b->stats.requests);
+  if (req->op >= BROKER_OPS) {
+    send_reply(cl, req->id, EW_FUNC, 0, NULL, 0);
+    return;
+  }
+  snprintf(host, sizeof(host), "%.*s", (int)sizeof(req->host) - 1, req->host);
+  if ((m = find_machine(b, host, req->port)) == NULL) {
+    send_reply(cl, req->id, EW_OVRFLOW, 0, NULL, 0);
+    return;
+  }
+
+  drop_stale(b, m, now());
+  if (req->op != BROKER_WRITE_PMC) {
+    for (c = m->calls; c; c = c->next) {
+      if (!same_call(c, req->op, args, req->size)) continue;
+      if (c->state == CALL_DONE) {
+        count(b, &b->stats.cached);
+        send_reply(cl, req->id, c->err, 1, c->data, c->size);
+        return;
+      }
+      if (add_waiter(c, cl, req->id) == 0) {
+        count(b, &b->stats.coalesced);
+        return;
+      }
+    }
+  }
+
+  if ((c = calloc(1, sizeof(*c))) == NULL ||
+      (c->data = malloc(BROKER_MAX_DATA)) == NULL ||
+      (req->size && (c->args = malloc(req->size)) == NULL) ||
+      add_waiter(c, cl, req->id)) {
+    if (c) free_call(c);
+    send_reply(cl, req->id, EW_OVRFLOW, 0, NULL, 0);
+    return;
+  }
+  c->machine = m;
+  c->op = req->op;
+  c->args_size = req->size;
+  if (req->size) memcpy(c->args, args, req->size);
+  c->next = m->calls;
+  m->calls = c;
+
+  pthread_mutex_lock(&b->lock);
+  if (m->tail)
+    m->tail->queued = c;
+  else
+    m->head = c;
+  m->tail = c;
+  pthread_cond_signal(&m->cond);
+  pthread_mutex_unlock(&b->lock);
+}
+
+static int args_ok(const BrokerRequest *req) {
+  switch (req->op) {
+    case BROKER_READ_POSITION:
+      return req->size == sizeof(BrokerPositionArgs);
+    case BROKER_READ_SPINDLE:
+    case BROKER_READ_DYNAMIC:
+      return req->size == sizeof(short);
+    case BROKER_READ_PMC:
+      return req->size == sizeof(BrokerPmcArgs);
+    case BROKER_WRITE_PMC:
+      return req->size > 0;
+    default:
+      return req->size == 0;
+  }
+}
+
+/* fan the results out and keep the ones that may be reused */
+static void finish_calls(Broker *b) {
+  struct call *done;
+  struct call *c;
+  struct call *next;
+  char drain[64];
+  double t = now();
+
+  while (read(b->wake[0], drain, sizeof(drain)) == sizeof(drain))
+    ;
+  pthread_mutex_lock(&b->lock);
+  done = b->done;
+  b->done = b->done_tail = NULL;
+  pthread_mutex_unlock(&b->lock);
+
+  for (; done; done = next) {
+    next = done->queued;
+    done->state = CALL_DONE;
+    done->time = t;
+    for (size_t i = 0; i < done->nwait; i++) {
+      send_reply(done->waiters[i].client, done->waiters[i].id, done->err,
+                 i > 0, done->data, done->size);
+    }
+    done->nwait = 0;
+
+    if (done->op == BROKER_WRITE_PMC) {
+      for (c = done->machine->calls; c; c = c->next) {
+        // read again once they are done
+        if (c->op == BROKER_READ_PMC) c->time = -1e9;
+      }
+    }
+    if (done->err != EW_OK || b->opts.stale_ms[done->op] <= 0 ||
+        done->op == BROKER_WRITE_PMC)
+      unlink_call(done);
+  }
+}
+
+static void read_client(Broker *b, struct client *cl) {
+  ssize_t n;
+  BrokerRequest req;
+
+  n = recv(cl->fd, cl->in + cl->len, sizeof(cl->in) - cl->len, MSG_DONTWAIT);
+  if (n <= 0) {
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) cl->dead = 1;
+    return;
+  }
+  cl->len += n;
+
+  while (cl->len >= sizeof(req)) {
+    memcpy(&req, cl->in, sizeof(req));
+    if (req.size > BROKER_MAX_DATA) {
+      cl->dead = 1;
+      return;
+    }
+    if (cl->len < sizeof(req) + req.size) return;
+    if (!args_ok(&req))
+      send_reply(cl, req.id, EW_LENGTH, 0, NULL, 0);
+    else
+      handle_request(b, cl, &req, cl->in + sizeof(req));
+    cl->len -= sizeof(req) + req.size;
+    memmove(cl->in, cl->in + sizeof(req) + req.size, cl->len);
+  }
+}
+
+static void accept_client(Broker *b) {
+  struct client *cl;
+  struct client **tmp;
+  int fd;
+
+  if ((fd = accept(b->listen_fd, NULL, NULL)) < 0) return;
+  tmp = realloc(b->clients, (b->nclients + 1) * sizeof(*tmp));
+  if (tmp == NULL || (cl = calloc(1, sizeof(*cl))) == NULL) {
+    if (tmp) b->clients = tmp;
+    close(fd);
+    return;
+  }
+  b->clients = tmp;
+  cl->fd = fd;
+  b->clients[b->nclients++] = cl;
+}
+
+/* close clients that went away, their pending results are not sent */
+static void reap_clients(Broker *b) {
+  size_t kept = 0;
+
+  for (size_t i = 0; i < b->nclients; i++) {
+    struct client *cl = b->clients[i];
+    if (!cl->dead) {
+      b->clients[kept++] = cl;
+      continue;
+    }
+    for (size_t j = 0; j < b->nmachines; j++) {
+      for (struct call *c = b->machines[j]->calls; c; c = c->next) {
+        size_t w = 0;
+        for (size_t k = 0; k < c->nwait; k++) {
+          if (c->waiters[k].client != cl) c->waiters[w++] = c->waiters[k];
+        }
+        c->nwait = w;
+      }
+    }
+    close(cl->fd);
+    free(cl);
+  }
+  b->nclients = kept;
+}
+
+Broker *broker_create(const char *path, const BrokerOptions *opts) {
+  struct sockaddr_un addr = {0};
+  Broker *b;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) return NULL;
+  if ((b = calloc(1, sizeof(*b))) == NULL) return NULL;
+  b->opts = opts ? *opts : default_broker_options;
+  snprintf(b->path, sizeof(b->path), "%s", path);
+  pthread_mutex_init(&b->lock, NULL);
+  b->wake[0] = b->wake[1] = -1;
+
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, strlen(path));
+  unlink(path);
+  if ((b->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      bind(b->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(b->listen_fd, 16) != 0) {
+    fprintf(stderr, "Failed to listen on %s!\n", path);
+    if (b->listen_fd >= 0) close(b->listen_fd);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+    return NULL;
+  }
+  if (pipe(b->wake) != 0) {
+    close(b->listen_fd);
+    unlink(path);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+    return NULL;
+  }
+  for (int i = 0; i < 2; i++) {
+    int flags = fcntl(b->wake[i], F_GETFL);
+    fcntl(b->wake[i], F_SETFL, flags | O_NONBLOCK);
+  }
+  return b;
+}
+
+void broker_destroy(Broker *b) {
+  if (b == NULL) return;
+
+  pthread_mutex_lock(&b->lock);
+  for (size_t i = 0; i < b->nmachines; i++) {
+    b->machines[i]->stop = 1;
+    pthread_cond_signal(&b->machines[i]->cond);
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  for (size_t i = 0; i < b->nmachines; i++) {
+    struct machine *m = b->machines[i];
+    struct call *next;
+    pthread_join(m->thread, NULL);
+    for (struct call *c = m->calls; c; c = next) {
+      next = c->next;
+      free_call(c);
+    }
+    pthread_cond_destroy(&m->cond);
+    free(m);
+  }
+  for (size_t i = 0; i < b->nclients; i++) {
+    close(b->clients[i]->fd);
+    free(b->clients[i]);
+  }
+  close(b->listen_fd);
+  close(b->wake[0]);
+  close(b->wake[1]);
+  unlink(b->path);
+  pthread_mutex_destroy(&b->lock);
+  free(b->machines);
+  free(b->clients);
+  free(b);
+}
+
+void broker_run(Broker *b, long timeout_ms) {
+  double end = timeout_ms >= 0 ? now() + timeout_ms / 1000.0 : 0;
+  struct pollfd *fds = NULL;
+  size_t cap = 0;
+  int wait = -1;
+
+  while (!atomic_load(&b->stop)) {
+    size_t n = 2;
+    if (timeout_ms >= 0 && (wait = (end - now()) * 1000) <= 0) break;
+
+    if (cap < b->nclients + 2) {
+      struct pollfd *tmp = realloc(fds, (b->nclients + 2) * sizeof(*tmp));
+      if (tmp == NULL) break;
+      fds = tmp;
+      cap = b->nclients + 2;
+    }
+    fds[0].fd = b->wake[0];
+    fds[0].events = POLLIN;
+    // new connections wait in the backlog while the broker is full
+    fds[1].fd = (int)b->nclients < b->opts.max_clients ? b->listen_fd : -1;
+    fds[1].events = POLLIN;
+    for (size_t i = 0; i < b->nclients; i++, n++) {
+      fds[n].fd = b->clients[i]->fd;
+      fds[n].events = POLLIN;
+    }
+    if (poll(fds, n, wait) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (fds[0].revents) finish_calls(b);
+    for (size_t i = 2; i < n; i++) {
+      if (fds[i].revents) read_client(b, b->clients[i - 2]);
+    }
+    if (fds[1].revents) accept_client(b);
+    reap_clients(b);
+    pthread_mutex_lock(&b->lock);
+    b->stats.clients = b->nclients;
+    pthread_mutex_unlock(&b->lock);
+  }
+  atomic_store(&b->stop, 0);
+  free(fds);
+}
+
+void broker_stop(Broker *b) {
+  atomic_store(&b->stop, 1);
+  if (write(b->wake[1], "s", 1) < 0) {
+    // already woken up
+  }
+}
+
+void broker_stats(Broker *b, BrokerStats *stats) {
+  pthread_mutex_lock(&b->lock);
+  *stats = b->stats;
+  pthread_mutex_unlock(&b->lock);
+}
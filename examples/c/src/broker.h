@@ -0,0 +1,122 @@
+#ifndef FW_BROKER_H
+#define FW_BROKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* local FOCAS broker: one process owns a handle per machine and serves
+ * many client applications over a unix domain socket. identical reads of a
+ * machine that are in flight at the same time become a single FOCAS call
+ * whose result goes to every waiting client, and results are reused for
+ * `stale_ms` of their kind, so the load on a cnc does not grow with the
+ * number of applications reading it. writes are always executed and drop
+ * the cached pmc reads of their machine. */
+
+/* arguments -> result, structs with long fields in the 32 bit layout of
+ * the library (fwabi.h) */
+typedef enum broker_op {
+  BROKER_READ_ID,              // none -> 4 x u32 of cnc_rdcncid
+  BROKER_READ_STATUS,          // none -> ODBST of cnc_statinfo
+  BROKER_READ_POSITION,        // BrokerPositionArgs -> Fw32Pos[num]
+  BROKER_READ_SPINDLE,         // short type -> Fw32Speed of cnc_rdspeed
+  BROKER_READ_DYNAMIC,         // short axis -> Fw32Dy2 of cnc_rddynamic2
+  BROKER_READ_PMC,             // BrokerPmcArgs -> IODBPMC of pmc_rdpmcrng
+  BROKER_READ_PROGRAM_NUMBER,  // none -> ODBPRO of cnc_rdprgnum
+  BROKER_WRITE_PMC,            // IODBPMC for pmc_wrpmcrng -> none
+  BROKER_OPS,
+} BrokerOp;
+
+typedef struct broker_position_args {
+  short axis;
+  short num;
+} BrokerPositionArgs;
+
+typedef struct broker_pmc_args {
+  short adr_type;
+  short data_type;
+  unsigned short start;
+  unsigned short end;
+} BrokerPmcArgs;
+
+#define BROKER_MAX_DATA 4096
+#define BROKER_HOST_LEN 64
+
+/* wire format, host byte order: a request header and `size` bytes of
+ * arguments, answered by a reply header and `size` bytes of data */
+typedef struct broker_request {
+  uint32_t size;
+  uint32_t id;
+  uint16_t op;
+  uint16_t port;
+  char host[BROKER_HOST_LEN];
+} BrokerRequest;
+
+typedef struct broker_reply {
+  uint32_t size;
+  uint32_t id;
+  int16_t err;      // EW_OK or the failing FOCAS code
+  uint16_t cached;  // served without a call of its own
+} BrokerReply;
+
+typedef struct broker_options {
+  long stale_ms[BROKER_OPS];  // reuse results this young, 0 never reuses
+  long timeout;               // cnc_allclibhndl3 seconds
+  int max_clients;
+  // after two failed cnc_allclibhndl3 in a row the requests for the machine
+  // fail with its code for retry_ms, doubling up to max_retry_ms while it
+  // stays down
+  long retry_ms;
+  long max_retry_ms;
+} BrokerOptions;
+
+extern const BrokerOptions default_broker_options;
+
+typedef struct broker_stats {
+  unsigned long requests;
+  unsigned long calls;      // FOCAS calls made
+  unsigned long coalesced;  // requests joining a call in flight
+  unsigned long cached;     // requests answered from a recent result
+  unsigned long errors;
+  int clients;
+  int machines;
+} BrokerStats;
+
+typedef struct broker Broker;
+
+/* listens on `path`, replacing a stale socket */
+Broker *broker_create(const char *path, const BrokerOptions *opts);
+/* stops the machine threads and frees their handles */
+void broker_destroy(Broker *b);
+/* serve clients until broker_stop or timeout_ms passed, -1 for no timeout */
+void broker_run(Broker *b, long timeout_ms);
+/* safe from other threads and signal handlers */
+void broker_stop(Broker *b);
+void broker_stats(Broker *b, BrokerStats *stats);
+
+/* client, one request at a time per connection. every call returns EW_OK,
+ * the FOCAS error of the broker, or EW_SOCKET when the broker is gone. */
+typedef struct broker_client BrokerClient;
+
+BrokerClient *broker_connect(const char *path, const char *host,
+                             unsigned short port);
+void broker_close(BrokerClient *c);
+/* `size` bytes of `data` hold the result, `got` is set to its length */
+short broker_call(BrokerClient *c, BrokerOp op, const void *args,
+                  size_t args_size, void *data, size_t size, size_t *got);
+
+/* the Context methods of the python extension */
+short broker_read_id(BrokerClient *c, uint32_t ids[4]);
+short broker_read_status(BrokerClient *c, void *odbst);
+short broker_read_position(BrokerClient *c, short axis, short *num,
+                           void *fw32pos, size_t size);
+short broker_read_spindle(BrokerClient *c, short type, void *fw32speed);
+short broker_read_dynamic(BrokerClient *c, short axis, void *fw32dy2);
+/* `length` as for pmc_rdpmcrng, 8 header bytes plus the data */
+short broker_read_pmc(BrokerClient *c, short adr_type, short data_type,
+                      unsigned short start, unsigned short end, void *iodbpmc,
+                      unsigned short length);
+short broker_read_program_number(BrokerClient *c, void *odbpro);
+short broker_write_pmc(BrokerClient *c, const void *iodbpmc,
+                       unsigned short length);
+
+#endif
@@ -0,0 +1,158 @@
+#include "./broker.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "./fwabi.h"
+#include "fwlib32.h"
+
+struct broker_client {
+  int fd;
+  uint32_t id;
+  char host[BROKER_HOST_LEN];
+  unsigned short port;
+};
+
+static int write_all(int fd, const void *buf, size_t size) {
+  const char *p = buf;
+  ssize_t n;
+
+  while (size > 0) {
+    if ((n = send(fd, p, size, MSG_NOSIGNAL)) < 0) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+static int read_all(int fd, void *buf, size_t size) {
+  char *p = buf;
+  ssize_t n;
+
+  while (size > 0) {
+    if ((n = recv(fd, p, size, 0)) <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      return 1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+BrokerClient *broker_connect(const char *path, const char *host,
+                             unsigned short port) {
+  struct sockaddr_un addr = {0};
+  BrokerClient *c;
+
+  if (strlen(path) >= sizeof(addr.sun_path) ||
+      strlen(host) >= BROKER_HOST_LEN)
+    return NULL;
+  if ((c = calloc(1, sizeof(*c))) == NULL) return NULL;
+  snprintf(c->host, sizeof(c->host), "%s", host);
+  c->port = port;
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, strlen(path));
+  if ((c->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    if (c->fd >= 0) close(c->fd);
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+void broker_close(BrokerClient *c) {
+  if (c == NULL) return;
+  close(c->fd);
+  free(c);
+}
+
+short broker_call(BrokerClient *c, BrokerOp op, const void *args,
+                  size_t args_size, void *data, size_t size, size_t *got) {
+  BrokerRequest req = {0};
+  BrokerReply reply;
+  char skip[256];
+  size_t keep;
+
+  if (args_size > BROKER_MAX_DATA) return EW_LENGTH;
+  req.size = args_size;
+  req.id = ++c->id;
+  req.op = op;
+  req.port = c->port;
+  memcpy(req.host, c->host, sizeof(req.host));
+  if (write_all(c->fd, &req, sizeof(req)) ||
+      (args_size && write_all(c->fd, args, args_size)) ||
+      read_all(c->fd, &reply, sizeof(reply)) || reply.id != req.id)
+    return EW_SOCKET;
+
+  // more than fits is read and dropped
+  keep = reply.size < size ? reply.size : size;
+  if (keep && read_all(c->fd, data, keep)) return EW_SOCKET;
+  for (size_t left = reply.size - keep; left > 0;) {
+    size_t n = left < sizeof(skip) ? left : sizeof(skip);
+    if (read_all(c->fd, skip, n)) return EW_SOCKET;
+    left -= n;
+  }
+  if (got) *got = keep;
+  return reply.err;
+}
+
+short broker_read_id(BrokerClient *c, uint32_t ids[4]) {
+  return broker_call(c, BROKER_READ_ID, NULL, 0, ids, 4 * sizeof(uint32_t),
+                     NULL);
+}
+
+short broker_read_status(BrokerClient *c, void *odbst) {
+  return broker_call(c, BROKER_READ_STATUS, NULL, 0, odbst, sizeof(ODBST),
+                     NULL);
+}
+
+short broker_read_position(BrokerClient *c, short axis, short *num,
+                           void *fw32pos, size_t size) {
+  BrokerPositionArgs args = {axis, *num};
+  size_t got = 0;
+  short ret;
+
+  ret = broker_call(c, BROKER_READ_POSITION, &args, sizeof(args), fw32pos,
+                    size, &got);
+  if (ret == EW_OK) *num = got / sizeof(Fw32Pos);
+  return ret;
+}
+
+short broker_read_spindle(BrokerClient *c, short type, void *fw32speed) {
+  return broker_call(c, BROKER_READ_SPINDLE, &type, sizeof(type), fw32speed,
+                     sizeof(Fw32Speed), NULL);
+}
+
+short broker_read_dynamic(BrokerClient *c, short axis, void *fw32dy2) {
+  return broker_call(c, BROKER_READ_DYNAMIC, &axis, sizeof(axis), fw32dy2,
+                     sizeof(Fw32Dy2), NULL);
+}
+
+short broker_read_pmc(BrokerClient *c, short adr_type, short data_type,
+                      unsigned short start, unsigned short end, void *iodbpmc,
+                      unsigned short length) {
+  BrokerPmcArgs args = {adr_type, data_type, start, end};
+
+  return broker_call(c, BROKER_READ_PMC, &args, sizeof(args), iodbpmc,
+                     length, NULL);
+}
+
+short broker_read_program_number(BrokerClient *c, void *odbpro) {
+  return broker_call(c, BROKER_READ_PROGRAM_NUMBER, NULL, 0, odbpro,
+                     sizeof(ODBPRO), NULL);
+}
+
+short broker_write_pmc(BrokerClient *c, const void *iodbpmc,
+                       unsigned short length) {
+  return broker_call(c, BROKER_WRITE_PMC, iodbpmc, length, NULL, 0, NULL);
+}
@@ -0,0 +1,121 @@
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./broker.h"
+#include "fwlib32.h"
+
+static struct option options[] = {{"socket", required_argument, NULL, 's'},
+                                  {"stale", required_argument, NULL, 'a'},
+                                  {"timeout", required_argument, NULL, 't'},
+                                  {"clients", required_argument, NULL, 'c'},
+                                  {NULL, 0, NULL, 0}};
+
+static const char *op_names[BROKER_OPS] = {
+    "id",      "status", "position",       "spindle",
+    "dynamic", "pmc",    "program_number", "write_pmc"};
+
+static Broker *broker;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s --socket=<path> [--stale=<read>:<ms>,...] "
+          "[--timeout=<seconds>] [--clients=<max clients>]\n"
+          "reads: id status position spindle dynamic pmc program_number\n",
+          name);
+}
+
+static int parse_stale(const char *arg, long *stale_ms) {
+  char buf[200];
+  char *tok;
+  char *save;
+  char *ms;
+  int i;
+
+  snprintf(buf, sizeof(buf), "%s", arg);
+  for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    if ((ms = strchr(tok, ':')) == NULL) {
+      fprintf(stderr, "invalid stale: \"%s\"\n", tok);
+      return 1;
+    }
+    *ms++ = '\0';
+    for (i = 0; i < BROKER_WRITE_PMC; i++) {
+      if (strcmp(tok, op_names[i]) == 0) break;
+    }
+    if (i == BROKER_WRITE_PMC || atol(ms) < 0) {
+      fprintf(stderr, "invalid stale: \"%s:%s\"\n", tok, ms);
+      return 1;
+    }
+    stale_ms[i] = atol(ms);
+  }
+  return 0;
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  broker_stop(broker);
+}
+
+int main(int argc, char *argv[]) {
+  BrokerOptions opts = default_broker_options;
+  const char *path = NULL;
+  BrokerStats stats;
+  int c;
+  int i = 0;
+  int tmp;
+
+  while ((c = getopt_long(argc, argv, "", options, &i)) != -1) {
+    switch (c) {
+      case 's':
+        path = optarg;
+        break;
+      case 'a':
+        if (parse_stale(optarg, opts.stale_ms)) return EXIT_FAILURE;
+        break;
+      case 't':
+        if ((tmp = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid timeout: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        opts.timeout = tmp;
+        break;
+      case 'c':
+        if ((tmp = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid clients: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        opts.max_clients = tmp;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (path == NULL) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (cnc_startupprocess(0, "focas.log") != EW_OK) {
+    fprintf(stderr, "Failed to create required log file!\n");
+    return EXIT_FAILURE;
+  }
+  if ((broker = broker_create(path, &opts)) == NULL) {
+    cnc_exitprocess();
+    return EXIT_FAILURE;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  broker_run(broker, -1);
+  broker_stats(broker, &stats);
+  printf("%lu requests, %lu FOCAS calls, %lu coalesced, %lu cached\n",
+         stats.requests, stats.calls, stats.coalesced, stats.cached);
+
+  broker_destroy(broker);
+  cnc_exitprocess();
+  return EXIT_SUCCESS;
+}
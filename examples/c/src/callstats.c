@@ -0,0 +1,293 @@
+#include "./callstats.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CALLSTATS_TSC
+#endif
+
+#define CHAINS 256      // hash chains of a thread's table
+#define CACHE_BITS 12  // entries a thread finds without walking a chain
+#define ROWS (HIST_BUCKETS >> HIST_SUB_BITS)
+#define ROW_BUCKETS (1 << HIST_SUB_BITS)
+
+/* a function on a machine, written by its thread only. the calls and
+ * errors are the sums of the codes. the histogram rows of a power of two
+ * are allocated when a call first falls into them, calls of one site
+ * spread over a few. */
+struct entry {
+  const char *function;
+  unsigned short machine;
+  struct entry *_Atomic next;
+  _Atomic uint64_t total_ns;
+  _Atomic uint64_t max_ns;
+  _Atomic uint64_t codes[HIST_CODES];
+  _Atomic(_Atomic uint64_t *) rows[ROWS];
+};
+
+/* the cache is a direct mapped copy of the chains by call site and machine,
+ * a poller of a thousand machines would walk a chain on every call */
+struct table {
+  struct entry *_Atomic chains[CHAINS];
+  struct table *next;
+  struct table **prev;
+  struct entry *cache[1 << CACHE_BITS];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static struct table *tables;  // of the running threads
+static struct table retired;  // calls of threads that have exited
+static __thread struct table *mine;
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+static atomic_int clock_ready;
+static double ns_per_tick;  // 0 when timestamps are CLOCK_MONOTONIC ns
+
+static unsigned long long monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* the time stamp counter is read in a few ns where clock_gettime takes
+ * 20 to 40, it is used when it ticks at a constant rate */
+static void calibrate(void) {
+#ifdef CALLSTATS_TSC
+  unsigned a, b, c, d;
+  unsigned long long t0, ns0, ns;
+
+  if (!__get_cpuid(0x80000007, &a, &b, &c, &d) || !(d & 1u << 8)) return;
+  ns0 = monotonic_ns();
+  t0 = __rdtsc();
+  while ((ns = monotonic_ns()) - ns0 < 1000000) {
+  }
+  ns_per_tick = (double)(ns - ns0) / (__rdtsc() - t0);
+#endif
+  atomic_store_explicit(&clock_ready, 1, memory_order_release);
+}
+
+unsigned long long callstats_now(void) {
+  if (!atomic_load_explicit(&clock_ready, memory_order_acquire))
+    pthread_once(&clock_once, calibrate);
+#ifdef CALLSTATS_TSC
+  if (ns_per_tick > 0) return __rdtsc();
+#endif
+  return monotonic_ns();
+}
+
+/* fibonacci hashing, consecutive handles of one site spread evenly */
+static uint32_t hash(const char *function, unsigned short machine) {
+  return ((uint32_t)((uintptr_t)function >> 3) + machine) * 0x9e3779b1u;
+}
+
+static struct entry *find(struct table *t, const char *function,
+                          unsigned short machine) {
+  struct entry *_Atomic *head = &t->chains[hash(function, machine) % CHAINS];
+  struct entry *e;
+
+  for (e = atomic_load_explicit(head, memory_order_relaxed); e;
+       e = atomic_load_explicit(&e->next, memory_order_relaxed)) {
+    if (e->function == function && e->machine == machine) return e;
+  }
+  if ((e = calloc(1, sizeof(*e))) == NULL) return NULL;
+  e->function = function;
+  e->machine = machine;
+  e->next = atomic_load_explicit(head, memory_order_relaxed);
+  // collect walks the chains of other threads
+  atomic_store_explicit(head, e, memory_order_release);
+  return e;
+}
+
+/* only the owner writes, so a load and a store count without a locked
+ * instruction */
+static void bump(_Atomic uint64_t *c, uint64_t n) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                        memory_order_relaxed);
+}
+
+unsigned long long callstats_bucket_high(int b) { return hist_bucket_high(b); }
+
+short callstats_code(int index) { return hist_code(index); }
+
+static void count(struct entry *e, uint64_t ns, short rc) {
+  int b = hist_bucket(ns);
+  _Atomic uint64_t *row =
+      atomic_load_explicit(&e->rows[b / ROW_BUCKETS], memory_order_relaxed);
+
+  if (row == NULL) {
+    if ((row = calloc(ROW_BUCKETS, sizeof(*row))) == NULL) return;
+    atomic_store_explicit(&e->rows[b / ROW_BUCKETS], row,
+                          memory_order_release);
+  }
+  bump(&row[b % ROW_BUCKETS], 1);
+  bump(&e->codes[hist_code_index(rc)], 1);
+  bump(&e->total_ns, ns);
+  if (ns > atomic_load_explicit(&e->max_ns, memory_order_relaxed))
+    atomic_store_explicit(&e->max_ns, ns, memory_order_relaxed);
+}
+
+static void free_table(struct table *t) {
+  for (int c = 0; c < CHAINS; c++) {
+    struct entry *e = t->chains[c];
+    while (e) {
+      struct entry *next = e->next;
+      for (int r = 0; r < ROWS; r++) free(e->rows[r]);
+      free(e);
+      e = next;
+    }
+  }
+}
+
+/* adds the counts of an exited thread, under the lock */
+static void add(struct entry *to, const struct entry *e) {
+  to->total_ns += e->total_ns;
+  if (e->max_ns > to->max_ns) to->max_ns = e->max_ns;
+  for (int k = 0; k < HIST_CODES; k++) to->codes[k] += e->codes[k];
+  for (int r = 0; r < ROWS; r++) {
+    if (e->rows[r] == NULL) continue;
+    if (to->rows[r] == NULL &&
+        (to->rows[r] = calloc(ROW_BUCKETS, sizeof(*to->rows[r]))) == NULL)
+      continue;
+    for (int b = 0; b < ROW_BUCKETS; b++) to->rows[r][b] += e->rows[r][b];
+  }
+}
+
+/* thread exit: its counts move to `retired` */
+static void retire(void *arg) {
+  struct table *t = arg;
+
+  pthread_mutex_lock(&lock);
+  *t->prev = t->next;
+  if (t->next) t->next->prev = t->prev;
+  for (int c = 0; c < CHAINS; c++) {
+    for (struct entry *e = t->chains[c]; e; e = e->next) {
+      struct entry *to = find(&retired, e->function, e->machine);
+      if (to) add(to, e);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  free_table(t);
+  free(t);
+  mine = NULL;
+}
+
+static void init(void) { pthread_key_create(&key, retire); }
+
+static struct table *table(void) {
+  struct table *t;
+
+  if (mine) return mine;
+  pthread_once(&once, init);
+  if ((t = calloc(1, sizeof(*t))) == NULL) return NULL;
+  pthread_mutex_lock(&lock);
+  t->next = tables;
+  t->prev = &tables;
+  if (tables) tables->prev = &t->next;
+  tables = t;
+  pthread_mutex_unlock(&lock);
+  pthread_setspecific(key, t);
+  return mine = t;
+}
+
+void callstats_add(const char *function, unsigned short machine,
+                   unsigned long long ns, short rc) {
+  struct table *t = mine;
+  struct entry **cached;
+  struct entry *e;
+
+  if (t == NULL && (t = table()) == NULL) return;
+  cached = &t->cache[hash(function, machine) >> (32 - CACHE_BITS)];
+  if ((e = *cached) == NULL || e->function != function ||
+      e->machine != machine) {
+    if ((e = find(t, function, machine)) == NULL) return;
+    *cached = e;
+  }
+  count(e, ns < HIST_MAX_NS ? ns : HIST_MAX_NS, rc);
+}
+
+void callstats_record(const char *function, unsigned short machine,
+                      unsigned long long start, short rc) {
+  // start came from callstats_now, the clock is calibrated
+#ifdef CALLSTATS_TSC
+  if (ns_per_tick > 0) {
+    callstats_add(function, machine,
+                  (unsigned long long)((__rdtsc() - start) * ns_per_tick), rc);
+    return;
+  }
+#endif
+  callstats_add(function, machine, monotonic_ns() - start, rc);
+}
+
+/* adds an entry of some thread to the merged rows */
+static int merge(CallStats *rows, int n, int max, const struct entry *e) {
+  CallStats *s;
+  uint64_t max_ns;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (rows[i].machine == e->machine &&
+        (rows[i].function == e->function ||
+         strcmp(rows[i].function, e->function) == 0))
+      break;
+  }
+  if (i == n) {
+    if (n == max) return n;
+    memset(&rows[n], 0, sizeof(rows[n]));
+    rows[n].function = e->function;
+    rows[n].machine = e->machine;
+    n++;
+  }
+  s = &rows[i];
+  s->total_ns += atomic_load_explicit(&e->total_ns, memory_order_relaxed);
+  max_ns = atomic_load_explicit(&e->max_ns, memory_order_relaxed);
+  if (max_ns > s->max_ns) s->max_ns = max_ns;
+  for (int k = 0; k < HIST_CODES; k++) {
+    uint64_t n = atomic_load_explicit(&e->codes[k], memory_order_relaxed);
+    s->codes[k] += n;
+    s->calls += n;
+    if (k != hist_code_index(0)) s->errors += n;
+  }
+  for (int r = 0; r < ROWS; r++) {
+    _Atomic uint64_t *row =
+        atomic_load_explicit(&e->rows[r], memory_order_acquire);
+    for (int b = 0; row && b < ROW_BUCKETS; b++)
+      s->hist[r * ROW_BUCKETS + b] +=
+          atomic_load_explicit(&row[b], memory_order_relaxed);
+  }
+  return n;
+}
+
+static int merge_table(CallStats *rows, int n, int max, struct table *t,
+                       int machine) {
+  for (int c = 0; c < CHAINS; c++) {
+    for (struct entry *e =
+             atomic_load_explicit(&t->chains[c], memory_order_acquire);
+         e; e = atomic_load_explicit(&e->next, memory_order_relaxed)) {
+      if (machine < 0 || e->machine == machine) n = merge(rows, n, max, e);
+    }
+  }
+  return n;
+}
+
+int callstats_collect(CallStats *rows, int max, int machine) {
+  int n = 0;
+
+  pthread_mutex_lock(&lock);
+  for (struct table *t = tables; t; t = t->next)
+    n = merge_table(rows, n, max, t, machine);
+  n = merge_table(rows, n, max, &retired, machine);
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+double callstats_quantile(const CallStats *s, double q) {
+  return hist_quantile(s->hist, s->max_ns, q);
+}
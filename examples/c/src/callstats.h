@@ -0,0 +1,55 @@
+#ifndef FW_CALLSTATS_H
+#define FW_CALLSTATS_H
+
+/* latency of the FOCAS calls a process makes itself, per function and
+ * machine (its handle). a call site takes the time before the call and
+ * records it after:
+ *   unsigned long long t = callstats_now();
+ *   ret = cnc_rddynamic2(libh, axis, sizeof(buf), &buf);
+ *   callstats_record("cnc_rddynamic2", libh, t, ret);
+ * every thread counts into histograms of its own (histogram.h) without
+ * locks or atomic read-modify-writes, callstats_collect merges the threads
+ * when the numbers are scraped. `function` is compared by pointer on the
+ * hot path, pass a string literal. */
+
+#include "./histogram.h"
+
+#define CALLSTATS_SUB_BITS HIST_SUB_BITS
+#define CALLSTATS_BUCKETS HIST_BUCKETS
+#define CALLSTATS_CODES HIST_CODES
+#define CALLSTATS_MIN_CODE HIST_MIN_CODE
+
+typedef struct call_stats {
+  const char *function;
+  unsigned short machine;
+  unsigned long long calls;
+  unsigned long long errors;  // calls that did not return EW_OK
+  unsigned long long total_ns;
+  unsigned long long max_ns;
+  unsigned long long hist[CALLSTATS_BUCKETS];
+  unsigned long long codes[CALLSTATS_CODES];
+} CallStats;
+
+/* the start of a call: ticks of the cpu's time stamp counter when it runs
+ * at a constant rate, else CLOCK_MONOTONIC nanoseconds. the first call
+ * takes a millisecond to measure the counter. */
+unsigned long long callstats_now(void);
+void callstats_record(const char *function, unsigned short machine,
+                      unsigned long long start, short rc);
+/* a call that took `ns`, timed by the caller */
+void callstats_add(const char *function, unsigned short machine,
+                   unsigned long long ns, short rc);
+
+/* the calls of `machine`, or of every machine when it is -1, merged over
+ * all threads, one row per function and machine. fills up to `max` rows
+ * and returns how many it filled, further functions are left out. */
+int callstats_collect(CallStats *rows, int max, int machine);
+
+/* the latency below which a share q of the calls finished, in ns */
+double callstats_quantile(const CallStats *s, double q);
+/* highest latency in ns that is counted in hist[b] */
+unsigned long long callstats_bucket_high(int b);
+/* return code of a codes[] index, CALLSTATS_CODES - 1 is any other */
+short callstats_code(int index);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef FW_CLOCK_H
+#define FW_CLOCK_H
+
+#include <time.h>
+
+/* seconds on the monotonic clock */
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void idle(long us) {
+  struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+  nanosleep(&ts, NULL);
+}
+
+/* when a *_run loop given timeout_ms ends, -1 for only when it is done */
+static inline double run_deadline(long timeout_ms) {
+  return timeout_ms < 0 ? -1 : now() + timeout_ms / 1e3;
+}
+
+/* sleeps the milliseconds a *_step answered, but not past `deadline`.
+ * 0 when the loop ends: the step answered -1 or the deadline passed */
+static inline int run_wait(long wait_ms, double deadline) {
+  if (wait_ms < 0) return 0;
+  if (deadline >= 0) {
+    double left = (deadline - now()) * 1e3;
+    if (left <= 0) return 0;
+    if (wait_ms > left) wait_ms = (long)left + 1;
+  }
+  idle(wait_ms * 1000);
+  return 1;
+}
+
+#endif
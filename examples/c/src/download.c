@@ -0,0 +1,142 @@
+#include "./download.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./backoff.h"
+#include "./callstats.h"
+#include "./clock.h"
+#include "fwlib32.h"
+
+const DownloadOptions default_download_options = {32768, NULL, NULL};
+
+/* called after each accepted chunk, used to drop sent pages of a mapping */
+typedef void (*sent_fn)(const char *data, size_t sent, void *ctx);
+
+static int download(unsigned short libh, short type, const char *folder,
+                    const char *data, size_t len, const DownloadOptions *opts,
+                    DownloadStats *stats, sent_fn sent, void *sent_ctx) {
+  DownloadStats s;
+  DownloadChunk c;
+  double start, t0;
+  size_t off = 0;
+  int ret = 0;
+  short err;
+
+  if (opts == NULL) opts = &default_download_options;
+  if (opts->chunk == 0) {
+    fprintf(stderr, "invalid download chunk size\n");
+    return 1;
+  }
+  memset(&s, 0, sizeof(s));
+
+  if ((err = cnc_dwnstart4(libh, type, (char *)folder)) != EW_OK) {
+    fprintf(stderr, "Failed to start download to \"%s\"! (%d)\n", folder, err);
+    if (stats) *stats = s;
+    return 1;
+  }
+
+  start = now();
+  memset(&c, 0, sizeof(c));
+  t0 = start;
+  while (off < len) {
+    long n = (long)(len - off < opts->chunk ? len - off : opts->chunk);
+    unsigned long long t;
+
+    // the library does not write through the pointer
+    t = callstats_now();
+    err = cnc_download4(libh, &n, (char *)data + off);
+    callstats_record("cnc_download4", libh, t, err);
+    if (err == EW_BUFFER && c.retries < BACKOFF_MAX_ATTEMPTS) {
+      backoff_sleep(c.retries++, 500, 50000);
+      continue;
+    }
+    if (err != EW_OK) {
+      fprintf(stderr, "Failed to download to \"%s\" at byte %zu! (%d)\n",
+              folder, off, err);
+      ret = 1;
+      break;
+    }
+
+    c.offset = off;
+    c.len = (size_t)n;
+    c.latency = now() - t0;
+    off += (size_t)n;
+    s.chunks++;
+    s.retries += c.retries;
+    if (c.latency > s.max_latency) s.max_latency = c.latency;
+    if (opts->on_chunk) opts->on_chunk(&c, opts->ctx);
+    if (sent) sent(data, off, sent_ctx);
+    c.retries = 0;
+    t0 = now();
+  }
+
+  if ((err = cnc_dwnend4(libh)) != EW_OK && !ret) {
+    fprintf(stderr, "Failed to end download to \"%s\"! (%d)\n", folder, err);
+    ret = 1;
+  }
+  s.bytes = off;
+  s.elapsed = now() - start;
+  s.rate = s.bytes / (s.elapsed + 1e-9);
+  if (stats) *stats = s;
+  return ret;
+}
+
+int download_buffer(unsigned short libh, short type, const char *folder,
+                    const char *data, size_t len,
+                    const DownloadOptions *opts, DownloadStats *stats) {
+  return download(libh, type, folder, data, len, opts, stats, NULL, NULL);
+}
+
+struct mapping {
+  size_t page;
+  size_t released;
+};
+
+static void release_sent(const char *data, size_t sent, void *ctx) {
+  struct mapping *m = ctx;
+  size_t end = sent / m->page * m->page;
+
+  // a few pages at a time, madvise per chunk would dominate small chunks
+  if (end - m->released >= 16 * m->page) {
+    madvise((char *)data + m->released, end - m->released, MADV_DONTNEED);
+    m->released = end;
+  }
+}
+
+int download_file(unsigned short libh, short type, const char *folder,
+                  const char *path, const DownloadOptions *opts,
+                  DownloadStats *stats) {
+  struct mapping m = {(size_t)sysconf(_SC_PAGESIZE), 0};
+  struct stat st;
+  void *data;
+  int ret;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "unable to open \"%s\"\n", path);
+    return 1;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "unable to read \"%s\"\n", path);
+    close(fd);
+    return 1;
+  }
+  data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "unable to map \"%s\"\n", path);
+    return 1;
+  }
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  ret = download(libh, type, folder, data, (size_t)st.st_size, opts, stats,
+                 release_sent, &m);
+  munmap(data, (size_t)st.st_size);
+  return ret;
+}
@@ -0,0 +1,44 @@
+#ifndef FW_DOWNLOAD_H
+#define FW_DOWNLOAD_H
+
+#include <stddef.h>
+
+/* one accepted cnc_download4 request, passed to the chunk callback */
+typedef struct download_chunk {
+  size_t offset;          // position of the chunk in the source
+  size_t len;             // bytes accepted by the cnc
+  unsigned long retries;  // EW_BUFFER responses before it was accepted
+  double latency;         // seconds from first attempt to acceptance
+} DownloadChunk;
+
+typedef struct download_stats {
+  size_t bytes;
+  unsigned long chunks;
+  unsigned long retries;
+  double max_latency;
+  double elapsed;
+  double rate;  // bytes per second
+} DownloadStats;
+
+typedef void (*download_chunk_fn)(const DownloadChunk *chunk, void *ctx);
+
+typedef struct download_options {
+  size_t chunk;  // bytes offered per cnc_download4 call
+  download_chunk_fn on_chunk;
+  void *ctx;
+} DownloadOptions;
+
+extern const DownloadOptions default_download_options;
+
+/* send `len` bytes at `data` as data of `type` (see cnc_dwnstart4) to
+ * `folder`. the cnc reads straight from `data`, nothing is copied. */
+int download_buffer(unsigned short libh, short type, const char *folder,
+                    const char *data, size_t len,
+                    const DownloadOptions *opts, DownloadStats *stats);
+/* same, with the source file mapped into memory; pages already sent are
+ * released so resident memory stays flat for large files */
+int download_file(unsigned short libh, short type, const char *folder,
+                  const char *path, const DownloadOptions *opts,
+                  DownloadStats *stats);
+
+#endif
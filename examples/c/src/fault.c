@@ -0,0 +1,209 @@
+#include "./fault.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "./clock.h"
+#include "fwlib32.h"
+
+enum when {
+  WHEN_ALWAYS,
+  WHEN_RATE,
+  WHEN_EVERY,
+  WHEN_WINDOW,
+};
+
+struct rule {
+  int kind;
+  long wait_ms;
+  char function[64];
+  int prefix;  // function ended in '*'
+  int when;
+  double rate;
+  unsigned long every;
+  double period;  // seconds, an outage is the last `length` of each
+  double length;
+  atomic_ulong matched;
+};
+
+struct fault_plan {
+  struct rule rules[FAULT_MAX_RULES];
+  int nrules;
+  double start;
+  _Atomic uint64_t rng;
+  atomic_ulong calls;
+  atomic_ulong injected[FAULT_KINDS];
+};
+
+static const char *const kind_names[FAULT_KINDS] = {
+    "busy", "socket", "handle", "reset", "buffer", "timeout", "slow"};
+static const short kind_codes[FAULT_KINDS] = {
+    EW_BUSY, EW_SOCKET, EW_HANDLE, EW_RESET, EW_BUFFER, EW_SOCKET, EW_OK};
+
+// splitmix64, callers share one sequence
+static double uniform(FaultPlan *p) {
+  uint64_t z = atomic_fetch_add(&p->rng, 0x9e3779b97f4a7c15ULL) +
+               0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) / 9007199254740992.0;
+}
+
+/* "60s/10s", the units are optional */
+static int parse_window(const char *s, struct rule *r) {
+  char *end;
+
+  r->period = strtod(s, &end);
+  if (end == s) return 1;
+  if (*end == 's') end++;
+  if (*end++ != '/') return 1;
+  s = end;
+  r->length = strtod(s, &end);
+  if (end == s) return 1;
+  if (*end == 's') end++;
+  return *end != '\0' || r->period <= 0 || r->length <= 0 ||
+         r->length > r->period;
+}
+
+static int parse_when(const char *s, struct rule *r) {
+  char *end;
+
+  if (s == NULL) {
+    r->when = WHEN_ALWAYS;
+    return 0;
+  }
+  if (strncmp(s, "every=", 6) == 0) {
+    long n = strtol(s + 6, &end, 10);
+    r->when = WHEN_EVERY;
+    r->every = n;
+    return end == s + 6 || *end != '\0' || n < 1;
+  }
+  if (strchr(s, '/')) {
+    r->when = WHEN_WINDOW;
+    return parse_window(s, r);
+  }
+  r->when = WHEN_RATE;
+  r->rate = strtod(s, &end);
+  return end == s || *end != '\0' || r->rate < 0 || r->rate > 1;
+}
+
+static int parse_rule(const char *s, size_t n, struct rule *r) {
+  char buf[128];
+  char *when, *function, *wait;
+
+  if (n == 0 || n >= sizeof(buf)) return 1;
+  memcpy(buf, s, n);
+  buf[n] = '\0';
+  if ((when = strchr(buf, ':')) != NULL) *when++ = '\0';
+  if ((function = strchr(buf, '@')) != NULL) *function++ = '\0';
+  if ((wait = strchr(buf, '=')) != NULL) *wait++ = '\0';
+
+  r->kind = -1;
+  for (int i = 0; i < FAULT_KINDS; i++) {
+    if (strcmp(buf, kind_names[i]) == 0) r->kind = i;
+  }
+  if (r->kind < 0) return 1;
+  r->wait_ms = r->kind == FAULT_TIMEOUT ? 10000
+               : r->kind == FAULT_SLOW  ? 1000
+                                        : 0;
+  if (wait) {
+    char *end;
+    if (r->kind != FAULT_TIMEOUT && r->kind != FAULT_SLOW) return 1;
+    r->wait_ms = strtol(wait, &end, 10);
+    if (end == wait || *end != '\0' || r->wait_ms < 0) return 1;
+  }
+  if (function) {
+    size_t len = strlen(function);
+    if (len == 0 || len >= sizeof(r->function)) return 1;
+    if (function[len - 1] == '*') {
+      r->prefix = 1;
+      function[--len] = '\0';
+    }
+    memcpy(r->function, function, len + 1);
+  }
+  return parse_when(when, r);
+}
+
+FaultPlan *fault_parse(const char *spec, unsigned long seed) {
+  FaultPlan *p;
+  const char *s = spec;
+
+  if ((p = calloc(1, sizeof(*p))) == NULL) return NULL;
+  p->start = now();
+  atomic_store(&p->rng, seed);
+  while (*s) {
+    const char *comma = strchr(s, ',');
+    size_t n = comma ? (size_t)(comma - s) : strlen(s);
+
+    if (p->nrules == FAULT_MAX_RULES ||
+        parse_rule(s, n, &p->rules[p->nrules])) {
+      free(p);
+      return NULL;
+    }
+    p->nrules++;
+    s += comma ? n + 1 : n;
+  }
+  return p;
+}
+
+void fault_free(FaultPlan *p) { free(p); }
+
+static int matches(const struct rule *r, const char *function) {
+  if (r->function[0] == '\0') return 1;
+  if (r->prefix)
+    return strncmp(function, r->function, strlen(r->function)) == 0;
+  return strcmp(function, r->function) == 0;
+}
+
+static int fires(FaultPlan *p, struct rule *r, double *t) {
+  switch (r->when) {
+    case WHEN_RATE:
+      return uniform(p) < r->rate;
+    case WHEN_EVERY:
+      return (atomic_fetch_add_explicit(&r->matched, 1, memory_order_relaxed) +
+              1) % r->every == 0;
+    case WHEN_WINDOW:
+      if (*t < 0) *t = now() - p->start;
+      return fmod(*t, r->period) >= r->period - r->length;
+    default:
+      return 1;
+  }
+}
+
+short fault_check(FaultPlan *p, const char *function, long *wait_us) {
+  double t = -1;
+
+  *wait_us = 0;
+  atomic_fetch_add_explicit(&p->calls, 1, memory_order_relaxed);
+  for (int i = 0; i < p->nrules; i++) {
+    struct rule *r = &p->rules[i];
+
+    if (!matches(r, function) || !fires(p, r, &t)) continue;
+    atomic_fetch_add_explicit(&p->injected[r->kind], 1, memory_order_relaxed);
+    *wait_us += r->wait_ms * 1000;
+    if (r->kind != FAULT_SLOW) return kind_codes[r->kind];
+  }
+  return EW_OK;
+}
+
+short fault_apply(FaultPlan *p, const char *function) {
+  long us;
+  short code = fault_check(p, function, &us);
+  struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+
+  while (us > 0 && nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+  return code;
+}
+
+void fault_stats(const FaultPlan *p, FaultStats *stats) {
+  stats->calls = atomic_load(&p->calls);
+  for (int i = 0; i < FAULT_KINDS; i++)
+    stats->injected[i] = atomic_load(&p->injected[i]);
+}
@@ -0,0 +1,62 @@
+#ifndef FW_FAULT_H
+#define FW_FAULT_H
+
+/* FOCAS fault injection, to see how a program copes with a controller or
+ * network that misbehaves. the simulated library applies a plan to its
+ * calls (FWSIM_FAULTS, fwsim.h) and libfocastrace to the calls of the real
+ * library or any other (FOCASTRACE_FAULTS, focastrace.h).
+ *
+ * a plan is a comma separated list of rules
+ *
+ *   <fault>[=<ms>][@<function>][:<when>]
+ *
+ *   fault     busy, socket, handle, reset or buffer return EW_BUSY,
+ *             EW_SOCKET, EW_HANDLE, EW_RESET or EW_BUFFER instead of making
+ *             the call. timeout waits <ms> (default 10000) and returns
+ *             EW_SOCKET, as a cnc that does not answer. slow waits <ms>
+ *             (default 1000) before making the call.
+ *   function  the name of a call, or a prefix ending in '*' (cnc_rd*).
+ *             every call when left out.
+ *   when      <rate>              that share of the calls, at random
+ *             every=<n>           every n-th call the rule matches
+ *             <period>s/<length>s the last length of every period from
+ *                                 the time the plan was made, an outage
+ *             every call when left out.
+ *
+ * e.g. "socket@cnc_allclibhndl3:0.5,busy@pmc_*:every=10,slow=200:0.01,
+ * socket:60s/10s". the first rule that fires and returns a code decides,
+ * the waits of the rules that fire add up. */
+
+#define FAULT_MAX_RULES 32
+
+enum fault_kind {
+  FAULT_BUSY,
+  FAULT_SOCKET,
+  FAULT_HANDLE,
+  FAULT_RESET,
+  FAULT_BUFFER,
+  FAULT_TIMEOUT,
+  FAULT_SLOW,
+  FAULT_KINDS,
+};
+
+typedef struct fault_stats {
+  unsigned long calls;
+  unsigned long injected[FAULT_KINDS];
+} FaultStats;
+
+typedef struct fault_plan FaultPlan;
+
+/* NULL when the plan is not valid. `seed` makes the rates repeatable. */
+FaultPlan *fault_parse(const char *spec, unsigned long seed);
+void fault_free(FaultPlan *p);
+
+/* any thread, before a call is made. EW_OK to make it after waiting
+ * *wait_us, else the code to return in its place after waiting *wait_us. */
+short fault_check(FaultPlan *p, const char *function, long *wait_us);
+/* fault_check and the wait */
+short fault_apply(FaultPlan *p, const char *function);
+
+void fault_stats(const FaultPlan *p, FaultStats *stats);
+
+#endif
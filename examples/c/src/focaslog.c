@@ -0,0 +1,278 @@
+#include "./focaslog.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEADER 32
+#define CALL_HEADER 28  // after the type byte: args .. duration_ns
+#define ARG_HEADER 5
+#define WRITE_BUFFER (1 << 20)
+
+struct focaslog {
+  // written, not through stdio so that the buffer of a forked child that
+  // exits is not written a second time
+  int fd;
+  unsigned char *buf;
+  size_t used;
+  pthread_mutex_t lock;
+  unsigned char named[FOCASLOG_MAX_FUNCTIONS];
+  int failed;
+
+  // read
+  unsigned char *map;
+  size_t size;
+  FocasLogCall *calls;
+  int ncalls;
+  char *names[FOCASLOG_MAX_FUNCTIONS];
+  int pid;
+  double started;
+};
+
+FocasLog *focaslog_create(const char *path) {
+  unsigned char header[HEADER] = {0};
+  uint32_t version = FOCASLOG_VERSION;
+  uint32_t pid = (uint32_t)getpid();
+  struct timespec ts;
+  double started;
+  FocasLog *log;
+
+  if ((log = calloc(1, sizeof(*log))) == NULL) return NULL;
+  if ((log->buf = malloc(WRITE_BUFFER)) == NULL ||
+      (log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) <
+          0) {
+    fprintf(stderr, "Failed to create %s!\n", path);
+    free(log->buf);
+    free(log);
+    return NULL;
+  }
+  pthread_mutex_init(&log->lock, NULL);
+  clock_gettime(CLOCK_REALTIME, &ts);
+  started = ts.tv_sec + ts.tv_nsec / 1e9;
+  memcpy(header, FOCASLOG_MAGIC, sizeof(FOCASLOG_MAGIC));
+  memcpy(header + 8, &version, 4);
+  memcpy(header + 12, &pid, 4);
+  memcpy(header + 16, &started, 8);
+  memcpy(log->buf, header, HEADER);
+  log->used = HEADER;
+  return log;
+}
+
+/* under the lock */
+static void drain(FocasLog *log) {
+  for (size_t done = 0; done < log->used;) {
+    ssize_t n = write(log->fd, log->buf + done, log->used - done);
+    if (n <= 0) {
+      log->failed = 1;
+      break;
+    }
+    done += n;
+  }
+  log->used = 0;
+}
+
+static void put(FocasLog *log, const void *data, size_t size) {
+  while (size > 0) {
+    size_t n = WRITE_BUFFER - log->used;
+    if (n > size) n = size;
+    memcpy(log->buf + log->used, data, n);
+    log->used += n;
+    data = (const unsigned char *)data + n;
+    size -= n;
+    if (log->used == WRITE_BUFFER) drain(log);
+  }
+}
+
+int focaslog_write(FocasLog *log, int id, const FocasLogCall *call,
+                   const FocasLogArg *args) {
+  unsigned char head[1 + CALL_HEADER];
+  uint16_t function = (uint16_t)id;
+  uint32_t thread = call->thread;
+  uint64_t start = call->start_ns;
+  uint64_t duration = call->duration_ns;
+  int failed;
+
+  if (id < 0 || id >= FOCASLOG_MAX_FUNCTIONS || call->nargs < 0 ||
+      call->nargs > FOCASLOG_MAX_ARGS)
+    return 1;
+  head[0] = FOCASLOG_CALL;
+  head[1] = (unsigned char)call->nargs;
+  memcpy(head + 2, &function, 2);
+  memcpy(head + 4, &call->handle, 2);
+  memcpy(head + 6, &call->rc, 2);
+  memcpy(head + 8, &thread, 4);
+  memcpy(head + 12, &start, 8);
+  memcpy(head + 20, &duration, 8);
+
+  pthread_mutex_lock(&log->lock);
+  if (!log->named[id]) {
+    unsigned char name[4];
+    size_t len = strlen(call->function);
+    if (len > 255) len = 255;
+    name[0] = FOCASLOG_NAME;
+    name[1] = (unsigned char)len;
+    memcpy(name + 2, &function, 2);
+    put(log, name, sizeof(name));
+    put(log, call->function, len);
+    log->named[id] = 1;
+  }
+  put(log, head, sizeof(head));
+  for (int i = 0; i < call->nargs; i++) {
+    unsigned char arg[ARG_HEADER];
+    uint32_t size = args[i].data ? (uint32_t)args[i].size : 0;
+    arg[0] = (unsigned char)args[i].kind;
+    memcpy(arg + 1, &size, 4);
+    put(log, arg, sizeof(arg));
+    put(log, args[i].data, size);
+  }
+  failed = log->failed;
+  pthread_mutex_unlock(&log->lock);
+  return failed;
+}
+
+int focaslog_flush(FocasLog *log) {
+  int failed;
+
+  pthread_mutex_lock(&log->lock);
+  drain(log);
+  failed = log->failed;
+  pthread_mutex_unlock(&log->lock);
+  return failed;
+}
+
+/* bytes of the record at p, 0 when it runs past the end or is not one */
+static size_t record_size(const unsigned char *p, const unsigned char *end) {
+  const unsigned char *q;
+
+  if (end - p < 4) return 0;
+  if (p[0] == FOCASLOG_NAME) return end - p < 4 + p[1] ? 0 : 4 + p[1];
+  if (p[0] != FOCASLOG_CALL || end - p < 1 + CALL_HEADER) return 0;
+  q = p + 1 + CALL_HEADER;
+  for (int i = 0; i < p[1]; i++) {
+    uint32_t size;
+    if (end - q < ARG_HEADER) return 0;
+    memcpy(&size, q + 1, 4);
+    if ((size_t)(end - q - ARG_HEADER) < size) return 0;
+    q += ARG_HEADER + size;
+  }
+  return q - p;
+}
+
+static int load(FocasLog *log) {
+  const unsigned char *end = log->map + log->size;
+  const unsigned char *p;
+  size_t n;
+  int count = 0;
+
+  // a log cut short by a crash ends at its last whole record
+  for (p = log->map + HEADER; (n = record_size(p, end)) > 0; p += n)
+    count += p[0] == FOCASLOG_CALL;
+  if ((log->calls = calloc(count ? count : 1, sizeof(*log->calls))) == NULL)
+    return 1;
+  for (p = log->map + HEADER; (n = record_size(p, end)) > 0; p += n) {
+    FocasLogCall *c = &log->calls[log->ncalls];
+    uint16_t function;
+    uint32_t thread;
+    uint64_t t;
+
+    memcpy(&function, p + 2, 2);
+    if (function >= FOCASLOG_MAX_FUNCTIONS) continue;
+    if (p[0] == FOCASLOG_NAME) {
+      free(log->names[function]);
+      if ((log->names[function] = strndup((const char *)p + 4, p[1])) == NULL)
+        return 1;
+      continue;
+    }
+    c->function = log->names[function] ? log->names[function] : "";
+    memcpy(&c->handle, p + 4, 2);
+    memcpy(&c->rc, p + 6, 2);
+    memcpy(&thread, p + 8, 4);
+    c->thread = thread;
+    memcpy(&t, p + 12, 8);
+    c->start_ns = t;
+    memcpy(&t, p + 20, 8);
+    c->duration_ns = t;
+    c->nargs = p[1];
+    c->args = p + 1 + CALL_HEADER;
+    log->ncalls++;
+  }
+  return 0;
+}
+
+FocasLog *focaslog_open(const char *path) {
+  FocasLog *log;
+  struct stat st;
+  uint32_t version;
+  uint32_t pid;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) != 0 || st.st_size < HEADER ||
+      (log = calloc(1, sizeof(*log))) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  log->size = st.st_size;
+  log->map = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (log->map == MAP_FAILED) {
+    free(log);
+    return NULL;
+  }
+  memcpy(&version, log->map + 8, 4);
+  memcpy(&pid, log->map + 12, 4);
+  memcpy(&log->started, log->map + 16, 8);
+  log->pid = (int)pid;
+  if (memcmp(log->map, FOCASLOG_MAGIC, sizeof(FOCASLOG_MAGIC)) != 0 ||
+      version != FOCASLOG_VERSION || load(log) != 0) {
+    focaslog_close(log);
+    return NULL;
+  }
+  return log;
+}
+
+const FocasLogCall *focaslog_calls(const FocasLog *log, int *count) {
+  *count = log->ncalls;
+  return log->calls;
+}
+
+int focaslog_arg(const FocasLogCall *call, int i, FocasLogArg *arg) {
+  const unsigned char *p = call->args;
+  uint32_t size;
+
+  if (i < 0 || i >= call->nargs) return 1;
+  for (;; i--) {
+    memcpy(&size, p + 1, 4);
+    if (i == 0) break;
+    p += ARG_HEADER + size;
+  }
+  arg->kind = p[0];
+  arg->size = size;
+  arg->data = p + ARG_HEADER;
+  return 0;
+}
+
+int focaslog_pid(const FocasLog *log) { return log->pid; }
+
+double focaslog_started(const FocasLog *log) { return log->started; }
+
+void focaslog_close(FocasLog *log) {
+  if (log == NULL) return;
+  if (log->buf) {
+    focaslog_flush(log);
+    close(log->fd);
+    pthread_mutex_destroy(&log->lock);
+    free(log->buf);
+  }
+  if (log->map && log->map != MAP_FAILED) munmap(log->map, log->size);
+  for (int i = 0; i < FOCASLOG_MAX_FUNCTIONS; i++) free(log->names[i]);
+  free(log->calls);
+  free(log);
+}
@@ -0,0 +1,75 @@
+#ifndef FW_FOCASLOG_H
+#define FW_FOCASLOG_H
+
+/* binary log of FOCAS calls with their arguments, the data they returned,
+ * the return code and the time they took. libfocastrace writes one when
+ * FOCASTRACE_RECORD names a file, libfwlib32 of focasreplay serves it back
+ * to an unmodified program (focasreplay.h).
+ *
+ * layout, host byte order:
+ *   header (32)  char magic[8] "FWLOG", u32 version, u32 pid,
+ *                f64 started (unix time), u64 reserved
+ *   records      u8 type, then
+ *     FOCASLOG_NAME  u8 length, u16 function, the name (no terminator)
+ *     FOCASLOG_CALL  u8 args, u16 function, u16 handle, i16 rc,
+ *                    u32 thread, u64 start_ns, u64 duration_ns, then per
+ *                    argument u8 kind, u32 size and its bytes
+ * a function is named once, before its first call. start_ns counts from
+ * the start of the recording. */
+
+#define FOCASLOG_MAGIC "FWLOG"
+#define FOCASLOG_VERSION 1
+#define FOCASLOG_MAX_ARGS 16
+#define FOCASLOG_MAX_FUNCTIONS 4096
+
+enum focaslog_record {
+  FOCASLOG_NAME = 1,
+  FOCASLOG_CALL = 2,
+};
+
+enum focaslog_kind {
+  FOCASLOG_VALUE,  // passed by value, or a string: what a call is asked
+  FOCASLOG_IN,     // data the call only reads
+  FOCASLOG_OUT,    // what the pointer held after the call
+};
+
+typedef struct focaslog_arg {
+  int kind;
+  unsigned long size;  // 0 when the size is not known
+  const void *data;
+} FocasLogArg;
+
+typedef struct focaslog_call {
+  const char *function;
+  unsigned short handle;  // the first parameter, 0 for calls without one
+  short rc;
+  unsigned thread;
+  unsigned long long start_ns;
+  unsigned long long duration_ns;
+  int nargs;
+  const unsigned char *args;  // as in the log, see focaslog_arg
+} FocasLogCall;
+
+typedef struct focaslog FocasLog;
+
+/* writing, any thread. `id` is the function's number in the writer, below
+ * FOCASLOG_MAX_FUNCTIONS, and `args` the call->nargs arguments. records
+ * are buffered and written out by focaslog_close, or by focaslog_flush. */
+FocasLog *focaslog_create(const char *path);
+int focaslog_write(FocasLog *log, int id, const FocasLogCall *call,
+                   const FocasLogArg *args);
+int focaslog_flush(FocasLog *log);
+
+/* reading: the calls of a whole log in the order they were written */
+FocasLog *focaslog_open(const char *path);
+const FocasLogCall *focaslog_calls(const FocasLog *log, int *count);
+/* argument i of a call, its data points into the log. 1 when there is no
+ * such argument. */
+int focaslog_arg(const FocasLogCall *call, int i, FocasLogArg *arg);
+int focaslog_pid(const FocasLog *log);
+double focaslog_started(const FocasLog *log);
+
+/* flushes and closes a log being written, unmaps one being read */
+void focaslog_close(FocasLog *log);
+
+#endif
@@ -0,0 +1,192 @@
+#include "./focasreplay.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fwlib32.h"
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+/* a call under one of its two keys */
+struct entry {
+  uint64_t key;
+  uint32_t call;
+};
+
+/* the calls with one key, entries[first .. first + count) */
+struct group {
+  uint64_t key;
+  uint32_t first;
+  uint32_t count;
+  _Atomic uint32_t next;
+};
+
+struct replay {
+  FocasLog *log;
+  const FocasLogCall *calls;
+  struct entry *entries;  // by key, then in recorded order
+  struct group *groups;   // by key
+  int ngroups;
+  double speed;
+};
+
+static Replay *global;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static uint64_t fnv(uint64_t h, const void *data, size_t size) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * FNV_PRIME;
+  return h;
+}
+
+static uint64_t loose_key(const char *function, unsigned short handle) {
+  uint64_t h = fnv(FNV_OFFSET, function, strlen(function) + 1);
+  return fnv(h, &handle, sizeof(handle));
+}
+
+/* the loose key and the arguments by value, sized as in the log */
+static uint64_t exact_key(uint64_t h, const FocasLogArg *args, int nargs) {
+  h = fnv(h, "=", 1);
+  for (int i = 0; i < nargs; i++) {
+    uint32_t size = args[i].data ? (uint32_t)args[i].size : 0;
+    if (args[i].kind != FOCASLOG_VALUE) continue;
+    h = fnv(h, &i, sizeof(i));
+    h = fnv(h, &size, sizeof(size));
+    h = fnv(h, args[i].data, size);
+  }
+  return h;
+}
+
+static int by_key(const void *a, const void *b) {
+  const struct entry *x = a, *y = b;
+  if (x->key != y->key) return x->key < y->key ? -1 : 1;
+  return (x->call > y->call) - (x->call < y->call);
+}
+
+static struct group *find(Replay *r, uint64_t key) {
+  int lo = 0, hi = r->ngroups;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (r->groups[mid].key == key) return &r->groups[mid];
+    if (r->groups[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+static int index_calls(Replay *r, int ncalls) {
+  FocasLogArg args[FOCASLOG_MAX_ARGS];
+  int n = 0;
+
+  if ((r->entries = malloc((ncalls ? ncalls : 1) * 2 * sizeof(*r->entries))) ==
+      NULL)
+    return 1;
+  for (int i = 0; i < ncalls; i++) {
+    const FocasLogCall *c = &r->calls[i];
+    uint64_t loose = loose_key(c->function, c->handle);
+
+    for (int a = 0; a < c->nargs; a++) focaslog_arg(c, a, &args[a]);
+    r->entries[n++] = (struct entry){loose, (uint32_t)i};
+    r->entries[n++] = (struct entry){exact_key(loose, args, c->nargs), (uint32_t)i};
+  }
+  qsort(r->entries, n, sizeof(*r->entries), by_key);
+
+  for (int i = 0; i < n; i++)
+    r->ngroups += i == 0 || r->entries[i].key != r->entries[i - 1].key;
+  if ((r->groups = calloc(r->ngroups ? r->ngroups : 1, sizeof(*r->groups))) ==
+      NULL)
+    return 1;
+  for (int i = 0, g = -1; i < n; i++) {
+    if (i == 0 || r->entries[i].key != r->entries[i - 1].key) {
+      r->groups[++g].key = r->entries[i].key;
+      r->groups[g].first = i;
+    }
+    r->groups[g].count++;
+  }
+  return 0;
+}
+
+Replay *replay_open(const char *path, double speed) {
+  Replay *r;
+  int ncalls;
+
+  if ((r = calloc(1, sizeof(*r))) == NULL) return NULL;
+  r->speed = speed;
+  if ((r->log = focaslog_open(path)) == NULL) {
+    free(r);
+    return NULL;
+  }
+  r->calls = focaslog_calls(r->log, &ncalls);
+  if (index_calls(r, ncalls)) {
+    replay_close(r);
+    return NULL;
+  }
+  return r;
+}
+
+short replay_serve(Replay *r, const char *function, unsigned short handle,
+                   const FocasLogArg *args, int nargs) {
+  uint64_t loose = loose_key(function, handle);
+  const FocasLogCall *c;
+  struct group *g;
+  uint32_t n;
+
+  if ((g = find(r, exact_key(loose, args, nargs))) == NULL &&
+      (g = find(r, loose)) == NULL)
+    return EW_FUNC;
+  n = atomic_fetch_add_explicit(&g->next, 1, memory_order_relaxed) % g->count;
+  c = &r->calls[r->entries[g->first + n].call];
+
+  for (int i = 0; i < nargs && i < c->nargs; i++) {
+    FocasLogArg recorded;
+    if (args[i].kind != FOCASLOG_OUT || args[i].data == NULL ||
+        focaslog_arg(c, i, &recorded) || recorded.kind != FOCASLOG_OUT)
+      continue;
+    // the caller's pointers are not const, the descriptors only say so
+    memcpy((void *)args[i].data, recorded.data,
+           recorded.size < args[i].size ? recorded.size : args[i].size);
+  }
+
+  if (r->speed > 0 && c->duration_ns > 0) {
+    unsigned long long ns = c->duration_ns / r->speed;
+    struct timespec ts = {ns / 1000000000, ns % 1000000000};
+    nanosleep(&ts, NULL);
+  }
+  return c->rc;
+}
+
+void replay_close(Replay *r) {
+  if (r == NULL) return;
+  focaslog_close(r->log);
+  free(r->entries);
+  free(r->groups);
+  free(r);
+}
+
+static void open_global(void) {
+  const char *path = getenv("FOCASREPLAY");
+  const char *speed = getenv("FOCASREPLAY_SPEED");
+
+  if (path == NULL || *path == '\0') {
+    fprintf(stderr, "FOCASREPLAY names no recording!\n");
+    return;
+  }
+  if ((global = replay_open(path, speed ? atof(speed) : 1)) == NULL)
+    fprintf(stderr, "Failed to read recording %s!\n", path);
+}
+
+short replay_call(const char *function, unsigned short handle,
+                  const FocasLogArg *args, int nargs) {
+  pthread_once(&once, open_global);
+  return global ? replay_serve(global, function, handle, args, nargs)
+                : EW_FUNC;
+}
@@ -0,0 +1,33 @@
+#ifndef FW_FOCASREPLAY_H
+#define FW_FOCASREPLAY_H
+
+#include "./focaslog.h"
+
+/* a libfwlib32 that answers from a recording (focaslog.h) instead of a cnc,
+ * to run a program offline against a session recorded in production:
+ *
+ *   LD_PRELOAD=lib/libfocastrace.so FOCASTRACE_RECORD=session.fwlog prog
+ *   LD_LIBRARY_PATH=replay FOCASREPLAY=session.fwlog prog
+ *
+ * a call is answered by the next recorded call of the same function on the
+ * same handle with the same arguments by value, or, when there is none, by
+ * the next one of the function on the handle. each of those cycles through
+ * its calls in the order they were recorded, so a recording loops for as
+ * long as the program runs. the answer copies what the pointers held after
+ * the recorded call, up to what the caller passes room for, and returns the
+ * recorded code after the recorded time divided by FOCASREPLAY_SPEED (1 by
+ * default, 0 answers at once). calls that were never recorded return
+ * EW_FUNC. */
+
+typedef struct replay Replay;
+
+Replay *replay_open(const char *path, double speed);
+short replay_serve(Replay *r, const char *function, unsigned short handle,
+                   const FocasLogArg *args, int nargs);
+void replay_close(Replay *r);
+
+/* used by the generated calls of the library, from the log of FOCASREPLAY */
+short replay_call(const char *function, unsigned short handle,
+                  const FocasLogArg *args, int nargs);
+
+#endif
@@ -0,0 +1,232 @@
+#include "./focastrace.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEADER_BYTES 128
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;
+  uint32_t buckets;
+  uint32_t codes;
+  uint32_t pid;
+  uint32_t reserved;
+  double started;
+  _Atomic uint64_t dropped;
+  char process[80];
+};
+
+struct slot {
+  _Atomic uint32_t key;
+  _Atomic uint32_t ready;
+  char function[TRACE_NAME_LEN];
+  uint16_t handle;
+  uint16_t reserved[3];
+  _Atomic uint64_t calls;
+  _Atomic uint64_t errors;
+  _Atomic uint64_t total_ns;
+  _Atomic uint64_t max_ns;
+  _Atomic uint64_t bytes;
+  _Atomic uint64_t hist[TRACE_BUCKETS];
+  _Atomic uint64_t codes[TRACE_CODES];
+};
+
+struct trace_region {
+  unsigned char *mem;
+  size_t bytes;
+  struct header *header;
+  struct slot *slots;
+};
+
+_Static_assert(sizeof(struct header) <= HEADER_BYTES, "trace header");
+_Static_assert(sizeof(struct slot) ==
+                   64 + 8 * (5 + TRACE_BUCKETS + TRACE_CODES),
+               "trace slot");
+
+static size_t region_bytes(int slots) {
+  return HEADER_BYTES + slots * sizeof(struct slot);
+}
+
+TraceRegion *trace_create(const char *name, int slots, const char *process) {
+  TraceRegion *t;
+  struct timespec ts;
+  int fd;
+
+  if (slots < 1 || (t = calloc(1, sizeof(*t))) == NULL) return NULL;
+  t->bytes = region_bytes(slots);
+
+  shm_unlink(name);
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+    fprintf(stderr, "Failed to create shared memory %s!\n", name);
+    free(t);
+    return NULL;
+  }
+  if (ftruncate(fd, t->bytes) != 0 ||
+      (t->mem = mmap(NULL, t->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     0)) == MAP_FAILED) {
+    fprintf(stderr, "Failed to map shared memory %s!\n", name);
+    close(fd);
+    shm_unlink(name);
+    free(t);
+    return NULL;
+  }
+  close(fd);
+
+  // a fresh segment is zero filled, so readers see no magic yet
+  t->header = (struct header *)t->mem;
+  t->slots = (struct slot *)(t->mem + HEADER_BYTES);
+  t->header->version = TRACE_VERSION;
+  t->header->slots = slots;
+  t->header->buckets = TRACE_BUCKETS;
+  t->header->codes = TRACE_CODES;
+  t->header->pid = getpid();
+  clock_gettime(CLOCK_REALTIME, &ts);
+  t->header->started = ts.tv_sec + ts.tv_nsec / 1e9;
+  snprintf(t->header->process, sizeof(t->header->process), "%s",
+           process ? process : "");
+
+  atomic_thread_fence(memory_order_release);
+  memcpy(t->header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  return t;
+}
+
+TraceRegion *trace_open(const char *name) {
+  TraceRegion *t;
+  struct stat st;
+  const struct header *h;
+  int fd;
+
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0) return NULL;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < HEADER_BYTES ||
+      (t = calloc(1, sizeof(*t))) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  t->bytes = st.st_size;
+  t->mem = mmap(NULL, t->bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (t->mem == MAP_FAILED) {
+    free(t);
+    return NULL;
+  }
+
+  h = t->header = (struct header *)t->mem;
+  t->slots = (struct slot *)(t->mem + HEADER_BYTES);
+  if (memcmp(h->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) goto fail;
+  atomic_thread_fence(memory_order_acquire);
+  if (h->version != TRACE_VERSION || h->buckets != TRACE_BUCKETS ||
+      h->codes != TRACE_CODES || h->slots < 1 ||
+      region_bytes(h->slots) > t->bytes)
+    goto fail;
+  return t;
+
+fail:
+  trace_close(t);
+  return NULL;
+}
+
+void trace_close(TraceRegion *t) {
+  if (t == NULL) return;
+  munmap(t->mem, t->bytes);
+  free(t);
+}
+
+short trace_code(int index) { return hist_code(index); }
+
+/* the slot of a function on a handle, taken when it is new */
+static struct slot *find(TraceRegion *t, int function, const char *name,
+                         unsigned short handle) {
+  uint32_t key = (uint32_t)(function + 1) << 16 | handle;
+  uint32_t n = t->header->slots;
+  uint32_t i = (key * 2654435761u) % n;
+
+  for (uint32_t probe = 0; probe < n; probe++, i = (i + 1) % n) {
+    struct slot *s = &t->slots[i];
+    uint32_t seen = atomic_load_explicit(&s->key, memory_order_acquire);
+    if (seen == 0 &&
+        atomic_compare_exchange_strong(&s->key, &seen, key)) {
+      snprintf(s->function, sizeof(s->function), "%s", name);
+      s->handle = handle;
+      atomic_store_explicit(&s->ready, 1, memory_order_release);
+      return s;
+    }
+    if (seen == key) return s;
+  }
+  return NULL;
+}
+
+void trace_record(TraceRegion *t, int function, const char *name,
+                  unsigned short handle, short rc, unsigned long long ns,
+                  unsigned long long bytes) {
+  struct slot *s = find(t, function, name, handle);
+  uint64_t max;
+
+  if (s == NULL) {
+    atomic_fetch_add_explicit(&t->header->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+  if (rc != 0) atomic_fetch_add_explicit(&s->errors, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->total_ns, ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->bytes, bytes, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->hist[hist_bucket(ns)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->codes[hist_code_index(rc)], 1,
+                            memory_order_relaxed);
+  max = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+  while (ns > max && !atomic_compare_exchange_weak_explicit(
+                         &s->max_ns, &max, ns, memory_order_relaxed,
+                         memory_order_relaxed)) {
+  }
+}
+
+int trace_read(const TraceRegion *t, TraceStats *stats, int max) {
+  int n = 0;
+
+  for (uint32_t i = 0; i < t->header->slots && n < max; i++) {
+    struct slot *s = &t->slots[i];
+    TraceStats *out = &stats[n];
+    if (!atomic_load_explicit(&s->ready, memory_order_acquire)) continue;
+    memcpy(out->function, s->function, sizeof(out->function));
+    out->function[sizeof(out->function) - 1] = '\0';
+    out->handle = s->handle;
+    out->slot = i;
+    // counters move while copied, each one is consistent on its own
+    out->calls = atomic_load_explicit(&s->calls, memory_order_relaxed);
+    out->errors = atomic_load_explicit(&s->errors, memory_order_relaxed);
+    out->total_ns = atomic_load_explicit(&s->total_ns, memory_order_relaxed);
+    out->max_ns = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+    out->bytes = atomic_load_explicit(&s->bytes, memory_order_relaxed);
+    for (int b = 0; b < TRACE_BUCKETS; b++)
+      out->hist[b] = atomic_load_explicit(&s->hist[b], memory_order_relaxed);
+    for (int c = 0; c < TRACE_CODES; c++)
+      out->codes[c] = atomic_load_explicit(&s->codes[c], memory_order_relaxed);
+    n++;
+  }
+  return n;
+}
+
+int trace_slots(const TraceRegion *t) { return t->header->slots; }
+
+int trace_pid(const TraceRegion *t) { return t->header->pid; }
+
+const char *trace_process(const TraceRegion *t) { return t->header->process; }
+
+double trace_started(const TraceRegion *t) { return t->header->started; }
+
+unsigned long long trace_dropped(const TraceRegion *t) {
+  return atomic_load_explicit(&t->header->dropped, memory_order_relaxed);
+}
+
+double trace_quantile(const TraceStats *s, double q) {
+  return hist_quantile(s->hist, s->max_ns, q) / 1e3;
+}
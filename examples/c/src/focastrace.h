@@ -0,0 +1,115 @@
+#ifndef FW_FOCASTRACE_H
+#define FW_FOCASTRACE_H
+
+#include <time.h>
+
+#include "./fault.h"
+#include "./focaslog.h"
+#include "./histogram.h"
+
+/* FOCAS call tracing without a rebuild: `libfocastrace.so` exports every
+ * call of fwlib32.h (wrappers generated by focastrace_gen.py), times the
+ * real call of libfwlib32 behind it and counts it into a POSIX shared
+ * memory segment, per function and handle. `focas-trace` shows the slowest
+ * calls of a running process:
+ *   LD_PRELOAD=libfocastrace.so focas-broker ...
+ *   focas-trace --pid=<pid of focas-broker>
+ *
+ * the segment is "/focastrace-<pid>" or FOCASTRACE_NAME, created on the
+ * first call and left behind at exit so a finished process can still be
+ * read. calls made by libfwlib32 itself are part of the outer call.
+ *
+ * FOCASTRACE_FAULTS=<plan> injects the faults of a fault.h plan into the
+ * calls, in front of the real library or the simulated one, seeded with
+ * FOCASTRACE_SEED. the injected codes and waits are traced as any other.
+ *
+ * layout, little endian, offsets in bytes from the start of the segment:
+ *   0   header (128)
+ *         char magic[8]  "FWTRACE", set last once the segment is ready
+ *         u32 version    TRACE_VERSION
+ *         u32 slots, u32 buckets, u32 codes
+ *         u32 pid        of the traced process
+ *         u32 reserved
+ *         f64 started    unix time of the first call
+ *         u64 dropped    calls not counted, every slot was taken
+ *         char process[80]
+ *   128 slots of 64 + 8 * (5 + buckets + codes) bytes, one per function
+ *       and handle: {u32 key, u32 ready, char function[TRACE_NAME_LEN],
+ *       u16 handle, u16 reserved[3], u64 calls, errors, total_ns, max_ns,
+ *       bytes, hist[buckets], codes[codes]}
+ * a slot is taken by a compare and swap of its key, (function + 1) << 16 |
+ * handle, and counted in once ready is 1. the latency histogram and the
+ * return codes are counted as in histogram.h, the same as callstats.h. */
+
+#define TRACE_MAGIC "FWTRACE"
+#define TRACE_VERSION 2
+#define TRACE_SLOTS 4096
+#define TRACE_BUCKETS HIST_BUCKETS
+#define TRACE_CODES HIST_CODES
+#define TRACE_MIN_CODE HIST_MIN_CODE
+#define TRACE_NAME_LEN 48
+
+typedef struct trace_region TraceRegion;
+
+/* one function on one handle, copied out of the segment */
+typedef struct trace_stats {
+  char function[TRACE_NAME_LEN];
+  unsigned short handle;
+  int slot;  // stays the same for the life of the segment
+  unsigned long long calls;
+  unsigned long long errors;  // calls that did not return EW_OK
+  unsigned long long total_ns;
+  unsigned long long max_ns;
+  unsigned long long bytes;  // payload, see focastrace_gen.py
+  unsigned long long hist[TRACE_BUCKETS];
+  unsigned long long codes[TRACE_CODES];
+} TraceStats;
+
+/* `name` as for shm_open, a stale segment of the same name is replaced */
+TraceRegion *trace_create(const char *name, int slots, const char *process);
+/* NULL when the segment does not exist, is not ready or has another
+ * version */
+TraceRegion *trace_open(const char *name);
+/* unmaps, the segment stays until shm_unlink */
+void trace_close(TraceRegion *t);
+
+void trace_record(TraceRegion *t, int function, const char *name,
+                  unsigned short handle, short rc, unsigned long long ns,
+                  unsigned long long bytes);
+
+/* copies up to `max` slots in use, returns how many */
+int trace_read(const TraceRegion *t, TraceStats *stats, int max);
+int trace_slots(const TraceRegion *t);
+int trace_pid(const TraceRegion *t);
+const char *trace_process(const TraceRegion *t);
+double trace_started(const TraceRegion *t);
+unsigned long long trace_dropped(const TraceRegion *t);
+
+/* the latency below which a share q of the calls finished, in microseconds,
+ * from the histogram */
+double trace_quantile(const TraceStats *s, double q);
+/* return code of a codes[] index, TRACE_CODES - 1 is any other */
+short trace_code(int index);
+
+/* used by the generated wrappers of libfocastrace */
+typedef struct trace_call {
+  struct timespec start;
+  unsigned long long ns;  // set by trace_leave
+  int outer;  // not called from within libfwlib32
+} TraceCall;
+
+void *trace_resolve(const char *name);
+void trace_enter(TraceCall *call);
+void trace_leave(TraceCall *call, int function, const char *name,
+                 unsigned short handle, short rc, unsigned long long bytes);
+/* EW_OK to make an outer call, else the code of an injected fault to
+ * return in its place. waits for slow and timeout faults. */
+short trace_fault(const TraceCall *call, const char *name);
+/* recording into the focaslog.h log named by FOCASTRACE_RECORD: a wrapper
+ * passes every argument of an outer call once trace_leave returned */
+int trace_recording(const TraceCall *call);
+void trace_capture(const TraceCall *call, int function, const char *name,
+                   unsigned short handle, short rc, const FocasLogArg *args,
+                   int nargs);
+
+#endif
@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+"""Generates the wrappers of libfocastrace (focastrace.h) from fwlib32.h.
+
+    focastrace_gen.py [--replay] <fwlib32.h> <fwlib32.h preprocessed> <output.c>
+
+The exported calls are the FWLIBAPI declarations of the header, their
+parameter types are taken from the preprocessed header (cc -E -P), so the
+#if branches of the platform pick one declaration of each call. Every
+wrapper times the real call, found with dlsym(RTLD_NEXT), or the fault
+injected in its place (trace_fault), and records it:
+
+  handle   the first parameter when it is an unsigned short, or the handle
+           returned by cnc_allclibhndl*
+  payload  the length parameter of the calls in LENGTHS, the transferred
+           length of uploads and downloads, else the size of the structs
+           passed by pointer
+
+and, while FOCASTRACE_RECORD is set, passes every argument to the
+focaslog.h recording:
+
+  by value, strings        FOCASLOG_VALUE
+  const pointers, buffers  FOCASLOG_IN
+  of writes and downloads
+  other pointers           FOCASLOG_OUT, what they point to after the call:
+                           the length parameter of LENGTHS, the entries of
+                           COUNTS, the transferred length of uploads, else
+                           the pointed to type. char and void pointers of
+                           unknown length are recorded empty.
+
+--replay generates the calls of libfwlib32 of focasreplay.h instead, which
+pass the same arguments, before the call, to replay_call.
+"""
+
+import re
+import sys
+
+# calls with a byte count parameter, by position
+LENGTHS = {
+    "pmc_rdpmcrng": 5,
+    "pmc_wrpmcrng": 1,
+    "cnc_rdparam": 3,
+    "cnc_wrparam": 1,
+    "cnc_rdmacro": 2,
+    "cnc_rddynamic2": 2,
+}
+
+# calls that fill an array with as many entries as a count parameter says,
+# (array, count) by position
+COUNTS = {
+    "cnc_rdalmmsg": (3, 2),
+    "cnc_rdalmmsg2": (3, 2),
+    "cnc_rdaxisname": (2, 1),
+    "cnc_rdexecprog": (3, 1),
+    "cnc_rdmacror2": (3, 2),
+    "cnc_rdposition": (3, 2),
+    "cnc_rdprogdir3": (4, 3),
+    "cnc_rdprogline": (3, 5),
+    "cnc_rdspmeter": (3, 2),
+    "cnc_rdsvmeter": (2, 1),
+}
+
+TYPE_WORDS = {"short", "long", "int", "char", "unsigned", "signed", "float",
+              "double", "void", "const", "volatile", "struct", "union", "enum"}
+
+DECLARATION = re.compile(
+    r"\b(short)\s+(\w+)\s*\(((?:[^()]|\([^()]*\))*)\)\s*;")
+
+
+def exported(header):
+    with open(header, encoding="latin-1") as f:
+        text = f.read()
+    return set(re.findall(r"FWLIBAPI\s+\w+\s+WINAPI\s+(\w+)\s*\(", text))
+
+
+def split_params(params):
+    out, depth, cur = [], 0, ""
+    for ch in params:
+        if ch == "," and depth == 0:
+            out.append(cur.strip())
+            cur = ""
+            continue
+        depth += ch == "("
+        depth -= ch == ")"
+        cur += ch
+    if cur.strip():
+        out.append(cur.strip())
+    return [] if out == ["void"] else out
+
+
+def strip_name(base):
+    """"unsigned short h" -> "unsigned short", "ODBST *buf" -> "ODBST *" """
+    tokens = re.findall(r"\w+|\*", base)
+    if (len(tokens) > 1 and re.match(r"\w", tokens[-1])
+            and tokens[-1] not in TYPE_WORDS
+            and tokens[-2] not in ("struct", "union", "enum")
+            and (tokens[-2] == "*" or tokens[-2] in TYPE_WORDS
+                 or re.match(r"[A-Z_]", tokens[-2]))):
+        tokens = tokens[:-1]
+    return " ".join(tokens)
+
+
+def parameter(param, i):
+    """(declaration with the name a<i>, base type, pointers, is an array)"""
+    name = f"a{i}"
+    if "(" in param:
+        # char (*)[MAX_AXISNAME]
+        decl = re.sub(r"\(\s*\*\s*\w*\s*\)", f"(*{name})", param)
+        return decl, None, 2, False
+    array = ""
+    if "[" in param:
+        param, array = param[:param.index("[")], param[param.index("["):]
+        array = re.sub(r"\s+", "", array)
+    base = strip_name(param)
+    pointers = base.count("*") + (1 if array else 0)
+    return f"{base} {name}{array}", base.replace("*", "").strip(), pointers, bool(array)
+
+
+def descriptors(name, params):
+    """the FocasLogArg initializer of every parameter"""
+    parsed = [parameter(p, i) for i, p in enumerate(params)]
+    pointers = [i for i, p in enumerate(parsed) if p[2] > 0]
+    writes = re.search(r"_wr|download", name) is not None
+    length = next((i for i, p in enumerate(parsed) if p[1] == "long" and
+                   p[2] == 1 and re.search(r"(up|down)load", name)), None)
+    out = []
+    for i, (_, base, n, array) in enumerate(parsed):
+        a = f"a{i}"
+        words = (base or "").split()
+        if n == 0:
+            out.append(f"{{FOCASLOG_VALUE, sizeof({a}), &{a}}}")
+            continue
+        if n == 1 and not array and "char" in words and "const" in words:
+            out.append(f"{{FOCASLOG_VALUE, {a} ? strlen({a}) + 1 : 0, {a}}}")
+            continue
+        kind = "FOCASLOG_IN" if writes or "const" in words else "FOCASLOG_OUT"
+        if name in LENGTHS and i == pointers[-1]:
+            c = f"a{LENGTHS[name]}"
+            size = f"({c} > 0 ? (unsigned long){c} : 0)"
+        elif name in COUNTS and COUNTS[name][0] == i:
+            c = f"a{COUNTS[name][1]}"
+            size = f"({c} && *{c} > 0 ? sizeof(*{a}) * *{c} : 0)"
+        elif length is not None and i != length and words[-1:] in (["char"], ["void"]):
+            c = f"a{length}"
+            size = f"({c} && *{c} > 0 ? (unsigned long)*{c} : 0)"
+        elif base is None:
+            size = f"sizeof(*{a})"
+        elif words[-1] in ("char", "void") or n > 1:
+            size = "0"
+        elif array:
+            dim = re.search(r"\[(\w+)\]", params[i])
+            size = f"sizeof(*{a}) * ({dim.group(1)})" if dim else f"sizeof(*{a})"
+        else:
+            size = f"sizeof(*{a})"
+        out.append(f"{{{kind}, {size}, {a}}}")
+    return out
+
+
+def key_handle(params):
+    """the first parameter when it is a handle"""
+    if params:
+        _, base, pointers, _ = parameter(params[0], 0)
+        if base == "unsigned short" and pointers == 0:
+            return "a0"
+    return "0"
+
+
+def wrapper(index, name, params):
+    decls, args, sizes = [], [], []
+    handle, opened, length = "0", None, None
+    for i, p in enumerate(params):
+        decl, base, pointers, _ = parameter(p, i)
+        decls.append(decl)
+        args.append(f"a{i}")
+        if i == 0 and base == "unsigned short" and pointers == 0:
+            handle = "a0"
+        if base == "unsigned short" and pointers == 1 and \
+                name.startswith("cnc_allclibhndl"):
+            opened = f"a{i}"
+        if base == "long" and pointers == 1 and length is None and \
+                re.search(r"(up|down)load", name):
+            length = f"a{i}"
+        # the structs of fwlib32.h are upper case typedefs
+        if pointers == 1 and base and re.fullmatch(r"[A-Z][A-Z0-9_]*", base):
+            sizes.append(f"sizeof(*a{i})")
+    if name in LENGTHS and LENGTHS[name] < len(params):
+        payload = f"(unsigned long)(a{LENGTHS[name]} > 0 ? a{LENGTHS[name]} : 0)"
+    elif length:
+        payload = f"({length} && rc == EW_OK && *{length} > 0 ? (unsigned long)*{length} : 0)"
+    else:
+        payload = " + ".join(sizes) if sizes else "0"
+    if opened:
+        handle = f"({opened} && rc == EW_OK ? *{opened} : 0)"
+    return f"""
+FWLIBAPI short WINAPI {name}({", ".join(decls) or "void"}) {{
+  static __typeof__({name}) *real;
+  TraceCall call;
+  short rc;
+
+  if (real == NULL &&
+      (real = (__typeof__({name}) *)trace_resolve("{name}")) == NULL)
+    return EW_FUNC;
+  trace_enter(&call);
+  if ((rc = trace_fault(&call, "{name}")) == EW_OK) rc = real({", ".join(args)});
+  trace_leave(&call, {index}, "{name}", {handle}, rc, {payload});
+  {capture(index, name, params)}
+  return rc;
+}}
+"""
+
+
+def capture(index, name, params):
+    key = key_handle(params)
+    if not params:
+        return f"""if (trace_recording(&call))
+    trace_capture(&call, {index}, "{name}", 0, rc, NULL, 0);"""
+    args = ",\n        ".join(descriptors(name, params))
+    return f"""if (trace_recording(&call)) {{
+    const FocasLogArg args[] = {{
+        {args}}};
+    trace_capture(&call, {index}, "{name}", {key}, rc, args, {len(params)});
+  }}"""
+
+
+def replayed(name, params):
+    decls = [parameter(p, i)[0] for i, p in enumerate(params)]
+    key = key_handle(params)
+    if not params:
+        body = f'return replay_call("{name}", 0, NULL, 0);'
+    else:
+        args = ",\n      ".join(descriptors(name, params))
+        body = f"""const FocasLogArg args[] = {{
+      {args}}};
+
+  return replay_call("{name}", {key}, args, {len(params)});"""
+    return f"""
+FWLIBAPI short WINAPI {name}({", ".join(decls) or "void"}) {{
+  {body}
+}}
+"""
+
+
+def main():
+    replay = sys.argv[1:2] == ["--replay"]
+    header, preprocessed, output = sys.argv[1 + replay:4 + replay]
+    names = exported(header)
+    with open(preprocessed, encoding="latin-1") as f:
+        text = re.sub(r"\s+", " ", f.read())
+
+    calls = {}
+    for m in DECLARATION.finditer(text):
+        if m.group(2) in names and m.group(2) not in calls:
+            calls[m.group(2)] = split_params(m.group(3))
+    missing = names - set(calls)
+    # declared only in branches of other platforms
+    if len(calls) < len(names) // 2:
+        sys.exit(f"only {len(calls)} of {len(names)} calls found")
+
+    with open(output, "w") as f:
+        f.write(f"/* generated by focastrace_gen.py from {header.split('/')[-1]}, "
+                f"{len(calls)} calls, {len(missing)} only on other platforms */\n\n")
+        f.write('#include <string.h>\n\n')
+        f.write('#include "focasreplay.h"\n' if replay else '#include "focastrace.h"\n')
+        f.write('\n#include "fwlib32.h"\n')
+        for index, name in enumerate(sorted(calls)):
+            if replay:
+                f.write(replayed(name, calls[name]))
+            else:
+                f.write(wrapper(index, name, calls[name]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,268 @@
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./clock.h"
+#include "./focastrace.h"
+
+static struct option options[] = {{"pid", required_argument, NULL, 'p'},
+                                  {"name", required_argument, NULL, 'n'},
+                                  {"top", required_argument, NULL, 't'},
+                                  {"interval", required_argument, NULL, 'i'},
+                                  {"sort", required_argument, NULL, 's'},
+                                  {"functions", no_argument, NULL, 'f'},
+                                  {"once", no_argument, NULL, 'o'},
+                                  {"unlink", no_argument, NULL, 'u'},
+                                  {NULL, 0, NULL, 0}};
+
+enum sort { SORT_P99, SORT_MAX, SORT_MEAN, SORT_TOTAL, SORT_CALLS, SORT_ERRORS };
+
+static const char *sort_names[] = {"p99",   "max",   "mean",
+                                   "total", "calls", "errors"};
+
+/* a row of the table, a function on a handle or on all of them */
+struct row {
+  TraceStats s;
+  double rate;  // calls per second since the last refresh
+  double key;
+};
+
+static volatile sig_atomic_t running = 1;
+static enum sort sort = SORT_P99;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s --pid=<traced pid> | --name=<shm name> [--top=<n>] "
+          "[--interval=<ms>] [--sort=p99|max|mean|total|calls|errors] "
+          "[--functions] [--once] [--unlink]\n"
+          "trace a process with LD_PRELOAD=libfocastrace.so <program>\n",
+          name);
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  running = 0;
+}
+
+static double sort_key(const struct row *r) {
+  switch (sort) {
+    case SORT_P99:
+      return trace_quantile(&r->s, 0.99);
+    case SORT_MAX:
+      return r->s.max_ns;
+    case SORT_MEAN:
+      return r->s.calls ? (double)r->s.total_ns / r->s.calls : 0;
+    case SORT_TOTAL:
+      return r->s.total_ns;
+    case SORT_CALLS:
+      return r->s.calls;
+    case SORT_ERRORS:
+      return r->s.errors;
+  }
+  return 0;
+}
+
+static int by_key(const void *a, const void *b) {
+  const struct row *x = a;
+  const struct row *y = b;
+  return x->key < y->key ? 1 : x->key > y->key ? -1 : 0;
+}
+
+static void add(TraceStats *to, const TraceStats *s) {
+  to->calls += s->calls;
+  to->errors += s->errors;
+  to->total_ns += s->total_ns;
+  to->bytes += s->bytes;
+  if (s->max_ns > to->max_ns) to->max_ns = s->max_ns;
+  for (int b = 0; b < TRACE_BUCKETS; b++) to->hist[b] += s->hist[b];
+  for (int c = 0; c < TRACE_CODES; c++) to->codes[c] += s->codes[c];
+}
+
+/* one row per function, summed over its handles */
+static int by_function(struct row *rows, int n) {
+  int out = 0;
+
+  for (int i = 0; i < n; i++) {
+    int j = 0;
+    while (j < out && strcmp(rows[j].s.function, rows[i].s.function) != 0) j++;
+    if (j == out) {
+      rows[out] = rows[i];
+      rows[out++].s.handle = 0;
+    } else {
+      add(&rows[j].s, &rows[i].s);
+      rows[j].rate += rows[i].rate;
+    }
+  }
+  return out;
+}
+
+/* "-16x12", the most frequent error */
+static void top_error(const TraceStats *s, char *buf, size_t size) {
+  int best = -1;
+
+  for (int c = 0; c < TRACE_CODES; c++) {
+    if (trace_code(c) == 0 || s->codes[c] == 0) continue;
+    if (best < 0 || s->codes[c] > s->codes[best]) best = c;
+  }
+  if (best < 0)
+    snprintf(buf, size, "-");
+  else if (best == TRACE_CODES - 1)
+    snprintf(buf, size, "otherx%llu", s->codes[best]);
+  else
+    snprintf(buf, size, "%dx%llu", trace_code(best), s->codes[best]);
+}
+
+static void show(const TraceRegion *t, struct row *rows, int n, int top,
+                 int functions) {
+  unsigned long long calls = 0;
+  time_t started = (time_t)trace_started(t);
+  char since[32];
+
+  for (int i = 0; i < n; i++) calls += rows[i].s.calls;
+  if (functions) n = by_function(rows, n);
+  for (int i = 0; i < n; i++) rows[i].key = sort_key(&rows[i]);
+  qsort(rows, n, sizeof(*rows), by_key);
+
+  strftime(since, sizeof(since), "%Y-%m-%d %H:%M:%S", localtime(&started));
+  printf("%s, pid %d, since %s: %llu calls, %llu dropped, sorted by %s\n",
+         trace_process(t), trace_pid(t), since, calls, trace_dropped(t),
+         sort_names[sort]);
+  printf("%-32s %6s %10s %9s %8s %10s %10s %10s %10s %10s %10s\n", "function",
+         "handle", "calls", "calls/s", "errors", "mean us", "p50 us",
+         "p99 us", "max us", "bytes/call", "top error");
+  for (int i = 0; i < n && i < top; i++) {
+    const TraceStats *s = &rows[i].s;
+    char handle[8];
+    char err[24];
+
+    if (functions)
+      snprintf(handle, sizeof(handle), "*");
+    else
+      snprintf(handle, sizeof(handle), "%u", s->handle);
+    top_error(s, err, sizeof(err));
+    printf("%-32s %6s %10llu %9.1f %8llu %10.1f %10.0f %10.0f %10.1f %10.0f "
+           "%10s\n",
+           s->function, handle, s->calls, rows[i].rate, s->errors,
+           s->calls ? s->total_ns / 1e3 / s->calls : 0,
+           trace_quantile(s, 0.5), trace_quantile(s, 0.99), s->max_ns / 1e3,
+           s->calls ? (double)s->bytes / s->calls : 0, err);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  char name[256] = "";
+  int top = 20;
+  long interval_ms = 1000;
+  int functions = 0;
+  int once = 0;
+  int remove = 0;
+  int c;
+  int i = 0;
+  TraceRegion *t;
+  TraceStats *stats;
+  struct row *rows;
+  unsigned long long *last;
+  double then;
+  struct timespec wall;
+  int shown = 0;
+
+  while ((c = getopt_long(argc, argv, "", options, &i)) != -1) {
+    switch (c) {
+      case 'p':
+        snprintf(name, sizeof(name), "/focastrace-%d", atoi(optarg));
+        break;
+      case 'n':
+        snprintf(name, sizeof(name), "%s", optarg);
+        break;
+      case 't':
+        if ((top = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid top: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'i':
+        if ((interval_ms = atol(optarg)) < 1) {
+          fprintf(stderr, "invalid interval: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        for (c = 0; c <= SORT_ERRORS; c++) {
+          if (strcmp(optarg, sort_names[c]) == 0) break;
+        }
+        if (c > SORT_ERRORS) {
+          fprintf(stderr, "invalid sort: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        sort = c;
+        break;
+      case 'f':
+        functions = 1;
+        break;
+      case 'o':
+        once = 1;
+        break;
+      case 'u':
+        remove = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (name[0] == '\0') {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if ((t = trace_open(name)) == NULL) {
+    fprintf(stderr, "Failed to open trace %s!\n", name);
+    return EXIT_FAILURE;
+  }
+  stats = calloc(trace_slots(t), sizeof(*stats));
+  rows = calloc(trace_slots(t), sizeof(*rows));
+  last = calloc(trace_slots(t), sizeof(*last));
+  if (stats == NULL || rows == NULL || last == NULL) {
+    fprintf(stderr, "Failed to allocate %d slots!\n", trace_slots(t));
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  // the first rates are since the first traced call
+  clock_gettime(CLOCK_REALTIME, &wall);
+  then = now() - (wall.tv_sec + wall.tv_nsec / 1e9 - trace_started(t));
+  do {
+    struct timespec ts = {interval_ms / 1000, interval_ms % 1000 * 1000000};
+    double elapsed;
+    int n;
+
+    if (!once && shown) nanosleep(&ts, NULL);
+    shown = 1;
+    elapsed = now() - then;
+    then = now();
+    n = trace_read(t, stats, trace_slots(t));
+    for (int k = 0; k < n; k++) {
+      rows[k].s = stats[k];
+      rows[k].rate =
+          elapsed > 0 ? (stats[k].calls - last[stats[k].slot]) / elapsed : 0;
+      last[stats[k].slot] = stats[k].calls;
+    }
+    if (!once && isatty(STDOUT_FILENO)) printf("\033[H\033[J");
+    show(t, rows, n, top, functions);
+    if (!once) printf("\n");
+    fflush(stdout);
+  } while (running && !once);
+
+  trace_close(t);
+  if (remove) shm_unlink(name);
+  free(stats);
+  free(rows);
+  free(last);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+// RTLD_NEXT and program_invocation_name
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "./focastrace.h"
+#include "fwlib32.h"
+
+static TraceRegion *_Atomic region;
+static _Atomic int failed;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+// calls of libfwlib32 from within a traced call are not counted
+static __thread int depth;
+// FOCASTRACE_RECORD
+static FocasLog *record;
+static struct timespec record_start;
+static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+// FOCASTRACE_FAULTS
+static FaultPlan *faults;
+static pthread_once_t faults_once = PTHREAD_ONCE_INIT;
+
+/* a forked child counts into a segment of its own and records nothing */
+static void after_fork(void) {
+  region = NULL;
+  failed = 0;
+  record = NULL;
+  pthread_mutex_init(&lock, NULL);
+}
+
+static void install(void) { pthread_atfork(NULL, NULL, after_fork); }
+
+static TraceRegion *get_region(void) {
+  TraceRegion *t = atomic_load_explicit(&region, memory_order_acquire);
+  const char *name;
+  char buf[64];
+
+  if (t || failed) return t;
+  pthread_once(&once, install);
+  pthread_mutex_lock(&lock);
+  if ((t = region) == NULL && !failed) {
+    if ((name = getenv("FOCASTRACE_NAME")) == NULL) {
+      snprintf(buf, sizeof(buf), "/focastrace-%d", (int)getpid());
+      name = buf;
+    }
+    t = trace_create(name, TRACE_SLOTS, program_invocation_name);
+    atomic_store_explicit(&region, t, memory_order_release);
+    failed = t == NULL;
+  }
+  pthread_mutex_unlock(&lock);
+  return t;
+}
+
+static void flush_record(void) {
+  if (record) focaslog_flush(record);
+}
+
+static void open_record(void) {
+  const char *path = getenv("FOCASTRACE_RECORD");
+
+  if (path == NULL || *path == '\0') return;
+  pthread_once(&once, install);
+  clock_gettime(CLOCK_MONOTONIC, &record_start);
+  if ((record = focaslog_create(path)) != NULL) atexit(flush_record);
+}
+
+void *trace_resolve(const char *name) { return dlsym(RTLD_NEXT, name); }
+
+void trace_enter(TraceCall *call) {
+  call->outer = depth++ == 0;
+  if (call->outer) clock_gettime(CLOCK_MONOTONIC, &call->start);
+}
+
+void trace_leave(TraceCall *call, int function, const char *name,
+                 unsigned short handle, short rc, unsigned long long bytes) {
+  struct timespec end;
+  TraceRegion *t;
+  long long ns;
+  int saved = errno;
+
+  depth--;
+  if (!call->outer) return;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ns = (end.tv_sec - call->start.tv_sec) * 1000000000LL +
+       (end.tv_nsec - call->start.tv_nsec);
+  call->ns = ns > 0 ? ns : 0;
+  if ((t = get_region()) != NULL)
+    trace_record(t, function, name, handle, rc, ns > 0 ? ns : 0, bytes);
+  errno = saved;
+}
+
+static void load_faults(void) {
+  const char *spec = getenv("FOCASTRACE_FAULTS");
+  const char *seed = getenv("FOCASTRACE_SEED");
+
+  if (spec == NULL || *spec == '\0') return;
+  if ((faults = fault_parse(spec, seed ? strtoul(seed, NULL, 10) : 1)) == NULL)
+    fprintf(stderr, "invalid FOCASTRACE_FAULTS: \"%s\"\n", spec);
+}
+
+short trace_fault(const TraceCall *call, const char *name) {
+  int saved = errno;
+  short rc;
+
+  if (!call->outer) return EW_OK;
+  pthread_once(&faults_once, load_faults);
+  if (faults == NULL) return EW_OK;
+  rc = fault_apply(faults, name);
+  errno = saved;
+  return rc;
+}
+
+int trace_recording(const TraceCall *call) {
+  if (!call->outer) return 0;
+  pthread_once(&record_once, open_record);
+  return record != NULL;
+}
+
+void trace_capture(const TraceCall *call, int function, const char *name,
+                   unsigned short handle, short rc, const FocasLogArg *args,
+                   int nargs) {
+  FocasLogCall c = {name, handle, rc, (unsigned)syscall(SYS_gettid), 0,
+                    call->ns, nargs, NULL};
+  long long start = (call->start.tv_sec - record_start.tv_sec) * 1000000000LL +
+                    (call->start.tv_nsec - record_start.tv_nsec);
+  int saved = errno;
+
+  // the first call started before the log was opened
+  c.start_ns = start > 0 ? start : 0;
+  focaslog_write(record, function, &c, args);
+  errno = saved;
+}
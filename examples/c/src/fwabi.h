@@ -0,0 +1,160 @@
+#ifndef FW_FWABI_H
+#define FW_FWABI_H
+
+#include <stdint.h>
+
+/* the structs of fwlib32.h that have `long` fields, as libfwlib32 fills
+ * them. `long` is a 32 bit word in every libfwlib32, libfwlib32-linux-x64
+ * included, while a 64 bit build of fwlib32.h lays these structs out with
+ * 8 byte longs and reads them at the wrong offsets. callers pass these
+ * mirrors, cast to the fwlib32.h type, and read them the same way on 32
+ * and 64 bit hosts. `long *` arguments hold 32 bit words as well, a `long`
+ * that is passed in or out of the library must stay within 32 bits. */
+
+// MAX_AXIS of fwlib32.h
+#define FW32_MAX_AXIS 32
+
+/* ODBDY2 of cnc_rddynamic2 */
+typedef struct fw32_dy2 {
+  int16_t dummy;
+  int16_t axis;
+  int32_t alarm;
+  int32_t prgnum;
+  int32_t prgmnum;
+  int32_t seqnum;
+  int32_t actf;
+  int32_t acts;
+  union {
+    struct {
+      int32_t absolute[FW32_MAX_AXIS];
+      int32_t machine[FW32_MAX_AXIS];
+      int32_t relative[FW32_MAX_AXIS];
+      int32_t distance[FW32_MAX_AXIS];
+    } faxis;
+    struct {
+      int32_t absolute;
+      int32_t machine;
+      int32_t relative;
+      int32_t distance;
+    } oaxis;  // a single axis
+  } pos;
+} Fw32Dy2;
+
+/* ODBAXIS of cnc_absolute, cnc_machine, cnc_relative, ... */
+typedef struct fw32_axis {
+  int16_t dummy;
+  int16_t type;
+  int32_t data[FW32_MAX_AXIS];
+} Fw32Axis;
+
+/* POSELM and SPEEDELM */
+typedef struct fw32_elem {
+  int32_t data;
+  int16_t dec;
+  int16_t unit;
+  int16_t disp;
+  char name;
+  char suff;
+} Fw32Elem;
+
+/* ODBPOS of cnc_rdposition, one per axis */
+typedef struct fw32_pos {
+  Fw32Elem abs;
+  Fw32Elem mach;
+  Fw32Elem rel;
+  Fw32Elem dist;
+} Fw32Pos;
+
+/* ODBSPEED of cnc_rdspeed */
+typedef struct fw32_speed {
+  Fw32Elem actf;
+  Fw32Elem acts;
+} Fw32Speed;
+
+/* LOADELM and ODBSPLOAD of cnc_rdspmeter, one per spindle */
+typedef struct fw32_loadelm {
+  int32_t data;
+  int16_t dec;
+  int16_t unit;
+  char name;
+  char suff1;
+  char suff2;
+  char reserve;
+} Fw32Loadelm;
+
+typedef struct fw32_spload {
+  Fw32Loadelm spload;
+  Fw32Loadelm spspeed;
+} Fw32Spload;
+
+/* ODBACT of cnc_actf and cnc_acts, ODBSEQ of cnc_rdseqnum */
+typedef struct fw32_act {
+  int16_t dummy[2];
+  int32_t data;
+} Fw32Act;
+
+/* ODBEXEPRG of cnc_exeprgname */
+typedef struct fw32_exeprg {
+  char name[36];
+  int32_t o_num;
+} Fw32Exeprg;
+
+/* ODBM of cnc_rdmacro */
+typedef struct fw32_macro {
+  int16_t datano;
+  int16_t dummy;
+  int32_t mcr_val;
+  int16_t dec_val;
+} Fw32Macro;
+
+/* REALPRM and IODBPSD of cnc_rdparam / cnc_wrparam, a value per axis */
+typedef struct fw32_realprm {
+  int32_t prm_val;
+  int32_t dec_val;
+} Fw32Realprm;
+
+typedef struct fw32_param {
+  int16_t datano;
+  int16_t type;
+  union {
+    char cdata;
+    int16_t idata;
+    int32_t ldata;
+    Fw32Realprm rdata;
+    char cdatas[FW32_MAX_AXIS];
+    int16_t idatas[FW32_MAX_AXIS];
+    int32_t ldatas[FW32_MAX_AXIS];
+    Fw32Realprm rdatas[FW32_MAX_AXIS];
+  } u;
+} Fw32Param;
+
+/* ODBALMMSG2 of cnc_rdalmmsg2 */
+typedef struct fw32_almmsg2 {
+  int32_t alm_no;
+  int16_t type;
+  int16_t axis;
+  int16_t dummy;
+  int16_t msg_len;
+  char alm_msg[64];
+} Fw32Almmsg2;
+
+/* PRGDIR3 of cnc_rdprogdir3 */
+typedef struct fw32_date {
+  int16_t year;
+  int16_t month;
+  int16_t day;
+  int16_t hour;
+  int16_t minute;
+  int16_t dummy;
+} Fw32Date;
+
+typedef struct fw32_prgdir3 {
+  int32_t number;
+  int32_t length;
+  int32_t page;
+  char comment[52];
+  Fw32Date mdate;
+  Fw32Date cdate;
+} Fw32Prgdir3;
+
+#endif
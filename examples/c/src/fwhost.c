@@ -0,0 +1,327 @@
+#include "./fwhost.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./fwabi.h"
+#include "fwlib32.h"
+
+// the same layout for 32 and 64 bit processes
+_Static_assert(sizeof(FwhostHeader) == 64, "header layout");
+_Static_assert(sizeof(FwhostSlot) == 32 + FWHOST_SLOT_DATA, "slot layout");
+_Static_assert(sizeof(FwDynamic) == 28 + 16 * FWHOST_MAX_AXIS, "dyn layout");
+_Static_assert(sizeof(FwElem) == 12, "elem layout");
+_Static_assert(sizeof(FwPmc) == FWHOST_SLOT_DATA, "pmc layout");
+
+struct worker {
+  FwHost *host;
+  pthread_t thread;
+};
+
+struct fwhost {
+  char name[256];
+  FwhostHeader *header;
+  FwhostSlot *slots;
+  size_t bytes;
+  atomic_int stop;
+};
+
+static _Atomic uint32_t *word(uint32_t *w) { return (_Atomic uint32_t *)w; }
+
+static void futex_wait(uint32_t *w, uint32_t seen, long timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+  syscall(SYS_futex, w, FUTEX_WAIT, seen, &ts, NULL, 0);
+}
+
+static void futex_wake(uint32_t *w) {
+  syscall(SYS_futex, w, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void from_elem(FwElem *to, const Fw32Elem *from) {
+  to->data = from->data;
+  to->dec = from->dec;
+  to->unit = from->unit;
+  to->disp = from->disp;
+  to->name = from->name;
+  to->suff = from->suff;
+}
+
+/* start and end are byte addresses whatever the data type */
+static short pmc_length(const FwPmcArgs *a, unsigned short *length) {
+  size_t n;
+
+  if (a->data_type < 0 || a->data_type > 5 || a->data_type == 3)
+    return EW_TYPE;
+  if (a->end < a->start) return EW_RANGE;
+  n = 8 + (size_t)(a->end - a->start + 1);
+  if (n > sizeof(FwPmc)) return EW_LENGTH;
+  *length = n;
+  return EW_OK;
+}
+
+/* marshal one call between the fixed width slot and the library, whose
+ * structs with long fields are read through the mirrors of fwabi.h */
+static short call(FwhostSlot *s) {
+  unsigned short h = s->libh;
+  short ret;
+
+  switch (s->op) {
+    case FWHOST_ALLCLIBHNDL3: {
+      FwOpenArgs a;
+      unsigned short libh = 0;
+      if (s->size != sizeof(a)) return EW_LENGTH;
+      memcpy(&a, s->data, sizeof(a));
+      a.host[sizeof(a.host) - 1] = '\0';
+      ret = cnc_allclibhndl3(a.host, a.port, a.timeout, &libh);
+      memcpy(s->data, &libh, sizeof(libh));
+      s->size = sizeof(libh);
+      return ret;
+    }
+    case FWHOST_FREELIBHNDL:
+      s->size = 0;
+      return cnc_freelibhndl(h);
+    case FWHOST_RDCNCID: {
+      // the library writes four 32 bit words whatever a long is
+      uint32_t ids[4] = {0};
+      ret = cnc_rdcncid(h, (unsigned long *)ids);
+      memcpy(s->data, ids, sizeof(ids));
+      s->size = sizeof(ids);
+      return ret;
+    }
+    case FWHOST_STATINFO: {
+      ODBST st;
+      FwStatus out = {0};
+      memset(&st, 0, sizeof(st));
+      ret = cnc_statinfo(h, &st);
+      out.hdck = st.hdck;
+      out.tmmode = st.tmmode;
+      out.aut = st.aut;
+      out.run = st.run;
+      out.motion = st.motion;
+      out.mstb = st.mstb;
+      out.emergency = st.emergency;
+      out.alarm = st.alarm;
+      out.edit = st.edit;
+      memcpy(s->data, &out, sizeof(out));
+      s->size = sizeof(out);
+      return ret;
+    }
+    case FWHOST_RDDYNAMIC2: {
+      Fw32Dy2 dy;
+      FwDynamic *out = (FwDynamic *)s->data;
+      int16_t axis;
+      short length = sizeof(dy);
+      int n = FW32_MAX_AXIS < FWHOST_MAX_AXIS ? FW32_MAX_AXIS : FWHOST_MAX_AXIS;
+      if (s->size != sizeof(axis)) return EW_LENGTH;
+      memcpy(&axis, s->data, sizeof(axis));
+      if (axis != -1)
+        length = offsetof(Fw32Dy2, pos) + sizeof(dy.pos.oaxis);
+      memset(&dy, 0, sizeof(dy));
+      ret = cnc_rddynamic2(h, axis, length, (ODBDY2 *)&dy);
+      memset(out, 0, sizeof(*out));
+      out->axis = dy.axis;
+      out->alarm = dy.alarm;
+      out->prgnum = dy.prgnum;
+      out->prgmnum = dy.prgmnum;
+      out->seqnum = dy.seqnum;
+      out->actf = dy.actf;
+      out->acts = dy.acts;
+      if (axis != -1) {
+        out->absolute[0] = dy.pos.oaxis.absolute;
+        out->machine[0] = dy.pos.oaxis.machine;
+        out->relative[0] = dy.pos.oaxis.relative;
+        out->distance[0] = dy.pos.oaxis.distance;
+      } else {
+        for (int i = 0; i < n; i++) {
+          out->absolute[i] = dy.pos.faxis.absolute[i];
+          out->machine[i] = dy.pos.faxis.machine[i];
+          out->relative[i] = dy.pos.faxis.relative[i];
+          out->distance[i] = dy.pos.faxis.distance[i];
+        }
+      }
+      s->size = sizeof(*out);
+      return ret;
+    }
+    case FWHOST_RDSPEED: {
+      Fw32Speed sp;
+      FwSpeed out;
+      int16_t type;
+      if (s->size != sizeof(type)) return EW_LENGTH;
+      memcpy(&type, s->data, sizeof(type));
+      memset(&sp, 0, sizeof(sp));
+      ret = cnc_rdspeed(h, type, (ODBSPEED *)&sp);
+      from_elem(&out.actf, &sp.actf);
+      from_elem(&out.acts, &sp.acts);
+      memcpy(s->data, &out, sizeof(out));
+      s->size = sizeof(out);
+      return ret;
+    }
+    case FWHOST_RDPOSITION: {
+      Fw32Pos pos[FWHOST_MAX_AXIS];
+      FwPosition *out = (FwPosition *)s->data;
+      FwPositionArgs a;
+      short num;
+      if (s->size != sizeof(a)) return EW_LENGTH;
+      memcpy(&a, s->data, sizeof(a));
+      if (a.num < 1 || a.num > FWHOST_MAX_AXIS) return EW_NUMBER;
+      num = a.num;
+      memset(pos, 0, sizeof(pos));
+      ret = cnc_rdposition(h, a.axis, &num, (ODBPOS *)pos);
+      if (num < 0 || num > a.num) num = 0;
+      for (int i = 0; i < num; i++) {
+        from_elem(&out[i].abs, &pos[i].abs);
+        from_elem(&out[i].mach, &pos[i].mach);
+        from_elem(&out[i].rel, &pos[i].rel);
+        from_elem(&out[i].dist, &pos[i].dist);
+      }
+      s->size = num * sizeof(*out);
+      return ret;
+    }
+    case FWHOST_RDPRGNUM: {
+      ODBPRO pro;
+      FwProgram out;
+      memset(&pro, 0, sizeof(pro));
+      ret = cnc_rdprgnum(h, &pro);
+      out.data = pro.data;
+      out.mdata = pro.mdata;
+      memcpy(s->data, &out, sizeof(out));
+      s->size = sizeof(out);
+      return ret;
+    }
+    case FWHOST_RDPMCRNG: {
+      FwPmcArgs a;
+      unsigned short length;
+      if (s->size != sizeof(a)) return EW_LENGTH;
+      memcpy(&a, s->data, sizeof(a));
+      if ((ret = pmc_length(&a, &length)) != EW_OK) return ret;
+      // the packed values of IODBPMC are the same bytes as FwPmc
+      ret = pmc_rdpmcrng(h, a.adr_type, a.data_type, a.start, a.end, length,
+                         (IODBPMC *)s->data);
+      s->size = length;
+      return ret;
+    }
+    case FWHOST_WRPMCRNG: {
+      FwPmcArgs a;
+      unsigned short length;
+      if (s->size < sizeof(a)) return EW_LENGTH;
+      memcpy(&a, s->data, sizeof(a));
+      if ((ret = pmc_length(&a, &length)) != EW_OK) return ret;
+      if (s->size < length) return EW_LENGTH;
+      ret = pmc_wrpmcrng(h, length, (IODBPMC *)s->data);
+      s->size = 0;
+      return ret;
+    }
+    default:
+      return EW_FUNC;
+  }
+}
+
+static void *serve(void *arg) {
+  FwHost *h = ((struct worker *)arg)->host;
+  FwhostHeader *hd = h->header;
+  uint32_t seen;
+  int busy;
+
+  while (!atomic_load(&h->stop)) {
+    seen = atomic_load(word(&hd->doorbell));
+    busy = 0;
+    for (uint32_t i = 0; i < hd->slots; i++) {
+      FwhostSlot *s = &h->slots[i];
+      uint32_t ready = FWHOST_READY;
+      if (!atomic_compare_exchange_strong(word(&s->state), &ready,
+                                          FWHOST_RUNNING))
+        continue;
+      s->size = s->size > FWHOST_SLOT_DATA ? FWHOST_SLOT_DATA : s->size;
+      s->err = call(s);
+      if (s->err != EW_OK) s->size = 0;
+      atomic_store(word(&s->state), FWHOST_DONE);
+      futex_wake(&s->state);
+      busy = 1;
+    }
+    // wake up now and then to notice fwhost_stop
+    if (!busy) futex_wait(&hd->doorbell, seen, 200);
+  }
+  return NULL;
+}
+
+FwHost *fwhost_create(const char *name, int slots) {
+  FwHost *h;
+  int fd;
+
+  if (slots < 1 || strlen(name) >= sizeof(h->name)) return NULL;
+  if ((h = calloc(1, sizeof(*h))) == NULL) return NULL;
+  snprintf(h->name, sizeof(h->name), "%s", name);
+  h->bytes = sizeof(FwhostHeader) + slots * sizeof(FwhostSlot);
+
+  shm_unlink(name);
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+    fprintf(stderr, "Failed to create shared memory %s!\n", name);
+    free(h);
+    return NULL;
+  }
+  if (ftruncate(fd, h->bytes) != 0 ||
+      (h->header = mmap(NULL, h->bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "Failed to map shared memory %s!\n", name);
+    close(fd);
+    shm_unlink(name);
+    free(h);
+    return NULL;
+  }
+  close(fd);
+
+  h->slots = (FwhostSlot *)(h->header + 1);
+  h->header->version = FWHOST_VERSION;
+  h->header->slots = slots;
+  h->header->slot_bytes = sizeof(FwhostSlot);
+  h->header->pid = getpid();
+  atomic_thread_fence(memory_order_release);
+  memcpy(h->header->magic, FWHOST_MAGIC, sizeof(FWHOST_MAGIC));
+  return h;
+}
+
+void fwhost_destroy(FwHost *h) {
+  if (h == NULL) return;
+  // callers still waiting notice the pid is gone, or this one exits soon
+  h->header->pid = 0;
+  for (uint32_t i = 0; i < h->header->slots; i++)
+    futex_wake(&h->slots[i].state);
+  munmap(h->header, h->bytes);
+  shm_unlink(h->name);
+  free(h);
+}
+
+int fwhost_serve(FwHost *h, int workers) {
+  struct worker *w;
+  int started = 0;
+
+  if (workers < 1 || (w = calloc(workers, sizeof(*w))) == NULL) return 1;
+  for (; started < workers; started++) {
+    w[started].host = h;
+    if (pthread_create(&w[started].thread, NULL, serve, &w[started]) != 0) {
+      fprintf(stderr, "Failed to start worker %d!\n", started);
+      fwhost_stop(h);
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) pthread_join(w[i].thread, NULL);
+  free(w);
+  atomic_store(&h->stop, 0);
+  return started == workers ? 0 : 1;
+}
+
+void fwhost_stop(FwHost *h) {
+  atomic_store(&h->stop, 1);
+  atomic_fetch_add(word(&h->header->doorbell), 1);
+  futex_wake(&h->header->doorbell);
+}
@@ -0,0 +1,198 @@
+#ifndef FW_FWHOST_H
+#define FW_FWHOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* out of process FOCAS host: `focas-host` loads libfwlib32 (the x86 one on
+ * x86_64 hosts with gcc-multilib, the native one otherwise) and serves calls through a POSIX shared memory
+ * segment of request slots. arguments and results are fixed width structs
+ * laid out the same for 32 and 64 bit processes, so callers never see the
+ * `long` fields of fwlib32.h and do not link the library at all. a crash of
+ * the library takes down the host, not the caller, whose calls then return
+ * FWHOST_GONE.
+ *
+ * a caller claims a free slot, writes the request, marks it ready and rings
+ * the doorbell futex of the segment. a host worker runs the call, writes
+ * the result into the same slot and wakes the futex of the slot. */
+
+#define FWHOST_MAGIC "FWHOST"
+#define FWHOST_VERSION 1
+#define FWHOST_SLOT_DATA 4096
+#define FWHOST_MAX_AXIS 32
+
+// returned by the client when the host is gone, same value as EW_SOCKET
+#define FWHOST_GONE (-16)
+
+typedef enum fwhost_op {
+  FWHOST_ALLCLIBHNDL3,  // FwOpenArgs -> uint16 handle
+  FWHOST_FREELIBHNDL,
+  FWHOST_RDCNCID,       // -> uint32[4]
+  FWHOST_STATINFO,      // -> FwStatus
+  FWHOST_RDDYNAMIC2,    // int16 axis, -1 for all -> FwDynamic
+  FWHOST_RDSPEED,       // int16 type -> FwSpeed
+  FWHOST_RDPOSITION,    // FwPositionArgs -> FwPosition[num]
+  FWHOST_RDPRGNUM,      // -> FwProgram
+  FWHOST_RDPMCRNG,      // FwPmcArgs -> FwPmc
+  FWHOST_WRPMCRNG,      // FwPmc ->
+  FWHOST_OPS,
+} FwhostOp;
+
+/* the data of the pmc calls are packed values of 1 (char), 2 (short),
+ * 4 (long, float) or 8 (double) bytes, from the byte address start to
+ * the byte address end */
+typedef struct fw_pmc {
+  int16_t adr_type;
+  int16_t data_type;
+  uint16_t start;
+  uint16_t end;
+  uint8_t data[FWHOST_SLOT_DATA - 8];
+} FwPmc;
+
+typedef struct fw_open_args {
+  char host[64];
+  uint16_t port;
+  uint16_t reserved;
+  int32_t timeout;
+} FwOpenArgs;
+
+typedef struct fw_position_args {
+  int16_t axis;
+  int16_t num;
+} FwPositionArgs;
+
+typedef struct fw_pmc_args {
+  int16_t adr_type;
+  int16_t data_type;
+  uint16_t start;
+  uint16_t end;
+} FwPmcArgs;
+
+typedef struct fw_status {
+  int16_t hdck;
+  int16_t tmmode;
+  int16_t aut;
+  int16_t run;
+  int16_t motion;
+  int16_t mstb;
+  int16_t emergency;
+  int16_t alarm;
+  int16_t edit;
+  int16_t reserved;
+} FwStatus;
+
+typedef struct fw_dynamic {
+  int16_t axis;
+  int16_t reserved;
+  int32_t alarm;
+  int32_t prgnum;
+  int32_t prgmnum;
+  int32_t seqnum;
+  int32_t actf;
+  int32_t acts;
+  // one entry for a single axis
+  int32_t absolute[FWHOST_MAX_AXIS];
+  int32_t machine[FWHOST_MAX_AXIS];
+  int32_t relative[FWHOST_MAX_AXIS];
+  int32_t distance[FWHOST_MAX_AXIS];
+} FwDynamic;
+
+/* POSELM and SPEEDELM */
+typedef struct fw_elem {
+  int32_t data;
+  int16_t dec;
+  int16_t unit;
+  int16_t disp;
+  char name;
+  char suff;
+} FwElem;
+
+typedef struct fw_speed {
+  FwElem actf;
+  FwElem acts;
+} FwSpeed;
+
+typedef struct fw_position {
+  FwElem abs;
+  FwElem mach;
+  FwElem rel;
+  FwElem dist;
+} FwPosition;
+
+typedef struct fw_program {
+  int32_t data;
+  int32_t mdata;
+} FwProgram;
+
+/* segment: the header, then `slots` slots. the state of a slot and the
+ * doorbell are futex words. */
+enum fwhost_state {
+  FWHOST_FREE,
+  FWHOST_CLAIMED,  // a caller writes the request
+  FWHOST_READY,
+  FWHOST_RUNNING,
+  FWHOST_DONE,     // the caller reads the result
+};
+
+typedef struct fwhost_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;
+  uint32_t slot_bytes;
+  uint32_t pid;       // of the host
+  uint32_t doorbell;  // counts requests
+  uint32_t freed;     // counts slots given back
+  uint32_t reserved[8];
+} FwhostHeader;
+
+typedef struct fwhost_slot {
+  uint32_t state;
+  uint32_t op;
+  uint16_t libh;
+  int16_t err;
+  uint32_t size;
+  uint32_t reserved[4];
+  uint8_t data[FWHOST_SLOT_DATA];
+} FwhostSlot;
+
+/* host */
+typedef struct fwhost FwHost;
+
+/* `name` as for shm_open, a stale segment of the same name is replaced */
+FwHost *fwhost_create(const char *name, int slots);
+/* unlinks the segment, callers still waiting get FWHOST_GONE */
+void fwhost_destroy(FwHost *h);
+/* run calls on `workers` threads until fwhost_stop */
+int fwhost_serve(FwHost *h, int workers);
+/* safe from other threads and signal handlers */
+void fwhost_stop(FwHost *h);
+
+/* client, thread safe, any number of processes share a host */
+typedef struct fwclient FwClient;
+
+FwClient *fwclient_open(const char *name);
+void fwclient_close(FwClient *c);
+/* `size` bytes of `data` hold the result, `got` is set to its length */
+short fwclient_call(FwClient *c, FwhostOp op, unsigned short libh,
+                    const void *args, size_t args_size, void *data,
+                    size_t size, size_t *got);
+
+short fw_allclibhndl3(FwClient *c, const char *host, unsigned short port,
+                      long timeout, unsigned short *libh);
+short fw_freelibhndl(FwClient *c, unsigned short libh);
+short fw_rdcncid(FwClient *c, unsigned short libh, uint32_t ids[4]);
+short fw_statinfo(FwClient *c, unsigned short libh, FwStatus *status);
+short fw_rddynamic2(FwClient *c, unsigned short libh, short axis,
+                    FwDynamic *dyn);
+short fw_rdspeed(FwClient *c, unsigned short libh, short type,
+                 FwSpeed *speed);
+/* `num` axes in, the axes read out */
+short fw_rdposition(FwClient *c, unsigned short libh, short axis, short *num,
+                    FwPosition *pos);
+short fw_rdprgnum(FwClient *c, unsigned short libh, FwProgram *prog);
+short fw_rdpmcrng(FwClient *c, unsigned short libh, short adr_type,
+                  short data_type, unsigned short start, unsigned short end,
+                  FwPmc *pmc);
+short fw_wrpmcrng(FwClient *c, unsigned short libh, const FwPmc *pmc);
+
+#endif
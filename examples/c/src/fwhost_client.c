@@ -0,0 +1,238 @@
+#include "./fwhost.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// polls of a slot before sleeping on its futex
+#define SPINS 2000
+// how often a waiting caller checks that the host is still there
+#define ALIVE_MS 100
+
+#define EW_OK 0
+#define EW_LENGTH 2
+#define EW_NUMBER 3
+
+struct fwclient {
+  FwhostHeader *header;
+  FwhostSlot *slots;
+  size_t bytes;
+  atomic_uint next;  // slot to try first
+};
+
+static _Atomic uint32_t *word(uint32_t *w) { return (_Atomic uint32_t *)w; }
+
+static void futex_wait(uint32_t *w, uint32_t seen, long timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+  syscall(SYS_futex, w, FUTEX_WAIT, seen, &ts, NULL, 0);
+}
+
+static void futex_wake(uint32_t *w, int waiters) {
+  syscall(SYS_futex, w, FUTEX_WAKE, waiters, NULL, NULL, 0);
+}
+
+static int host_alive(const FwClient *c) {
+  pid_t pid = c->header->pid;
+  char path[32], stat[64] = "";
+  char *state;
+  FILE *f;
+
+  if (pid == 0 || (kill(pid, 0) != 0 && errno != EPERM)) return 0;
+  // a crashed host the parent has not reaped yet is a zombie
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  if ((f = fopen(path, "r")) == NULL) return 1;
+  fgets(stat, sizeof(stat), f);
+  fclose(f);
+  state = strrchr(stat, ')');
+  return state == NULL || state[1] != ' ' || state[2] != 'Z';
+}
+
+FwClient *fwclient_open(const char *name) {
+  FwClient *c;
+  struct stat st;
+  int fd;
+
+  if ((fd = shm_open(name, O_RDWR, 0)) < 0) return NULL;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FwhostHeader) ||
+      (c = calloc(1, sizeof(*c))) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  c->bytes = st.st_size;
+  c->header = mmap(NULL, c->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (c->header == MAP_FAILED) {
+    free(c);
+    return NULL;
+  }
+  if (memcmp(c->header->magic, FWHOST_MAGIC, sizeof(FWHOST_MAGIC)) != 0 ||
+      c->header->version != FWHOST_VERSION ||
+      c->header->slot_bytes != sizeof(FwhostSlot) ||
+      sizeof(FwhostHeader) + c->header->slots * sizeof(FwhostSlot) >
+          c->bytes) {
+    munmap(c->header, c->bytes);
+    free(c);
+    return NULL;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  c->slots = (FwhostSlot *)(c->header + 1);
+  return c;
+}
+
+void fwclient_close(FwClient *c) {
+  if (c == NULL) return;
+  munmap(c->header, c->bytes);
+  free(c);
+}
+
+static FwhostSlot *claim(FwClient *c) {
+  uint32_t slots = c->header->slots;
+  uint32_t seen;
+
+  for (;;) {
+    uint32_t first = atomic_fetch_add(&c->next, 1);
+    seen = atomic_load(word(&c->header->freed));
+    for (uint32_t i = 0; i < slots; i++) {
+      FwhostSlot *s = &c->slots[(first + i) % slots];
+      uint32_t free_state = FWHOST_FREE;
+      if (atomic_compare_exchange_strong(word(&s->state), &free_state,
+                                         FWHOST_CLAIMED))
+        return s;
+    }
+    if (!host_alive(c)) return NULL;
+    futex_wait(&c->header->freed, seen, ALIVE_MS);
+  }
+}
+
+static void release(FwClient *c, FwhostSlot *s) {
+  atomic_store(word(&s->state), FWHOST_FREE);
+  atomic_fetch_add(word(&c->header->freed), 1);
+  futex_wake(&c->header->freed, 1);
+}
+
+short fwclient_call(FwClient *c, FwhostOp op, unsigned short libh,
+                    const void *args, size_t args_size, void *data,
+                    size_t size, size_t *got) {
+  FwhostSlot *s;
+  uint32_t state;
+  size_t keep;
+  short err;
+
+  if (args_size > FWHOST_SLOT_DATA) return EW_LENGTH;
+  if ((s = claim(c)) == NULL) return FWHOST_GONE;
+  s->op = op;
+  s->libh = libh;
+  s->size = args_size;
+  if (args_size) memcpy(s->data, args, args_size);
+  atomic_store(word(&s->state), FWHOST_READY);
+  atomic_fetch_add(word(&c->header->doorbell), 1);
+  futex_wake(&c->header->doorbell, 1);
+
+  for (int spin = 0; (state = atomic_load(word(&s->state))) != FWHOST_DONE;) {
+    if (spin < SPINS) {
+      spin++;
+      continue;
+    }
+    futex_wait(&s->state, state, ALIVE_MS);
+    // the slot stays taken, the segment is no use without its host
+    if (atomic_load(word(&s->state)) != FWHOST_DONE && !host_alive(c))
+      return FWHOST_GONE;
+  }
+
+  err = s->err;
+  keep = s->size < size ? s->size : size;
+  if (keep) memcpy(data, s->data, keep);
+  if (got) *got = keep;
+  release(c, s);
+  return err;
+}
+
+short fw_allclibhndl3(FwClient *c, const char *host, unsigned short port,
+                      long timeout, unsigned short *libh) {
+  FwOpenArgs args;
+  uint16_t h = 0;
+  short ret;
+
+  memset(&args, 0, sizeof(args));
+  snprintf(args.host, sizeof(args.host), "%s", host);
+  args.port = port;
+  args.timeout = timeout;
+  ret = fwclient_call(c, FWHOST_ALLCLIBHNDL3, 0, &args, sizeof(args), &h,
+                      sizeof(h), NULL);
+  if (ret == EW_OK) *libh = h;
+  return ret;
+}
+
+short fw_freelibhndl(FwClient *c, unsigned short libh) {
+  return fwclient_call(c, FWHOST_FREELIBHNDL, libh, NULL, 0, NULL, 0, NULL);
+}
+
+short fw_rdcncid(FwClient *c, unsigned short libh, uint32_t ids[4]) {
+  return fwclient_call(c, FWHOST_RDCNCID, libh, NULL, 0, ids,
+                       4 * sizeof(uint32_t), NULL);
+}
+
+short fw_statinfo(FwClient *c, unsigned short libh, FwStatus *status) {
+  return fwclient_call(c, FWHOST_STATINFO, libh, NULL, 0, status,
+                       sizeof(*status), NULL);
+}
+
+short fw_rddynamic2(FwClient *c, unsigned short libh, short axis,
+                    FwDynamic *dyn) {
+  int16_t a = axis;
+  return fwclient_call(c, FWHOST_RDDYNAMIC2, libh, &a, sizeof(a), dyn,
+                       sizeof(*dyn), NULL);
+}
+
+short fw_rdspeed(FwClient *c, unsigned short libh, short type,
+                 FwSpeed *speed) {
+  int16_t t = type;
+  return fwclient_call(c, FWHOST_RDSPEED, libh, &t, sizeof(t), speed,
+                       sizeof(*speed), NULL);
+}
+
+short fw_rdposition(FwClient *c, unsigned short libh, short axis, short *num,
+                    FwPosition *pos) {
+  FwPositionArgs args = {axis, *num};
+  size_t got = 0;
+  short ret;
+
+  if (*num < 1 || *num > FWHOST_MAX_AXIS) return EW_NUMBER;
+  ret = fwclient_call(c, FWHOST_RDPOSITION, libh, &args, sizeof(args), pos,
+                      *num * sizeof(*pos), &got);
+  if (ret == EW_OK) *num = got / sizeof(*pos);
+  return ret;
+}
+
+short fw_rdprgnum(FwClient *c, unsigned short libh, FwProgram *prog) {
+  return fwclient_call(c, FWHOST_RDPRGNUM, libh, NULL, 0, prog,
+                       sizeof(*prog), NULL);
+}
+
+short fw_rdpmcrng(FwClient *c, unsigned short libh, short adr_type,
+                  short data_type, unsigned short start, unsigned short end,
+                  FwPmc *pmc) {
+  FwPmcArgs args = {adr_type, data_type, start, end};
+  return fwclient_call(c, FWHOST_RDPMCRNG, libh, &args, sizeof(args), pmc,
+                       sizeof(*pmc), NULL);
+}
+
+short fw_wrpmcrng(FwClient *c, unsigned short libh, const FwPmc *pmc) {
+  size_t size = sizeof(*pmc);
+
+  // only the bytes that are written, the host checks the rest
+  if (pmc->end >= pmc->start && 8 + (size_t)(pmc->end - pmc->start + 1) < size)
+    size = 8 + (size_t)(pmc->end - pmc->start + 1);
+  return fwclient_call(c, FWHOST_WRPMCRNG, libh, pmc, size, NULL, 0, NULL);
+}
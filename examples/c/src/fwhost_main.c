@@ -0,0 +1,75 @@
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./fwhost.h"
+#include "fwlib32.h"
+
+static struct option options[] = {{"name", required_argument, NULL, 'n'},
+                                  {"slots", required_argument, NULL, 's'},
+                                  {"workers", required_argument, NULL, 'w'},
+                                  {NULL, 0, NULL, 0}};
+
+static FwHost *host;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--name=<shared memory name>] [--slots=<calls at once>] "
+          "[--workers=<threads>]\n",
+          name);
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  fwhost_stop(host);
+}
+
+int main(int argc, char *argv[]) {
+  const char *name = "/focas-host";
+  int slots = 16;
+  int workers = 4;
+  int failed;
+  int c;
+  int i = 0;
+
+  while ((c = getopt_long(argc, argv, "", options, &i)) != -1) {
+    switch (c) {
+      case 'n':
+        name = optarg;
+        break;
+      case 's':
+        if ((slots = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid slots: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'w':
+        if ((workers = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid workers: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (cnc_startupprocess(0, "focas.log") != EW_OK) {
+    fprintf(stderr, "Failed to create required log file!\n");
+    return EXIT_FAILURE;
+  }
+  if ((host = fwhost_create(name, slots)) == NULL) {
+    cnc_exitprocess();
+    return EXIT_FAILURE;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  failed = fwhost_serve(host, workers);
+
+  fwhost_destroy(host);
+  cnc_exitprocess();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
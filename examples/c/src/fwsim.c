@@ -0,0 +1,1592 @@
+#include "./fwsim.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "./clock.h"
+#include "./fault.h"
+#include "./fwabi.h"
+#include "fwlib32.h"
+
+#define MACHINES 4096
+#define HANDLES 4096
+#define PMC_TYPES 16
+#define PMC_BYTES 65536
+#define MACROS 10000
+#define PARAMS 4096
+#define PROGRAMS 256
+#define ALARMS 8
+// upload / download data types: 0 programs, 1 tool offsets ... 5 work offsets
+#define DATA_TYPES 6
+
+// a part takes CYCLE seconds, the program runs for CUTTING of them
+#define CYCLE 60.0
+#define CUTTING 50.0
+// travel of every axis, 0.001 mm
+#define TRAVEL 100000.0
+#define MACRO_ALARM 8
+#define SCRIPT_LINE 256
+
+static const char *const family_names[FWSIM_FAMILIES] = {
+    "connect", "status", "axis", "pmc", "macro", "param", "program", "alarm"};
+
+const FwsimOptions default_fwsim_options = {
+    .latency_us = {20000, 2000, 2000, 2000, 2000, 2000, 5000, 2000},
+    .jitter_us = 500,
+    .error_rate = {0},
+    .error = EW_SOCKET,
+    .axes = 3,
+    .seed = 1,
+    .stall_rate = 0,
+    .stall_us = 0,
+    .faults = NULL,
+    .script = NULL};
+
+typedef struct program {
+  long number;
+  char *text;
+  size_t len;
+  time_t changed;
+} Program;
+
+typedef struct param {
+  short number;
+  short axis;  // 0 for no axis
+  int used;
+  long value;
+  long dec;  // of real parameters
+} Param;
+
+typedef struct alarm {
+  long number;
+  short type;
+  char msg[32];
+} Alarm;
+
+typedef struct machine {
+  char host[64];
+  unsigned short port;
+  pthread_mutex_t lock;
+  double start;
+  unsigned char pmc[PMC_TYPES][PMC_BYTES];
+  double macro[MACROS];  // NAN for vacant
+  Param params[PARAMS];
+  Program programs[PROGRAMS];  // by number
+  int nprograms;
+  char *data[DATA_TYPES];  // the other upload / download types
+  Alarm alarms[ALARMS];
+  int nalarms;
+  unsigned script;      // id of the script the steps below belong to
+  int step;             // next one to take
+  double script_start;  // of the current round
+} Machine;
+
+enum { IDLE, UPLOAD, DOWNLOAD };
+
+typedef struct handle {
+  Machine *m;  // NULL for a free handle
+  int xfer;
+  short type;
+  char *buf;
+  size_t len;
+  size_t off;
+  size_t cap;
+} Handle;
+
+enum { STEP_MACRO, STEP_PMC, STEP_ALARM, STEP_RESET };
+
+/* a line of FWSIM_SCRIPT */
+typedef struct step {
+  double at;  // seconds into the round
+  int kind;
+  long a;  // macro, pmc address type or alarm number
+  long b;  // pmc byte address
+  double value;
+  char msg[32];
+} Step;
+
+typedef struct script {
+  unsigned id;
+  double repeat;  // 0 to run once
+  Step *steps;
+  int nsteps;
+} Script;
+
+/* the machine as seen at one point in time */
+typedef struct motion {
+  int running;
+  long pos[MAX_AXIS];
+  long dist[MAX_AXIS];
+  long actf;
+  long acts;
+  long seqnum;
+  long prgnum;
+} Motion;
+
+/* the options with the plan and the script read from them, never changed
+ * once published, so a call takes them without a lock */
+typedef struct config {
+  FwsimOptions options;
+  FaultPlan *faults;
+  Script *script;
+  struct config *next;  // retired, freed by fwsim_reset
+} Config;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static _Atomic(Config *) config;
+static Config *retired;   // the ones set_options replaced
+static unsigned scripts;  // ids handed out
+static _Atomic uint64_t rng;
+static atomic_ulong calls[FWSIM_FAMILIES];
+static atomic_ulong errors[FWSIM_FAMILIES];
+
+// handles and the machine list
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Machine *machines[MACHINES];
+static Handle handles[HANDLES];
+
+static const char sample[] =
+    "%\nO1000(SIMULATED PART)\nG21G90G17\nT1M6\nS8000M3\n"
+    "G0X0.Y0.Z10.\nG1Z-1.F500.\nX100.\nY100.\nX0.\nY0.\nG0Z10.\nM30\n%";
+
+// splitmix64, callers share one sequence
+static double uniform(void) {
+  uint64_t z = atomic_fetch_add(&rng, 0x9e3779b97f4a7c15ULL) +
+               0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) / 9007199254740992.0;
+}
+
+static void delay(long us) {
+  struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+  while (us > 0 && nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+}
+
+int fwsim_parse(const char *spec, double values[FWSIM_FAMILIES]) {
+  const char *p = spec;
+
+  while (*p) {
+    const char *colon = strchr(p, ':');
+    const char *comma = strchr(p, ',');
+    char *end;
+    int f = -1;
+
+    if (colon && (comma == NULL || colon < comma)) {
+      for (int i = 0; i < FWSIM_FAMILIES; i++) {
+        if (strlen(family_names[i]) == (size_t)(colon - p) &&
+            strncmp(p, family_names[i], colon - p) == 0)
+          f = i;
+      }
+      if (f < 0) return 1;
+      p = colon + 1;
+    }
+    double v = strtod(p, &end);
+    if (end == p || v < 0 || (*end != ',' && *end != '\0')) return 1;
+    for (int i = 0; i < FWSIM_FAMILIES; i++) {
+      if (f < 0 || f == i) values[i] = v;
+    }
+    p = *end ? end + 1 : end;
+  }
+  return 0;
+}
+
+static void free_script(Script *s) {
+  if (s == NULL) return;
+  free(s->steps);
+  free(s);
+}
+
+/* one line of a script into `s`, 1 when it is not valid */
+static int parse_step(char *line, Script *s) {
+  char *comment = strchr(line, '#');
+  char *rest;
+  char kind[16];
+  Step st = {0};
+  int n = 0;
+  int k = 0;
+
+  if (comment) *comment = '\0';
+  if (sscanf(line, " %15s %n", kind, &n) != 1) return 0;  // blank
+  if (strcmp(kind, "repeat") == 0) {
+    return sscanf(line + n, "%lf %n", &s->repeat, &k) != 1 ||
+           s->repeat <= 0 || line[n + k] != '\0';
+  }
+  if (sscanf(line, "%lf %15s %n", &st.at, kind, &n) != 2 || st.at < 0 ||
+      (s->nsteps && st.at < s->steps[s->nsteps - 1].at))
+    return 1;
+  rest = line + n;
+  if (strcmp(kind, "macro") == 0) {
+    st.kind = STEP_MACRO;
+    if (sscanf(rest, "%ld %lf %n", &st.a, &st.value, &k) != 2 || st.a < 1 ||
+        st.a >= MACROS)
+      return 1;
+  } else if (strcmp(kind, "pmc") == 0) {
+    st.kind = STEP_PMC;
+    if (sscanf(rest, "%ld %ld %lf %n", &st.a, &st.b, &st.value, &k) != 3 ||
+        st.a < 0 || st.a >= PMC_TYPES || st.b < 0 || st.b >= PMC_BYTES ||
+        st.value < 0 || st.value > 255)
+      return 1;
+  } else if (strcmp(kind, "alarm") == 0) {
+    st.kind = STEP_ALARM;
+    if (sscanf(rest, "%ld %n", &st.a, &k) != 1) return 1;
+    rest[k + strcspn(rest + k, "\r\n")] = '\0';
+    snprintf(st.msg, sizeof(st.msg), "%s", rest + k);
+    k += strlen(rest + k);
+  } else if (strcmp(kind, "reset") == 0) {
+    st.kind = STEP_RESET;
+  } else {
+    return 1;
+  }
+  if (rest[k] != '\0') return 1;
+
+  if ((s->nsteps & (s->nsteps - 1)) == 0) {
+    Step *steps = realloc(s->steps, (s->nsteps ? 2 * s->nsteps : 16) *
+                                        sizeof(*steps));
+    if (steps == NULL) return 1;
+    s->steps = steps;
+  }
+  s->steps[s->nsteps++] = st;
+  return 0;
+}
+
+/* NULL when the file can not be read or a line is not valid */
+static Script *load_script(const char *path) {
+  char line[SCRIPT_LINE];
+  Script *s;
+  FILE *f;
+  int failed = 0;
+  int n = 0;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    fprintf(stderr, "Failed to open script %s!\n", path);
+    return NULL;
+  }
+  if ((s = calloc(1, sizeof(*s))) == NULL) {
+    fclose(f);
+    return NULL;
+  }
+  while (!failed && fgets(line, sizeof(line), f)) {
+    n++;
+    if ((failed = parse_step(line, s)) != 0)
+      fprintf(stderr, "invalid script line %s:%d\n", path, n);
+  }
+  if (!failed && s->repeat > 0 && s->nsteps &&
+      s->steps[s->nsteps - 1].at >= s->repeat) {
+    fprintf(stderr, "script %s repeats before its last step\n", path);
+    failed = 1;
+  }
+  if (ferror(f)) failed = 1;
+  fclose(f);
+  if (failed) {
+    free_script(s);
+    return NULL;
+  }
+  return s;
+}
+
+static void free_configs(Config *c) {
+  for (Config *next; c; c = next) {
+    next = c->next;
+    fault_free(c->faults);
+    free_script(c->script);
+    free(c);
+  }
+}
+
+static int set_options(const FwsimOptions *opts) {
+  FaultPlan *plan = NULL;
+  Script *steps = NULL;
+  Config *c, *old;
+  int failed = 0;
+
+  if (opts->faults && *opts->faults &&
+      (plan = fault_parse(opts->faults, opts->seed)) == NULL) {
+    fprintf(stderr, "invalid fault plan: \"%s\"\n", opts->faults);
+    failed = 1;
+  }
+  if (opts->script && *opts->script &&
+      (steps = load_script(opts->script)) == NULL)
+    failed = 1;
+  if ((c = calloc(1, sizeof(Config))) == NULL) {
+    fprintf(stderr, "Failed to allocate the simulator options!\n");
+    fault_free(plan);
+    free_script(steps);
+    return 1;
+  }
+  c->options = *opts;
+  if (c->options.axes < 1) c->options.axes = 1;
+  if (c->options.axes > MAX_AXIS) c->options.axes = MAX_AXIS;
+  c->faults = plan;
+  if ((c->script = steps) != NULL) c->script->id = ++scripts;
+  atomic_store(&rng, c->options.seed);
+  // a call still running may hold the old one
+  if ((old = atomic_exchange(&config, c)) != NULL) {
+    old->next = retired;
+    retired = old;
+  }
+  return failed;
+}
+
+static void load_env(void) {
+  FwsimOptions o = default_fwsim_options;
+  double v[FWSIM_FAMILIES];
+  const char *s;
+
+  if ((s = getenv("FWSIM_LATENCY")) != NULL) {
+    for (int i = 0; i < FWSIM_FAMILIES; i++) v[i] = o.latency_us[i];
+    if (fwsim_parse(s, v) == 0) {
+      for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = v[i];
+    } else {
+      fprintf(stderr, "invalid FWSIM_LATENCY: \"%s\"\n", s);
+    }
+  }
+  if ((s = getenv("FWSIM_ERRORS")) != NULL) {
+    for (int i = 0; i < FWSIM_FAMILIES; i++) v[i] = o.error_rate[i];
+    if (fwsim_parse(s, v) == 0) {
+      for (int i = 0; i < FWSIM_FAMILIES; i++) o.error_rate[i] = v[i];
+    } else {
+      fprintf(stderr, "invalid FWSIM_ERRORS: \"%s\"\n", s);
+    }
+  }
+  if ((s = getenv("FWSIM_JITTER")) != NULL) o.jitter_us = atol(s);
+  if ((s = getenv("FWSIM_ERROR")) != NULL) o.error = atoi(s);
+  if ((s = getenv("FWSIM_AXES")) != NULL) o.axes = atoi(s);
+  if ((s = getenv("FWSIM_SEED")) != NULL) o.seed = strtoul(s, NULL, 10);
+  if ((s = getenv("FWSIM_STALLS")) != NULL) o.stall_rate = atof(s);
+  if ((s = getenv("FWSIM_STALL")) != NULL) o.stall_us = atol(s);
+  o.faults = getenv("FWSIM_FAULTS");
+  o.script = getenv("FWSIM_SCRIPT");
+  set_options(&o);
+}
+
+int fwsim_configure(const FwsimOptions *opts) {
+  pthread_once(&once, load_env);
+  return set_options(opts);
+}
+
+void fwsim_stats(FwsimStats *stats) {
+  const Config *c;
+
+  for (int i = 0; i < FWSIM_FAMILIES; i++) {
+    stats->calls[i] = atomic_load(&calls[i]);
+    stats->errors[i] = atomic_load(&errors[i]);
+  }
+  c = atomic_load(&config);
+  if (c && c->faults)
+    fault_stats(c->faults, &stats->faults);
+  else
+    memset(&stats->faults, 0, sizeof(stats->faults));
+}
+
+static void free_machine(Machine *m) {
+  for (int i = 0; i < m->nprograms; i++) free(m->programs[i].text);
+  for (int i = 0; i < DATA_TYPES; i++) free(m->data[i]);
+  pthread_mutex_destroy(&m->lock);
+  free(m);
+}
+
+void fwsim_reset(void) {
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < HANDLES; i++) free(handles[i].buf);
+  memset(handles, 0, sizeof(handles));
+  for (int i = 0; i < MACHINES; i++) {
+    if (machines[i]) free_machine(machines[i]);
+    machines[i] = NULL;
+  }
+  pthread_mutex_unlock(&lock);
+  for (int i = 0; i < FWSIM_FAMILIES; i++) {
+    atomic_store(&calls[i], 0);
+    atomic_store(&errors[i], 0);
+  }
+  free_configs(retired);
+  retired = NULL;
+}
+
+static int axes(void) { return atomic_load(&config)->options.axes; }
+
+int fwsim_axes(void) {
+  pthread_once(&once, load_env);
+  return axes();
+}
+
+static void play(Machine *m, const Script *s);
+
+/* every call starts here: latency, error injection and the handle */
+static short enter(const char *function, unsigned short h, FwsimFamily f,
+                   Machine **m, int inject) {
+  const Config *c;
+  const FwsimOptions *o;
+  short fault = EW_OK;
+  long us, wait = 0;
+
+  pthread_once(&once, load_env);
+  c = atomic_load(&config);
+  o = &c->options;
+
+  atomic_fetch_add(&calls[f], 1);
+  us = o->latency_us[f];
+  if (o->jitter_us > 0) us += (long)(uniform() * (o->jitter_us + 1));
+  if (o->stall_rate > 0 && uniform() < o->stall_rate)
+    us += (long)(-log(1 - uniform()) * o->stall_us);
+  if (c->faults) fault = fault_check(c->faults, function, &wait);
+  delay(us + wait);
+  if (fault != EW_OK) return fault;
+  if (inject && o->error_rate[f] > 0 && uniform() < o->error_rate[f]) {
+    atomic_fetch_add(&errors[f], 1);
+    return o->error;
+  }
+  if (m == NULL) return EW_OK;
+
+  pthread_mutex_lock(&lock);
+  *m = h >= 1 && h <= HANDLES ? handles[h - 1].m : NULL;
+  pthread_mutex_unlock(&lock);
+  if (*m == NULL) return EW_HANDLE;
+  if (c->script) {
+    pthread_mutex_lock(&(*m)->lock);
+    play(*m, c->script);
+    pthread_mutex_unlock(&(*m)->lock);
+  }
+  return EW_OK;
+}
+
+static int compare_programs(const void *a, const void *b) {
+  long x = ((const Program *)a)->number, y = ((const Program *)b)->number;
+  return (x > y) - (x < y);
+}
+
+// takes `text`, `m` locked
+static short store_program(Machine *m, long number, char *text, size_t len) {
+  Program *p = NULL;
+
+  for (int i = 0; i < m->nprograms; i++) {
+    if (m->programs[i].number == number) p = &m->programs[i];
+  }
+  if (p) {
+    free(p->text);
+  } else {
+    if (m->nprograms == PROGRAMS) {
+      free(text);
+      return EW_OVRFLOW;
+    }
+    p = &m->programs[m->nprograms++];
+  }
+  p->number = number;
+  p->text = text;
+  p->len = len;
+  p->changed = time(NULL);
+  qsort(m->programs, m->nprograms, sizeof(Program), compare_programs);
+  return EW_OK;
+}
+
+static Machine *create_machine(const char *host, unsigned short port) {
+  Machine *m = calloc(1, sizeof(*m));
+  char *text;
+
+  if (m == NULL || (text = strdup(sample)) == NULL) {
+    free(m);
+    return NULL;
+  }
+  snprintf(m->host, sizeof(m->host), "%s", host);
+  m->port = port;
+  pthread_mutex_init(&m->lock, NULL);
+  m->start = now();
+  for (int i = 0; i < MACROS; i++) m->macro[i] = NAN;
+  store_program(m, 1000, text, strlen(text));
+  return m;
+}
+
+static void sample_motion(Machine *m, Motion *mo) {
+  double t = now() - m->start;
+  double in_cycle = fmod(t, CYCLE);
+  double feed = 0;
+  int n = axes();
+
+  memset(mo, 0, sizeof(*mo));
+  // time spent cutting, the axes stand still in between and on alarm
+  double cut = floor(t / CYCLE) * CUTTING + fmin(in_cycle, CUTTING);
+  mo->running = in_cycle < CUTTING && m->nalarms == 0;
+  for (int i = 0; i < n; i++) {
+    double period = 8.0 + 3.0 * i;
+    double phase = 2 * M_PI * cut / period;
+    mo->pos[i] = lround(TRAVEL * sin(phase));
+    mo->dist[i] =
+        mo->running ? lround(TRAVEL * sin(phase + M_PI / period)) - mo->pos[i]
+                    : 0;
+    // mm/min
+    double v = TRAVEL / 1000 * 2 * M_PI / period * cos(phase) * 60;
+    feed += v * v;
+  }
+  mo->actf = mo->running ? lround(sqrt(feed)) : 0;
+  mo->acts = mo->running ? lround(8000 + 200 * sin(t)) : 0;
+  mo->seqnum = 10 * (1 + (long)in_cycle % 12);
+  mo->prgnum = m->nprograms ? m->programs[0].number : 0;
+}
+
+static void raise_alarm(Machine *m, long number, short type, const char *msg) {
+  if (m->nalarms == ALARMS) return;
+  m->alarms[m->nalarms].number = number;
+  m->alarms[m->nalarms].type = type;
+  snprintf(m->alarms[m->nalarms].msg, sizeof(m->alarms[0].msg), "%s", msg);
+  m->nalarms++;
+}
+
+// `m` locked, #3000 raises a macro alarm like on the cnc
+static void write_macro(Machine *m, int number, double value) {
+  m->macro[number] = value;
+  if (number == 3000) {
+    char msg[32];
+    snprintf(msg, sizeof(msg), "MACRO ALARM %ld", lround(value));
+    raise_alarm(m, 3000 + lround(value), MACRO_ALARM, msg);
+  }
+}
+
+// `m` locked
+static void take(Machine *m, const Step *st) {
+  switch (st->kind) {
+    case STEP_MACRO:
+      write_macro(m, st->a, st->value);
+      break;
+    case STEP_PMC:
+      m->pmc[st->a][st->b] = (unsigned char)st->value;
+      break;
+    case STEP_ALARM:
+      raise_alarm(m, st->a, MACRO_ALARM, st->msg);
+      break;
+    case STEP_RESET:
+      m->nalarms = 0;
+      m->macro[3000] = NAN;
+      break;
+  }
+}
+
+/* takes the steps whose time has come, `m` locked */
+static void play(Machine *m, const Script *s) {
+  double t;
+
+  if (m->script != s->id) {
+    m->script = s->id;
+    m->step = 0;
+    m->script_start = m->start;
+  }
+  t = now() - m->script_start;
+  for (;;) {
+    if (m->step < s->nsteps && s->steps[m->step].at <= t) {
+      take(m, &s->steps[m->step++]);
+    } else if (m->step == s->nsteps && s->repeat > 0 && t >= s->repeat) {
+      // a machine nobody asked for a while skips the rounds it missed
+      double rounds = floor(t / s->repeat);
+      m->script_start += rounds * s->repeat;
+      t -= rounds * s->repeat;
+      m->step = 0;
+    } else {
+      break;
+    }
+  }
+}
+
+FWLIBAPI short WINAPI cnc_startupprocess(long level, const char *file) {
+  (void)level;
+  (void)file;
+  pthread_once(&once, load_env);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_exitprocess() { return EW_OK; }
+
+FWLIBAPI short WINAPI cnc_allclibhndl3(const char *host, unsigned short port,
+                                       long timeout, unsigned short *libh) {
+  (void)timeout;
+  Machine *m = NULL;
+  short ret;
+  int free_handle = -1;
+
+  if ((ret = enter(__func__, 0, FWSIM_CONNECT, NULL, 1)) != EW_OK) return ret;
+  if (host == NULL || *host == '\0') return EW_SOCKET;
+
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < MACHINES && m == NULL; i++) {
+    if (machines[i] && machines[i]->port == port &&
+        strcmp(machines[i]->host, host) == 0)
+      m = machines[i];
+  }
+  for (int i = 0; i < MACHINES && m == NULL; i++) {
+    if (machines[i] == NULL) m = machines[i] = create_machine(host, port);
+  }
+  for (int i = 0; i < HANDLES && free_handle < 0; i++) {
+    if (handles[i].m == NULL) free_handle = i;
+  }
+  if (m == NULL || free_handle < 0) {
+    pthread_mutex_unlock(&lock);
+    return EW_SOCKET;
+  }
+  memset(&handles[free_handle], 0, sizeof(Handle));
+  handles[free_handle].m = m;
+  pthread_mutex_unlock(&lock);
+  *libh = free_handle + 1;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_freelibhndl(unsigned short libh) {
+  Machine *m;
+  char *buf;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_CONNECT, &m, 0)) != EW_OK) return ret;
+  // another free of the handle may have come first, and a new one taken it
+  pthread_mutex_lock(&lock);
+  if (handles[libh - 1].m != m) {
+    pthread_mutex_unlock(&lock);
+    return EW_HANDLE;
+  }
+  buf = handles[libh - 1].buf;
+  memset(&handles[libh - 1], 0, sizeof(Handle));
+  pthread_mutex_unlock(&lock);
+  free(buf);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdcncid(unsigned short libh, unsigned long *cncid) {
+  Machine *m;
+  short ret;
+  uint32_t hash = 2166136261u;
+
+  if ((ret = enter(__func__, libh, FWSIM_CONNECT, &m, 1)) != EW_OK) return ret;
+  // the same id for the same ip and port
+  for (const char *p = m->host; *p; p++) hash = (hash ^ *p) * 16777619u;
+  hash = (hash ^ m->port) * 16777619u;
+  // four 32 bit words as the library fills them, callers pass uint32_t[4]
+  for (int i = 0; i < 4; i++) {
+    hash = (hash ^ i) * 16777619u;
+    memcpy((char *)cncid + i * sizeof(hash), &hash, sizeof(hash));
+  }
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_getdtailerr(unsigned short libh, ODBERR *err) {
+  Machine *m;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_CONNECT, &m, 0)) != EW_OK) return ret;
+  err->err_no = 0;
+  err->err_dtno = 0;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_sysinfo(unsigned short libh, ODBSYS *sys) {
+  Machine *m;
+  short ret;
+  char count[12];
+
+  if ((ret = enter(__func__, libh, FWSIM_STATUS, &m, 1)) != EW_OK) return ret;
+  memset(sys, 0, sizeof(*sys));
+  sys->max_axis = MAX_AXIS;
+  snprintf(count, sizeof(count), "%2d", axes());
+  memcpy(sys->cnc_type, "30", 2);
+  memcpy(sys->mt_type, " M", 2);
+  memcpy(sys->series, "G001", 4);
+  memcpy(sys->version, "0010", 4);
+  memcpy(sys->axes, count, 2);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_statinfo(unsigned short libh, ODBST *st) {
+  Machine *m;
+  Motion mo;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_STATUS, &m, 1)) != EW_OK) return ret;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  memset(st, 0, sizeof(*st));
+  st->aut = 1;  // MEM
+  st->run = mo.running ? 3 : 0;
+  st->motion = mo.running ? 1 : 0;
+  st->alarm = m->nalarms ? 1 : 0;
+  pthread_mutex_unlock(&m->lock);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdprgnum(unsigned short libh, ODBPRO *prog) {
+  Machine *m;
+  Motion mo;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_STATUS, &m, 1)) != EW_OK) return ret;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  pthread_mutex_unlock(&m->lock);
+  memset(prog, 0, sizeof(*prog));
+  prog->data = mo.prgnum;
+  prog->mdata = mo.prgnum;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdseqnum(unsigned short libh, ODBSEQ *out) {
+  Fw32Act *seq = (Fw32Act *)out;
+  Machine *m;
+  Motion mo;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_STATUS, &m, 1)) != EW_OK) return ret;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  pthread_mutex_unlock(&m->lock);
+  memset(seq, 0, sizeof(*seq));
+  seq->data = mo.seqnum;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_exeprgname(unsigned short libh, ODBEXEPRG *out) {
+  Fw32Exeprg *prog = (Fw32Exeprg *)out;
+  Machine *m;
+  Motion mo;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_STATUS, &m, 1)) != EW_OK) return ret;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  pthread_mutex_unlock(&m->lock);
+  memset(prog, 0, sizeof(*prog));
+  snprintf(prog->name, sizeof(prog->name), "O%ld", mo.prgnum);
+  prog->o_num = mo.prgnum;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rddynamic2(unsigned short libh, short axis,
+                                     short length, ODBDY2 *out) {
+  Fw32Dy2 *dy = (Fw32Dy2 *)out;
+  Machine *m;
+  Motion mo;
+  short ret;
+  int n = axes();
+  size_t need =
+      axis == ALL_AXES
+          ? offsetof(Fw32Dy2, pos.faxis.distance) + n * sizeof(int32_t)
+          : offsetof(Fw32Dy2, pos) + sizeof(dy->pos.oaxis);
+
+  if ((ret = enter(__func__, libh, FWSIM_AXIS, &m, 1)) != EW_OK) return ret;
+  if (axis != ALL_AXES && (axis < 1 || axis > n)) return EW_ATTRIB;
+  if (length < 0 || (size_t)length < need) return EW_LENGTH;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  dy->alarm = m->nalarms ? 1 << MACRO_ALARM : 0;
+  pthread_mutex_unlock(&m->lock);
+  dy->dummy = 0;
+  dy->axis = axis;
+  dy->prgnum = mo.prgnum;
+  dy->prgmnum = mo.prgnum;
+  dy->seqnum = mo.seqnum;
+  dy->actf = mo.actf;
+  dy->acts = mo.acts;
+  if (axis == ALL_AXES) {
+    for (int i = 0; i < n; i++) {
+      dy->pos.faxis.absolute[i] = mo.pos[i];
+      dy->pos.faxis.machine[i] = mo.pos[i];
+      dy->pos.faxis.relative[i] = mo.pos[i];
+      dy->pos.faxis.distance[i] = mo.dist[i];
+    }
+  } else {
+    dy->pos.oaxis.absolute = mo.pos[axis - 1];
+    dy->pos.oaxis.machine = mo.pos[axis - 1];
+    dy->pos.oaxis.relative = mo.pos[axis - 1];
+    dy->pos.oaxis.distance = mo.dist[axis - 1];
+  }
+  return EW_OK;
+}
+
+static const char axis_names[] = "XYZABCUVW";
+
+static char axis_name(int i) {
+  return i < (int)sizeof(axis_names) - 1 ? axis_names[i] : 'X';
+}
+
+FWLIBAPI short WINAPI cnc_rdaxisname(unsigned short libh, short *num,
+                                     ODBAXISNAME *names) {
+  Machine *m;
+  short ret;
+  int n = axes();
+
+  if ((ret = enter(__func__, libh, FWSIM_AXIS, &m, 1)) != EW_OK) return ret;
+  if (*num < n) n = *num;
+  for (int i = 0; i < n; i++) {
+    names[i].name = axis_name(i);
+    names[i].suff = i < (int)sizeof(axis_names) - 1 ? ' ' : '1' + i % 9;
+  }
+  *num = n;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdposition(unsigned short libh, short type,
+                                     short *num, ODBPOS *out) {
+  Fw32Pos *pos = (Fw32Pos *)out;
+  Machine *m;
+  Motion mo;
+  short ret;
+  int n = axes();
+
+  if ((ret = enter(__func__, libh, FWSIM_AXIS, &m, 1)) != EW_OK) return ret;
+  if (type < -1 || type > 3) return EW_ATTRIB;
+  if (*num < 1) return EW_LENGTH;
+  if (*num < n) n = *num;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  pthread_mutex_unlock(&m->lock);
+  memset(pos, 0, n * sizeof(*pos));
+  for (int i = 0; i < n; i++) {
+    Fw32Elem *elems[] = {&pos[i].abs, &pos[i].mach, &pos[i].rel,
+                         &pos[i].dist};
+    for (int j = 0; j < 4; j++) {
+      elems[j]->data = j == 3 ? mo.dist[i] : mo.pos[i];
+      elems[j]->dec = 3;
+      elems[j]->disp = 1;
+      elems[j]->name = axis_name(i);
+      elems[j]->suff = ' ';
+    }
+  }
+  *num = n;
+  return EW_OK;
+}
+
+static short read_axes(const char *function, unsigned short libh, short axis,
+                       short length, ODBAXIS *out) {
+  Fw32Axis *data = (Fw32Axis *)out;
+  Machine *m;
+  Motion mo;
+  short ret;
+  int n = axes();
+  size_t need = offsetof(Fw32Axis, data) + (axis == ALL_AXES ? n : 1) *
+                                               sizeof(int32_t);
+
+  if ((ret = enter(function, libh, FWSIM_AXIS, &m, 1)) != EW_OK) return ret;
+  if (axis != ALL_AXES && (axis < 1 || axis > n)) return EW_ATTRIB;
+  if (length < 0 || (size_t)length < need) return EW_LENGTH;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  pthread_mutex_unlock(&m->lock);
+  data->dummy = 0;
+  data->type = axis;
+  if (axis == ALL_AXES) {
+    for (int i = 0; i < n; i++) data->data[i] = mo.pos[i];
+  } else {
+    data->data[0] = mo.pos[axis - 1];
+  }
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_absolute(unsigned short libh, short axis,
+                                   short length, ODBAXIS *data) {
+  return read_axes(__func__, libh, axis, length, data);
+}
+
+FWLIBAPI short WINAPI cnc_machine(unsigned short libh, short axis,
+                                  short length, ODBAXIS *data) {
+  return read_axes(__func__, libh, axis, length, data);
+}
+
+FWLIBAPI short WINAPI cnc_relative(unsigned short libh, short axis,
+                                   short length, ODBAXIS *data) {
+  return read_axes(__func__, libh, axis, length, data);
+}
+
+static short read_speed(const char *function, unsigned short libh,
+                         int32_t *actf, int32_t *acts) {
+  Machine *m;
+  Motion mo;
+  short ret;
+
+  if ((ret = enter(function, libh, FWSIM_AXIS, &m, 1)) != EW_OK) return ret;
+  pthread_mutex_lock(&m->lock);
+  sample_motion(m, &mo);
+  pthread_mutex_unlock(&m->lock);
+  *actf = mo.actf;
+  *acts = mo.acts;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_actf(unsigned short libh, ODBACT *out) {
+  Fw32Act *act = (Fw32Act *)out;
+  int32_t acts;
+  memset(act, 0, sizeof(*act));
+  return read_speed(__func__, libh, &act->data, &acts);
+}
+
+FWLIBAPI short WINAPI cnc_acts(unsigned short libh, ODBACT *out) {
+  Fw32Act *act = (Fw32Act *)out;
+  int32_t actf;
+  memset(act, 0, sizeof(*act));
+  return read_speed(__func__, libh, &actf, &act->data);
+}
+
+FWLIBAPI short WINAPI cnc_rdspeed(unsigned short libh, short type,
+                                  ODBSPEED *out) {
+  Fw32Speed *speed = (Fw32Speed *)out;
+  int32_t actf, acts;
+  short ret;
+
+  if (type < -1 || type > 1) return EW_ATTRIB;
+  if ((ret = read_speed(__func__, libh, &actf, &acts)) != EW_OK) return ret;
+  memset(speed, 0, sizeof(*speed));
+  speed->actf.data = actf;
+  speed->actf.disp = 1;
+  speed->actf.name = 'F';
+  speed->acts.data = acts;
+  speed->acts.unit = 2;  // rpm
+  speed->acts.disp = 1;
+  speed->acts.name = 'S';
+  return EW_OK;
+}
+
+/* one spindle, loaded by the cut: 30 to 60 % while running */
+FWLIBAPI short WINAPI cnc_rdspmeter(unsigned short libh, short type,
+                                    short *data_num, ODBSPLOAD *out) {
+  Fw32Spload *load = (Fw32Spload *)out;
+  int32_t actf, acts;
+  short ret;
+
+  if (type < -1 || type > 1) return EW_ATTRIB;
+  if (*data_num < 1) return EW_LENGTH;
+  if ((ret = read_speed(__func__, libh, &actf, &acts)) != EW_OK) return ret;
+  memset(load, 0, sizeof(*load));
+  *data_num = 1;
+  if (type != 1) {
+    load->spload.data = acts ? 30 + actf % 31 : 0;
+    load->spload.name = 'S';
+    load->spload.suff1 = '1';
+  }
+  if (type != 0) {
+    load->spspeed.data = acts;
+    load->spspeed.unit = 1;  // rpm
+    load->spspeed.name = 'S';
+    load->spspeed.suff1 = '1';
+  }
+  return EW_OK;
+}
+
+/* pmc areas are byte addressed, value k of a range is at start + k * size
+ * as in the rest of the examples */
+/* start and end are byte addresses whatever the data type, R0 .. R9 as
+ * words is five of them */
+static short pmc_range(short adr_type, short data_type, unsigned short start,
+                       unsigned short end, size_t *size) {
+  if (adr_type < 0 || adr_type >= PMC_TYPES || data_type < 0 ||
+      data_type > 5 || data_type == 3)
+    return EW_TYPE;
+  if (end < start) return EW_NUMBER;
+  *size = end - start + 1;
+  if (start + *size > PMC_BYTES) return EW_NUMBER;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI pmc_rdpmcrng(unsigned short libh, short adr_type,
+                                   short data_type, unsigned short start,
+                                   unsigned short end, unsigned short length,
+                                   IODBPMC *buf) {
+  Machine *m;
+  size_t size;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PMC, &m, 1)) != EW_OK) return ret;
+  if ((ret = pmc_range(adr_type, data_type, start, end, &size)) != EW_OK)
+    return ret;
+  if (length < 8 + size) return EW_LENGTH;
+  buf->type_a = adr_type;
+  buf->type_d = data_type;
+  buf->datano_s = start;
+  buf->datano_e = end;
+  pthread_mutex_lock(&m->lock);
+  memcpy(buf->u.cdata, &m->pmc[adr_type][start], size);
+  pthread_mutex_unlock(&m->lock);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI pmc_wrpmcrng(unsigned short libh, unsigned short length,
+                                   IODBPMC *buf) {
+  Machine *m;
+  size_t size;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PMC, &m, 1)) != EW_OK) return ret;
+  if ((ret = pmc_range(buf->type_a, buf->type_d, buf->datano_s, buf->datano_e,
+                       &size)) != EW_OK)
+    return ret;
+  if (length < 8 + size) return EW_LENGTH;
+  pthread_mutex_lock(&m->lock);
+  memcpy(&m->pmc[buf->type_a][buf->datano_s], buf->u.cdata, size);
+  pthread_mutex_unlock(&m->lock);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdmacro(unsigned short libh, short number,
+                                  short length, ODBM *out) {
+  Fw32Macro *macro = (Fw32Macro *)out;
+  Machine *m;
+  short ret;
+  double v;
+
+  (void)length;
+  if ((ret = enter(__func__, libh, FWSIM_MACRO, &m, 1)) != EW_OK) return ret;
+  if (number < 1 || number >= MACROS) return EW_NUMBER;
+  pthread_mutex_lock(&m->lock);
+  v = m->macro[number];
+  pthread_mutex_unlock(&m->lock);
+  macro->datano = number;
+  macro->dummy = 0;
+  // vacant as in the manual: value 0 and decimal point -1
+  macro->mcr_val = isnan(v) ? 0 : lround(v * 1000);
+  macro->dec_val = isnan(v) ? -1 : 3;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_wrmacro(unsigned short libh, short number,
+                                  short length, long value, short dec) {
+  Machine *m;
+  short ret;
+
+  (void)length;
+  if ((ret = enter(__func__, libh, FWSIM_MACRO, &m, 1)) != EW_OK) return ret;
+  if (number < 1 || number >= MACROS) return EW_NUMBER;
+  if (dec < 0 || dec > 8) return EW_DATA;
+  pthread_mutex_lock(&m->lock);
+  write_macro(m, number, value / pow(10, dec));
+  pthread_mutex_unlock(&m->lock);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdmacror2(unsigned short libh, unsigned long start,
+                                    unsigned long *num, double *data) {
+  Machine *m;
+  short ret;
+  unsigned long n = *(uint32_t *)num;
+
+  if ((ret = enter(__func__, libh, FWSIM_MACRO, &m, 1)) != EW_OK) return ret;
+  if (start < 1 || start >= MACROS) return EW_NUMBER;
+  if (start + n > MACROS) n = MACROS - start;
+  pthread_mutex_lock(&m->lock);
+  for (unsigned long i = 0; i < n; i++) {
+    // vacant reads as 0
+    double v = m->macro[start + i];
+    data[i] = isnan(v) ? 0 : v;
+  }
+  pthread_mutex_unlock(&m->lock);
+  *(uint32_t *)num = n;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_wrmacror2(unsigned short libh, unsigned long start,
+                                    unsigned long *num, double *data) {
+  Machine *m;
+  short ret;
+  unsigned long n = *(uint32_t *)num;
+
+  if ((ret = enter(__func__, libh, FWSIM_MACRO, &m, 1)) != EW_OK) return ret;
+  if (start < 1 || start >= MACROS) return EW_NUMBER;
+  if (start + n > MACROS) n = MACROS - start;
+  pthread_mutex_lock(&m->lock);
+  for (unsigned long i = 0; i < n; i++) write_macro(m, start + i, data[i]);
+  pthread_mutex_unlock(&m->lock);
+  *(uint32_t *)num = n;
+  return EW_OK;
+}
+
+// `m` locked, NULL when full
+static Param *find_param(Machine *m, short number, short axis, int add) {
+  unsigned h = ((unsigned)number * 31 + (unsigned)axis) % PARAMS;
+
+  for (int i = 0; i < PARAMS; i++) {
+    Param *p = &m->params[(h + i) % PARAMS];
+    if (p->used && p->number == number && p->axis == axis) return p;
+    if (!p->used) {
+      if (!add) return NULL;
+      p->used = 1;
+      p->number = number;
+      p->axis = axis;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/* size of one value from the length of an IODBPSD: char, short, long or
+ * REALPRM, for `count` axes */
+static size_t param_size(short length, int count) {
+  size_t size;
+
+  if (length <= 4 || (length - 4) % count) return 0;
+  size = (length - 4) / count;
+  if (size == 1 || size == 2 || size == sizeof(int32_t) ||
+      size == sizeof(Fw32Realprm))
+    return size;
+  return 0;
+}
+
+// `m` locked, value i of `p` from or to the axis i + first
+static void copy_param(Machine *m, Fw32Param *p, size_t size, int i,
+                       int axis, int write) {
+  Param *v = find_param(m, p->datano, axis, write);
+  long value = 0, dec = 0;
+
+  if (write && v) {
+    switch (size) {
+      case 1:
+        v->value = p->u.cdatas[i];
+        break;
+      case 2:
+        v->value = p->u.idatas[i];
+        break;
+      case sizeof(int32_t):
+        v->value = p->u.ldatas[i];
+        break;
+      default:
+        v->value = p->u.rdatas[i].prm_val;
+        v->dec = p->u.rdatas[i].dec_val;
+    }
+    return;
+  }
+  if (v) {
+    value = v->value;
+    dec = v->dec;
+  }
+  switch (size) {
+    case 1:
+      p->u.cdatas[i] = value;
+      break;
+    case 2:
+      p->u.idatas[i] = value;
+      break;
+    case sizeof(int32_t):
+      p->u.ldatas[i] = value;
+      break;
+    default:
+      p->u.rdatas[i].prm_val = value;
+      p->u.rdatas[i].dec_val = dec;
+  }
+}
+
+static short access_param(const char *function, unsigned short libh,
+                          short number, short axis, short length,
+                          Fw32Param *p, int write) {
+  Machine *m;
+  short ret;
+  int n = axes();
+  size_t size;
+
+  if ((ret = enter(function, libh, FWSIM_PARAM, &m, 1)) != EW_OK) return ret;
+  if (number < 0) return EW_NUMBER;
+  if (axis != ALL_AXES && (axis < 0 || axis > n)) return EW_ATTRIB;
+  if ((size = param_size(length, axis == ALL_AXES ? n : 1)) == 0)
+    return EW_LENGTH;
+  p->datano = number;
+  p->type = axis;
+  pthread_mutex_lock(&m->lock);
+  if (axis == ALL_AXES) {
+    for (int i = 0; i < n; i++) copy_param(m, p, size, i, i + 1, write);
+  } else {
+    copy_param(m, p, size, 0, axis, write);
+  }
+  pthread_mutex_unlock(&m->lock);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdparam(unsigned short libh, short number,
+                                  short axis, short length, IODBPSD *param) {
+  return access_param(__func__, libh, number, axis, length,
+                      (Fw32Param *)param, 0);
+}
+
+FWLIBAPI short WINAPI cnc_wrparam(unsigned short libh, short length,
+                                  IODBPSD *param) {
+  Fw32Param *p = (Fw32Param *)param;
+
+  return access_param(__func__, libh, p->datano, p->type, length, p, 1);
+}
+
+// O number of a program name, a path such as //CNC_MEM/USER/PATH1/O1000
+static long program_number(const char *name) {
+  const char *base = strrchr(name, '/');
+  char *end;
+  long number;
+
+  base = base ? base + 1 : name;
+  if (*base == 'O' || *base == 'o') base++;
+  number = strtol(base, &end, 10);
+  return end == base || *end != '\0' || number < 1 ? -1 : number;
+}
+
+// O number of the first program of downloaded text
+static long text_number(const char *text, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (text[i] == 'O' && i + 1 < len && isdigit((unsigned char)text[i + 1]))
+      return strtol(text + i + 1, NULL, 10);
+    if (text[i] != '%' && !isspace((unsigned char)text[i])) return -1;
+  }
+  return -1;
+}
+
+FWLIBAPI short WINAPI cnc_upstart4(unsigned short libh, short type,
+                                   char *name) {
+  Machine *m;
+  Handle *h;
+  const char *text = NULL;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 1)) != EW_OK) return ret;
+  if (type < 0 || type >= DATA_TYPES) return EW_ATTRIB;
+  h = &handles[libh - 1];
+  if (h->xfer != IDLE) return EW_BUSY;
+
+  pthread_mutex_lock(&m->lock);
+  if (type == 0) {
+    long number = program_number(name);
+    for (int i = 0; i < m->nprograms; i++) {
+      if (m->programs[i].number == number) text = m->programs[i].text;
+    }
+  } else {
+    text = m->data[type] ? m->data[type] : "%\n%";
+  }
+  if (text == NULL) {
+    pthread_mutex_unlock(&m->lock);
+    return EW_DATA;
+  }
+  // the handle uploads a copy, later downloads do not change it
+  free(h->buf);
+  h->len = h->cap = strlen(text);
+  h->buf = malloc(h->cap + 1);
+  if (h->buf) memcpy(h->buf, text, h->len + 1);
+  pthread_mutex_unlock(&m->lock);
+  if (h->buf == NULL) return EW_OVRFLOW;
+  h->xfer = UPLOAD;
+  h->type = type;
+  h->off = 0;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_upload4(unsigned short libh, long *len, char *buf) {
+  int32_t *want = (int32_t *)len;
+  Machine *m;
+  Handle *h;
+  size_t n;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 1)) != EW_OK) return ret;
+  h = &handles[libh - 1];
+  if (h->xfer != UPLOAD) return EW_FUNC;
+  if (*want < 0) return EW_LENGTH;
+  n = h->len - h->off;
+  if ((size_t)*want < n) n = *want;
+  memcpy(buf, h->buf + h->off, n);
+  h->off += n;
+  *want = n;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_upend4(unsigned short libh) {
+  Machine *m;
+  Handle *h;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 0)) != EW_OK) return ret;
+  h = &handles[libh - 1];
+  if (h->xfer != UPLOAD) return EW_FUNC;
+  h->xfer = IDLE;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_dwnstart4(unsigned short libh, short type,
+                                    char *folder) {
+  Machine *m;
+  Handle *h;
+  short ret;
+
+  (void)folder;
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 1)) != EW_OK) return ret;
+  if (type < 0 || type >= DATA_TYPES) return EW_ATTRIB;
+  h = &handles[libh - 1];
+  if (h->xfer != IDLE) return EW_BUSY;
+  h->xfer = DOWNLOAD;
+  h->type = type;
+  h->len = 0;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_download4(unsigned short libh, long *len,
+                                    char *data) {
+  int32_t n = *(int32_t *)len;
+  Machine *m;
+  Handle *h;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 1)) != EW_OK) return ret;
+  h = &handles[libh - 1];
+  if (h->xfer != DOWNLOAD) return EW_FUNC;
+  if (n < 0) return EW_LENGTH;
+  if (h->len + n + 1 > h->cap) {
+    size_t cap = h->cap ? h->cap : 4096;
+    char *buf;
+    while (h->len + n + 1 > cap) cap *= 2;
+    if ((buf = realloc(h->buf, cap)) == NULL) return EW_OVRFLOW;
+    h->buf = buf;
+    h->cap = cap;
+  }
+  memcpy(h->buf + h->len, data, n);
+  h->len += n;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_dwnend4(unsigned short libh) {
+  Machine *m;
+  Handle *h;
+  char *text;
+  long number = 0;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 0)) != EW_OK) return ret;
+  h = &handles[libh - 1];
+  if (h->xfer != DOWNLOAD) return EW_FUNC;
+  h->xfer = IDLE;
+  if (h->type == 0 && (number = text_number(h->buf, h->len)) < 1)
+    return EW_DATA;
+  if ((text = malloc(h->len + 1)) == NULL) return EW_OVRFLOW;
+  memcpy(text, h->buf, h->len);
+  text[h->len] = '\0';
+
+  pthread_mutex_lock(&m->lock);
+  if (h->type == 0) {
+    ret = store_program(m, number, text, h->len);
+  } else {
+    free(m->data[h->type]);
+    m->data[h->type] = text;
+  }
+  pthread_mutex_unlock(&m->lock);
+  return ret;
+}
+
+FWLIBAPI short WINAPI cnc_rdprogdir3(unsigned short libh, short type,
+                                     long *top, short *num, PRGDIR3 *out) {
+  Fw32Prgdir3 *dir = (Fw32Prgdir3 *)out;
+  int32_t *first = (int32_t *)top;
+  Machine *m;
+  short ret;
+  int n = 0;
+
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 1)) != EW_OK) return ret;
+  if (type < 0 || type > 2) return EW_ATTRIB;
+  if (*num < 1) return EW_LENGTH;
+  pthread_mutex_lock(&m->lock);
+  for (int i = 0; i < m->nprograms && n < *num; i++) {
+    Program *p = &m->programs[i];
+    Fw32Prgdir3 *d = &dir[n];
+    const char *line, *eol, *open, *close;
+    struct tm tm;
+
+    if (p->number < *first) continue;
+    memset(d, 0, sizeof(*d));
+    d->number = p->number;
+    if (type >= 1) {
+      d->length = p->len;
+      localtime_r(&p->changed, &tm);
+      d->mdate.year = d->cdate.year = tm.tm_year + 1900;
+      d->mdate.month = d->cdate.month = tm.tm_mon + 1;
+      d->mdate.day = d->cdate.day = tm.tm_mday;
+      d->mdate.hour = d->cdate.hour = tm.tm_hour;
+      d->mdate.minute = d->cdate.minute = tm.tm_min;
+    }
+    // the comment of the O line, with its parentheses
+    line = strchr(p->text, '\n');
+    line = line ? line + 1 : p->text;
+    eol = line + strcspn(line, "\n");
+    open = memchr(line, '(', eol - line);
+    close = open ? memchr(open, ')', eol - open) : NULL;
+    if (type == 2 && close) {
+      size_t len = close - open + 1;
+      if (len >= sizeof(d->comment)) len = sizeof(d->comment) - 1;
+      memcpy(d->comment, open, len);
+    }
+    *first = p->number + 1;
+    n++;
+  }
+  pthread_mutex_unlock(&m->lock);
+  *num = n;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_delete(unsigned short libh, short number) {
+  Machine *m;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_PROGRAM, &m, 1)) != EW_OK) return ret;
+  ret = EW_DATA;
+  pthread_mutex_lock(&m->lock);
+  for (int i = 0; i < m->nprograms; i++) {
+    if (m->programs[i].number != number) continue;
+    free(m->programs[i].text);
+    memmove(&m->programs[i], &m->programs[i + 1],
+            (m->nprograms - i - 1) * sizeof(Program));
+    m->nprograms--;
+    ret = EW_OK;
+    break;
+  }
+  pthread_mutex_unlock(&m->lock);
+  return ret;
+}
+
+FWLIBAPI short WINAPI cnc_alarm2(unsigned short libh, long *out) {
+  int32_t *alarm = (int32_t *)out;
+  Machine *m;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_ALARM, &m, 1)) != EW_OK) return ret;
+  pthread_mutex_lock(&m->lock);
+  *alarm = 0;
+  for (int i = 0; i < m->nalarms; i++) *alarm |= 1u << m->alarms[i].type;
+  pthread_mutex_unlock(&m->lock);
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_rdalmmsg2(unsigned short libh, short type,
+                                    short *num, ODBALMMSG2 *out) {
+  Fw32Almmsg2 *msgs = (Fw32Almmsg2 *)out;
+  Machine *m;
+  short ret;
+  int n = 0;
+
+  if ((ret = enter(__func__, libh, FWSIM_ALARM, &m, 1)) != EW_OK) return ret;
+  if (*num < 1) return EW_LENGTH;
+  pthread_mutex_lock(&m->lock);
+  for (int i = 0; i < m->nalarms && n < *num; i++) {
+    Alarm *a = &m->alarms[i];
+    if (type != -1 && type != a->type) continue;
+    memset(&msgs[n], 0, sizeof(*msgs));
+    msgs[n].alm_no = a->number;
+    msgs[n].type = a->type;
+    msgs[n].axis = 0;
+    msgs[n].msg_len = strlen(a->msg);
+    memcpy(msgs[n].alm_msg, a->msg, msgs[n].msg_len);
+    n++;
+  }
+  pthread_mutex_unlock(&m->lock);
+  *num = n;
+  return EW_OK;
+}
+
+FWLIBAPI short WINAPI cnc_reset(unsigned short libh) {
+  Machine *m;
+  short ret;
+
+  if ((ret = enter(__func__, libh, FWSIM_ALARM, &m, 1)) != EW_OK) return ret;
+  pthread_mutex_lock(&m->lock);
+  m->nalarms = 0;
+  m->macro[3000] = NAN;
+  pthread_mutex_unlock(&m->lock);
+  return EW_OK;
+}
+
+/* linked by the python extension or the poller but not simulated: EW_FUNC
+ * for a valid handle, so they load and their other calls work */
+static short unsimulated(const char *function, unsigned short libh,
+                         FwsimFamily f) {
+  Machine *m;
+  short ret;
+
+  if ((ret = enter(function, libh, f, &m, 0)) != EW_OK) return ret;
+  return EW_FUNC;
+}
+
+FWLIBAPI short WINAPI cnc_start(unsigned short libh) {
+  return unsimulated(__func__, libh, FWSIM_STATUS);
+}
+
+FWLIBAPI short WINAPI cnc_wrmdiprog(unsigned short libh, short len,
+                                    char *data) {
+  (void)len;
+  (void)data;
+  return unsimulated(__func__, libh, FWSIM_PROGRAM);
+}
+
+FWLIBAPI short WINAPI cnc_wrjogmdi(unsigned short libh, char *data) {
+  (void)data;
+  return unsimulated(__func__, libh, FWSIM_PROGRAM);
+}
+
+FWLIBAPI short WINAPI cnc_pdf_rdmain(unsigned short libh, char *path) {
+  (void)path;
+  return unsimulated(__func__, libh, FWSIM_PROGRAM);
+}
+
+FWLIBAPI short WINAPI cnc_pdf_slctmain(unsigned short libh, char *path) {
+  (void)path;
+  return unsimulated(__func__, libh, FWSIM_PROGRAM);
+}
+
+FWLIBAPI short WINAPI cnc_wropnlsgnl(unsigned short libh, IODBSGNL *sgnl) {
+  (void)sgnl;
+  return unsimulated(__func__, libh, FWSIM_STATUS);
+}
+
+FWLIBAPI short WINAPI cnc_sdtsetchnl(unsigned short libh, short num,
+                                     long type, IDBSDTCHAN *chan) {
+  (void)num;
+  (void)type;
+  (void)chan;
+  return unsimulated(__func__, libh, FWSIM_AXIS);
+}
+
+FWLIBAPI short WINAPI cnc_sdtstartsmpl(unsigned short libh, short type,
+                                       long period) {
+  (void)type;
+  (void)period;
+  return unsimulated(__func__, libh, FWSIM_AXIS);
+}
+
+FWLIBAPI short WINAPI cnc_sdtreadsmpl(unsigned short libh, short *num,
+                                      long size, ODBSD *data) {
+  (void)num;
+  (void)size;
+  (void)data;
+  return unsimulated(__func__, libh, FWSIM_AXIS);
+}
+
+FWLIBAPI short WINAPI cnc_sdtendsmpl(unsigned short libh) {
+  return unsimulated(__func__, libh, FWSIM_AXIS);
+}
+
+// no unsolicited messages, the poller reads every signal itself
+FWLIBAPI short WINAPI cnc_wrunsolicprm2(unsigned short libh, short number,
+                                        IODBUNSOLIC2 *data) {
+  (void)number;
+  (void)data;
+  return unsimulated(__func__, libh, FWSIM_PMC);
+}
+
+FWLIBAPI short WINAPI cnc_unsolicstart(unsigned short libh, short number,
+                                       HWND hwnd, unsigned long msgno,
+                                       short chkalive, short *bill) {
+  (void)number;
+  (void)hwnd;
+  (void)msgno;
+  (void)chkalive;
+  (void)bill;
+  return unsimulated(__func__, libh, FWSIM_PMC);
+}
+
+FWLIBAPI short WINAPI cnc_unsolicstop(unsigned short libh, short number) {
+  (void)number;
+  return unsimulated(__func__, libh, FWSIM_PMC);
+}
+
+FWLIBAPI short WINAPI cnc_rdunsolicmsg2(short bill, IDBUNSOLICMSG2 *data) {
+  (void)bill;
+  (void)data;
+  return EW_FUNC;
+}
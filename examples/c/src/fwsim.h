@@ -0,0 +1,89 @@
+#ifndef FW_FWSIM_H
+#define FW_FWSIM_H
+
+/* simulated libfwlib32: `fwlib32-sim` is a shared library with the soname
+ * of the real one (libfwlib32.so.1) that exports the fwlib32.h calls of
+ * the common families below, backed by an in-memory machine per ip and
+ * port. put its directory first in LD_LIBRARY_PATH to run the tools, the
+ * python extension or the go example without a cnc.
+ *
+ * every call sleeps for the latency of its family plus a uniform jitter,
+ * a share of the calls stalls for an exponentially distributed extra time
+ * and fails with `error` at the error rate of its family. the options are
+ * read from the environment on first use:
+ *   FWSIM_LATENCY=<us>[,<family>:<us>...]   e.g. "2000,pmc:500"
+ *   FWSIM_JITTER=<us>
+ *   FWSIM_STALLS=<rate>  FWSIM_STALL=<mean us>
+ *   FWSIM_ERRORS=<rate>[,<family>:<rate>...] e.g. "0,connect:0.1"
+ *   FWSIM_ERROR=<code>  (default EW_SOCKET)
+ *   FWSIM_AXES=<n>
+ *   FWSIM_SEED=<n>
+ *   FWSIM_FAULTS=<plan>  (fault.h, on top of the above)
+ *   FWSIM_SCRIPT=<file>
+ *
+ * a script drives every machine from the time it was first connected, one
+ * step per line, `#` starts a comment:
+ *   <seconds> macro <number> <value>
+ *   <seconds> pmc <adr_type> <byte address> <byte value>
+ *   <seconds> alarm <number> [<message>]
+ *   <seconds> reset               clears the alarms as cnc_reset does
+ *   repeat <seconds>              starts over every <seconds>
+ * the steps are taken in order by the first call to a machine once their
+ * time has come, on top of the built-in program cycle and sine motion.
+ *
+ * the structs with `long` fields (ODBDY2, ODBPOS, ODBSPEED, ODBM, IODBPSD,
+ * ODBACT, PRGDIR3, ...) and the `long *` arguments are filled with 32 bit
+ * words as the real library fills them, also in a 64 bit build, so read
+ * them through the mirrors of fwabi.h. cnc_rdcncid writes four 32 bit
+ * words.
+ */
+
+#include "./fault.h"
+
+typedef enum fwsim_family {
+  FWSIM_CONNECT,  // cnc_allclibhndl3, cnc_freelibhndl, cnc_rdcncid, ...
+  FWSIM_STATUS,   // cnc_statinfo, cnc_sysinfo, cnc_rdprgnum, ...
+  FWSIM_AXIS,     // cnc_rddynamic2, cnc_rdposition, cnc_rdspeed, ...
+  FWSIM_PMC,      // pmc_rdpmcrng, pmc_wrpmcrng
+  FWSIM_MACRO,    // cnc_rdmacro, cnc_wrmacro, cnc_rdmacror2, ...
+  FWSIM_PARAM,    // cnc_rdparam, cnc_wrparam
+  FWSIM_PROGRAM,  // upload, download, cnc_rdprogdir3, cnc_delete
+  FWSIM_ALARM,    // cnc_alarm2, cnc_rdalmmsg2, cnc_reset
+  FWSIM_FAMILIES,
+} FwsimFamily;
+
+typedef struct fwsim_options {
+  long latency_us[FWSIM_FAMILIES];
+  long jitter_us;
+  double error_rate[FWSIM_FAMILIES];
+  short error;
+  short axes;
+  unsigned long seed;
+  double stall_rate;  // share of calls that stall, the long tail of a cnc
+  long stall_us;      // mean of the extra time of a stall
+  const char *faults;  // fault.h plan, NULL for none
+  const char *script;  // path of a machine script, NULL for none
+} FwsimOptions;
+
+typedef struct fwsim_stats {
+  unsigned long calls[FWSIM_FAMILIES];
+  unsigned long errors[FWSIM_FAMILIES];  // injected
+  FaultStats faults;                     // of the plan
+} FwsimStats;
+
+extern const FwsimOptions default_fwsim_options;
+
+/* replaces the options, e.g. the ones read from the environment, while no
+ * calls are made. 1 when the fault plan or the script is not valid, the
+ * simulator then runs without it. */
+int fwsim_configure(const FwsimOptions *opts);
+/* "<value>[,<family>:<value>...]", a plain value sets every family */
+int fwsim_parse(const char *spec, double values[FWSIM_FAMILIES]);
+void fwsim_stats(FwsimStats *stats);
+/* axes of every machine, without a call's latency or errors */
+int fwsim_axes(void);
+/* frees all handles and machines, programs and memory start over, while no
+ * calls are made */
+void fwsim_reset(void);
+
+#endif
@@ -0,0 +1,737 @@
+#include "./fwwire.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "./clock.h"
+#include "./fwabi.h"
+#include "./fwsim.h"
+#include "fwlib32.h"
+
+/* pdu: magic, version, type and body length, big endian like everything
+ * after it */
+#define MAGIC 0xa0a0a0a0u
+#define VERSION 1
+#define HEADER 10
+#define MAX_BODY 65535
+
+#define INITIATE 0x0101
+#define INITIATE_REPLY 0x0102
+#define CLOSE 0x0201
+#define CLOSE_REPLY 0x0202
+#define REQUEST 0x2101
+#define RESPONSE 0x2102
+
+/* a request block: length, class, path, command and five arguments, then
+ * the data of a write. the response block has the same first four fields,
+ * the error, its detail, two unused bytes and the data length. */
+#define BLOCK 28
+#define REPLY_BLOCK 16
+
+#define CLASS_CNC 1
+#define CLASS_PMC 2
+
+enum {
+  CMD_PARAM = 0x0e,
+  CMD_MACRO = 0x15,
+  CMD_WRMACRO = 0x16,
+  CMD_SYSINFO = 0x18,
+  CMD_STATUS = 0x19,
+  CMD_ALARM = 0x1a,
+  CMD_PRGNUM = 0x1c,
+  CMD_SEQNUM = 0x1d,
+  CMD_DISPLAY = 0x21,
+  CMD_ACTF = 0x24,
+  CMD_ACTS = 0x25,
+  CMD_POSITION = 0x26,
+  CMD_UNIT = 0x88,
+  CMD_AXISNAME = 0x89,
+  CMD_TMMODE = 0x98,
+  CMD_MACROR2 = 0xa7,
+  CMD_WRMACROR2 = 0xa8,
+  CMD_EXEPRG = 0xcf,
+  CMD_HDCK = 0xe1,
+  CMD_CNCID = 0xe8,
+  CMD_PMC_READ = 0x8001,
+  CMD_PMC_WRITE = 0x8002,
+};
+
+/* the library reads this parameter while connecting and only sends the
+ * cnc_rddynamic2 blocks when its bit 0 is set */
+#define PARAM_DYNAMIC 9968
+
+const FwwireOptions default_fwwire_options = {1024, 0};
+
+struct conn {
+  Fwwire *w;
+  int fd;
+  pthread_t thread;
+  atomic_int done;
+  char host[INET6_ADDRSTRLEN];
+  unsigned short port;
+  unsigned short h;  // fwsim handle, 0 before the data connection starts
+  int drop;          // an injected EW_SOCKET closes the connection
+  // cnc_rddynamic2 and cnc_statinfo results shared by the blocks of a pdu
+  int have_dy;
+  short dy_ret;
+  Fw32Dy2 dy;
+  int have_st;
+  short st_ret;
+  ODBST st;
+  struct conn *next;
+};
+
+struct fwwire {
+  FwwireOptions opts;
+  int *listen_fds;
+  size_t nlisten;
+  int wake[2];
+  atomic_int stop;
+  pthread_mutex_t lock;
+  struct conn *conns;
+  FwwireStats stats;
+};
+
+typedef struct out {
+  unsigned char buf[MAX_BODY];
+  size_t len;
+  int full;
+} Out;
+
+static void put(Out *o, const void *p, size_t n) {
+  if (o->full || o->len + n > sizeof(o->buf)) {
+    o->full = 1;
+    return;
+  }
+  memcpy(o->buf + o->len, p, n);
+  o->len += n;
+}
+
+static void put16(Out *o, int v) {
+  unsigned char b[2] = {(v >> 8) & 0xff, v & 0xff};
+  put(o, b, sizeof(b));
+}
+
+static void put32(Out *o, long v) {
+  unsigned char b[4] = {(v >> 24) & 0xff, (v >> 16) & 0xff, (v >> 8) & 0xff,
+                        v & 0xff};
+  put(o, b, sizeof(b));
+}
+
+static void put_double(Out *o, double v) {
+  uint64_t u;
+  memcpy(&u, &v, sizeof(u));
+  put32(o, (long)(u >> 32));
+  put32(o, (long)(u & 0xffffffff));
+}
+
+static void set16(unsigned char *p, int v) {
+  p[0] = (v >> 8) & 0xff;
+  p[1] = v & 0xff;
+}
+
+static int get16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+
+static int32_t get32(const unsigned char *p) {
+  return (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+                   (uint32_t)p[2] << 8 | p[3]);
+}
+
+static double get_double(const unsigned char *p) {
+  uint64_t u = (uint64_t)(uint32_t)get32(p) << 32 | (uint32_t)get32(p + 4);
+  double v;
+  memcpy(&v, &u, sizeof(v));
+  return v;
+}
+
+static int read_all(int fd, void *buf, size_t n) {
+  size_t got = 0;
+
+  while (got < n) {
+    ssize_t r = recv(fd, (char *)buf + got, n - got, 0);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return -1;
+    got += r;
+  }
+  return 0;
+}
+
+static int send_pdu(int fd, int type, const void *body, size_t len) {
+  unsigned char header[HEADER] = {0xa0, 0xa0, 0xa0, 0xa0};
+  struct iovec iov[2] = {{header, HEADER}, {(void *)body, len}};
+  struct msghdr msg = {0};
+
+  set16(header + 4, VERSION);
+  set16(header + 6, type);
+  set16(header + 8, len);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = len ? 2 : 1;
+  return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)(HEADER + len) ? 0 : -1;
+}
+
+/* macro values travel as a mantissa and a binary exponent, 0 and -1 for
+ * vacant */
+static void put_macro(Out *o, const Fw32Macro *m) {
+  int e;
+  double f;
+
+  if (m->mcr_val == 0 && m->dec_val < 0) {
+    put32(o, 0);
+    put16(o, -1);
+    put16(o, -1);
+    return;
+  }
+  f = frexp(m->mcr_val / pow(10, m->dec_val), &e);
+  put32(o, lround(f * (1 << 30)));
+  put16(o, 0);
+  put16(o, 30 - e);
+}
+
+static double get_macro(const unsigned char *p) {
+  int32_t mant = get32(p);
+  short e = get16(p + 6);
+
+  if (mant == 0 && e == -1) return NAN;
+  return ldexp(mant, -e);
+}
+
+static short open_machine(struct conn *c) {
+  short ret;
+
+  if (c->h) return EW_OK;
+  if ((ret = cnc_allclibhndl3(c->host, c->port, 10, &c->h)) != EW_OK)
+    c->h = 0;
+  return ret;
+}
+
+/* the second connection of a handle announces its axes and paths, the
+ * first one gets an empty answer */
+static int initiate(struct conn *c, const unsigned char *body, size_t len) {
+  Out *o = calloc(1, sizeof(*o));
+  int ret = -1;
+
+  if (o == NULL) return -1;
+  if (len >= 2 && get16(body) == 2) {
+    if (open_machine(c) != EW_OK) goto done;
+    put16(o, 0);
+    put16(o, 0);  // 2 and 3 make the library ask for more
+    put16(o, fwsim_axes());
+    put16(o, 0);
+    put16(o, 1);  // paths
+    put16(o, 0);
+    put16(o, 0);
+    put16(o, 0);
+    // per path: " T" for a lathe or " M", then its axes
+    put(o, " M", 2);
+    put16(o, 1);
+    put16(o, fwsim_axes());
+    put16(o, 1);
+  } else {
+    for (int i = 0; i < 8; i++) put16(o, 0);
+  }
+  ret = send_pdu(c->fd, INITIATE_REPLY, o->buf, o->len);
+done:
+  free(o);
+  return ret;
+}
+
+static short dynamic(struct conn *c) {
+  if (!c->have_dy) {
+    c->dy_ret = cnc_rddynamic2(c->h, ALL_AXES, sizeof(c->dy),
+                               (ODBDY2 *)&c->dy);
+    c->have_dy = 1;
+  }
+  return c->dy_ret;
+}
+
+static short status(struct conn *c) {
+  if (!c->have_st) {
+    c->st_ret = cnc_statinfo(c->h, &c->st);
+    c->have_st = 1;
+  }
+  return c->st_ret;
+}
+
+static short position(struct conn *c, int type, int axis, Out *o) {
+  int n = fwsim_axes();
+  short ret;
+
+  if (axis != ALL_AXES && (axis < 1 || axis > n)) return EW_ATTRIB;
+  if ((ret = dynamic(c)) != EW_OK) return ret;
+  for (int i = 0; i < n; i++) {
+    int32_t *pos[] = {c->dy.pos.faxis.absolute, c->dy.pos.faxis.machine,
+                      c->dy.pos.faxis.relative, c->dy.pos.faxis.distance};
+    if (axis != ALL_AXES && i != axis - 1) continue;
+    // absolute, machine, relative, distance to go, from 4 on the same
+    put32(o, pos[type & 3][i]);
+    put32(o, 0);
+  }
+  return EW_OK;
+}
+
+static short param(struct conn *c, int number, int axis, Out *o) {
+  Fw32Param p;
+  int n = axis == ALL_AXES ? fwsim_axes() : 1;
+  short ret;
+
+  ret = cnc_rdparam(c->h, number, axis, 4 + n * sizeof(int32_t),
+                    (IODBPSD *)&p);
+  if (ret != EW_OK) return ret;
+  put32(o, number);
+  put16(o, axis);
+  put16(o, 3);  // long, the others are bit, byte and word
+  for (int i = 0; i < n; i++) {
+    long v = p.u.ldatas[i];
+    put32(o, number == PARAM_DYNAMIC ? v | 1 : v);
+  }
+  return EW_OK;
+}
+
+static short pmc(struct conn *c, int cmd, const int32_t *args,
+                 const unsigned char *data, size_t size, Out *o) {
+  static const size_t bytes[] = {1, 2, 4, 0, 4, 8};
+  int start = args[0], end = args[1], adr = args[2], type = args[3];
+  size_t n, width;
+  IODBPMC *buf;
+  short ret;
+
+  if (type < 0 || type > 5 || bytes[type] == 0) return EW_TYPE;
+  if (start < 0 || end < start || end > 65535) return EW_NUMBER;
+  width = bytes[type];
+  // values between the byte addresses start and end
+  if ((n = (end - start + 1) / width) == 0) return EW_LENGTH;
+  if (cmd == CMD_PMC_WRITE) {
+    // as many values as the library sent
+    if (args[4] < 0 || (size_t)args[4] > size) return EW_LENGTH;
+    if (args[4] / width < n) n = args[4] / width;
+    if (n == 0) return EW_LENGTH;
+  }
+  if (8 + n * width > MAX_BODY) return EW_OVRFLOW;
+  if ((buf = calloc(1, 8 + n * width)) == NULL) return EW_BUFFER;
+
+  if (cmd == CMD_PMC_READ) {
+    ret = pmc_rdpmcrng(c->h, adr, type, start, start + n * width - 1,
+                       8 + n * width, buf);
+    for (size_t i = 0; ret == EW_OK && i < n * width; i += width) {
+      for (size_t k = 0; k < width; k++)
+        put(o, &buf->u.cdata[i + width - 1 - k], 1);
+    }
+  } else {
+    buf->type_a = adr;
+    buf->type_d = type;
+    buf->datano_s = start;
+    buf->datano_e = start + n * width - 1;
+    for (size_t i = 0; i < n * width; i += width) {
+      for (size_t k = 0; k < width; k++)
+        buf->u.cdata[i + width - 1 - k] = data[i + k];
+    }
+    ret = pmc_wrpmcrng(c->h, 8 + n * width, buf);
+  }
+  free(buf);
+  return ret;
+}
+
+static short cnc(struct conn *c, int cmd, const int32_t *args,
+                 const unsigned char *data, size_t size, Out *o) {
+  short ret = EW_OK;
+
+  switch (cmd) {
+    case CMD_SYSINFO: {
+      ODBSYS sys;
+      if ((ret = cnc_sysinfo(c->h, &sys)) != EW_OK) return ret;
+      put16(o, sys.addinfo);
+      put16(o, sys.max_axis);
+      put(o, sys.cnc_type, sizeof(sys) - offsetof(ODBSYS, cnc_type));
+      return EW_OK;
+    }
+    case CMD_CNCID: {
+      uint32_t id[4];
+      if ((ret = cnc_rdcncid(c->h, (unsigned long *)id)) != EW_OK) return ret;
+      for (int i = 0; i < 4; i++) put32(o, id[i]);
+      return EW_OK;
+    }
+    case CMD_STATUS:
+      if ((ret = status(c)) != EW_OK) return ret;
+      put16(o, c->st.aut);
+      put16(o, c->st.run);
+      put16(o, c->st.motion);
+      put16(o, c->st.mstb);
+      put16(o, c->st.emergency);
+      put16(o, c->st.alarm);
+      put16(o, c->st.edit);
+      return EW_OK;
+    case CMD_HDCK:
+    case CMD_TMMODE:
+      if ((ret = status(c)) != EW_OK) return ret;
+      put16(o, cmd == CMD_HDCK ? c->st.hdck : c->st.tmmode);
+      return EW_OK;
+    case CMD_ALARM:
+    case CMD_PRGNUM:
+    case CMD_SEQNUM:
+    case CMD_ACTF:
+    case CMD_ACTS:
+      if ((ret = dynamic(c)) != EW_OK) return ret;
+      if (cmd == CMD_ALARM) put32(o, c->dy.alarm);
+      if (cmd == CMD_PRGNUM) {
+        put32(o, c->dy.prgnum);
+        put32(o, c->dy.prgmnum);
+      }
+      if (cmd == CMD_SEQNUM) put32(o, c->dy.seqnum);
+      if (cmd == CMD_ACTF || cmd == CMD_ACTS) {
+        put32(o, cmd == CMD_ACTF ? c->dy.actf : c->dy.acts);
+        put32(o, 0);
+      }
+      return EW_OK;
+    case CMD_POSITION:
+      return position(c, args[0], args[1], o);
+    case CMD_UNIT:
+    case CMD_DISPLAY:
+      // read along with speeds and positions, zeros keep the defaults
+      put32(o, 0);
+      return EW_OK;
+    case CMD_AXISNAME: {
+      ODBAXISNAME names[MAX_AXIS];
+      short n = MAX_AXIS;
+      if ((ret = cnc_rdaxisname(c->h, &n, names)) != EW_OK) return ret;
+      for (int i = 0; i < n; i++) {
+        put(o, &names[i].name, 1);
+        put(o, &names[i].suff, 1);
+        put16(o, 0);
+      }
+      return EW_OK;
+    }
+    case CMD_EXEPRG: {
+      Fw32Exeprg prog;
+      if ((ret = cnc_exeprgname(c->h, (ODBEXEPRG *)&prog)) != EW_OK)
+        return ret;
+      put32(o, prog.o_num);
+      put(o, prog.name, sizeof(prog.name));
+      return EW_OK;
+    }
+    case CMD_PARAM:
+      return param(c, args[0], args[2], o);
+    case CMD_MACRO: {
+      Fw32Macro m;
+      if ((ret = cnc_rdmacro(c->h, args[0], sizeof(m), (ODBM *)&m)) != EW_OK)
+        return ret;
+      put_macro(o, &m);
+      return EW_OK;
+    }
+    case CMD_WRMACRO: {
+      unsigned long n = 1;
+      double v;
+      if (size < 8) return EW_LENGTH;
+      v = get_macro(data);
+      return cnc_wrmacror2(c->h, args[0], &n, &v);
+    }
+    case CMD_MACROR2:
+    case CMD_WRMACROR2: {
+      unsigned long n;
+      double *v;
+      if (args[0] < 0 || (cmd == CMD_MACROR2 && args[1] < 0))
+        return EW_LENGTH;
+      // a read asks for a count of values, a write carries them
+      n = cmd == CMD_MACROR2 ? (unsigned long)args[1] : size / 8;
+      if (n == 0 || n > (unsigned long)(MAX_BODY - REPLY_BLOCK) / 8)
+        return EW_LENGTH;
+      if ((v = calloc(n, sizeof(*v))) == NULL) return EW_BUFFER;
+      if (cmd == CMD_MACROR2) {
+        ret = cnc_rdmacror2(c->h, args[0], &n, v);
+        for (unsigned long i = 0; ret == EW_OK && i < n; i++)
+          put_double(o, v[i]);
+      } else {
+        for (unsigned long i = 0; i < n; i++) v[i] = get_double(data + i * 8);
+        ret = cnc_wrmacror2(c->h, args[0], &n, v);
+        // the library hands the count in the answer back as *num
+        if (ret == EW_OK) put32(o, n);
+      }
+      free(v);
+      return ret;
+    }
+    default:
+      return EW_FUNC;
+  }
+}
+
+static void count(Fwwire *w, unsigned long *stat, unsigned long n) {
+  pthread_mutex_lock(&w->lock);
+  *stat += n;
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* answers every block of a request pdu, in order */
+static int request(struct conn *c, const unsigned char *body, size_t len) {
+  Out *o;
+  int n, sent;
+  size_t off = 2;
+
+  if ((o = calloc(1, sizeof(*o))) == NULL) return -1;
+  // the library checks the block count of an empty request too
+  n = len >= 2 ? get16(body) : 0;
+  put16(o, len >= 2 ? n : 1);
+  c->have_dy = c->have_st = 0;
+  count(c->w, &c->w->stats.pdus, 1);
+  count(c->w, &c->w->stats.blocks, n);
+
+  for (int i = 0; i < n && !c->drop; i++) {
+    int size = off + 2 <= len ? get16(body + off) : 0;
+    const unsigned char *b = body + off;
+    int32_t args[5];
+    size_t start = o->len;
+    short ret;
+
+    if (size < BLOCK || off + size > len) {
+      free(o);
+      return -1;
+    }
+    for (int k = 0; k < 5; k++) args[k] = get32(b + 8 + 4 * k);
+    put(o, b, 8);  // length is set below
+    put(o, (unsigned char[8]){0}, 8);
+
+    if (c->h == 0 && (ret = open_machine(c)) != EW_OK) {
+      // no machine, the rest of the pdu fails the same way
+    } else if (get16(b + 2) == CLASS_PMC &&
+               (get16(b + 6) == CMD_PMC_READ ||
+                get16(b + 6) == CMD_PMC_WRITE)) {
+      ret = pmc(c, get16(b + 6), args, b + BLOCK, size - BLOCK, o);
+    } else if (get16(b + 2) == CLASS_CNC) {
+      ret = cnc(c, get16(b + 6), args, b + BLOCK, size - BLOCK, o);
+    } else {
+      ret = EW_FUNC;
+    }
+    if (ret == EW_FUNC) count(c->w, &c->w->stats.unsupported, 1);
+    if (ret == EW_SOCKET) c->drop = 1;
+    if (o->full) {
+      o->full = 0;
+      ret = EW_OVRFLOW;
+    }
+    if (ret != EW_OK) o->len = start + REPLY_BLOCK;
+    set16(o->buf + start, o->len - start);
+    set16(o->buf + start + 8, ret);
+    set16(o->buf + start + 14, o->len - start - REPLY_BLOCK);
+    off += size;
+  }
+  sent = c->drop ? -1 : send_pdu(c->fd, RESPONSE, o->buf, o->len);
+  free(o);
+  return sent;
+}
+
+static void *serve(void *arg) {
+  struct conn *c = arg;
+  unsigned char header[HEADER];
+  unsigned char *body = malloc(MAX_BODY);
+
+  while (body && !atomic_load(&c->w->stop) &&
+         read_all(c->fd, header, HEADER) == 0) {
+    size_t len = get16(header + 8);
+    int type = get16(header + 6);
+    int failed = 0;
+
+    if ((uint32_t)get32(header) != MAGIC || read_all(c->fd, body, len) != 0)
+      break;
+    if (type == INITIATE) {
+      failed = initiate(c, body, len);
+    } else if (type == REQUEST) {
+      failed = request(c, body, len);
+    } else if (type == CLOSE) {
+      send_pdu(c->fd, CLOSE_REPLY, NULL, 0);
+      break;
+    }
+    if (failed) break;
+  }
+  free(body);
+  if (c->h) cnc_freelibhndl(c->h);
+  shutdown(c->fd, SHUT_RDWR);
+  atomic_store(&c->done, 1);
+  return NULL;
+}
+
+static void accept_conn(Fwwire *w, int listen_fd) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  struct conn *c;
+  int one = 1;
+  int fd;
+
+  if ((fd = accept(listen_fd, NULL, NULL)) < 0) return;
+  if ((c = calloc(1, sizeof(*c))) == NULL ||
+      getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0 ||
+      getnameinfo((struct sockaddr *)&addr, addr_len, c->host,
+                  sizeof(c->host), NULL, 0, NI_NUMERICHOST) != 0) {
+    free(c);
+    close(fd);
+    return;
+  }
+  c->port = ntohs(addr.ss_family == AF_INET6
+                      ? ((struct sockaddr_in6 *)&addr)->sin6_port
+                      : ((struct sockaddr_in *)&addr)->sin_port);
+  c->w = w;
+  c->fd = fd;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (w->opts.idle_ms > 0) {
+    struct timeval tv = {w->opts.idle_ms / 1000,
+                         (w->opts.idle_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  if (pthread_create(&c->thread, NULL, serve, c) != 0) {
+    close(fd);
+    free(c);
+    return;
+  }
+  pthread_mutex_lock(&w->lock);
+  c->next = w->conns;
+  w->conns = c;
+  w->stats.connections++;
+  w->stats.open++;
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* joins the threads of closed connections */
+static void reap_conns(Fwwire *w, int all) {
+  struct conn **p = &w->conns;
+
+  pthread_mutex_lock(&w->lock);
+  while (*p) {
+    struct conn *c = *p;
+    if (!all && !atomic_load(&c->done)) {
+      p = &c->next;
+      continue;
+    }
+    *p = c->next;
+    w->stats.open--;
+    pthread_mutex_unlock(&w->lock);
+    if (all) shutdown(c->fd, SHUT_RDWR);
+    pthread_join(c->thread, NULL);
+    close(c->fd);
+    free(c);
+    pthread_mutex_lock(&w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+static int listen_on(const char *addr, unsigned short port) {
+  struct addrinfo hints = {0}, *ai;
+  char service[8];
+  int one = 1;
+  int fd = -1;
+
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(addr, service, &hints, &ai) != 0) return -1;
+  if ((fd = socket(ai->ai_family, SOCK_STREAM, 0)) >= 0) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(ai);
+  return fd;
+}
+
+Fwwire *fwwire_create(const char *const *addrs, size_t naddrs,
+                      unsigned short port, int ports,
+                      const FwwireOptions *opts) {
+  Fwwire *w;
+
+  if (naddrs == 0 || ports < 1 || port + ports - 1 > 65535) return NULL;
+  if ((w = calloc(1, sizeof(*w))) == NULL) return NULL;
+  w->opts = opts ? *opts : default_fwwire_options;
+  w->wake[0] = w->wake[1] = -1;
+  pthread_mutex_init(&w->lock, NULL);
+  if ((w->listen_fds = calloc(naddrs * ports, sizeof(int))) == NULL ||
+      pipe(w->wake) != 0) {
+    fwwire_destroy(w);
+    return NULL;
+  }
+  for (size_t i = 0; i < naddrs; i++) {
+    for (int k = 0; k < ports; k++) {
+      int fd = listen_on(addrs[i], port + k);
+      if (fd < 0) {
+        fprintf(stderr, "Failed to listen on %s:%d!\n", addrs[i], port + k);
+        fwwire_destroy(w);
+        return NULL;
+      }
+      w->listen_fds[w->nlisten++] = fd;
+    }
+  }
+  for (int i = 0; i < 2; i++) {
+    int flags = fcntl(w->wake[i], F_GETFL);
+    fcntl(w->wake[i], F_SETFL, flags | O_NONBLOCK);
+  }
+  return w;
+}
+
+void fwwire_destroy(Fwwire *w) {
+  if (w == NULL) return;
+
+  atomic_store(&w->stop, 1);
+  reap_conns(w, 1);
+  for (size_t i = 0; i < w->nlisten; i++) close(w->listen_fds[i]);
+  if (w->wake[0] >= 0) close(w->wake[0]);
+  if (w->wake[1] >= 0) close(w->wake[1]);
+  pthread_mutex_destroy(&w->lock);
+  free(w->listen_fds);
+  free(w);
+}
+
+void fwwire_run(Fwwire *w, long timeout_ms) {
+  double end = timeout_ms >= 0 ? now() + timeout_ms / 1000.0 : 0;
+  struct pollfd *fds = calloc(w->nlisten + 1, sizeof(*fds));
+  char drain[16];
+  int wait = -1;
+
+  while (fds && !atomic_load(&w->stop)) {
+    int full;
+    if (timeout_ms >= 0 && (wait = (end - now()) * 1000) <= 0) break;
+    // closed connections are noticed at least once a second
+    if (wait < 0 || wait > 1000) wait = 1000;
+
+    pthread_mutex_lock(&w->lock);
+    full = w->stats.open >= w->opts.max_connections;
+    pthread_mutex_unlock(&w->lock);
+    fds[0].fd = w->wake[0];
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < w->nlisten; i++) {
+      fds[i + 1].fd = full ? -1 : w->listen_fds[i];
+      fds[i + 1].events = POLLIN;
+    }
+    if (poll(fds, w->nlisten + 1, wait) < 0 && errno != EINTR) break;
+    while (read(w->wake[0], drain, sizeof(drain)) > 0) {
+    }
+    for (size_t i = 0; i < w->nlisten; i++) {
+      if (fds[i + 1].revents) accept_conn(w, w->listen_fds[i]);
+    }
+    reap_conns(w, 0);
+  }
+  atomic_store(&w->stop, 0);
+  free(fds);
+}
+
+void fwwire_stop(Fwwire *w) {
+  atomic_store(&w->stop, 1);
+  if (write(w->wake[1], "s", 1) < 0) {
+    // already woken up
+  }
+}
+
+void fwwire_stats(Fwwire *w, FwwireStats *stats) {
+  pthread_mutex_lock(&w->lock);
+  *stats = w->stats;
+  pthread_mutex_unlock(&w->lock);
+}
@@ -0,0 +1,54 @@
+#ifndef FW_FWWIRE_H
+#define FW_FWWIRE_H
+
+#include <stddef.h>
+
+/* FOCAS/Ethernet simulator: answers the real libfwlib32 over tcp with the
+ * machines of fwsim.c, one machine per local address and port a client
+ * connected to, so one process stands in for hundreds of controllers on
+ * consecutive ports or loopback aliases (127.0.0.0/8 needs no setup).
+ *
+ * the library opens two connections per handle and sends its calls as
+ * PDUs of request blocks on the second one. the blocks of the common
+ * families are served: connect, cnc_sysinfo, cnc_rdcncid, cnc_statinfo,
+ * cnc_rddynamic2 and its parts (positions, speeds, program and sequence
+ * number, alarm), pmc_rdpmcrng / pmc_wrpmcrng, cnc_rdmacro / wrmacro,
+ * cnc_rdmacror2 / wrmacror2, cnc_rdparam and cnc_exeprgname. others are
+ * answered with EW_FUNC. latency and errors are fwsim's FWSIM_* options,
+ * an injected EW_SOCKET drops the connection. FWSIM_SCRIPT scripts what
+ * the machines do over time. */
+
+#define FWWIRE_PORT 8193
+
+typedef struct fwwire_options {
+  int max_connections;  // further connections wait in the backlog
+  long idle_ms;         // close connections quiet for this long, 0 never
+} FwwireOptions;
+
+extern const FwwireOptions default_fwwire_options;
+
+typedef struct fwwire_stats {
+  unsigned long connections;  // accepted so far
+  unsigned long pdus;
+  unsigned long blocks;
+  unsigned long unsupported;  // blocks answered with EW_FUNC
+  int open;
+} FwwireStats;
+
+typedef struct fwwire Fwwire;
+
+/* listens on `ports` consecutive ports from `port` of each of the
+ * `naddrs` addresses, NULL if any of them fails */
+Fwwire *fwwire_create(const char *const *addrs, size_t naddrs,
+                      unsigned short port, int ports,
+                      const FwwireOptions *opts);
+/* closes the listeners and every connection */
+void fwwire_destroy(Fwwire *w);
+/* accept connections until fwwire_stop or timeout_ms passed, -1 for no
+ * timeout, each connection is served by a thread of its own */
+void fwwire_run(Fwwire *w, long timeout_ms);
+/* safe from other threads and signal handlers */
+void fwwire_stop(Fwwire *w);
+void fwwire_stats(Fwwire *w, FwwireStats *stats);
+
+#endif
@@ -0,0 +1,148 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./fwwire.h"
+#include "fwlib32.h"
+
+#define MAX_ADDRS 1024
+
+static struct option options[] = {{"listen", required_argument, NULL, 'l'},
+                                  {"aliases", required_argument, NULL, 'a'},
+                                  {"port", required_argument, NULL, 'p'},
+                                  {"ports", required_argument, NULL, 'n'},
+                                  {"connections", required_argument, NULL, 'c'},
+                                  {"idle", required_argument, NULL, 'i'},
+                                  {NULL, 0, NULL, 0}};
+
+static Fwwire *wire;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--listen=<address>]... [--aliases=<addresses from each>] "
+          "[--port=<first port>] [--ports=<ports per address>] "
+          "[--connections=<max>] [--idle=<ms>]\n",
+          name);
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  fwwire_stop(wire);
+}
+
+/* `n` consecutive ipv4 addresses from `first`, 127.0.0.1 -> 127.0.0.2 ... */
+static int add_aliases(const char *first, int n, char **addrs, size_t *naddrs) {
+  struct in_addr a;
+
+  if (n == 1) {
+    if (*naddrs == MAX_ADDRS || (addrs[*naddrs] = strdup(first)) == NULL)
+      return 1;
+    (*naddrs)++;
+    return 0;
+  }
+  if (inet_pton(AF_INET, first, &a) != 1) {
+    fprintf(stderr, "aliases need an ipv4 address: \"%s\"\n", first);
+    return 1;
+  }
+  for (int i = 0; i < n; i++) {
+    char buf[INET_ADDRSTRLEN];
+    struct in_addr b = {htonl(ntohl(a.s_addr) + i)};
+    if (*naddrs == MAX_ADDRS) {
+      fprintf(stderr, "more than %d addresses\n", MAX_ADDRS);
+      return 1;
+    }
+    inet_ntop(AF_INET, &b, buf, sizeof(buf));
+    if ((addrs[*naddrs] = strdup(buf)) == NULL) return 1;
+    (*naddrs)++;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  FwwireOptions opts = default_fwwire_options;
+  const char *listen[MAX_ADDRS];
+  char *addrs[MAX_ADDRS];
+  size_t nlisten = 0;
+  size_t naddrs = 0;
+  int aliases = 1;
+  int port = FWWIRE_PORT;
+  int ports = 1;
+  FwwireStats stats;
+  int failed = 0;
+  int c;
+  int i = 0;
+
+  while ((c = getopt_long(argc, argv, "", options, &i)) != -1) {
+    switch (c) {
+      case 'l':
+        if (nlisten == MAX_ADDRS) {
+          fprintf(stderr, "more than %d addresses\n", MAX_ADDRS);
+          return EXIT_FAILURE;
+        }
+        listen[nlisten++] = optarg;
+        break;
+      case 'a':
+        if ((aliases = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid aliases: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'p':
+        if ((port = atoi(optarg)) < 1 || port > 65535) {
+          fprintf(stderr, "invalid port: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'n':
+        if ((ports = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid ports: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'c':
+        if ((opts.max_connections = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid connections: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'i':
+        if ((opts.idle_ms = atol(optarg)) < 0) {
+          fprintf(stderr, "invalid idle: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (nlisten == 0) listen[nlisten++] = "0.0.0.0";
+  for (size_t k = 0; k < nlisten && !failed; k++)
+    failed = add_aliases(listen[k], aliases, addrs, &naddrs);
+
+  // the machines of the simulated library, FWSIM_* set their behaviour
+  if (!failed && cnc_startupprocess(0, "focas.log") != EW_OK) {
+    fprintf(stderr, "Failed to create required log file!\n");
+    failed = 1;
+  }
+  if (!failed && (wire = fwwire_create((const char *const *)addrs, naddrs,
+                                       port, ports, &opts)) == NULL)
+    failed = 1;
+  if (!failed) {
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    fwwire_run(wire, -1);
+    fwwire_stats(wire, &stats);
+    printf("%lu connections, %lu PDUs, %lu blocks, %lu unsupported\n",
+           stats.connections, stats.pdus, stats.blocks, stats.unsupported);
+    fwwire_destroy(wire);
+    cnc_exitprocess();
+  }
+
+  for (size_t k = 0; k < naddrs; k++) free(addrs[k]);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#ifndef FW_HISTOGRAM_H
+#define FW_HISTOGRAM_H
+
+/* the latency histograms and return code counts of the FOCAS calls, the
+ * same for callstats.h and focastrace.h so their numbers compare. the
+ * histograms are log-linear like HdrHistogram: 16 linear buckets per power
+ * of two, so a quantile is within 1/16 of the value, from 1 ns to 68 s. */
+
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS 544  // (36 - HIST_SUB_BITS + 2) << HIST_SUB_BITS
+#define HIST_MAX_NS ((1ull << 36) - 1)
+#define HIST_CODES 40  // EW_PROTOCOL (-17) .. 21, then any other
+#define HIST_MIN_CODE (-17)
+
+static inline int hist_bucket(unsigned long long ns) {
+  int shift;
+
+  if (ns > HIST_MAX_NS) ns = HIST_MAX_NS;
+  shift = 63 - __builtin_clzll(ns | 1) - HIST_SUB_BITS;
+  if (shift < 0) shift = 0;
+  return (shift << HIST_SUB_BITS) + (int)(ns >> shift);
+}
+
+/* lowest and highest ns counted in bucket b */
+static inline unsigned long long hist_bucket_low(int b) {
+  int shift = b < 2 << HIST_SUB_BITS ? 0 : (b >> HIST_SUB_BITS) - 1;
+  return (unsigned long long)(b - (shift << HIST_SUB_BITS)) << shift;
+}
+
+static inline unsigned long long hist_bucket_high(int b) {
+  int shift = b < 2 << HIST_SUB_BITS ? 0 : (b >> HIST_SUB_BITS) - 1;
+  return hist_bucket_low(b) + (1ull << shift) - 1;
+}
+
+/* the latency below which a share q of the calls finished, in ns: the
+ * highest value of its bucket, as HdrHistogram reports it, and no more
+ * than the slowest call */
+static inline double hist_quantile(const unsigned long long *hist,
+                                   unsigned long long max_ns, double q) {
+  unsigned long long total = 0;
+  unsigned long long seen = 0;
+
+  for (int b = 0; b < HIST_BUCKETS; b++) total += hist[b];
+  if (total == 0) return 0;
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    seen += hist[b];
+    if (seen >= q * total) {
+      unsigned long long high = hist_bucket_high(b);
+      return high < max_ns ? high : max_ns;
+    }
+  }
+  return max_ns;
+}
+
+/* index of a return code in the counts, HIST_CODES - 1 is any other */
+static inline int hist_code_index(short rc) {
+  int i = rc - HIST_MIN_CODE;
+  return i >= 0 && i < HIST_CODES - 1 ? i : HIST_CODES - 1;
+}
+
+static inline short hist_code(int index) {
+  return (short)(index + HIST_MIN_CODE);
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include "./loadgen.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "./clock.h"
+#include "./poller.h"
+#include "fwlib32.h"
+
+// handles are opened by this many threads at once, like a host starting up
+#define CONNECTORS 32
+
+const LoadOptions default_load_options = {100, 4, 1, 5.0, 1.5};
+
+/* what the value callback saw of one machine */
+struct tally {
+  const LoadOptions *opts;
+  double last;  // completion of the last cycle
+  unsigned long cycles;
+  unsigned long misses;
+  unsigned long errors;
+  double max_late;
+};
+
+struct worker {
+  Poller *p;
+  long ms;
+  pthread_t thread;
+};
+
+struct connector {
+  unsigned short *h;
+  int first;
+  int machines;
+  pthread_t thread;
+};
+
+static double cpu_seconds(void) {
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec +
+         ru.ru_stime.tv_usec / 1e6;
+}
+
+static long resident_bytes(void) {
+  FILE *f = fopen("/proc/self/statm", "r");
+  long size, pages = 0;
+
+  if (f == NULL) return 0;
+  if (fscanf(f, "%ld %ld", &size, &pages) != 2) pages = 0;
+  fclose(f);
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+/* status, dynamic data, then pmc ranges and macro variables in turn */
+static void fill_signals(Signal *sig, int n) {
+  memset(sig, 0, n * sizeof(*sig));
+  for (int i = 0; i < n; i++) {
+    if (i == 0) {
+      sig[i].kind = SIGNAL_STATUS;
+    } else if (i == 1) {
+      sig[i].kind = SIGNAL_DYNAMIC;
+      sig[i].addr = ALL_AXES;
+    } else if (i % 2 == 0) {
+      sig[i].kind = SIGNAL_PMC;
+      sig[i].addr = 5;  // R
+      sig[i].no = (i / 2 - 1) * 32;
+      sig[i].size = 32;
+    } else {
+      sig[i].kind = SIGNAL_MACRO;
+      sig[i].no = 100 + (i / 2 - 1) * 10;
+      sig[i].size = 10;
+    }
+  }
+}
+
+static void on_value(const ValueUpdate *update, void *ctx) {
+  struct tally *t = ctx;
+  double interval = t->opts->interval_ms / 1e3;
+  double done;
+
+  if (update->err != EW_OK) t->errors++;
+  // the status is read first, so it starts every cycle
+  if (update->signal != 0) return;
+  done = now();
+  if (t->last > 0) {
+    double late = done - t->last - interval;
+    if (late > t->max_late) t->max_late = late;
+    if (done - t->last > interval * t->opts->miss_factor) t->misses++;
+  }
+  t->last = done;
+  t->cycles++;
+}
+
+// 10.0.0.1, 10.0.0.2, ... one controller each
+static void *connect_machines(void *arg) {
+  struct connector *c = arg;
+
+  for (int i = c->first; i < c->machines; i += CONNECTORS) {
+    char host[32];
+    snprintf(host, sizeof(host), "10.%d.%d.%d", (i + 1) >> 16 & 255,
+             (i + 1) >> 8 & 255, (i + 1) & 255);
+    if (cnc_allclibhndl3(host, 8193, 10, &c->h[i]) != EW_OK) c->h[i] = 0;
+  }
+  return NULL;
+}
+
+static void *run_worker(void *arg) {
+  struct worker *w = arg;
+  poller_run(w->p, w->ms);
+  return NULL;
+}
+
+int loadgen_run(int machines, const LoadOptions *opts, LoadResult *r) {
+  MachineOptions mopts = default_machine_options;
+  unsigned short *h = calloc(machines, sizeof(*h));
+  struct tally *tally = calloc(machines, sizeof(*tally));
+  struct worker *w = calloc(opts->threads, sizeof(*w));
+  Signal *sig = calloc(opts->signals, sizeof(*sig));
+  struct connector connectors[CONNECTORS];
+  int started = 0;
+  int ret = 1;
+  double t, end, cpu;
+  long rss;
+
+  memset(r, 0, sizeof(*r));
+  r->machines = machines;
+  if (h == NULL || tally == NULL || w == NULL || sig == NULL) {
+    fprintf(stderr, "Failed to allocate load of %d machines!\n", machines);
+    goto cleanup;
+  }
+  fill_signals(sig, opts->signals);
+  mopts.interval_ms = opts->interval_ms;
+  mopts.mode = POLL_ONLY;
+
+  t = now();
+  for (int i = 0; i < CONNECTORS; i++) {
+    struct connector *c = &connectors[i];
+    c->h = h;
+    c->first = i;
+    c->machines = machines;
+    if (pthread_create(&c->thread, NULL, connect_machines, c)) {
+      connect_machines(c);
+      c->h = NULL;
+    }
+  }
+  for (int i = 0; i < CONNECTORS; i++) {
+    if (connectors[i].h) pthread_join(connectors[i].thread, NULL);
+  }
+  for (int i = 0; i < machines; i++) r->connected += h[i] != 0;
+  r->connect_s = now() - t;
+
+  rss = resident_bytes();
+  for (int i = 0; i < opts->threads; i++) {
+    if ((w[i].p = poller_create()) == NULL) goto cleanup;
+    w[i].ms = (long)(opts->seconds * 1e3);
+  }
+  for (int i = 0; i < machines; i++) {
+    if (h[i] == 0) continue;
+    tally[i].opts = opts;
+    if (poller_add(w[i % opts->threads].p, h[i], sig, opts->signals, &mopts,
+                   on_value, &tally[i]) != 0)
+      goto cleanup;
+  }
+  if (r->connected)
+    r->bytes_per_handle = (double)(resident_bytes() - rss) / r->connected;
+
+  cpu = cpu_seconds();
+  t = now();
+  for (; started < opts->threads; started++) {
+    if (pthread_create(&w[started].thread, NULL, run_worker, &w[started])) {
+      fprintf(stderr, "Failed to start poller thread!\n");
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) pthread_join(w[i].thread, NULL);
+  end = now();
+  cpu = cpu_seconds() - cpu;
+  if (started < opts->threads) goto cleanup;
+
+  for (int i = 0; i < machines; i++) {
+    double last = tally[i].last > 0 ? tally[i].last : t;
+    // a cycle still overdue at the end is late as well
+    if (h[i] && end - last - opts->interval_ms / 1e3 > tally[i].max_late)
+      tally[i].max_late = end - last - opts->interval_ms / 1e3;
+    if (h[i] && end - last > opts->interval_ms / 1e3 * opts->miss_factor)
+      tally[i].misses++;
+    r->cycles += tally[i].cycles;
+    r->misses += tally[i].misses;
+    r->errors += tally[i].errors;
+    if (tally[i].max_late * 1e3 > r->max_late_ms)
+      r->max_late_ms = tally[i].max_late * 1e3;
+  }
+  r->target_rate = r->connected * 1e3 / opts->interval_ms;
+  r->cycle_rate = r->cycles / (end - t);
+  if (r->connected) r->cpu_per_machine = cpu / (end - t) / r->connected;
+  ret = 0;
+
+cleanup:
+  for (int i = 0; w && i < opts->threads; i++) {
+    if (w[i].p) poller_destroy(w[i].p);
+  }
+  for (int i = 0; h && i < machines; i++) {
+    if (h[i]) cnc_freelibhndl(h[i]);
+  }
+  free(h);
+  free(tally);
+  free(w);
+  free(sig);
+  return ret;
+}
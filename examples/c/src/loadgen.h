@@ -0,0 +1,38 @@
+#ifndef FW_LOADGEN_H
+#define FW_LOADGEN_H
+
+/* fleet load for the poller (poller.h): connects to `machines` controllers,
+ * polls every one of them from `threads` pollers for a while and measures
+ * what one host achieves. `focas-load` runs it against the simulated
+ * controllers of fwsim.c with growing machine counts to find where a
+ * poller host tops out. */
+
+typedef struct load_options {
+  long interval_ms;    // poll period of every machine
+  int signals;         // per machine: status, dynamic, then pmc / macros
+  int threads;         // pollers, each polls its share of the machines
+  double seconds;      // measured time per run
+  double miss_factor;  // a cycle this many intervals late is a miss
+} LoadOptions;
+
+extern const LoadOptions default_load_options;
+
+typedef struct load_result {
+  int machines;
+  int connected;
+  double target_rate;  // cycles per second of all machines together
+  double cycle_rate;   // achieved
+  unsigned long cycles;
+  unsigned long misses;  // cycles later than miss_factor intervals
+  unsigned long errors;  // failed signal reads
+  double max_late_ms;    // latest cycle past its interval
+  double cpu_per_machine;   // cpu seconds per second, per machine
+  double bytes_per_handle;  // resident memory of the pollers per machine
+  double connect_s;         // time to open every handle
+} LoadResult;
+
+/* 0, or 1 when the run could not be set up. machines that fail to connect
+ * are left out and counted in `connected`. */
+int loadgen_run(int machines, const LoadOptions *opts, LoadResult *result);
+
+#endif
@@ -0,0 +1,139 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./fwsim.h"
+#include "./loadgen.h"
+#include "fwlib32.h"
+
+#define MAX_STEPS 64
+
+static struct option options[] = {{"machines", required_argument, NULL, 'm'},
+                                  {"interval", required_argument, NULL, 'i'},
+                                  {"signals", required_argument, NULL, 's'},
+                                  {"threads", required_argument, NULL, 't'},
+                                  {"seconds", required_argument, NULL, 'd'},
+                                  {"latency", required_argument, NULL, 'l'},
+                                  {"jitter", required_argument, NULL, 'j'},
+                                  {"errors", required_argument, NULL, 'e'},
+                                  {"stalls", required_argument, NULL, 'r'},
+                                  {"stall", required_argument, NULL, 'u'},
+                                  {NULL, 0, NULL, 0}};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--machines=<n>,<n>...] [--interval=<ms>] "
+          "[--signals=<per machine>] [--threads=<pollers>] "
+          "[--seconds=<per step>] [--latency=<us>[,<family>:<us>...]] "
+          "[--jitter=<us>] [--errors=<rate>[,<family>:<rate>...]] "
+          "[--stalls=<rate>] [--stall=<mean us>]\n",
+          name);
+}
+
+static int parse_steps(const char *arg, int *steps) {
+  char buf[400];
+  char *tok;
+  char *save;
+  int n = 0;
+
+  snprintf(buf, sizeof(buf), "%s", arg);
+  for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    if (n == MAX_STEPS || (steps[n] = atoi(tok)) < 1) {
+      fprintf(stderr, "invalid machines: \"%s\"\n", tok);
+      return -1;
+    }
+    n++;
+  }
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  LoadOptions opts = default_load_options;
+  FwsimOptions sim = default_fwsim_options;
+  int steps[MAX_STEPS] = {10, 20, 50, 100, 200, 500, 1000, 2000};
+  int nsteps = 8;
+  double v[FWSIM_FAMILIES];
+  int c;
+  int i = 0;
+
+  // a few calls per hundred take tens of milliseconds, as on a busy cnc
+  sim.stall_rate = 0.01;
+  sim.stall_us = 20000;
+  while ((c = getopt_long(argc, argv, "", options, &i)) != -1) {
+    switch (c) {
+      case 'm':
+        if ((nsteps = parse_steps(optarg, steps)) < 1) return EXIT_FAILURE;
+        break;
+      case 'i':
+        if ((opts.interval_ms = atol(optarg)) < 1) {
+          fprintf(stderr, "invalid interval: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        if ((opts.signals = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid signals: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 't':
+        if ((opts.threads = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid threads: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'd':
+        if ((opts.seconds = atof(optarg)) <= 0) {
+          fprintf(stderr, "invalid seconds: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'l':
+      case 'e':
+        for (int k = 0; k < FWSIM_FAMILIES; k++)
+          v[k] = c == 'l' ? sim.latency_us[k] : sim.error_rate[k];
+        if (fwsim_parse(optarg, v) != 0) {
+          fprintf(stderr, "invalid %s: \"%s\"\n",
+                  c == 'l' ? "latency" : "errors", optarg);
+          return EXIT_FAILURE;
+        }
+        for (int k = 0; k < FWSIM_FAMILIES; k++) {
+          if (c == 'l') sim.latency_us[k] = v[k];
+          else sim.error_rate[k] = v[k];
+        }
+        break;
+      case 'j':
+        sim.jitter_us = atol(optarg);
+        break;
+      case 'r':
+        sim.stall_rate = atof(optarg);
+        break;
+      case 'u':
+        sim.stall_us = atol(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  fwsim_configure(&sim);
+  printf("%d signals every %ld ms, %d poller threads, %.1f s per step\n",
+         opts.signals, opts.interval_ms, opts.threads, opts.seconds);
+  printf("%9s %9s %10s %10s %8s %7s %9s %11s %11s %9s\n", "machines",
+         "connected", "target/s", "cycles/s", "misses", "errors", "late ms",
+         "cpu/machine", "KiB/machine", "connect s");
+  for (int k = 0; k < nsteps; k++) {
+    LoadResult r;
+    if (loadgen_run(steps[k], &opts, &r) != 0) return EXIT_FAILURE;
+    printf("%9d %9d %10.1f %10.1f %8lu %7lu %9.1f %10.2f%% %11.1f %9.2f\n",
+           r.machines, r.connected, r.target_rate, r.cycle_rate, r.misses,
+           r.errors, r.max_late_ms, 100 * r.cpu_per_machine,
+           r.bytes_per_handle / 1024, r.connect_s);
+    fflush(stdout);
+    // the next step starts with fresh controllers
+    fwsim_reset();
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,534 @@
+#include "./metrics.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "./callstats.h"
+#include "fwlib32.h"
+
+#define FUNCTIONS 8          // callstats rows of a machine
+#define LABEL 136            // a machine name with every byte escaped
+#define MACHINE_BYTES 12288  // first guess at the exposition of a machine
+#define REQUEST_BYTES 1024
+
+// upper bounds of the latency buckets in seconds, the Prometheus defaults
+// stretched down to the 100 us a FOCAS call takes on a quiet network
+static const double bounds[] = {0.0001, 0.00025, 0.0005, 0.001,
+                                0.0025, 0.005,   0.01,   0.025,
+                                0.05,   0.1,     0.25,   0.5,
+                                1,      2.5,     5,      10};
+#define BOUNDS (int)(sizeof(bounds) / sizeof(bounds[0]))
+
+/* what the connecting and polling threads publish about a machine, each
+ * field has one writer */
+struct counters {
+  _Atomic int connected;
+  _Atomic unsigned long connects;
+  _Atomic unsigned long connect_failures;
+  _Atomic unsigned long disconnects;
+  _Atomic unsigned long cycles;
+  _Atomic unsigned long skipped;
+  _Atomic double late;
+  _Atomic double max_late;
+};
+
+/* the values of a machine as one scrape saw them */
+struct values {
+  int status;  // the slots were written without error
+  int dynamic;
+  int spindle;
+  ODBST st;
+  long actf;
+  long acts;
+  double load;
+};
+
+/* return codes of a function, kept from the histogram pass for the
+ * counters that follow it */
+struct returns {
+  const char *function;
+  unsigned long long codes[CALLSTATS_CODES];
+};
+
+struct metrics {
+  int n;
+  const StateTable *state;
+  struct counters *c;
+  char (*names)[LABEL];
+  struct values *values;
+  struct returns *returns;  // FUNCTIONS per machine
+  int *nreturns;
+  CallStats rows[FUNCTIONS];
+
+  char *buf;
+  size_t cap;
+  size_t len;
+  int full;
+
+  int listen_fd;
+  int wake[2];
+  int serving;
+  unsigned short port;
+  pthread_t thread;
+};
+
+static void bump(_Atomic unsigned long *c) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+/* label values escape backslash, double quote and line feed */
+static void escape(char *to, const char *from) {
+  for (; *from; from++) {
+    if (*from == '\\' || *from == '"') *to++ = '\\';
+    if (*from == '\n') {
+      *to++ = '\\';
+      *to++ = 'n';
+    } else {
+      *to++ = *from;
+    }
+  }
+  *to = '\0';
+}
+
+Metrics *metrics_create(const char *const *names, int machines,
+                        const StateTable *state) {
+  Metrics *m;
+
+  if (machines < 1 || state_machines(state) < machines ||
+      state_slots(state) < METRICS_SLOTS)
+    return NULL;
+  if ((m = calloc(1, sizeof(*m))) == NULL) return NULL;
+  m->n = machines;
+  m->state = state;
+  m->listen_fd = m->wake[0] = m->wake[1] = -1;
+  m->cap = (size_t)machines * MACHINE_BYTES;
+  if ((m->c = calloc(machines, sizeof(*m->c))) == NULL ||
+      (m->names = calloc(machines, sizeof(*m->names))) == NULL ||
+      (m->values = calloc(machines, sizeof(*m->values))) == NULL ||
+      (m->returns = calloc(machines * FUNCTIONS, sizeof(*m->returns))) ==
+          NULL ||
+      (m->nreturns = calloc(machines, sizeof(*m->nreturns))) == NULL ||
+      (m->buf = malloc(m->cap)) == NULL) {
+    fprintf(stderr, "Failed to allocate metrics!\n");
+    metrics_destroy(m);
+    return NULL;
+  }
+  for (int i = 0; i < machines; i++) {
+    char name[LABEL / 2];
+    snprintf(name, sizeof(name), "%s", names[i]);
+    escape(m->names[i], name);
+  }
+  return m;
+}
+
+void metrics_destroy(Metrics *m) {
+  if (m == NULL) return;
+  if (m->serving) {
+    if (write(m->wake[1], "", 1) != 1) perror("write");
+    pthread_join(m->thread, NULL);
+  }
+  if (m->listen_fd >= 0) close(m->listen_fd);
+  if (m->wake[0] >= 0) close(m->wake[0]);
+  if (m->wake[1] >= 0) close(m->wake[1]);
+  free(m->c);
+  free(m->names);
+  free(m->values);
+  free(m->returns);
+  free(m->nreturns);
+  free(m->buf);
+  free(m);
+}
+
+void metrics_connect(Metrics *m, int machine, short err) {
+  struct counters *c = &m->c[machine];
+
+  if (err != EW_OK) {
+    bump(&c->connect_failures);
+    return;
+  }
+  bump(&c->connects);
+  atomic_store_explicit(&c->connected, 1, memory_order_relaxed);
+}
+
+void metrics_disconnect(Metrics *m, int machine) {
+  struct counters *c = &m->c[machine];
+
+  bump(&c->disconnects);
+  atomic_store_explicit(&c->connected, 0, memory_order_relaxed);
+}
+
+void metrics_poller(Metrics *m, int machine, const MachineStats *stats) {
+  struct counters *c = &m->c[machine];
+
+  atomic_store_explicit(&c->cycles, stats->cycles, memory_order_relaxed);
+  atomic_store_explicit(&c->skipped, stats->skipped, memory_order_relaxed);
+  atomic_store_explicit(&c->late, stats->late, memory_order_relaxed);
+  atomic_store_explicit(&c->max_late, stats->max_late, memory_order_relaxed);
+}
+
+static void out(Metrics *m, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  if (m->full) return;
+  va_start(ap, fmt);
+  n = vsnprintf(m->buf + m->len, m->cap - m->len, fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t)n >= m->cap - m->len) {
+    m->full = 1;
+    return;
+  }
+  m->len += n;
+}
+
+static void family(Metrics *m, const char *name, const char *type,
+                   const char *unit, const char *help) {
+  out(m, "# TYPE %s %s\n", name, type);
+  if (unit) out(m, "# UNIT %s %s\n", name, unit);
+  out(m, "# HELP %s %s\n", name, help);
+}
+
+static unsigned long counter(_Atomic unsigned long *c) {
+  return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static void render_connections(Metrics *m) {
+  family(m, "fanuc_connected", "gauge", NULL,
+         "1 while the machine has a FOCAS handle");
+  for (int i = 0; i < m->n; i++) {
+    out(m, "fanuc_connected{machine=\"%s\"} %d\n", m->names[i],
+        atomic_load_explicit(&m->c[i].connected, memory_order_relaxed));
+  }
+  family(m, "fanuc_reconnects", "counter", NULL,
+         "Handles opened after the first one");
+  for (int i = 0; i < m->n; i++) {
+    unsigned long connects = counter(&m->c[i].connects);
+    out(m, "fanuc_reconnects_total{machine=\"%s\"} %lu\n", m->names[i],
+        connects ? connects - 1 : 0);
+  }
+  family(m, "fanuc_connect_failures", "counter", NULL,
+         "Failed cnc_allclibhndl3 calls");
+  for (int i = 0; i < m->n; i++) {
+    out(m, "fanuc_connect_failures_total{machine=\"%s\"} %lu\n", m->names[i],
+        counter(&m->c[i].connect_failures));
+  }
+  family(m, "fanuc_disconnects", "counter", NULL,
+         "Handles given up after a socket or handle error");
+  for (int i = 0; i < m->n; i++) {
+    out(m, "fanuc_disconnects_total{machine=\"%s\"} %lu\n", m->names[i],
+        counter(&m->c[i].disconnects));
+  }
+}
+
+static void render_schedule(Metrics *m) {
+  family(m, "fanuc_poll_lateness_seconds", "summary", "seconds",
+         "How long after they were due the poll cycles started");
+  for (int i = 0; i < m->n; i++) {
+    out(m,
+        "fanuc_poll_lateness_seconds_count{machine=\"%s\"} %lu\n"
+        "fanuc_poll_lateness_seconds_sum{machine=\"%s\"} %.9g\n",
+        m->names[i], counter(&m->c[i].cycles), m->names[i],
+        atomic_load_explicit(&m->c[i].late, memory_order_relaxed));
+  }
+  family(m, "fanuc_poll_max_lateness_seconds", "gauge", "seconds",
+         "Latest start of a poll cycle");
+  for (int i = 0; i < m->n; i++) {
+    out(m, "fanuc_poll_max_lateness_seconds{machine=\"%s\"} %.9g\n",
+        m->names[i],
+        atomic_load_explicit(&m->c[i].max_late, memory_order_relaxed));
+  }
+  family(m, "fanuc_poll_skipped_cycles", "counter", NULL,
+         "Poll cycles left out because the poller fell behind");
+  for (int i = 0; i < m->n; i++) {
+    out(m, "fanuc_poll_skipped_cycles_total{machine=\"%s\"} %lu\n",
+        m->names[i], counter(&m->c[i].skipped));
+  }
+}
+
+static int read_slot(const Metrics *m, int machine, int slot, void *data,
+                     size_t size) {
+  StateInfo info;
+
+  return state_read(m->state, machine, slot, data, size, &info) == 0 &&
+         info.err == EW_OK;
+}
+
+/* one consistent copy of each slot, read once for all value families. the
+ * slots hold the 32 bit layout the library fills, a 64 bit ODBDY2 would
+ * find actf and acts at other offsets. */
+static void read_values(Metrics *m) {
+  for (int i = 0; i < m->n; i++) {
+    struct values *v = &m->values[i];
+    Fw32Dy2 dy;
+    Fw32Spload sp;
+
+    v->status = read_slot(m, i, METRICS_STATUS, &v->st, sizeof(v->st));
+    // the positions behind the speeds are left out
+    v->dynamic = read_slot(m, i, METRICS_DYNAMIC, &dy, offsetof(Fw32Dy2, pos));
+    v->spindle = read_slot(m, i, METRICS_SPINDLE, &sp, sizeof(sp));
+    if (v->dynamic) {
+      v->actf = dy.actf;
+      v->acts = dy.acts;
+    }
+    if (v->spindle) {
+      v->load = sp.spload.data;
+      for (int d = 0; d < sp.spload.dec; d++) v->load /= 10;
+    }
+  }
+}
+
+static void render_values(Metrics *m) {
+  read_values(m);
+  family(m, "fanuc_run_state", "gauge", NULL,
+         "ODBST run: 0 reset, 1 stop, 2 hold, 3 start, 4 MSTR");
+  for (int i = 0; i < m->n; i++) {
+    if (m->values[i].status)
+      out(m, "fanuc_run_state{machine=\"%s\"} %d\n", m->names[i],
+          m->values[i].st.run);
+  }
+  family(m, "fanuc_automatic_mode", "gauge", NULL,
+         "ODBST aut: 0 MDI, 1 MEM, 3 EDIT, 4 HANDLE, 5 JOG, ...");
+  for (int i = 0; i < m->n; i++) {
+    if (m->values[i].status)
+      out(m, "fanuc_automatic_mode{machine=\"%s\"} %d\n", m->names[i],
+          m->values[i].st.aut);
+  }
+  family(m, "fanuc_alarm", "gauge", NULL, "ODBST alarm, 0 for none");
+  for (int i = 0; i < m->n; i++) {
+    if (m->values[i].status)
+      out(m, "fanuc_alarm{machine=\"%s\"} %d\n", m->names[i],
+          m->values[i].st.alarm);
+  }
+  family(m, "fanuc_emergency", "gauge", NULL, "ODBST emergency, 0 for none");
+  for (int i = 0; i < m->n; i++) {
+    if (m->values[i].status)
+      out(m, "fanuc_emergency{machine=\"%s\"} %d\n", m->names[i],
+          m->values[i].st.emergency);
+  }
+  family(m, "fanuc_feed_rate", "gauge", NULL,
+         "Actual feed rate of ODBDY2, in the input unit per minute");
+  for (int i = 0; i < m->n; i++) {
+    if (m->values[i].dynamic)
+      out(m, "fanuc_feed_rate{machine=\"%s\"} %ld\n", m->names[i],
+          m->values[i].actf);
+  }
+  family(m, "fanuc_spindle_speed_rpm", "gauge", "rpm",
+         "Actual spindle speed of ODBDY2");
+  for (int i = 0; i < m->n; i++) {
+    if (m->values[i].dynamic)
+      out(m, "fanuc_spindle_speed_rpm{machine=\"%s\"} %ld\n", m->names[i],
+          m->values[i].acts);
+  }
+  family(m, "fanuc_spindle_load_percent", "gauge", "percent",
+         "Load meter of the first spindle");
+  for (int i = 0; i < m->n; i++) {
+    if (m->values[i].spindle)
+      out(m, "fanuc_spindle_load_percent{machine=\"%s\"} %.9g\n", m->names[i],
+          m->values[i].load);
+  }
+}
+
+static void render_calls(Metrics *m) {
+  family(m, "fanuc_focas_call_seconds", "histogram", "seconds",
+         "Latency of the FOCAS calls per machine and function");
+  for (int i = 0; i < m->n; i++) {
+    int rows = callstats_collect(m->rows, FUNCTIONS, i);
+
+    m->nreturns[i] = rows;
+    for (int r = 0; r < rows; r++) {
+      const CallStats *s = &m->rows[r];
+      struct returns *ret = &m->returns[i * FUNCTIONS + r];
+      unsigned long long below = 0;
+      int b = 0;
+
+      for (int k = 0; k < BOUNDS; k++) {
+        // a bucket counts once its highest latency is within the bound
+        for (; b < CALLSTATS_BUCKETS &&
+               callstats_bucket_high(b) <= bounds[k] * 1e9;
+             b++)
+          below += s->hist[b];
+        out(m,
+            "fanuc_focas_call_seconds_bucket{machine=\"%s\",function=\"%s\","
+            "le=\"%g\"} %llu\n",
+            m->names[i], s->function, bounds[k], below);
+      }
+      out(m,
+          "fanuc_focas_call_seconds_bucket{machine=\"%s\",function=\"%s\","
+          "le=\"+Inf\"} %llu\n"
+          "fanuc_focas_call_seconds_count{machine=\"%s\",function=\"%s\"} "
+          "%llu\n"
+          "fanuc_focas_call_seconds_sum{machine=\"%s\",function=\"%s\"} "
+          "%.9g\n",
+          m->names[i], s->function, s->calls, m->names[i], s->function,
+          s->calls, m->names[i], s->function, s->total_ns / 1e9);
+      ret->function = s->function;
+      memcpy(ret->codes, s->codes, sizeof(ret->codes));
+    }
+  }
+  family(m, "fanuc_focas_returns", "counter", NULL,
+         "FOCAS calls by EW_* return code, \"other\" for codes beyond "
+         "EW_PROTOCOL .. EW_RD_RSTFIN");
+  for (int i = 0; i < m->n; i++) {
+    for (int r = 0; r < m->nreturns[i]; r++) {
+      const struct returns *ret = &m->returns[i * FUNCTIONS + r];
+      for (int k = 0; k < CALLSTATS_CODES; k++) {
+        char code[8];
+        if (ret->codes[k] == 0) continue;
+        if (k == CALLSTATS_CODES - 1)
+          snprintf(code, sizeof(code), "other");
+        else
+          snprintf(code, sizeof(code), "%d", callstats_code(k));
+        out(m,
+            "fanuc_focas_returns_total{machine=\"%s\",function=\"%s\","
+            "code=\"%s\"} %llu\n",
+            m->names[i], ret->function, code, ret->codes[k]);
+      }
+    }
+  }
+}
+
+const char *metrics_render(Metrics *m, size_t *len) {
+  for (;;) {
+    char *buf;
+
+    m->len = 0;
+    m->full = 0;
+    render_connections(m);
+    render_schedule(m);
+    render_values(m);
+    render_calls(m);
+    out(m, "# EOF\n");
+    if (!m->full) break;
+    // more functions per machine than guessed, the next scrape fits
+    if ((buf = realloc(m->buf, m->cap * 2)) == NULL) return NULL;
+    m->buf = buf;
+    m->cap *= 2;
+  }
+  *len = m->len;
+  return m->buf;
+}
+
+static int send_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n <= 0) return 1;
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+static void answer(Metrics *m, int fd) {
+  static const char not_found[] =
+      "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+      "Connection: close\r\n\r\n";
+  static const char failed[] =
+      "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n"
+      "Connection: close\r\n\r\n";
+  char req[REQUEST_BYTES];
+  char header[256];
+  const char *body;
+  size_t have = 0;
+  size_t len;
+  ssize_t n;
+
+  // the request line is all that is needed, up to the end of the headers
+  while (have < sizeof(req) - 1 &&
+         (n = recv(fd, req + have, sizeof(req) - 1 - have, 0)) > 0) {
+    have += n;
+    req[have] = '\0';
+    if (strstr(req, "\r\n\r\n")) break;
+  }
+  req[have] = '\0';
+  if (strncmp(req, "GET /metrics ", 13) != 0 &&
+      strncmp(req, "GET /metrics?", 13) != 0) {
+    send_all(fd, not_found, sizeof(not_found) - 1);
+    return;
+  }
+  if ((body = metrics_render(m, &len)) == NULL) {
+    send_all(fd, failed, sizeof(failed) - 1);
+    return;
+  }
+  snprintf(header, sizeof(header),
+           "HTTP/1.1 200 OK\r\n"
+           "Content-Type: application/openmetrics-text; version=1.0.0; "
+           "charset=utf-8\r\n"
+           "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+           len);
+  if (send_all(fd, header, strlen(header)) == 0) send_all(fd, body, len);
+}
+
+/* one scrape at a time, a client that stalls is dropped after 5 s */
+static void *serve(void *arg) {
+  Metrics *m = arg;
+  struct pollfd fds[2] = {{m->wake[0], POLLIN, 0}, {m->listen_fd, POLLIN, 0}};
+  struct timeval timeout = {5, 0};
+
+  for (;;) {
+    int fd;
+
+    if (poll(fds, 2, -1) < 0) continue;
+    if (fds[0].revents) break;
+    if (!fds[1].revents || (fd = accept(m->listen_fd, NULL, NULL)) < 0)
+      continue;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    answer(m, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+int metrics_listen(Metrics *m, const char *addr, unsigned short port) {
+  struct addrinfo hints = {0}, *ai;
+  struct sockaddr_storage bound;
+  socklen_t size = sizeof(bound);
+  char service[8];
+  int one = 1;
+
+  if (m->serving) return 1;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(addr, service, &hints, &ai) != 0) {
+    fprintf(stderr, "invalid address: \"%s\"\n", addr);
+    return 1;
+  }
+  if ((m->listen_fd = socket(ai->ai_family, SOCK_STREAM, 0)) >= 0) {
+    setsockopt(m->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(m->listen_fd, ai->ai_addr, ai->ai_addrlen) != 0 ||
+        listen(m->listen_fd, 16) != 0 ||
+        getsockname(m->listen_fd, (struct sockaddr *)&bound, &size) != 0) {
+      close(m->listen_fd);
+      m->listen_fd = -1;
+    }
+  }
+  freeaddrinfo(ai);
+  if (m->listen_fd < 0) {
+    fprintf(stderr, "Failed to listen on %s:%u!\n", addr, port);
+    return 1;
+  }
+  m->port = ntohs(bound.ss_family == AF_INET6
+                      ? ((struct sockaddr_in6 *)&bound)->sin6_port
+                      : ((struct sockaddr_in *)&bound)->sin_port);
+  if (pipe(m->wake) != 0 ||
+      pthread_create(&m->thread, NULL, serve, m) != 0) {
+    fprintf(stderr, "Failed to start metrics server!\n");
+    return 1;
+  }
+  m->serving = 1;
+  return 0;
+}
+
+unsigned short metrics_port(const Metrics *m) { return m->port; }
@@ -0,0 +1,52 @@
+#ifndef FW_METRICS_H
+#define FW_METRICS_H
+
+#include <stddef.h>
+
+#include "./fwabi.h"
+#include "./poller.h"
+#include "./state.h"
+
+/* OpenMetrics text exposition of a polled fleet, for Prometheus. machine i
+ * is row i of the latest value table (state.h), with its slots in the order
+ * of enum metrics_slot, and machine i of the call statistics (callstats.h).
+ * the threads that connect and poll publish into per machine counters with
+ * plain atomic stores, a scrape renders from those, the seqlocked table and
+ * callstats_collect into a buffer of its own, so it never waits on a poller
+ * and a poller never waits on it. the buffer is sized at metrics_create for
+ * a guess of the exposition per machine and doubles on a scrape that
+ * outgrows it. */
+
+enum metrics_slot {
+  METRICS_STATUS,   // ODBST
+  METRICS_DYNAMIC,  // Fw32Dy2 (ODBDY2)
+  METRICS_SPINDLE,  // Fw32Spload (ODBSPLOAD)
+  METRICS_SLOTS,
+};
+
+typedef struct metrics Metrics;
+
+/* `names` are copied */
+Metrics *metrics_create(const char *const *names, int machines,
+                        const StateTable *state);
+/* stops serving first */
+void metrics_destroy(Metrics *m);
+
+/* writers, any thread, one writer per machine at a time */
+/* result of cnc_allclibhndl3 */
+void metrics_connect(Metrics *m, int machine, short err);
+/* the handle was given up after a socket or handle error */
+void metrics_disconnect(Metrics *m, int machine);
+/* poller counters of the machine so far */
+void metrics_poller(Metrics *m, int machine, const MachineStats *stats);
+
+/* the exposition, valid until the next call. one thread renders at a time,
+ * NULL when the buffer can not grow. */
+const char *metrics_render(Metrics *m, size_t *len);
+
+/* serve GET /metrics from a thread of its own. port 0 picks a free port,
+ * metrics_port tells which. */
+int metrics_listen(Metrics *m, const char *addr, unsigned short port);
+unsigned short metrics_port(const Metrics *m);
+
+#endif
@@ -0,0 +1,349 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./backoff.h"
+#include "./backup.h"
+#include "./callstats.h"
+#include "./clock.h"
+#include "./metrics.h"
+#include "./poller.h"
+#include "./shmstate.h"
+#include "./state.h"
+#include "fwlib32.h"
+
+// handles are opened by this many threads, a machine that does not answer
+// holds one of them up for the timeout
+#define CONNECTORS 8
+// longest wait before connecting to a machine again, in seconds
+#define MAX_RETRY 60
+// poller counters are published this often, in seconds
+#define PUBLISH 1.0
+// longest sleep of a poll thread, new handles are picked up this often
+#define IDLE_MS 100
+
+static struct option options[] = {{"machines", required_argument, NULL, 'm'},
+                                  {"listen", required_argument, NULL, 'l'},
+                                  {"port", required_argument, NULL, 'p'},
+                                  {"interval", required_argument, NULL, 'i'},
+                                  {"threads", required_argument, NULL, 't'},
+                                  {"timeout", required_argument, NULL, 'o'},
+                                  {"shm", required_argument, NULL, 's'},
+                                  {NULL, 0, NULL, 0}};
+
+// the slots of enum metrics_slot
+static const Signal signals[METRICS_SLOTS] = {
+    {SIGNAL_STATUS, 0, 0, 0, 0},
+    {SIGNAL_DYNAMIC, 0, ALL_AXES, 0, 0},
+    {SIGNAL_SPINDLE, 0, 0, 0, 0},
+};
+
+enum link {
+  LINK_DOWN,    // the connectors open a handle
+  LINK_READY,   // opened, waiting for its poll thread
+  LINK_POLLED,  // the poll thread owns the handle until a read loses it
+};
+
+struct target {
+  const Machine *machine;
+  _Atomic int link;
+  unsigned short libh;  // set before LINK_READY
+  StateSink sink;
+  ShmSink shm;  // with --shm
+  int lost;           // poll thread: a read failed with EW_SOCKET or EW_HANDLE
+  MachineStats base;  // poll thread: counters of the earlier handles
+  double retry_at;    // connector: next attempt
+  int attempts;
+};
+
+static struct target *targets;
+static int ntargets;
+static Metrics *metrics;
+static ShmPublisher *pub;
+// the event ring of the segment has a single writer
+static pthread_mutex_t pub_lock = PTHREAD_MUTEX_INITIALIZER;
+static long interval_ms = 1000;
+static int threads = 1;
+static long timeout = 10;
+static volatile sig_atomic_t stop;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s --machines=<file> [--listen=<address>] [--port=<port>] "
+          "[--interval=<ms>] [--threads=<pollers>] [--timeout=<seconds>] "
+          "[--shm=<name>]\n",
+          name);
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+/* opens the handles of every CONNECTORS-th machine, backing off 1, 2, 4 ..
+ * 60 s from a machine that does not answer */
+static void *connect_machines(void *arg) {
+  int first = (int)(intptr_t)arg;
+
+  while (!stop) {
+    double t = now();
+
+    for (int i = first; i < ntargets && !stop; i += CONNECTORS) {
+      struct target *g = &targets[i];
+      unsigned long long start;
+      unsigned short libh;
+      short ret;
+
+      if (atomic_load_explicit(&g->link, memory_order_acquire) != LINK_DOWN ||
+          g->retry_at > t)
+        continue;
+      start = callstats_now();
+      ret = cnc_allclibhndl3(g->machine->ip, g->machine->port, timeout, &libh);
+      callstats_record("cnc_allclibhndl3", i, start, ret);
+      metrics_connect(metrics, i, ret);
+      if (ret != EW_OK) {
+        g->retry_at = now() + backoff_delay(g->attempts, 1, MAX_RETRY);
+        g->attempts++;
+        continue;
+      }
+      g->attempts = 0;
+      g->libh = libh;
+      atomic_store_explicit(&g->link, LINK_READY, memory_order_release);
+    }
+    idle(IDLE_MS * 1000);
+  }
+  return NULL;
+}
+
+static void on_value(const ValueUpdate *update, void *ctx) {
+  struct target *g = ctx;
+
+  if (pub != NULL) {
+    pthread_mutex_lock(&pub_lock);
+    shmpub_value_fn(update, &g->shm);
+    pthread_mutex_unlock(&pub_lock);
+  } else {
+    state_value_fn(update, &g->sink);
+  }
+  if (update->err == EW_SOCKET || update->err == EW_HANDLE) g->lost = 1;
+}
+
+/* the counters of this handle on top of those of the earlier ones */
+static void publish(Poller *p, struct target *g, int i) {
+  MachineStats s;
+
+  if (poller_stats(p, g->libh, &s)) return;
+  s.cycles += g->base.cycles;
+  s.skipped += g->base.skipped;
+  s.late += g->base.late;
+  if (g->base.max_late > s.max_late) s.max_late = g->base.max_late;
+  metrics_poller(metrics, i, &s);
+  if (g->lost) g->base = s;
+}
+
+/* polls every threads-th machine whose handle is open */
+static void *poll_machines(void *arg) {
+  int first = (int)(intptr_t)arg;
+  MachineOptions opts = default_machine_options;
+  Poller *p = poller_create();
+  double published = 0;
+
+  if (p == NULL) {
+    fprintf(stderr, "Failed to create poller!\n");
+    stop = 1;
+    return NULL;
+  }
+  opts.interval_ms = interval_ms;
+  opts.mode = POLL_ONLY;
+  while (!stop) {
+    double t = now();
+    int due = t - published >= PUBLISH;
+    long wait;
+
+    for (int i = first; i < ntargets; i += threads) {
+      struct target *g = &targets[i];
+      if (atomic_load_explicit(&g->link, memory_order_acquire) != LINK_READY)
+        continue;
+      opts.calls_key = i;
+      g->lost = 0;
+      if (poller_add(p, g->libh, signals, METRICS_SLOTS, &opts, on_value, g)) {
+        cnc_freelibhndl(g->libh);
+        metrics_disconnect(metrics, i);
+        atomic_store_explicit(&g->link, LINK_DOWN, memory_order_release);
+        continue;
+      }
+      atomic_store_explicit(&g->link, LINK_POLLED, memory_order_relaxed);
+    }
+
+    wait = poller_step(p);
+
+    for (int i = first; i < ntargets; i += threads) {
+      struct target *g = &targets[i];
+      if (atomic_load_explicit(&g->link, memory_order_relaxed) != LINK_POLLED)
+        continue;
+      if (due || g->lost) publish(p, g, i);
+      if (!g->lost) continue;
+      // the connectors open a new handle
+      poller_remove(p, g->libh);
+      cnc_freelibhndl(g->libh);
+      metrics_disconnect(metrics, i);
+      atomic_store_explicit(&g->link, LINK_DOWN, memory_order_release);
+    }
+    if (due) published = t;
+    idle((wait < 0 || wait > IDLE_MS ? IDLE_MS : wait) * 1000);
+  }
+
+  poller_destroy(p);
+  for (int i = first; i < ntargets; i += threads) {
+    if (atomic_load(&targets[i].link) != LINK_DOWN)
+      cnc_freelibhndl(targets[i].libh);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t sizes[METRICS_SLOTS] = {sizeof(ODBST), sizeof(Fw32Dy2),
+                                       sizeof(Fw32Spload)};
+  const char *machines_file = NULL;
+  const char *addr = "127.0.0.1";
+  const char *shm_name = NULL;
+  const char **names = NULL;
+  pthread_t connectors[CONNECTORS];
+  pthread_t *pollers = NULL;
+  StateTable *state = NULL;
+  Machine *machines = NULL;
+  int port = 9464;
+  int nconnectors = 0;
+  int npollers = 0;
+  int ret = EXIT_FAILURE;
+  int c;
+  int i = 0;
+
+  while ((c = getopt_long(argc, argv, "", options, &i)) != -1) {
+    switch (c) {
+      case 'm':
+        machines_file = optarg;
+        break;
+      case 'l':
+        addr = optarg;
+        break;
+      case 'p':
+        if ((port = atoi(optarg)) < 0 || port > 65535) {
+          fprintf(stderr, "invalid port: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'i':
+        if ((interval_ms = atol(optarg)) < 1) {
+          fprintf(stderr, "invalid interval: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 't':
+        if ((threads = atoi(optarg)) < 1) {
+          fprintf(stderr, "invalid threads: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'o':
+        if ((timeout = atol(optarg)) < 1) {
+          fprintf(stderr, "invalid timeout: \"%s\"\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        shm_name = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (machines_file == NULL) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (read_machines(machines_file, &machines, &ntargets)) return EXIT_FAILURE;
+  if (ntargets == 0) {
+    fprintf(stderr, "no machines in \"%s\"\n", machines_file);
+    free(machines);
+    return EXIT_FAILURE;
+  }
+  if (threads > ntargets) threads = ntargets;
+
+  if (cnc_startupprocess(0, "focas.log") != EW_OK) {
+    fprintf(stderr, "Failed to create required log file!\n");
+    free(machines);
+    return EXIT_FAILURE;
+  }
+  if ((targets = calloc(ntargets, sizeof(*targets))) == NULL ||
+      (names = calloc(ntargets, sizeof(*names))) == NULL ||
+      (pollers = calloc(threads, sizeof(*pollers))) == NULL ||
+      (shm_name == NULL &&
+       (state = state_create(ntargets, METRICS_SLOTS, sizes)) == NULL)) {
+    fprintf(stderr, "Failed to allocate machines!\n");
+    goto cleanup;
+  }
+  // the metrics then read the table of the segment
+  if (shm_name != NULL) {
+    if ((pub = shmpub_create(shm_name, ntargets, METRICS_SLOTS, sizes,
+                             NULL)) == NULL)
+      goto cleanup;
+    state = shmpub_table(pub);
+  }
+  for (i = 0; i < ntargets; i++) {
+    targets[i].machine = &machines[i];
+    targets[i].sink.table = state;
+    targets[i].sink.machine = i;
+    targets[i].shm.pub = pub;
+    targets[i].shm.machine = i;
+    if (pub != NULL) shmpub_set_machine(pub, i, 0, machines[i].name);
+    names[i] = machines[i].name;
+  }
+  if ((metrics = metrics_create(names, ntargets, state)) == NULL ||
+      metrics_listen(metrics, addr, (unsigned short)port))
+    goto cleanup;
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  for (; nconnectors < CONNECTORS && nconnectors < ntargets; nconnectors++) {
+    if (pthread_create(&connectors[nconnectors], NULL, connect_machines,
+                       (void *)(intptr_t)nconnectors) != 0)
+      break;
+  }
+  for (; npollers < threads; npollers++) {
+    if (pthread_create(&pollers[npollers], NULL, poll_machines,
+                       (void *)(intptr_t)npollers) != 0)
+      break;
+  }
+  if (nconnectors == 0 || npollers < threads) {
+    fprintf(stderr, "Failed to start threads!\n");
+    stop = 1;
+  } else {
+    printf("polling %d machines, metrics on http://%s:%u/metrics\n", ntargets,
+           addr, metrics_port(metrics));
+    fflush(stdout);
+    ret = EXIT_SUCCESS;
+  }
+  for (i = 0; i < nconnectors; i++) pthread_join(connectors[i], NULL);
+  for (i = 0; i < npollers; i++) pthread_join(pollers[i], NULL);
+
+cleanup:
+  metrics_destroy(metrics);
+  if (pub != NULL)
+    shmpub_destroy(pub);
+  else
+    state_destroy(state);
+  cnc_exitprocess();
+  free(pollers);
+  free(names);
+  free(targets);
+  free(machines);
+  return ret;
+}
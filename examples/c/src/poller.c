@@ -0,0 +1,352 @@
+#include "./poller.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./callstats.h"
+#include "./clock.h"
+#include "./fwabi.h"
+#include "./unsolic.h"
+#include "fwlib32.h"
+
+// bytes per pmc_rdpmcrng call
+#define PMC_CHUNK 256
+// unsolicited messages picked up per machine and step
+#define PUSH_BURST 16
+
+const MachineOptions default_machine_options = {100, POLL_AUTO, NULL, 5,
+                                                60000, -1};
+
+struct machine {
+  unsigned short libh;
+  Signal *sig;
+  int count;
+  MachineOptions opts;
+  UnsolicOptions push;
+  value_fn fn;
+  void *ctx;
+  int dead;
+  unsigned short key;  // of the call statistics
+
+  UnsolicReceiver *rx;  // while the cnc pushes the first signals
+  double due;           // next poll
+  double push_due;      // next pickup of pushed messages
+  double retry_at;      // next attempt to start pushing, 0 for never
+  MachineStats stats;
+  void *value;  // largest signal
+  IODBPMC *pmc;
+};
+
+struct poller {
+  struct machine **machines;
+  size_t n;
+  size_t cap;
+};
+
+static size_t signal_bytes(const Signal *s) {
+  switch (s->kind) {
+    case SIGNAL_MACRO:
+      return s->size * sizeof(double);
+    case SIGNAL_STATUS:
+      return sizeof(ODBST);
+    case SIGNAL_DYNAMIC:
+      return sizeof(Fw32Dy2);
+    case SIGNAL_SPINDLE:
+      return sizeof(Fw32Spload);
+    default:
+      return s->size;
+  }
+}
+
+static struct machine *find(Poller *p, unsigned short libh) {
+  for (size_t i = 0; i < p->n; i++) {
+    if (!p->machines[i]->dead && p->machines[i]->libh == libh)
+      return p->machines[i];
+  }
+  return NULL;
+}
+
+static void destroy_machine(struct machine *m) {
+  if (m->rx) unsolic_stop(m->rx);
+  free(m->sig);
+  free(m->value);
+  free(m->pmc);
+  free(m);
+}
+
+Poller *poller_create(void) { return calloc(1, sizeof(Poller)); }
+
+void poller_destroy(Poller *p) {
+  if (p == NULL) return;
+  for (size_t i = 0; i < p->n; i++) destroy_machine(p->machines[i]);
+  free(p->machines);
+  free(p);
+}
+
+static void emit(struct machine *m, int i, const void *data, short err,
+                 int pushed, double t) {
+  ValueUpdate u = {m->libh, i, &m->sig[i], NULL, 0, err, pushed, t};
+
+  if (err == EW_OK) {
+    u.data = data;
+    u.size = signal_bytes(&m->sig[i]);
+  }
+  if (err != EW_OK) m->stats.errors++;
+  else if (pushed) m->stats.pushes++;
+  else m->stats.polls++;
+  if (m->fn) m->fn(&u, m->ctx);
+}
+
+/* start the unsolicited messages, on failure decide when to try again */
+static void try_push(struct machine *m, double t) {
+  short err;
+
+  m->retry_at = 0;
+  m->rx = unsolic_start(m->libh, &m->push, m->sig, m->count, &err);
+  m->stats.pushing = m->rx != NULL;
+  m->stats.push_err = m->rx ? EW_OK : err;
+  if (m->rx) {
+    m->push_due = t;
+    return;
+  }
+  if (m->opts.mode == PUSH_ONLY) {
+    for (int i = 0; i < m->count; i++) emit(m, i, NULL, err, 1, t);
+  } else if (err == EW_FUNC || err == EW_NOOPT || err == EW_NUMBER) {
+    // the library or the cnc lacks the option or nothing can be pushed,
+    // keep polling for good
+    return;
+  }
+  m->retry_at = t + m->opts.push_retry_ms / 1e3;
+}
+
+/* pushing stopped working, poll until the next attempt */
+static void fall_back(struct machine *m, short err, double t) {
+  unsolic_stop(m->rx);
+  m->rx = NULL;
+  m->stats.pushing = 0;
+  m->stats.push_err = err;
+  m->stats.fallbacks++;
+  m->due = t;
+  m->retry_at = t + m->opts.push_retry_ms / 1e3;
+}
+
+int poller_add(Poller *p, unsigned short libh, const Signal *signals,
+               int count, const MachineOptions *opts, value_fn fn, void *ctx) {
+  struct machine *m;
+  size_t largest = 0;
+
+  if (opts == NULL) opts = &default_machine_options;
+  if (count < 1 || find(p, libh)) return 1;
+  if (p->n == p->cap) {
+    size_t cap = p->cap ? p->cap * 2 : 16;
+    struct machine **ms = realloc(p->machines, cap * sizeof(*ms));
+    if (ms == NULL) {
+      fprintf(stderr, "Failed to allocate machine!\n");
+      return 1;
+    }
+    p->machines = ms;
+    p->cap = cap;
+  }
+  for (int i = 0; i < count; i++) {
+    if (signal_bytes(&signals[i]) > largest) largest = signal_bytes(&signals[i]);
+  }
+  if ((m = calloc(1, sizeof(*m))) == NULL ||
+      (m->sig = malloc(count * sizeof(Signal))) == NULL ||
+      (m->value = malloc(largest ? largest : 1)) == NULL ||
+      (m->pmc = malloc(sizeof(IODBPMC) + PMC_CHUNK)) == NULL) {
+    fprintf(stderr, "Failed to allocate machine!\n");
+    if (m) destroy_machine(m);
+    return 1;
+  }
+  memcpy(m->sig, signals, count * sizeof(Signal));
+  m->libh = libh;
+  m->count = count;
+  m->opts = *opts;
+  m->fn = fn;
+  m->ctx = ctx;
+  m->key = opts->calls_key < 0 ? libh : (unsigned short)opts->calls_key;
+  m->due = now();
+  if (opts->push && opts->mode != POLL_ONLY) {
+    m->push = *opts->push;
+    m->opts.push = &m->push;
+    try_push(m, m->due);
+  }
+  p->machines[p->n++] = m;
+  return 0;
+}
+
+int poller_remove(Poller *p, unsigned short libh) {
+  struct machine *m = find(p, libh);
+
+  if (m == NULL) return 1;
+  // freed by the next step, the callback may be running on it
+  m->dead = 1;
+  return 0;
+}
+
+int poller_stats(Poller *p, unsigned short libh, MachineStats *stats) {
+  struct machine *m = find(p, libh);
+
+  if (m == NULL) return 1;
+  *stats = m->stats;
+  return 0;
+}
+
+static short read_pmc(struct machine *m, const Signal *s) {
+  char *out = m->value;
+
+  for (unsigned long off = 0; off < s->size;) {
+    unsigned long n = s->size - off < PMC_CHUNK ? s->size - off : PMC_CHUNK;
+    unsigned long start = s->no + off;
+    unsigned long long t = callstats_now();
+    short ret;
+
+    // 8 byte header of IODBPMC, then byte data
+    ret = pmc_rdpmcrng(m->libh, s->addr, 0, start, start + n - 1, 8 + n,
+                       m->pmc);
+    callstats_record("pmc_rdpmcrng", m->key, t, ret);
+    if (ret != EW_OK) return ret;
+    memcpy(out + off, (const char *)m->pmc + offsetof(IODBPMC, u), n);
+    off += n;
+  }
+  return EW_OK;
+}
+
+static short read_macro(struct machine *m, const Signal *s) {
+  unsigned long num = s->size;
+  unsigned long long t = callstats_now();
+  short ret = cnc_rdmacror2(m->libh, s->no, &num, m->value);
+
+  callstats_record("cnc_rdmacror2", m->key, t, ret);
+  if (ret == EW_OK && num < s->size) {
+    memset((double *)m->value + num, 0, (s->size - num) * sizeof(double));
+  }
+  return ret;
+}
+
+static short read_signal(struct machine *m, const Signal *s) {
+  unsigned long long t;
+  short num;
+  short ret;
+
+  switch (s->kind) {
+    case SIGNAL_MACRO:
+      return read_macro(m, s);
+    case SIGNAL_STATUS:
+      t = callstats_now();
+      ret = cnc_statinfo(m->libh, m->value);
+      callstats_record("cnc_statinfo", m->key, t, ret);
+      return ret;
+    case SIGNAL_DYNAMIC:
+      t = callstats_now();
+      ret = cnc_rddynamic2(m->libh, s->addr, sizeof(Fw32Dy2), m->value);
+      callstats_record("cnc_rddynamic2", m->key, t, ret);
+      return ret;
+    case SIGNAL_SPINDLE:
+      t = callstats_now();
+      num = 1;
+      ret = cnc_rdspmeter(m->libh, -1, &num, m->value);
+      callstats_record("cnc_rdspmeter", m->key, t, ret);
+      return ret;
+    default:
+      return read_pmc(m, s);
+  }
+}
+
+static void poll_signals(struct machine *m, int first, double t) {
+  for (int i = first; i < m->count && !m->dead; i++) {
+    emit(m, i, m->value, read_signal(m, &m->sig[i]), 0, t);
+  }
+}
+
+static void pick_up(struct machine *m, double t) {
+  for (int burst = 0; burst < PUSH_BURST && m->rx && !m->dead; burst++) {
+    unsigned updated;
+    short ret = unsolic_read(m->rx, &updated);
+
+    if (ret != EW_OK) {
+      fprintf(stderr, "unsolicited messages of %u stopped: %d\n", m->libh,
+              ret);
+      fall_back(m, ret, t);
+      return;
+    }
+    if (updated == 0) break;
+    for (int i = 0; i < unsolic_signals(m->rx) && !m->dead; i++) {
+      size_t size;
+      const void *data;
+      if (!(updated & 1u << i)) continue;
+      data = unsolic_data(m->rx, i, &size);
+      emit(m, i, data, EW_OK, 1, t);
+    }
+  }
+}
+
+static void advance(struct machine *m, double t) {
+  if (m->rx == NULL && m->retry_at && m->retry_at <= t) try_push(m, t);
+  if (m->rx && m->push_due <= t) {
+    pick_up(m, t);
+    m->push_due = t + m->opts.push_check_ms / 1e3;
+  }
+  if (m->due <= t) {
+    // signals beyond what the cnc pushes are always polled
+    int first = m->rx ? unsolic_signals(m->rx) : 0;
+    double interval = m->opts.interval_ms / 1e3;
+    if (m->opts.mode == PUSH_ONLY) first = m->count;
+    if (first < m->count) {
+      double late = t - m->due;
+      m->stats.cycles++;
+      m->stats.late += late;
+      if (late > m->stats.max_late) m->stats.max_late = late;
+      poll_signals(m, first, t);
+    }
+    m->due += interval;
+    // skip cycles that can not be caught up with
+    if (m->due <= t) {
+      if (first < m->count)
+        m->stats.skipped += (unsigned long)((t - m->due) / interval) + 1;
+      m->due = t + interval;
+    }
+  }
+}
+
+static double next_due(const struct machine *m) {
+  double next = m->due;
+
+  if (m->rx && m->push_due < next) next = m->push_due;
+  if (m->rx == NULL && m->retry_at && m->retry_at < next) next = m->retry_at;
+  return next;
+}
+
+long poller_step(Poller *p) {
+  double t = now();
+  double next = -1;
+  size_t kept = 0;
+
+  // callbacks may add machines, so the count is read on every iteration
+  for (size_t i = 0; i < p->n; i++) {
+    if (!p->machines[i]->dead) advance(p->machines[i], t);
+  }
+  for (size_t i = 0; i < p->n; i++) {
+    struct machine *m = p->machines[i];
+    if (m->dead) {
+      destroy_machine(m);
+      continue;
+    }
+    if (next < 0 || next_due(m) < next) next = next_due(m);
+    p->machines[kept++] = m;
+  }
+  p->n = kept;
+  if (next < 0) return -1;
+  t = now();
+  return next <= t ? 0 : (long)((next - t) * 1e3) + 1;
+}
+
+void poller_run(Poller *p, long timeout_ms) {
+  // a negative timeout steps once, unlike xfer_run and rmtcap_run
+  double deadline = run_deadline(timeout_ms < 0 ? 0 : timeout_ms);
+
+  while (run_wait(poller_step(p), deadline)) {
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef FW_POLLER_H
+#define FW_POLLER_H
+
+#include <stddef.h>
+
+/* value stream of pmc ranges, macro variables, status and dynamic data for
+ * many machines, driven by a single thread through poller_step /
+ * poller_run. a machine either gets its pmc / macro signals pushed by the
+ * cnc as unsolicited messages (unsolic.h) or has them read every interval,
+ * both end up in the same value callback. */
+
+typedef enum signal_kind {
+  SIGNAL_PMC,      // `size` bytes of pmc area `addr` from byte `no`
+  SIGNAL_MACRO,    // `size` macro variables from `no`, as doubles
+  SIGNAL_STATUS,   // ODBST of cnc_statinfo
+  SIGNAL_DYNAMIC,  // Fw32Dy2 (ODBDY2) of cnc_rddynamic2 for axis `addr`
+  SIGNAL_SPINDLE,  // Fw32Spload (ODBSPLOAD) of cnc_rdspmeter, spindle 1
+} SignalKind;
+
+typedef struct signal {
+  SignalKind kind;
+  unsigned short path;  // cnc path, used for unsolicited messages
+  short addr;           // pmc address type (0 G, 1 F, 2 Y, 3 X, ...)
+  unsigned long no;
+  unsigned long size;
+} Signal;
+
+typedef enum poll_mode {
+  POLL_AUTO,  // push when the cnc supports it, poll otherwise
+  POLL_ONLY,
+  PUSH_ONLY,  // never poll, report errors until push works
+} PollMode;
+
+struct unsolic_options;
+
+typedef struct machine_options {
+  long interval_ms;  // poll period
+  PollMode mode;
+  const struct unsolic_options *push;  // NULL polls, copied by poller_add
+  long push_check_ms;  // how often pushed messages are picked up
+  long push_retry_ms;  // try push again after falling back to polling
+  int calls_key;  // callstats.h machine of the FOCAS calls, -1 for the handle
+} MachineOptions;
+
+extern const MachineOptions default_machine_options;
+
+typedef struct value_update {
+  unsigned short libh;
+  int signal;  // index into the signals given to poller_add
+  const Signal *sig;
+  const void *data;  // bytes for pmc, doubles for macros, NULL on error
+  size_t size;       // bytes of data
+  short err;         // EW_OK or the failing FOCAS code
+  int pushed;        // arrived as an unsolicited message
+  double time;       // CLOCK_MONOTONIC seconds
+} ValueUpdate;
+
+typedef void (*value_fn)(const ValueUpdate *update, void *ctx);
+
+typedef struct machine_stats {
+  unsigned long polls;     // signals read by polling
+  unsigned long pushes;    // signals received as unsolicited messages
+  unsigned long errors;
+  unsigned long fallbacks; // times push stopped working and polling took over
+  int pushing;             // push is active right now
+  short push_err;          // why push is not active, EW_OK while it is
+  unsigned long cycles;    // times the signals were polled
+  unsigned long skipped;   // cycles left out because the poller fell behind
+  double late;             // seconds the cycles started after they were due
+  double max_late;
+} MachineStats;
+
+typedef struct poller Poller;
+
+Poller *poller_create(void);
+/* stops every unsolicited message receiver */
+void poller_destroy(Poller *p);
+
+/* signals are copied. returns 1 when the handle is already polled. */
+int poller_add(Poller *p, unsigned short libh, const Signal *signals,
+               int count, const MachineOptions *opts, value_fn fn, void *ctx);
+int poller_remove(Poller *p, unsigned short libh);
+int poller_stats(Poller *p, unsigned short libh, MachineStats *stats);
+
+/* handle everything that is due, returns milliseconds until the next
+ * machine is due or -1 when there are no machines */
+long poller_step(Poller *p);
+/* step and sleep for timeout_ms, or until no machines are left */
+void poller_run(Poller *p, long timeout_ms);
+
+#endif
@@ -0,0 +1,227 @@
+#include "./posstream.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./backoff.h"
+#include "./clock.h"
+#include "./spsc.h"
+#include "fwlib32.h"
+
+const PosOptions default_pos_options = {0, "", 256, 65536, 1000, 1, 1000};
+
+struct pos_stream {
+  unsigned short libh;
+  PosOptions opts;
+  SpscRing *ring;
+  ODBRENPLT *raw;
+  pthread_t thread;
+  atomic_int run;
+  atomic_int running;
+
+  // only touched by the thread
+  unsigned long long seq;
+  long long ticks;  // summed up in ticks so the clock does not drift
+  unsigned short pending;  // events for the next stored sample
+
+  _Atomic unsigned long long samples;
+  _Atomic unsigned long long dropped;
+  atomic_ulong gaps;
+  atomic_ulong overruns;
+  atomic_ulong restarts;
+  atomic_ulong reads;
+  atomic_short err;
+};
+
+static short start_sampling(PosStream *p) {
+  return cnc_stpossmpl(p->libh, p->opts.select, p->opts.axes);
+}
+
+/* end and start the cnc sampler again after a failed read, retrying with
+ * backoff until it comes back or the stream is stopped */
+static short restart(PosStream *p) {
+  unsigned long attempt = 0;
+  short ret;
+
+  cnc_endpossmpl(p->libh);
+  while ((ret = start_sampling(p)) != EW_OK) {
+    if (!atomic_load(&p->run) || attempt >= BACKOFF_MAX_ATTEMPTS) return ret;
+    backoff_sleep(attempt++, 1000, 1000000);
+  }
+  atomic_fetch_add(&p->restarts, 1);
+  p->pending |= POS_RESTART | POS_GAP;
+  return EW_OK;
+}
+
+/* timestamp `n` records and move them into the ring, returns the number
+ * stored */
+static size_t store(PosStream *p, const ODBRENPLT *raw, long n) {
+  PosSample *region = NULL;
+  size_t space = 0;
+  size_t used = 0;
+  size_t stored = 0;
+  // more than half a sample late counts as a gap
+  long late = p->opts.interval + (p->opts.interval + 1) / 2;
+
+  for (long i = 0; i < n; i++) {
+    PosSample *s;
+
+    if (p->seq && raw[i].delay_time > late) {
+      atomic_fetch_add_explicit(&p->gaps, 1, memory_order_relaxed);
+      p->pending |= POS_GAP;
+    }
+    if (p->seq) p->ticks += raw[i].delay_time;
+    p->seq++;
+
+    if (used == space) {
+      void *r;
+      if (used) spsc_commit(p->ring, used);
+      stored += used;
+      space = spsc_write_region(p->ring, &r);
+      region = r;
+      used = 0;
+    }
+    if (space == 0) {
+      if (!(p->pending & POS_OVERRUN))
+        atomic_fetch_add_explicit(&p->overruns, 1, memory_order_relaxed);
+      atomic_fetch_add_explicit(&p->dropped, 1, memory_order_relaxed);
+      p->pending |= POS_OVERRUN;
+      continue;
+    }
+
+    s = &region[used++];
+    s->seq = p->seq - 1;
+    s->time = p->ticks * p->opts.tick_us / 1e6;
+    s->flags = raw[i].data_flag;
+    s->events = p->pending;
+    memcpy(s->pos, raw[i].pos_data, sizeof(s->pos));
+    p->pending = 0;
+  }
+  if (used) spsc_commit(p->ring, used);
+  return stored + used;
+}
+
+static void *drain(void *arg) {
+  PosStream *p = arg;
+
+  while (atomic_load_explicit(&p->run, memory_order_relaxed)) {
+    long n = p->opts.batch;
+    size_t stored;
+    short ret;
+
+    ret = cnc_rdpossmpl(p->libh, &n, p->raw);
+    atomic_fetch_add_explicit(&p->reads, 1, memory_order_relaxed);
+    if (ret != EW_OK) {
+      if ((ret = restart(p)) != EW_OK) {
+        atomic_store(&p->err, ret);
+        break;
+      }
+      continue;
+    }
+    if (n > p->opts.batch) n = p->opts.batch;
+
+    stored = store(p, p->raw, n);
+    if (stored) {
+      atomic_fetch_add_explicit(&p->samples, stored, memory_order_relaxed);
+      spsc_wake(p->ring);
+    }
+    if (n < p->opts.batch) idle(p->opts.idle_us);
+  }
+
+  atomic_store(&p->running, 0);
+  spsc_close(p->ring);
+  return NULL;
+}
+
+PosStream *posstream_start(unsigned short libh, const PosOptions *opts,
+                           short *err) {
+  PosStream *p;
+
+  if (opts == NULL) opts = &default_pos_options;
+  if (opts->batch < 1 || opts->capacity < 1) {
+    *err = EW_NUMBER;
+    return NULL;
+  }
+  if ((p = calloc(1, sizeof(*p))) == NULL) {
+    *err = EW_FUNC;
+    return NULL;
+  }
+  p->libh = libh;
+  p->opts = *opts;
+  p->ring = spsc_create(opts->capacity, sizeof(PosSample));
+  p->raw = calloc(opts->batch, sizeof(ODBRENPLT));
+  if (p->ring == NULL || p->raw == NULL) {
+    fprintf(stderr, "Failed to allocate position stream!\n");
+    spsc_destroy(p->ring);
+    free(p->raw);
+    free(p);
+    *err = EW_FUNC;
+    return NULL;
+  }
+  atomic_init(&p->run, 1);
+  atomic_init(&p->running, 1);
+  atomic_init(&p->samples, 0);
+  atomic_init(&p->dropped, 0);
+  atomic_init(&p->gaps, 0);
+  atomic_init(&p->overruns, 0);
+  atomic_init(&p->restarts, 0);
+  atomic_init(&p->reads, 0);
+  atomic_init(&p->err, EW_OK);
+
+  if ((*err = start_sampling(p)) != EW_OK) {
+    spsc_destroy(p->ring);
+    free(p->raw);
+    free(p);
+    return NULL;
+  }
+  if (pthread_create(&p->thread, NULL, drain, p)) {
+    fprintf(stderr, "Failed to start position sampling thread!\n");
+    cnc_endpossmpl(libh);
+    spsc_destroy(p->ring);
+    free(p->raw);
+    free(p);
+    *err = EW_FUNC;
+    return NULL;
+  }
+  return p;
+}
+
+short posstream_stop(PosStream *p, PosStats *stats) {
+  short ret;
+
+  atomic_store(&p->run, 0);
+  pthread_join(p->thread, NULL);
+  ret = cnc_endpossmpl(p->libh);
+  if (stats) posstream_stats(p, stats);
+
+  spsc_destroy(p->ring);
+  free(p->raw);
+  free(p);
+  return ret;
+}
+
+size_t posstream_peek(PosStream *p, const PosSample **samples,
+                      long timeout_ms) {
+  const void *region;
+  size_t n = spsc_read_wait(p->ring, &region, timeout_ms);
+
+  *samples = region;
+  return n;
+}
+
+void posstream_release(PosStream *p, size_t n) { spsc_release(p->ring, n); }
+
+int posstream_running(PosStream *p) { return atomic_load(&p->running); }
+
+void posstream_stats(PosStream *p, PosStats *stats) {
+  stats->samples = atomic_load_explicit(&p->samples, memory_order_relaxed);
+  stats->dropped = atomic_load_explicit(&p->dropped, memory_order_relaxed);
+  stats->gaps = atomic_load_explicit(&p->gaps, memory_order_relaxed);
+  stats->overruns = atomic_load_explicit(&p->overruns, memory_order_relaxed);
+  stats->restarts = atomic_load_explicit(&p->restarts, memory_order_relaxed);
+  stats->reads = atomic_load_explicit(&p->reads, memory_order_relaxed);
+  stats->err = atomic_load(&p->err);
+}
@@ -0,0 +1,65 @@
+#ifndef FW_POSSTREAM_H
+#define FW_POSSTREAM_H
+
+#include <stddef.h>
+
+/* continuous position sampling (cnc_stpossmpl, cnc_rdpossmpl,
+ * cnc_endpossmpl). a thread keeps the cnc sampler running, drains it in
+ * batches and timestamps every sample on the controller clock by adding up
+ * the delay_time of the records. consumers read batches in place like
+ * sampling.h. */
+
+#define POS_AXES 6  // pos_data of ODBRENPLT
+
+/* PosSample.events, what happened between the previous sample and this one */
+#define POS_GAP 1      // delay_time jumped, the cnc skipped samples
+#define POS_OVERRUN 2  // samples were dropped because the ring was full
+#define POS_RESTART 4  // the cnc sampler failed and was started again
+
+typedef struct pos_sample {
+  unsigned long long seq;  // number of the sample since the stream started
+  double time;             // seconds on the controller clock since the start
+  unsigned short flags;    // data_flag as reported by the cnc
+  unsigned short events;
+  short pos[POS_AXES];
+} PosSample;
+
+typedef struct pos_options {
+  short select;      // first argument of cnc_stpossmpl
+  char axes[16];     // axis selection passed to cnc_stpossmpl
+  long batch;        // records requested per cnc_rdpossmpl
+  size_t capacity;   // ring size in samples
+  long tick_us;      // unit of delay_time
+  long interval;     // expected delay_time between two samples
+  long idle_us;      // sleep when the cnc had nothing new
+} PosOptions;
+
+extern const PosOptions default_pos_options;
+
+typedef struct pos_stats {
+  unsigned long long samples;  // stored in the ring
+  unsigned long long dropped;  // lost to overruns
+  unsigned long gaps;
+  unsigned long overruns;
+  unsigned long restarts;
+  unsigned long reads;
+  short err;  // EW_OK or the error that stopped the thread
+} PosStats;
+
+typedef struct pos_stream PosStream;
+
+PosStream *posstream_start(unsigned short libh, const PosOptions *opts,
+                           short *err);
+/* stop the thread and end sampling, regions from posstream_peek are invalid
+ * afterwards */
+short posstream_stop(PosStream *p, PosStats *stats);
+
+/* wait up to timeout_ms for samples, returns the number of contiguous
+ * samples at *samples, valid until posstream_release */
+size_t posstream_peek(PosStream *p, const PosSample **samples,
+                      long timeout_ms);
+void posstream_release(PosStream *p, size_t n);
+int posstream_running(PosStream *p);
+void posstream_stats(PosStream *p, PosStats *stats);
+
+#endif
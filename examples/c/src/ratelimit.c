@@ -0,0 +1,41 @@
+#include "./ratelimit.h"
+
+#include <time.h>
+
+#include "./clock.h"
+
+void ratelimit_init(RateLimit *rl, double rate) {
+  pthread_mutex_init(&rl->lock, NULL);
+  rl->rate = rate;
+  // a quarter second worth of data keeps chunky transfers from stalling
+  rl->burst = rate / 4;
+  rl->tokens = rl->burst;
+  rl->last = now();
+}
+
+void ratelimit_destroy(RateLimit *rl) { pthread_mutex_destroy(&rl->lock); }
+
+void ratelimit_take(RateLimit *rl, size_t bytes) {
+  double wait = 0;
+  double t;
+
+  if (rl->rate <= 0) return;
+
+  pthread_mutex_lock(&rl->lock);
+  t = now();
+  rl->tokens += (t - rl->last) * rl->rate;
+  if (rl->tokens > rl->burst) rl->tokens = rl->burst;
+  rl->last = t;
+  // go into debt so large requests are not starved by small ones, the
+  // caller sleeps until the debt would have been paid off
+  rl->tokens -= (double)bytes;
+  if (rl->tokens < 0) wait = -rl->tokens / rl->rate;
+  pthread_mutex_unlock(&rl->lock);
+
+  if (wait > 0) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)wait;
+    ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef FW_RATELIMIT_H
+#define FW_RATELIMIT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* token bucket shared by all transfers of a run */
+typedef struct ratelimit {
+  pthread_mutex_t lock;
+  double rate;    // bytes per second, 0 = unlimited
+  double burst;   // bytes that may pass without waiting
+  double tokens;
+  double last;
+} RateLimit;
+
+void ratelimit_init(RateLimit *rl, double rate);
+void ratelimit_destroy(RateLimit *rl);
+/* account for `bytes` and sleep until they fit under the rate */
+void ratelimit_take(RateLimit *rl, size_t bytes);
+
+#endif
@@ -0,0 +1,362 @@
+#include "./rmtcap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./clock.h"
+#include "fwlib32.h"
+
+// cnc_rmtwavestat: 1 waiting for the trigger, 2 sampling, 0 once done
+#define RMT_DONE 0
+// cnc_rdrmtwavedt types, waveform channels then signal channels
+#define RMT_TYPE_WAVE 0
+#define RMT_TYPE_SIGNAL 1
+#define RMT_RECORD 1917  // samples of ODBRMTDT
+#define RMT_MAX_RECORDS 100000
+
+const RmtCapOptions default_rmtcap_options = {10, 1000};
+
+enum rmt_state { RMT_IDLE, RMT_ARMED };
+
+struct rmt_job {
+  unsigned short libh;
+  RmtCapJob job;
+  char prefix[256];
+  rmtcap_done_fn done;
+  void *ctx;
+  int dead;
+
+  enum rmt_state state;
+  double due;
+  double armed;
+  long interval;  // ms between polls
+  unsigned long busy;
+  unsigned long polls;
+  unsigned long capture;
+  short stat;
+};
+
+struct rmtcap_service {
+  RmtCapOptions opts;
+  struct rmt_job **jobs;
+  size_t njobs;
+  size_t cap;
+  int live;
+};
+
+/* samples of one channel collected from the records of a capture */
+struct column {
+  short kind;
+  short *data;
+  size_t n;
+  size_t cap;
+};
+
+static struct rmt_job *find(RmtCapService *s, unsigned short libh) {
+  for (size_t i = 0; i < s->njobs; i++) {
+    if (!s->jobs[i]->dead && s->jobs[i]->libh == libh) return s->jobs[i];
+  }
+  return NULL;
+}
+
+RmtCapService *rmtcap_create(const RmtCapOptions *opts) {
+  RmtCapService *s = calloc(1, sizeof(*s));
+  if (s) s->opts = opts ? *opts : default_rmtcap_options;
+  return s;
+}
+
+void rmtcap_destroy(RmtCapService *s) {
+  if (s == NULL) return;
+  for (size_t i = 0; i < s->njobs; i++) {
+    if (!s->jobs[i]->dead && s->jobs[i]->state == RMT_ARMED)
+      cnc_rmtwavestop(s->jobs[i]->libh);
+    free(s->jobs[i]);
+  }
+  free(s->jobs);
+  free(s);
+}
+
+int rmtcap_jobs(const RmtCapService *s) { return s->live; }
+
+int rmtcap_add(RmtCapService *s, unsigned short libh, const RmtCapJob *job,
+               rmtcap_done_fn done, void *ctx) {
+  struct rmt_job *j;
+
+  if (find(s, libh)) return 1;
+  if (job->config.signals < 0 || job->config.signals > RMTCAP_SIGNALS)
+    return 1;
+  if (s->njobs == s->cap) {
+    size_t cap = s->cap ? s->cap * 2 : 16;
+    struct rmt_job **jobs = realloc(s->jobs, cap * sizeof(*jobs));
+    if (jobs == NULL) {
+      fprintf(stderr, "Failed to allocate capture job!\n");
+      return 1;
+    }
+    s->jobs = jobs;
+    s->cap = cap;
+  }
+  if ((j = calloc(1, sizeof(*j))) == NULL) {
+    fprintf(stderr, "Failed to allocate capture job!\n");
+    return 1;
+  }
+  j->libh = libh;
+  j->job = *job;
+  snprintf(j->prefix, sizeof(j->prefix), "%s", job->prefix);
+  j->job.prefix = j->prefix;
+  j->done = done;
+  j->ctx = ctx;
+  j->state = RMT_IDLE;
+  j->due = now();
+  s->jobs[s->njobs++] = j;
+  s->live++;
+  return 0;
+}
+
+int rmtcap_remove(RmtCapService *s, unsigned short libh) {
+  struct rmt_job *j = find(s, libh);
+
+  if (j == NULL) return 1;
+  if (j->state == RMT_ARMED) cnc_rmtwavestop(libh);
+  // freed by the next step, a callback may be running on it
+  j->dead = 1;
+  s->live--;
+  return 0;
+}
+
+int rmtcap_arm(RmtCapService *s, unsigned short libh) {
+  struct rmt_job *j = find(s, libh);
+
+  if (j == NULL || j->state != RMT_IDLE) return 1;
+  j->due = now();
+  return 0;
+}
+
+static short arm(struct rmt_job *j) {
+  const RmtCapConfig *c = &j->job.config;
+  IODBRMTPRM prm;
+  short ret;
+
+  memset(&prm, 0, sizeof(prm));
+  prm.condition = c->condition;
+  if (c->sig_trg.adr) {
+    prm.trg.io.adr = c->sig_trg.adr;
+    prm.trg.io.bit = c->sig_trg.bit;
+    prm.trg.io.no = c->sig_trg.no;
+  } else {
+    prm.trg.alm.no = c->alm_no;
+    prm.trg.alm.axis = c->alm_axis;
+    prm.trg.alm.type = c->alm_type;
+  }
+  prm.delay = c->delay;
+  prm.wv_intrvl = c->wv_intrvl;
+  prm.io_intrvl = c->io_intrvl;
+  prm.kind1 = c->kind1;
+  prm.kind2 = c->kind2;
+  for (int i = 0; i < c->signals; i++) {
+    prm.smpl[i].adr = c->smpl[i].adr;
+    prm.smpl[i].bit = c->smpl[i].bit;
+    prm.smpl[i].no = c->smpl[i].no;
+  }
+  if ((ret = cnc_wrrmtwaveprm(j->libh, &prm)) != EW_OK) return ret;
+  return cnc_rmtwavestart(j->libh);
+}
+
+static int column_append(struct column *col, short kind, const short *data,
+                         size_t n) {
+  if (col->n + n > col->cap) {
+    size_t cap = col->cap ? col->cap : RMT_RECORD;
+    short *p;
+    while (cap < col->n + n) cap *= 2;
+    if ((p = realloc(col->data, cap * sizeof(short))) == NULL) return 1;
+    col->data = p;
+    col->cap = cap;
+  }
+  memcpy(&col->data[col->n], data, n * sizeof(short));
+  col->kind = kind;
+  col->n += n;
+  return 0;
+}
+
+/* read every record of one type, records carry their 1 based channel.
+ * `base` is the first column used for the type, *used is raised to the
+ * number of columns in use. */
+static short read_type(struct rmt_job *j, short type, ODBRMTDT *buf,
+                       struct column *cols, int base, int *used,
+                       WaveInfo *info) {
+  for (long rec = 1; rec <= RMT_MAX_RECORDS; rec++) {
+    long len = RMT_RECORD;
+    int ch;
+    short ret;
+
+    if ((ret = cnc_rdrmtwavedt(j->libh, type, rec, &len, buf)) != EW_OK)
+      return ret;
+    if (len <= 0) break;
+    if (len > RMT_RECORD) len = RMT_RECORD;
+
+    if (info->period_us == 0 && type == RMT_TYPE_WAVE) {
+      char started[32];
+      snprintf(started, sizeof(started), "%04d-%02d-%02d %02d:%02d:%02d",
+               buf->year < 100 ? 2000 + buf->year : buf->year, buf->month,
+               buf->day, buf->hour, buf->minute, buf->second);
+      memcpy(info->started, started, sizeof(info->started) - 1);
+      // t_intrvl is in ms
+      info->period_us = buf->t_intrvl * 1000UL;
+    }
+    ch = base + buf->channel - 1;
+    if (buf->channel < 1 || ch >= WAVE_MAX_CHANNELS) continue;
+    if (column_append(&cols[ch], buf->kind, buf->data, len)) return EW_FUNC;
+    if (ch + 1 > *used) *used = ch + 1;
+  }
+  return EW_OK;
+}
+
+/* pull the finished capture into "<prefix>-<capture>.fwave" */
+static short collect(struct rmt_job *j, char *path, size_t size,
+                     unsigned long long *samples) {
+  struct column cols[WAVE_MAX_CHANNELS];
+  WaveInfo info;
+  WaveWriter *w = NULL;
+  ODBRMTDT *buf;
+  int used = 0;
+  short ret;
+
+  memset(cols, 0, sizeof(cols));
+  memset(&info, 0, sizeof(info));
+  *samples = 0;
+  if ((buf = malloc(sizeof(*buf))) == NULL) return EW_FUNC;
+
+  ret = read_type(j, RMT_TYPE_WAVE, buf, cols, 0, &used, &info);
+  if (ret == EW_OK && j->job.config.signals > 0)
+    ret = read_type(j, RMT_TYPE_SIGNAL, buf, cols, used, &used, &info);
+  if (ret != EW_OK) {
+    fprintf(stderr, "cnc_rdrmtwavedt failed: %d\n", ret);
+    goto done;
+  }
+
+  info.channels = used;
+  for (int i = 0; i < used; i++) info.ch[i].kind = cols[i].kind;
+  snprintf(path, size, "%s-%lu.fwave", j->prefix, j->capture);
+  if ((w = wavefile_create(path, &info)) == NULL) {
+    ret = EW_FUNC;
+    goto done;
+  }
+  wavefile_set_period(w, info.period_us, info.started);
+  for (int i = 0; i < used; i++) {
+    if (wavefile_append(w, i, cols[i].data, cols[i].n)) {
+      wavefile_abort(w);
+      ret = EW_FUNC;
+      goto done;
+    }
+    *samples += cols[i].n;
+  }
+  if (wavefile_commit(w) == 0) ret = EW_FUNC;
+
+done:
+  for (int i = 0; i < WAVE_MAX_CHANNELS; i++) free(cols[i].data);
+  free(buf);
+  return ret;
+}
+
+static void finish(RmtCapService *s, struct rmt_job *j, short err,
+                   const char *path, unsigned long long samples, double t) {
+  RmtCapResult r = {j->libh, err == EW_OK ? path : NULL, err, j->capture,
+                    j->polls, samples, t - j->armed};
+
+  j->state = RMT_IDLE;
+  if (j->done) j->done(&r, j->ctx);
+  if (j->dead) return;  // removed by the callback
+  if (j->job.every_ms > 0) {
+    j->due = t + j->job.every_ms / 1e3;
+  } else {
+    j->dead = 1;
+    s->live--;
+  }
+}
+
+static void advance(RmtCapService *s, struct rmt_job *j, double t) {
+  char path[320];
+  short stat;
+  short ret;
+
+  if (j->state == RMT_IDLE) {
+    if ((ret = arm(j)) == EW_BUSY && j->busy < 16) {
+      // someone else is using the waveform diagnosis, try again later
+      long ms = s->opts.poll_min_ms << j->busy++;
+      j->due = t + (ms < s->opts.poll_max_ms ? ms : s->opts.poll_max_ms) / 1e3;
+      return;
+    }
+    j->busy = 0;
+    j->capture++;
+    j->polls = 0;
+    j->armed = t;
+    if (ret != EW_OK) {
+      fprintf(stderr, "arming remote waveform capture failed: %d\n", ret);
+      finish(s, j, ret, NULL, 0, t);
+      return;
+    }
+    j->state = RMT_ARMED;
+    j->stat = -1;
+    j->interval = s->opts.poll_min_ms;
+    j->due = t + j->interval / 1e3;
+    return;
+  }
+
+  j->polls++;
+  if ((ret = cnc_rmtwavestat(j->libh, &stat)) != EW_OK) {
+    cnc_rmtwavestop(j->libh);
+    finish(s, j, ret, NULL, 0, t);
+    return;
+  }
+  if (stat != RMT_DONE) {
+    if (j->job.timeout_ms && (t - j->armed) * 1e3 > j->job.timeout_ms) {
+      cnc_rmtwavestop(j->libh);
+      finish(s, j, EW_BUSY, NULL, 0, t);
+      return;
+    }
+    // poll fast while the capture moves along, back off while it waits
+    j->interval = stat != j->stat ? s->opts.poll_min_ms : j->interval * 2;
+    if (j->interval > s->opts.poll_max_ms) j->interval = s->opts.poll_max_ms;
+    j->stat = stat;
+    j->due = t + j->interval / 1e3;
+    return;
+  }
+
+  unsigned long long samples = 0;
+  ret = collect(j, path, sizeof(path), &samples);
+  finish(s, j, ret, path, samples, now());
+}
+
+long rmtcap_step(RmtCapService *s) {
+  double t = now();
+  double next = -1;
+  size_t kept = 0;
+
+  // a scan is cheap next to a single FOCAS round trip, callbacks may add
+  // jobs so the count is read on every iteration
+  for (size_t i = 0; i < s->njobs; i++) {
+    struct rmt_job *j = s->jobs[i];
+    if (!j->dead && j->due <= t) advance(s, j, t);
+  }
+  for (size_t i = 0; i < s->njobs; i++) {
+    struct rmt_job *j = s->jobs[i];
+    if (j->dead) {
+      free(j);
+      continue;
+    }
+    if (next < 0 || j->due < next) next = j->due;
+    s->jobs[kept++] = j;
+  }
+  s->njobs = kept;
+  if (next < 0) return -1;
+  t = now();
+  return next <= t ? 0 : (long)((next - t) * 1e3) + 1;
+}
+
+int rmtcap_run(RmtCapService *s, long timeout_ms) {
+  double deadline = run_deadline(timeout_ms);
+
+  while (run_wait(rmtcap_step(s), deadline)) {
+  }
+  return s->live;
+}
@@ -0,0 +1,91 @@
+#ifndef FW_RMTCAP_H
+#define FW_RMTCAP_H
+
+#include "./wavefile.h"
+
+/* background capture service for the remote waveform diagnosis
+ * (cnc_wrrmtwaveprm, cnc_rmtwavestart, cnc_rmtwavestat, cnc_rdrmtwavedt).
+ * every machine gets one job: the service arms the capture on the cnc, which
+ * then waits for its own alarm / signal trigger, and one thread polls
+ * cnc_rmtwavestat of all armed machines with a backoff that grows while
+ * nothing happens. data is only read once a capture finished, into a
+ * waveform file per capture.
+ *
+ * the service writes the whole IODBRMTPRM of a job before every arm, so it
+ * never reads the parameters back with cnc_rdrmtwaveprm. fwlib32.h also
+ * leaves the meaning of that call's third argument open. */
+
+#define RMTCAP_SIGNALS 32  // smpl entries of IODBRMTPRM
+
+typedef struct rmtcap_signal {
+  char adr;  // pmc address type
+  char bit;
+  short no;
+} RmtCapSignal;
+
+typedef struct rmtcap_config {
+  short condition;  // trigger condition of IODBRMTPRM
+  short alm_no;     // alarm trigger, used when sig_trg.adr is 0
+  char alm_axis;
+  char alm_type;
+  RmtCapSignal sig_trg;  // signal trigger
+  long delay;            // ms after the trigger
+  short wv_intrvl;       // waveform sampling interval
+  short io_intrvl;       // signal sampling interval
+  short kind1;           // waveform kinds
+  short kind2;
+  int signals;
+  RmtCapSignal smpl[RMTCAP_SIGNALS];
+} RmtCapConfig;
+
+typedef struct rmtcap_job {
+  RmtCapConfig config;
+  const char *prefix;  // captures go to "<prefix>-<n>.fwave", copied
+  long every_ms;       // re-arm this long after a capture, 0 for one shot
+  long timeout_ms;     // give up waiting for the trigger, 0 waits forever
+} RmtCapJob;
+
+typedef struct rmtcap_options {
+  long poll_min_ms;  // cnc_rmtwavestat backoff per machine
+  long poll_max_ms;
+} RmtCapOptions;
+
+extern const RmtCapOptions default_rmtcap_options;
+
+typedef struct rmtcap_result {
+  unsigned short libh;
+  const char *path;  // NULL unless err is EW_OK
+  short err;         // EW_OK or the failing FOCAS code, EW_BUSY on timeout
+  unsigned long capture;  // number of the capture for this job, from 1
+  unsigned long polls;    // cnc_rmtwavestat calls for this capture
+  unsigned long long samples;
+  double waited;  // seconds between arming and the end of the capture
+} RmtCapResult;
+
+typedef void (*rmtcap_done_fn)(const RmtCapResult *result, void *ctx);
+
+typedef struct rmtcap_service RmtCapService;
+
+RmtCapService *rmtcap_create(const RmtCapOptions *opts);
+/* stops every capture still armed */
+void rmtcap_destroy(RmtCapService *s);
+
+/* add the job of `libh`, armed on the next step. returns 1 when the handle
+ * already has a job. */
+int rmtcap_add(RmtCapService *s, unsigned short libh, const RmtCapJob *job,
+               rmtcap_done_fn done, void *ctx);
+/* stop and drop the job of `libh`, returns 1 when there is none */
+int rmtcap_remove(RmtCapService *s, unsigned short libh);
+/* arm a waiting repeating job now instead of after every_ms */
+int rmtcap_arm(RmtCapService *s, unsigned short libh);
+
+/* poll everything that is due, returns milliseconds until the next poll is
+ * due or -1 when no jobs are left */
+long rmtcap_step(RmtCapService *s);
+/* step and sleep until every job finished, or timeout_ms passed when
+ * timeout_ms >= 0. returns the number of jobs left. */
+int rmtcap_run(RmtCapService *s, long timeout_ms);
+
+int rmtcap_jobs(const RmtCapService *s);
+
+#endif
@@ -0,0 +1,189 @@
+#include "./sampling.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./clock.h"
+#include "./spsc.h"
+#include "fwlib32.h"
+
+#if defined(__GNUC__) && !defined(_WIN32)
+// not every libfwlib32 build exports the sdt family, resolve it at runtime
+#pragma weak cnc_sdtsetchnl
+#pragma weak cnc_sdtstartsmpl
+#pragma weak cnc_sdtreadsmpl
+#pragma weak cnc_sdtendsmpl
+#define SDT_AVAILABLE() (cnc_sdtsetchnl && cnc_sdtstartsmpl && \
+                         cnc_sdtreadsmpl && cnc_sdtendsmpl)
+#else
+#define SDT_AVAILABLE() 1
+#endif
+
+const SamplerOptions default_sampler_options = {0, 1, 65536, 1024, 1000};
+
+struct sampler {
+  unsigned short libh;
+  int channels;
+  SamplerOptions opts;
+  SpscRing *ring;
+  unsigned short *scratch;  // target of reads while the ring is full
+  pthread_t thread;
+
+  atomic_int run;      // cleared by sampler_stop
+  atomic_int running;  // cleared by the thread when it exits
+
+  _Atomic unsigned long long frames;
+  _Atomic unsigned long long dropped;
+  atomic_ulong reads;
+  atomic_short status;
+  atomic_short err;
+};
+
+static void *drain(void *arg) {
+  Sampler *s = arg;
+
+  while (atomic_load_explicit(&s->run, memory_order_relaxed)) {
+    void *region;
+    size_t space = spsc_write_region(s->ring, &region);
+    long want = s->opts.batch;
+    long got = 0;
+    short stat = 0;
+    ODBSD sd;
+    short ret;
+
+    if (space && (size_t)want > space) want = space;
+    sd.chadata = space ? region : s->scratch;
+    sd.count = &got;
+    ret = cnc_sdtreadsmpl(s->libh, &stat, want, &sd);
+    atomic_fetch_add_explicit(&s->reads, 1, memory_order_relaxed);
+    atomic_store_explicit(&s->status, stat, memory_order_relaxed);
+    if (ret != EW_OK) {
+      atomic_store(&s->err, ret);
+      break;
+    }
+
+    if (got > want) got = want;
+    if (got > 0 && space) {
+      spsc_commit(s->ring, got);
+      atomic_fetch_add_explicit(&s->frames, got, memory_order_relaxed);
+      spsc_wake(s->ring);
+    } else if (got > 0) {
+      // keep draining the cnc so its buffer does not overflow, the frames
+      // are lost either way
+      atomic_fetch_add_explicit(&s->dropped, got, memory_order_relaxed);
+    }
+    if (got < want) idle(s->opts.idle_us);
+  }
+
+  atomic_store(&s->running, 0);
+  spsc_close(s->ring);
+  return NULL;
+}
+
+Sampler *sampler_start(unsigned short libh, const SamplerChannel *channels,
+                       short count, const SamplerOptions *opts, short *err) {
+  IDBSDTCHAN *chans;
+  Sampler *s;
+  short ret;
+
+  if (opts == NULL) opts = &default_sampler_options;
+  if (count < 1 || opts->batch < 1) {
+    *err = EW_NUMBER;
+    return NULL;
+  }
+  if (!SDT_AVAILABLE()) {
+    fprintf(stderr, "cnc_sdt* sampling is not supported by this library\n");
+    *err = EW_FUNC;
+    return NULL;
+  }
+
+  chans = calloc(count, sizeof(*chans));
+  s = calloc(1, sizeof(*s));
+  if (chans == NULL || s == NULL) {
+    free(chans);
+    free(s);
+    *err = EW_FUNC;
+    return NULL;
+  }
+  for (short i = 0; i < count; i++) {
+    chans[i].type = channels[i].type;
+    chans[i].chno = channels[i].chno;
+    chans[i].axis = channels[i].axis;
+    chans[i].shift = channels[i].shift;
+  }
+
+  ret = cnc_sdtsetchnl(libh, count, opts->period, chans);
+  free(chans);
+  if (ret == EW_OK) ret = cnc_sdtstartsmpl(libh, opts->type, opts->period);
+  if (ret != EW_OK) {
+    free(s);
+    *err = ret;
+    return NULL;
+  }
+
+  s->libh = libh;
+  s->channels = count;
+  s->opts = *opts;
+  s->ring = spsc_create(opts->capacity, count * sizeof(unsigned short));
+  s->scratch = malloc(opts->batch * count * sizeof(unsigned short));
+  atomic_init(&s->run, 1);
+  atomic_init(&s->running, 1);
+  atomic_init(&s->frames, 0);
+  atomic_init(&s->dropped, 0);
+  atomic_init(&s->reads, 0);
+  atomic_init(&s->status, 0);
+  atomic_init(&s->err, EW_OK);
+
+  if (s->ring == NULL || s->scratch == NULL ||
+      pthread_create(&s->thread, NULL, drain, s)) {
+    fprintf(stderr, "Failed to start sampling thread!\n");
+    cnc_sdtendsmpl(libh);
+    spsc_destroy(s->ring);
+    free(s->scratch);
+    free(s);
+    *err = EW_FUNC;
+    return NULL;
+  }
+  *err = EW_OK;
+  return s;
+}
+
+short sampler_stop(Sampler *s, SamplerStats *stats) {
+  short ret;
+
+  atomic_store(&s->run, 0);
+  pthread_join(s->thread, NULL);
+  ret = cnc_sdtendsmpl(s->libh);
+  if (stats) sampler_stats(s, stats);
+
+  spsc_destroy(s->ring);
+  free(s->scratch);
+  free(s);
+  return ret;
+}
+
+int sampler_channels(const Sampler *s) { return s->channels; }
+
+int sampler_running(Sampler *s) { return atomic_load(&s->running); }
+
+void sampler_stats(Sampler *s, SamplerStats *stats) {
+  stats->frames = atomic_load_explicit(&s->frames, memory_order_relaxed);
+  stats->dropped = atomic_load_explicit(&s->dropped, memory_order_relaxed);
+  stats->reads = atomic_load_explicit(&s->reads, memory_order_relaxed);
+  stats->status = atomic_load_explicit(&s->status, memory_order_relaxed);
+  stats->err = atomic_load(&s->err);
+}
+
+size_t sampler_peek(Sampler *s, const unsigned short **frames,
+                    long timeout_ms) {
+  const void *region;
+  size_t n = spsc_read_wait(s->ring, &region, timeout_ms);
+
+  *frames = region;
+  return n;
+}
+
+void sampler_release(Sampler *s, size_t n) { spsc_release(s->ring, n); }
@@ -0,0 +1,64 @@
+#ifndef FW_SAMPLING_H
+#define FW_SAMPLING_H
+
+#include <stddef.h>
+
+/* servo / spindle data sampling (cnc_sdtsetchnl, cnc_sdtstartsmpl,
+ * cnc_sdtreadsmpl, cnc_sdtendsmpl). a dedicated thread drains the cnc
+ * straight into a lock-free ring, consumers read batches of frames in place.
+ * a frame holds one unsigned short per channel in channel order.
+ *
+ * the *2 variants (cnc_sdtsetchnl2, cnc_sdtstartsmpl2, cnc_sdtreadsmpl2,
+ * cnc_sdtendsmpl2) are not used. they add pmc signals to the channels and
+ * a pmc trigger, but fwlib32.h does not say where the signals go in a
+ * frame, and none of the libfwlib32 builds here exports them. */
+
+/* same layout as IDBSDTCHAN */
+typedef struct sampler_channel {
+  short type;  // data type, e.g. current / velocity
+  char chno;   // cnc channel number
+  char axis;   // servo axis or spindle number
+  unsigned short shift;
+} SamplerChannel;
+
+typedef struct sampler_options {
+  short type;       // sampling type for cnc_sdtstartsmpl
+  long period;      // sampling cycle for cnc_sdtsetchnl / cnc_sdtstartsmpl
+  size_t capacity;  // ring size in frames, rounded up to a power of two
+  long batch;       // most frames requested per cnc_sdtreadsmpl
+  long idle_us;     // sleep when the cnc had nothing new
+} SamplerOptions;
+
+extern const SamplerOptions default_sampler_options;
+
+typedef struct sampler_stats {
+  unsigned long long frames;   // frames stored in the ring
+  unsigned long long dropped;  // frames read while the ring was full
+  unsigned long reads;         // cnc_sdtreadsmpl calls
+  short status;                // last status reported by cnc_sdtreadsmpl
+  short err;                   // EW_OK or the error that stopped the thread
+} SamplerStats;
+
+typedef struct sampler Sampler;
+
+/* configure the channels and start sampling. returns NULL and sets *err when
+ * the cnc refused or the sdt functions are missing from the library. */
+Sampler *sampler_start(unsigned short libh, const SamplerChannel *channels,
+                       short count, const SamplerOptions *opts, short *err);
+/* stop the thread, end sampling on the cnc and free everything. any region
+ * returned by sampler_peek is invalid afterwards. */
+short sampler_stop(Sampler *s, SamplerStats *stats);
+
+int sampler_channels(const Sampler *s);
+void sampler_stats(Sampler *s, SamplerStats *stats);
+
+/* wait up to timeout_ms for frames and point *frames at them. returns the
+ * number of contiguous frames, 0 on timeout or when sampling stopped and
+ * everything was read. the frames stay valid until sampler_release. */
+size_t sampler_peek(Sampler *s, const unsigned short **frames,
+                    long timeout_ms);
+void sampler_release(Sampler *s, size_t n);
+/* non-zero while the sampling thread is running */
+int sampler_running(Sampler *s);
+
+#endif
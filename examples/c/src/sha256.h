@@ -0,0 +1,22 @@
+#ifndef FW_SHA256_H
+#define FW_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+typedef struct sha256 {
+  uint32_t state[8];
+  uint64_t length;
+  unsigned char block[64];
+  size_t used;
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+void sha256_final(Sha256 *ctx, unsigned char digest[SHA256_SIZE]);
+/* lowercase hex of digest, `hex` must hold 2 * SHA256_SIZE + 1 bytes */
+void sha256_hex(const unsigned char digest[SHA256_SIZE], char *hex);
+
+#endif
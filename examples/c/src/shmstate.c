@@ -0,0 +1,356 @@
+#include "./shmstate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_bytes;
+  uint32_t machines;
+  uint32_t slots;
+  uint64_t stride;
+  uint64_t table_offset;
+  uint64_t ring_offset;
+  uint32_t ring_frames;
+  uint32_t frame_bytes;
+  uint32_t pid;
+  uint32_t reserved;
+};
+
+struct slot_entry {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct machine_entry {
+  uint32_t libh;
+  char name[SHM_NAME_LEN];
+};
+
+#define FRAME_HEADER 32
+
+struct frame {
+  _Atomic uint64_t seq;
+  double time;
+  uint32_t machine;
+  uint32_t slot;
+  int16_t err;
+  uint16_t reserved;
+  uint32_t size;
+};
+
+const ShmOptions default_shm_options = {1024, 256};
+
+struct shm_publisher {
+  char name[256];
+  unsigned char *mem;
+  size_t bytes;
+  StateTable *table;
+  struct header *header;
+  _Atomic uint64_t *head;
+  unsigned char *frames;
+  size_t frame_stride;
+};
+
+struct shm_reader {
+  unsigned char *mem;
+  size_t bytes;
+  StateTable *table;
+  const struct header *header;
+  const struct machine_entry *dir;
+  _Atomic uint64_t *head;
+  unsigned char *frames;
+  size_t frame_stride;
+  uint64_t next;  // next event to read
+};
+
+static size_t round_line(size_t n) {
+  return (n + STATE_CACHE_LINE - 1) & ~(size_t)(STATE_CACHE_LINE - 1);
+}
+
+static size_t header_bytes(int machines, int slots) {
+  return round_line(sizeof(struct header) +
+                    slots * sizeof(struct slot_entry) +
+                    machines * sizeof(struct machine_entry));
+}
+
+static struct slot_entry *slot_dir(const struct header *h) {
+  return (struct slot_entry *)((unsigned char *)h + sizeof(*h));
+}
+
+static struct machine_entry *machine_dir(const struct header *h) {
+  return (struct machine_entry *)(slot_dir(h) + h->slots);
+}
+
+/* kill(pid, 0) fails with ESRCH only when there is no such process */
+static int alive(uint32_t pid) {
+  return pid != 0 && (kill((pid_t)pid, 0) == 0 || errno != ESRCH);
+}
+
+/* pid of the publisher of an existing segment, 0 when it has none yet */
+static uint32_t publisher(const char *name) {
+  struct header h;
+  uint32_t pid = 0;
+  int fd = shm_open(name, O_RDONLY, 0);
+
+  if (fd < 0) return 0;
+  if (pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h)) pid = h.pid;
+  close(fd);
+  return pid;
+}
+
+ShmPublisher *shmpub_create(const char *name, int machines, int slots,
+                            const size_t *sizes, const ShmOptions *opts) {
+  ShmPublisher *p;
+  size_t table_bytes = state_bytes(machines, slots, sizes);
+  size_t table_offset = header_bytes(machines, slots);
+  size_t ring_offset = table_offset + table_bytes;
+  size_t frame_stride;
+  uint32_t pid = 0;
+  int fd;
+
+  if (opts == NULL) opts = &default_shm_options;
+  if (table_bytes == 0 || strlen(name) >= sizeof(p->name)) return NULL;
+  if ((p = calloc(1, sizeof(*p))) == NULL) return NULL;
+  snprintf(p->name, sizeof(p->name), "%s", name);
+  frame_stride = round_line(FRAME_HEADER + opts->frame_bytes);
+  p->bytes = ring_offset + STATE_CACHE_LINE + opts->ring_frames * frame_stride;
+
+  // the segment of a publisher that is gone is replaced, never a running one
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0 &&
+      errno == EEXIST && (pid = publisher(name)) != 0 && !alive(pid)) {
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  }
+  if (fd < 0) {
+    if (pid != 0 && alive(pid))
+      fprintf(stderr, "shared memory %s is published by process %u\n", name,
+              (unsigned)pid);
+    else
+      fprintf(stderr, "Failed to create shared memory %s!\n", name);
+    free(p);
+    return NULL;
+  }
+  if (ftruncate(fd, p->bytes) != 0 ||
+      (p->mem = mmap(NULL, p->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     0)) == MAP_FAILED) {
+    fprintf(stderr, "Failed to map shared memory %s!\n", name);
+    close(fd);
+    shm_unlink(name);
+    free(p);
+    return NULL;
+  }
+  close(fd);
+
+  // a fresh segment is zero filled, so readers see no magic yet
+  p->header = (struct header *)p->mem;
+  p->header->version = SHM_VERSION;
+  p->header->header_bytes = table_offset;
+  p->header->machines = machines;
+  p->header->slots = slots;
+  p->header->table_offset = table_offset;
+  p->header->ring_offset = ring_offset;
+  p->header->ring_frames = opts->ring_frames;
+  p->header->frame_bytes = opts->frame_bytes;
+  p->header->pid = getpid();
+  p->table = state_attach(p->mem + table_offset, machines, slots, sizes, 0);
+  p->header->stride = state_stride(p->table);
+  for (int i = 0; i < slots; i++) {
+    slot_dir(p->header)[i].offset = state_slot_offset(p->table, i);
+    slot_dir(p->header)[i].size = sizes[i];
+  }
+  p->head = (_Atomic uint64_t *)(p->mem + ring_offset);
+  p->frames = p->mem + ring_offset + STATE_CACHE_LINE;
+  p->frame_stride = frame_stride;
+
+  atomic_thread_fence(memory_order_release);
+  memcpy(p->header->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+  return p;
+}
+
+void shmpub_destroy(ShmPublisher *p) {
+  if (p == NULL) return;
+  state_destroy(p->table);
+  munmap(p->mem, p->bytes);
+  shm_unlink(p->name);
+  free(p);
+}
+
+int shmpub_set_machine(ShmPublisher *p, int machine, unsigned short libh,
+                       const char *name) {
+  struct machine_entry *m;
+
+  if (machine < 0 || machine >= (int)p->header->machines) return 1;
+  m = &machine_dir(p->header)[machine];
+  m->libh = libh;
+  snprintf(m->name, sizeof(m->name), "%s", name ? name : "");
+  return 0;
+}
+
+StateTable *shmpub_table(ShmPublisher *p) { return p->table; }
+
+void shmpub_event(ShmPublisher *p, int machine, int slot, const void *data,
+                  size_t size, short err, double time) {
+  uint64_t n;
+  struct frame *f;
+
+  if (p->header->ring_frames == 0) return;
+  n = atomic_load_explicit(p->head, memory_order_relaxed);
+  f = (struct frame *)(p->frames +
+                       (n % p->header->ring_frames) * p->frame_stride);
+  if (size > p->header->frame_bytes) size = p->header->frame_bytes;
+
+  atomic_store_explicit(&f->seq, 2 * n + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  f->time = time;
+  f->machine = machine;
+  f->slot = slot;
+  f->err = err;
+  f->size = data ? size : 0;
+  if (data && size) memcpy((unsigned char *)f + FRAME_HEADER, data, size);
+  atomic_store_explicit(&f->seq, 2 * n + 2, memory_order_release);
+  atomic_store_explicit(p->head, n + 1, memory_order_release);
+}
+
+void shmpub_value_fn(const ValueUpdate *u, void *ctx) {
+  ShmSink *sink = ctx;
+  StateSink state = {sink->pub->table, sink->machine};
+
+  state_value_fn(u, &state);
+  shmpub_event(sink->pub, sink->machine, u->signal, u->data, u->size, u->err,
+               u->time);
+}
+
+ShmReader *shmread_open(const char *name) {
+  ShmReader *r;
+  struct stat st;
+  const struct header *h;
+  size_t sizes[STATE_MAX_SLOTS];
+  int fd;
+
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0) return NULL;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct header) ||
+      (r = calloc(1, sizeof(*r))) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  r->bytes = st.st_size;
+  r->mem = mmap(NULL, r->bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (r->mem == MAP_FAILED) {
+    free(r);
+    return NULL;
+  }
+
+  h = r->header = (const struct header *)r->mem;
+  if (memcmp(h->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0) goto fail;
+  atomic_thread_fence(memory_order_acquire);
+  if (h->version != SHM_VERSION || h->slots < 1 ||
+      h->slots > STATE_MAX_SLOTS || h->machines < 1 ||
+      h->header_bytes != header_bytes(h->machines, h->slots) ||
+      h->ring_offset + STATE_CACHE_LINE +
+              h->ring_frames * round_line(FRAME_HEADER + h->frame_bytes) >
+          r->bytes)
+    goto fail;
+  for (uint32_t i = 0; i < h->slots; i++) sizes[i] = slot_dir(h)[i].size;
+  // the table only reads through a reader's StateTable
+  r->table = state_attach(r->mem + h->table_offset, h->machines, h->slots,
+                          sizes, 0);
+  if (r->table == NULL || state_stride(r->table) != h->stride ||
+      h->table_offset + h->machines * h->stride > h->ring_offset)
+    goto fail;
+
+  r->dir = machine_dir(h);
+  r->head = (_Atomic uint64_t *)(r->mem + h->ring_offset);
+  r->frames = r->mem + h->ring_offset + STATE_CACHE_LINE;
+  r->frame_stride = round_line(FRAME_HEADER + h->frame_bytes);
+  r->next = atomic_load_explicit(r->head, memory_order_acquire);
+  return r;
+
+fail:
+  shmread_close(r);
+  return NULL;
+}
+
+void shmread_close(ShmReader *r) {
+  if (r == NULL) return;
+  state_destroy(r->table);
+  munmap(r->mem, r->bytes);
+  free(r);
+}
+
+int shmread_machines(const ShmReader *r) { return r->header->machines; }
+
+int shmread_slots(const ShmReader *r) { return r->header->slots; }
+
+int shmread_find(const ShmReader *r, unsigned short libh) {
+  for (uint32_t i = 0; i < r->header->machines; i++) {
+    if (r->dir[i].libh == libh) return i;
+  }
+  return -1;
+}
+
+const char *shmread_name(const ShmReader *r, int machine) {
+  if (machine < 0 || machine >= (int)r->header->machines) return NULL;
+  return r->dir[machine].name;
+}
+
+int shmread_value(const ShmReader *r, int machine, int slot, void *data,
+                  size_t size, StateInfo *info) {
+  int ret = state_read(r->table, machine, slot, data, size, info);
+
+  if (ret == STATE_BUSY && !alive(r->header->pid)) return SHM_GONE;
+  return ret;
+}
+
+int shmread_event(ShmReader *r, ShmEvent *event, void *data, size_t size,
+                  unsigned long long *lost) {
+  uint32_t frames = r->header->ring_frames;
+  uint64_t head;
+  uint64_t before;
+  struct frame *f;
+  ShmEvent got;
+
+  if (frames == 0) return 0;
+  for (;;) {
+    head = atomic_load_explicit(r->head, memory_order_acquire);
+    if (r->next == head) return 0;
+    if (head - r->next > frames) {
+      if (lost) *lost += head - frames - r->next;
+      r->next = head - frames;
+    }
+    f = (struct frame *)(r->frames + (r->next % frames) * r->frame_stride);
+    before = atomic_load_explicit(&f->seq, memory_order_acquire);
+    if (before == 2 * r->next + 2) {
+      got.seq = r->next;
+      got.time = f->time;
+      got.machine = f->machine;
+      got.slot = f->slot;
+      got.err = f->err;
+      got.size = f->size;
+      if (got.size > r->header->frame_bytes) got.size = 0;  // torn read
+      if (data && size)
+        memcpy(data, (unsigned char *)f + FRAME_HEADER,
+               size < got.size ? size : got.size);
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&f->seq, memory_order_relaxed) == before) {
+        r->next++;
+        *event = got;
+        return 1;
+      }
+    }
+    // overwritten while it was read, skip it
+    if (lost) (*lost)++;
+    r->next++;
+  }
+}
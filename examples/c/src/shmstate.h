@@ -0,0 +1,101 @@
+#ifndef FW_SHMSTATE_H
+#define FW_SHMSTATE_H
+
+#include <stddef.h>
+
+#include "./poller.h"
+#include "./state.h"
+
+/* the latest value table (state.h) plus a ring of value events in a POSIX
+ * shared memory segment, so dashboards and other processes read machine
+ * state without a FOCAS handle of their own. one process publishes, any
+ * number of readers map the segment read-only.
+ *
+ * layout, little endian, offsets in bytes from the start of the segment:
+ *   0   header (64)
+ *         char magic[8]  "FWSTATE", set last once the segment is ready
+ *         u32 version    SHM_VERSION
+ *         u32 header_bytes
+ *         u32 machines, u32 slots
+ *         u64 stride     bytes per machine row of the table
+ *         u64 table_offset, u64 ring_offset
+ *         u32 ring_frames, u32 frame_bytes
+ *         u32 pid        of the publisher
+ *         u32 reserved
+ *   64  slot directory, per slot {u64 offset in the row, u64 size}
+ *       machine directory, per machine {u32 libh, char name[28]}
+ *   table_offset  the state table, slot value at STATE_SLOT_HEADER
+ *   ring_offset   u64 head (events published) on its own cache line, then
+ *                 ring_frames frames of round64(32 + frame_bytes) bytes:
+ *                 {u64 seq, f64 time, u32 machine, u32 slot, i16 err,
+ *                  u16 reserved, u32 size, data}
+ * slot and frame sequence counters are odd while written. frame n of the
+ * ring sits at n % ring_frames and its seq is 2n + 2 once complete. */
+
+#define SHM_MAGIC "FWSTATE"
+#define SHM_VERSION 1
+#define SHM_NAME_LEN 28
+// shmread_value: the publisher died while it wrote the slot
+#define SHM_GONE 3
+
+typedef struct shm_options {
+  unsigned ring_frames;  // events kept, 0 for no ring
+  unsigned frame_bytes;  // value bytes per event, longer values are cut
+} ShmOptions;
+
+extern const ShmOptions default_shm_options;
+
+typedef struct shm_publisher ShmPublisher;
+
+/* `name` as for shm_open, e.g. "/fwstate". a segment of the same name whose
+ * publisher is gone is replaced, readers still mapping it keep the old one.
+ * NULL when its publisher still runs. */
+ShmPublisher *shmpub_create(const char *name, int machines, int slots,
+                            const size_t *sizes, const ShmOptions *opts);
+/* unmaps and unlinks the segment */
+void shmpub_destroy(ShmPublisher *p);
+int shmpub_set_machine(ShmPublisher *p, int machine, unsigned short libh,
+                       const char *name);
+StateTable *shmpub_table(ShmPublisher *p);
+/* append an event to the ring, single writer */
+void shmpub_event(ShmPublisher *p, int machine, int slot, const void *data,
+                  size_t size, short err, double time);
+
+/* poller callback: state_value_fn into the shared table, plus an event */
+typedef struct shm_sink {
+  ShmPublisher *pub;
+  int machine;
+} ShmSink;
+
+void shmpub_value_fn(const ValueUpdate *update, void *ctx);
+
+typedef struct shm_event {
+  unsigned long long seq;  // event number, counts up from 0
+  double time;
+  int machine;
+  int slot;
+  short err;
+  size_t size;  // bytes of the value in the event
+} ShmEvent;
+
+typedef struct shm_reader ShmReader;
+
+/* NULL when the segment does not exist, is not ready yet or has another
+ * version. events are read from the ones published after opening. */
+ShmReader *shmread_open(const char *name);
+void shmread_close(ShmReader *r);
+int shmread_machines(const ShmReader *r);
+int shmread_slots(const ShmReader *r);
+/* machine row of a handle, -1 when it is not published */
+int shmread_find(const ShmReader *r, unsigned short libh);
+const char *shmread_name(const ShmReader *r, int machine);
+/* as state_read, SHM_GONE for a slot that stays locked because its
+ * publisher is no longer running */
+int shmread_value(const ShmReader *r, int machine, int slot, void *data,
+                  size_t size, StateInfo *info);
+/* copy the next event, returns 1 or 0 when there is none. events the
+ * publisher overwrote before they were read are added to `lost`. */
+int shmread_event(ShmReader *r, ShmEvent *event, void *data, size_t size,
+                  unsigned long long *lost);
+
+#endif
@@ -0,0 +1,266 @@
+#include "./socwave.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "./clock.h"
+#include "fwlib32.h"
+
+#if defined(__GNUC__) && !defined(_WIN32)
+// not every libfwlib32 build exports the soc family, resolve it at runtime
+#pragma weak cnc_soc_wave_setchnl
+#pragma weak cnc_rdsoc_wave_start
+#pragma weak cnc_rdsoc_wave
+#pragma weak cnc_rdsoc_wave_end
+#define SOC_AVAILABLE() (cnc_soc_wave_setchnl && cnc_rdsoc_wave_start && \
+                         cnc_rdsoc_wave && cnc_rdsoc_wave_end)
+#else
+#define SOC_AVAILABLE() 1
+#endif
+
+const SocOptions default_soc_options = {
+    1, 1, {0}, 65536, SOC_DROP_OLDEST, SOC_RAW, 1, 0, 1024, 1000};
+
+/* dropping the oldest frames means the producer moves the read position,
+ * so unlike sampling.h this ring is guarded by a mutex instead of being a
+ * lock-free spsc ring */
+struct soc_wave {
+  unsigned short libh;
+  SocOptions opts;
+  pthread_t thread;
+  atomic_int run;
+  atomic_int running;
+
+  pthread_mutex_t lock;
+  pthread_cond_t readable;
+  pthread_cond_t writable;
+  float *ring;
+  unsigned long long head;  // frames ever stored
+  unsigned long long tail;  // frames ever read or dropped
+  SocStats stats;
+
+  // only touched by the thread
+  unsigned short *raw;
+  float *out;
+  double sum[SOC_MAX_CHANNELS];
+  long fill;
+};
+
+static void push(SocWave *w, const float *frames, size_t n) {
+  size_t width = w->opts.channels;
+  size_t cap = w->opts.capacity;
+
+  pthread_mutex_lock(&w->lock);
+  for (size_t i = 0; i < n; i++) {
+    if (w->head - w->tail == cap) {
+      if (w->opts.overflow == SOC_BLOCK) {
+        double start = now();
+        while (w->head - w->tail == cap && atomic_load(&w->run)) {
+          pthread_cond_wait(&w->writable, &w->lock);
+        }
+        w->stats.blocked += now() - start;
+        if (w->head - w->tail == cap) break;  // stopped while blocked
+      } else {
+        w->tail++;
+        w->stats.dropped++;
+      }
+    }
+    memcpy(&w->ring[(w->head % cap) * width], &frames[i * width],
+           width * sizeof(float));
+    w->head++;
+    w->stats.stored++;
+  }
+  pthread_cond_broadcast(&w->readable);
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* turn n raw frames into output frames, returns the number produced */
+static size_t reduce(SocWave *w, long n) {
+  int width = w->opts.channels;
+  size_t out = 0;
+
+  for (long i = 0; i < n; i++) {
+    const unsigned short *frame = &w->raw[i * width];
+
+    if (w->opts.reduce == SOC_RAW) {
+      for (int c = 0; c < width; c++) w->out[i * width + c] = frame[c];
+      out++;
+      continue;
+    }
+    for (int c = 0; c < width; c++) {
+      double v = frame[c];
+      if (w->opts.reduce == SOC_RMS) {
+        v -= w->opts.offset;
+        v *= v;
+      }
+      w->sum[c] += v;
+    }
+    if (++w->fill == w->opts.window) {
+      for (int c = 0; c < width; c++) {
+        double mean = w->sum[c] / w->fill;
+        w->out[out * width + c] =
+            w->opts.reduce == SOC_RMS ? sqrt(mean) : mean;
+        w->sum[c] = 0;
+      }
+      w->fill = 0;
+      out++;
+    }
+  }
+  return out;
+}
+
+static void *drain(void *arg) {
+  SocWave *w = arg;
+  short ret = EW_OK;
+
+  while (atomic_load_explicit(&w->run, memory_order_relaxed)) {
+    long n = w->opts.batch;
+    size_t out;
+
+    ret = cnc_rdsoc_wave(w->libh, &n, w->raw);
+    pthread_mutex_lock(&w->lock);
+    w->stats.reads++;
+    if (ret == EW_OK && n > 0) {
+      if (n > w->opts.batch) n = w->opts.batch;
+      w->stats.sampled += n;
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (ret != EW_OK) break;
+
+    if (n > 0 && (out = reduce(w, n)) > 0) push(w, w->out, out);
+    if (n < w->opts.batch) idle(w->opts.idle_us);
+  }
+
+  pthread_mutex_lock(&w->lock);
+  w->stats.err = ret;
+  atomic_store(&w->running, 0);
+  pthread_cond_broadcast(&w->readable);
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+static void destroy(SocWave *w) {
+  pthread_cond_destroy(&w->readable);
+  pthread_cond_destroy(&w->writable);
+  pthread_mutex_destroy(&w->lock);
+  free(w->ring);
+  free(w->raw);
+  free(w->out);
+  free(w);
+}
+
+SocWave *socwave_start(unsigned short libh, const SocOptions *opts,
+                       short *err) {
+  pthread_condattr_t attr;
+  short select[SOC_MAX_CHANNELS];
+  SocWave *w;
+
+  if (opts == NULL) opts = &default_soc_options;
+  if (opts->channels < 1 || opts->channels > SOC_MAX_CHANNELS ||
+      opts->capacity < 1 || opts->batch < 1 ||
+      (opts->reduce != SOC_RAW && opts->window < 1)) {
+    *err = EW_NUMBER;
+    return NULL;
+  }
+  if (!SOC_AVAILABLE()) {
+    fprintf(stderr, "cnc_rdsoc_wave is not supported by this library\n");
+    *err = EW_FUNC;
+    return NULL;
+  }
+  if ((w = calloc(1, sizeof(*w))) == NULL) {
+    *err = EW_FUNC;
+    return NULL;
+  }
+  w->libh = libh;
+  w->opts = *opts;
+  w->ring = malloc(opts->capacity * opts->channels * sizeof(float));
+  w->raw = malloc(opts->batch * opts->channels * sizeof(unsigned short));
+  w->out = malloc(opts->batch * opts->channels * sizeof(float));
+  atomic_init(&w->run, 1);
+  atomic_init(&w->running, 1);
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->writable, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&w->readable, &attr);
+  pthread_condattr_destroy(&attr);
+  if (w->ring == NULL || w->raw == NULL || w->out == NULL) {
+    fprintf(stderr, "Failed to allocate spindle waveform buffers!\n");
+    destroy(w);
+    *err = EW_FUNC;
+    return NULL;
+  }
+
+  memcpy(select, opts->select, sizeof(select));
+  if ((*err = cnc_soc_wave_setchnl(libh, select)) != EW_OK ||
+      (*err = cnc_rdsoc_wave_start(libh, opts->spindle)) != EW_OK) {
+    destroy(w);
+    return NULL;
+  }
+  if (pthread_create(&w->thread, NULL, drain, w)) {
+    fprintf(stderr, "Failed to start spindle waveform thread!\n");
+    cnc_rdsoc_wave_end(libh);
+    destroy(w);
+    *err = EW_FUNC;
+    return NULL;
+  }
+  return w;
+}
+
+short socwave_stop(SocWave *w, SocStats *stats) {
+  short ret;
+
+  pthread_mutex_lock(&w->lock);
+  atomic_store(&w->run, 0);
+  pthread_cond_broadcast(&w->writable);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+
+  ret = cnc_rdsoc_wave_end(w->libh);
+  if (stats) socwave_stats(w, stats);
+  destroy(w);
+  return ret;
+}
+
+size_t socwave_read(SocWave *w, float *frames, size_t max_frames,
+                    long timeout_ms) {
+  size_t width = w->opts.channels;
+  size_t cap = w->opts.capacity;
+  struct timespec deadline;
+  size_t n = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&w->lock);
+  while (w->head == w->tail && atomic_load(&w->running) && timeout_ms > 0) {
+    if (pthread_cond_timedwait(&w->readable, &w->lock, &deadline)) break;
+  }
+  while (n < max_frames && w->tail < w->head) {
+    memcpy(&frames[n * width], &w->ring[(w->tail % cap) * width],
+           width * sizeof(float));
+    w->tail++;
+    n++;
+  }
+  if (n) pthread_cond_signal(&w->writable);
+  pthread_mutex_unlock(&w->lock);
+  return n;
+}
+
+int socwave_running(SocWave *w) { return atomic_load(&w->running); }
+
+void socwave_stats(SocWave *w, SocStats *stats) {
+  pthread_mutex_lock(&w->lock);
+  *stats = w->stats;
+  pthread_mutex_unlock(&w->lock);
+}
@@ -0,0 +1,63 @@
+#ifndef FW_SOCWAVE_H
+#define FW_SOCWAVE_H
+
+#include <stddef.h>
+
+/* spindle waveform streaming for smart adaptive control
+ * (cnc_soc_wave_setchnl, cnc_rdsoc_wave_start, cnc_rdsoc_wave,
+ * cnc_rdsoc_wave_end). a thread drains the cnc into a bounded ring, an
+ * optional reduce stage turns every `window` frames into one mean or rms
+ * frame so long term signatures can be kept without the raw waveform. */
+
+#define SOC_MAX_CHANNELS 8
+
+enum soc_overflow {
+  SOC_DROP_OLDEST,  // a full ring overwrites the oldest frames
+  SOC_BLOCK,        // a full ring stops reading from the cnc until there is room
+};
+
+enum soc_reduce {
+  SOC_RAW,   // every frame as sampled
+  SOC_MEAN,  // mean of each window, a decimating boxcar filter
+  SOC_RMS,   // rms of each window around `offset`
+};
+
+typedef struct soc_options {
+  short spindle;                    // passed to cnc_rdsoc_wave_start
+  int channels;                     // values per frame
+  short select[SOC_MAX_CHANNELS];   // passed to cnc_soc_wave_setchnl
+  size_t capacity;                  // ring size in (reduced) frames
+  enum soc_overflow overflow;
+  enum soc_reduce reduce;
+  long window;                      // frames per reduced frame
+  double offset;                    // zero level of the raw samples for rms
+  long batch;                       // frames requested per cnc_rdsoc_wave
+  long idle_us;                     // sleep when the cnc had nothing new
+} SocOptions;
+
+extern const SocOptions default_soc_options;
+
+typedef struct soc_stats {
+  unsigned long long sampled;  // raw frames read from the cnc
+  unsigned long long stored;   // frames put into the ring, after reduction
+  unsigned long long dropped;  // frames overwritten before they were read
+  unsigned long reads;
+  double blocked;  // seconds spent waiting for room in SOC_BLOCK mode
+  short err;
+} SocStats;
+
+typedef struct soc_wave SocWave;
+
+SocWave *socwave_start(unsigned short libh, const SocOptions *opts,
+                       short *err);
+short socwave_stop(SocWave *w, SocStats *stats);
+
+/* copy up to max_frames frames of `channels` floats into `frames`, waiting
+ * up to timeout_ms for the first one. returns the number of frames, 0 on
+ * timeout or once the stream stopped and everything was read. */
+size_t socwave_read(SocWave *w, float *frames, size_t max_frames,
+                    long timeout_ms);
+int socwave_running(SocWave *w);
+void socwave_stats(SocWave *w, SocStats *stats);
+
+#endif
@@ -0,0 +1,156 @@
+#include "./spsc.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CACHE_LINE 64
+// waiting consumers re-check the ring at least this often
+#define WAIT_SLICE_NS 10000000L
+
+/* head and tail count frames ever committed / released and only wrap with
+ * size_t, the index into the ring is count & mask. they live on their own
+ * cache lines so the two sides do not false share. */
+struct spsc_ring {
+  _Alignas(CACHE_LINE) _Atomic size_t head;  // written by the producer
+  _Alignas(CACHE_LINE) _Atomic size_t tail;  // written by the consumer
+  _Alignas(CACHE_LINE) size_t mask;
+  size_t frame;
+  unsigned char *data;
+  atomic_int waiting;  // a consumer is blocked in spsc_read_wait
+  atomic_int closed;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+SpscRing *spsc_create(size_t frames, size_t frame_size) {
+  SpscRing *r;
+  pthread_condattr_t attr;
+  size_t size = 1;
+
+  if (frames == 0 || frame_size == 0) return NULL;
+  while (size < frames) size <<= 1;
+
+  if (posix_memalign((void **)&r, CACHE_LINE, sizeof(*r))) return NULL;
+  if (posix_memalign((void **)&r->data, CACHE_LINE, size * frame_size)) {
+    free(r);
+    return NULL;
+  }
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->waiting, 0);
+  atomic_init(&r->closed, 0);
+  r->mask = size - 1;
+  r->frame = frame_size;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&r->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  return r;
+}
+
+void spsc_destroy(SpscRing *r) {
+  if (r == NULL) return;
+  pthread_cond_destroy(&r->cond);
+  pthread_mutex_destroy(&r->lock);
+  free(r->data);
+  free(r);
+}
+
+size_t spsc_capacity(const SpscRing *r) { return r->mask + 1; }
+
+size_t spsc_frame_size(const SpscRing *r) { return r->frame; }
+
+size_t spsc_used(SpscRing *r) {
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  return atomic_load_explicit(&r->head, memory_order_acquire) - tail;
+}
+
+size_t spsc_write_region(SpscRing *r, void **frames) {
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  size_t size = r->mask + 1;
+  size_t idx = head & r->mask;
+  size_t free_frames =
+      size - (head - atomic_load_explicit(&r->tail, memory_order_acquire));
+
+  *frames = r->data + idx * r->frame;
+  return free_frames < size - idx ? free_frames : size - idx;
+}
+
+void spsc_commit(SpscRing *r, size_t n) {
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
+
+size_t spsc_read_region(SpscRing *r, const void **frames) {
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  size_t size = r->mask + 1;
+  size_t idx = tail & r->mask;
+  size_t used = atomic_load_explicit(&r->head, memory_order_acquire) - tail;
+
+  *frames = r->data + idx * r->frame;
+  return used < size - idx ? used : size - idx;
+}
+
+void spsc_release(SpscRing *r, size_t n) {
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+void spsc_wake(SpscRing *r) {
+  // pairs with the store to waiting in spsc_read_wait, either the consumer
+  // sees the new frames or we see it waiting
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&r->waiting)) {
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+  }
+}
+
+void spsc_close(SpscRing *r) {
+  atomic_store(&r->closed, 1);
+  spsc_wake(r);
+}
+
+static int before(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void add_ns(struct timespec *ts, long ns) {
+  ts->tv_sec += ns / 1000000000L;
+  ts->tv_nsec += ns % 1000000000L;
+  if (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+size_t spsc_read_wait(SpscRing *r, const void **frames, long timeout_ms) {
+  struct timespec deadline;
+  size_t n = spsc_read_region(r, frames);
+
+  if (n || timeout_ms <= 0) return n;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  add_ns(&deadline, timeout_ms * 1000000L);
+
+  pthread_mutex_lock(&r->lock);
+  atomic_store(&r->waiting, 1);
+  while ((n = spsc_read_region(r, frames)) == 0 && !atomic_load(&r->closed)) {
+    struct timespec now, slice;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!before(&now, &deadline)) break;
+    slice = now;
+    add_ns(&slice, WAIT_SLICE_NS);
+    if (before(&deadline, &slice)) slice = deadline;
+    pthread_cond_timedwait(&r->cond, &r->lock, &slice);
+  }
+  atomic_store(&r->waiting, 0);
+  pthread_mutex_unlock(&r->lock);
+  return n;
+}
@@ -0,0 +1,39 @@
+#ifndef FW_SPSC_H
+#define FW_SPSC_H
+
+#include <stddef.h>
+
+/* lock-free single producer / single consumer ring of fixed size frames.
+ * both sides work on contiguous regions of the ring itself: the producer
+ * fills what spsc_write_region returns and publishes it with spsc_commit,
+ * the consumer reads what spsc_read_region returns and hands it back with
+ * spsc_release. regions never wrap, a second call returns the rest. */
+
+typedef struct spsc_ring SpscRing;
+
+/* `frames` is rounded up to a power of two */
+SpscRing *spsc_create(size_t frames, size_t frame_size);
+void spsc_destroy(SpscRing *r);
+
+size_t spsc_capacity(const SpscRing *r);
+size_t spsc_frame_size(const SpscRing *r);
+/* frames committed but not released yet, callable from either side */
+size_t spsc_used(SpscRing *r);
+
+/* producer side */
+size_t spsc_write_region(SpscRing *r, void **frames);
+void spsc_commit(SpscRing *r, size_t n);
+
+/* consumer side */
+size_t spsc_read_region(SpscRing *r, const void **frames);
+void spsc_release(SpscRing *r, size_t n);
+
+/* blocking helpers, the fast paths above never take a lock. the producer
+ * calls spsc_wake after committing and spsc_close when it is done for good,
+ * spsc_read_wait waits up to timeout_ms for frames and returns 0 on timeout
+ * or once the ring is closed and empty. */
+void spsc_wake(SpscRing *r);
+void spsc_close(SpscRing *r);
+size_t spsc_read_wait(SpscRing *r, const void **frames, long timeout_ms);
+
+#endif
@@ -0,0 +1,188 @@
+#include "./state.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// reads of a slot that its writer holds, yielding in between, before
+// state_read gives up. a write takes well under a microsecond.
+#define READ_TRIES 1000
+
+/* fixed width so other processes and languages can read the table, the
+ * value starts STATE_SLOT_HEADER bytes into the slot */
+struct slot {
+  _Atomic uint64_t seq;  // odd while a write is in progress
+  double time;
+  uint32_t size;
+  int16_t err;
+  uint16_t reserved;
+};
+
+struct state_table {
+  int machines;
+  int slots;
+  int owned;      // base was allocated by state_create
+  size_t stride;  // bytes per machine
+  size_t offset[STATE_MAX_SLOTS];
+  size_t size[STATE_MAX_SLOTS];
+  unsigned char *base;
+};
+
+static size_t round_line(size_t n) {
+  return (n + STATE_CACHE_LINE - 1) & ~(size_t)(STATE_CACHE_LINE - 1);
+}
+
+static struct slot *slot_at(const StateTable *t, int machine, int slot) {
+  return (struct slot *)(t->base + machine * t->stride + t->offset[slot]);
+}
+
+static StateTable *layout(int machines, int slots, const size_t *sizes) {
+  StateTable *t;
+
+  if (machines < 1 || slots < 1 || slots > STATE_MAX_SLOTS) return NULL;
+  if ((t = calloc(1, sizeof(*t))) == NULL) return NULL;
+  t->machines = machines;
+  t->slots = slots;
+  for (int i = 0; i < slots; i++) {
+    t->offset[i] = t->stride;
+    t->size[i] = sizes[i];
+    t->stride += round_line(STATE_SLOT_HEADER + sizes[i]);
+  }
+  return t;
+}
+
+size_t state_bytes(int machines, int slots, const size_t *sizes) {
+  StateTable *t = layout(machines, slots, sizes);
+  size_t bytes = t ? machines * t->stride : 0;
+
+  free(t);
+  return bytes;
+}
+
+StateTable *state_create(int machines, int slots, const size_t *sizes) {
+  StateTable *t = layout(machines, slots, sizes);
+  void *base;
+
+  if (t == NULL) return NULL;
+  if (posix_memalign(&base, STATE_CACHE_LINE, machines * t->stride)) {
+    free(t);
+    return NULL;
+  }
+  memset(base, 0, machines * t->stride);
+  t->base = base;
+  t->owned = 1;
+  return t;
+}
+
+StateTable *state_attach(void *mem, int machines, int slots,
+                         const size_t *sizes, int clear) {
+  StateTable *t = layout(machines, slots, sizes);
+
+  if (t == NULL) return NULL;
+  if (clear) memset(mem, 0, machines * t->stride);
+  t->base = mem;
+  return t;
+}
+
+void state_destroy(StateTable *t) {
+  if (t == NULL) return;
+  if (t->owned) free(t->base);
+  free(t);
+}
+
+size_t state_stride(const StateTable *t) { return t->stride; }
+
+size_t state_slot_offset(const StateTable *t, int slot) {
+  return t->offset[slot];
+}
+
+int state_machines(const StateTable *t) { return t->machines; }
+
+int state_slots(const StateTable *t) { return t->slots; }
+
+static int valid(const StateTable *t, int machine, int slot) {
+  return machine >= 0 && machine < t->machines && slot >= 0 && slot < t->slots;
+}
+
+static uint64_t write_begin(struct slot *s) {
+  uint64_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+  // the odd count has to be visible before any of the new bytes
+  atomic_thread_fence(memory_order_release);
+  return seq;
+}
+
+static void write_end(struct slot *s, uint64_t seq) {
+  atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+void state_write(StateTable *t, int machine, int slot, const void *data,
+                 size_t size, short err, double time) {
+  struct slot *s;
+  uint64_t seq;
+
+  if (!valid(t, machine, slot)) return;
+  s = slot_at(t, machine, slot);
+  if (size > t->size[slot]) size = t->size[slot];
+
+  seq = write_begin(s);
+  s->time = time;
+  s->size = size;
+  s->err = err;
+  if (size) memcpy((unsigned char *)s + STATE_SLOT_HEADER, data, size);
+  write_end(s, seq);
+}
+
+int state_read(const StateTable *t, int machine, int slot, void *data,
+               size_t size, StateInfo *info) {
+  struct slot *s;
+  uint64_t before;
+  StateInfo got;
+
+  if (!valid(t, machine, slot)) return 1;
+  s = slot_at(t, machine, slot);
+
+  for (int tries = 0;; tries++) {
+    // a writer in another process may have died with the count odd
+    if (tries == READ_TRIES) return STATE_BUSY;
+    if (tries) sched_yield();
+    before = atomic_load_explicit(&s->seq, memory_order_acquire);
+    if (before & 1) continue;
+    if (before == 0) return 1;
+    got.version = before / 2;
+    got.time = s->time;
+    got.size = s->size;
+    got.err = s->err;
+    if (got.size > t->size[slot]) got.size = t->size[slot];  // torn read
+    if (data && size)
+      memcpy(data, (unsigned char *)s + STATE_SLOT_HEADER,
+             size < got.size ? size : got.size);
+    // the copy has to complete before the count is checked again
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&s->seq, memory_order_relaxed) == before) break;
+  }
+
+  if (info) *info = got;
+  return 0;
+}
+
+void state_value_fn(const ValueUpdate *u, void *ctx) {
+  StateSink *sink = ctx;
+  StateTable *t = sink->table;
+  struct slot *s;
+
+  if (!valid(t, sink->machine, u->signal)) return;
+  s = slot_at(t, sink->machine, u->signal);
+  // a failed read keeps the last good value and only records the error
+  if (u->err != 0 && atomic_load_explicit(&s->seq, memory_order_relaxed)) {
+    uint64_t seq = write_begin(s);
+    s->time = u->time;
+    s->err = u->err;
+    write_end(s, seq);
+    return;
+  }
+  state_write(t, sink->machine, u->signal, u->data, u->size, u->err, u->time);
+}
@@ -0,0 +1,64 @@
+#ifndef FW_STATE_H
+#define FW_STATE_H
+
+#include <stddef.h>
+
+#include "./poller.h"
+
+/* latest value table: one slot per machine and signal holding the last
+ * value written, e.g. the ODBST / ODBDY2 / pmc results of the poller.
+ * every slot starts on its own cache line and is guarded by a sequence
+ * counter (seqlock), so one writer per slot and any number of readers work
+ * on it without locks and readers never cause cnc traffic. */
+
+#define STATE_MAX_SLOTS 64
+#define STATE_CACHE_LINE 64
+// slot header: u64 sequence, f64 time, u32 size, i16 err, u16 reserved
+#define STATE_SLOT_HEADER 32
+// state_read: the slot stayed locked by its writer
+#define STATE_BUSY 2
+
+typedef struct state_info {
+  unsigned long long version;  // times written, 0 for never
+  double time;                 // as given to state_write
+  short err;
+  size_t size;  // bytes of the value, may be more than was copied
+} StateInfo;
+
+typedef struct state_table StateTable;
+
+/* `sizes` holds the largest value of each of the `slots` slots */
+StateTable *state_create(int machines, int slots, const size_t *sizes);
+void state_destroy(StateTable *t);
+int state_machines(const StateTable *t);
+int state_slots(const StateTable *t);
+
+/* the table in memory owned by the caller, e.g. shared memory. `mem` is
+ * cache line aligned and state_bytes long, `clear` starts an empty table
+ * while readers attach to one that is already written. */
+size_t state_bytes(int machines, int slots, const size_t *sizes);
+StateTable *state_attach(void *mem, int machines, int slots,
+                         const size_t *sizes, int clear);
+/* machine m, slot i starts m * stride + offset(i) bytes into the table */
+size_t state_stride(const StateTable *t);
+size_t state_slot_offset(const StateTable *t, int slot);
+
+/* only one thread may write a given slot at a time. values larger than the
+ * slot are truncated. */
+void state_write(StateTable *t, int machine, int slot, const void *data,
+                 size_t size, short err, double time);
+/* copy up to `size` bytes of the latest value. returns 0, 1 when the slot
+ * was never written or does not exist, or STATE_BUSY when a write was in
+ * progress on every try, e.g. of a writer that died in the middle. */
+int state_read(const StateTable *t, int machine, int slot, void *data,
+               size_t size, StateInfo *info);
+
+/* poller callback storing signal i of a machine in slot i */
+typedef struct state_sink {
+  StateTable *table;
+  int machine;
+} StateSink;
+
+void state_value_fn(const ValueUpdate *update, void *ctx);
+
+#endif
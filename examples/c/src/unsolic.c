@@ -0,0 +1,164 @@
+#include "./unsolic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fwlib32.h"
+
+#if defined(__GNUC__) && !defined(_WIN32)
+// libfwlib32-linux does not export the unsolicited message functions
+#pragma weak cnc_wrunsolicprm2
+#pragma weak cnc_unsolicstart
+#pragma weak cnc_unsolicstop
+#pragma weak cnc_rdunsolicmsg2
+#define UNSOLIC_AVAILABLE() (cnc_wrunsolicprm2 && cnc_unsolicstart && \
+                             cnc_unsolicstop && cnc_rdunsolicmsg2)
+#else
+#define UNSOLIC_AVAILABLE() 1
+#endif
+
+// type of UNSOLICMSG_TYPE_PRM / UNSOLICMSG_TYPE_MSG
+#define UNSOLIC_TYPE_PMC 0
+#define UNSOLIC_TYPE_MACRO 1
+
+struct unsolic_receiver {
+  unsigned short libh;
+  short number;
+  short bill;
+  int count;
+  Signal sig[UNSOLIC_MAX_SIGNALS];
+  void *data[UNSOLIC_MAX_SIGNALS];
+  size_t size[UNSOLIC_MAX_SIGNALS];
+};
+
+static size_t signal_bytes(const Signal *s) {
+  return s->kind == SIGNAL_MACRO ? s->size * sizeof(double) : s->size;
+}
+
+static void set_trans(UNSOLICMSG_TYPE_PRM *t, const Signal *s) {
+  if (s->kind == SIGNAL_MACRO) {
+    t->type = UNSOLIC_TYPE_MACRO;
+    t->prm.macro.path = s->path;
+    t->prm.macro.no = s->no;
+    t->prm.macro.num = s->size;
+  } else {
+    t->type = UNSOLIC_TYPE_PMC;
+    t->prm.pmc.path = s->path;
+    t->prm.pmc.addr = s->addr;
+    t->prm.pmc.no = s->no;
+    t->prm.pmc.size = s->size;
+  }
+}
+
+static void destroy(UnsolicReceiver *r) {
+  for (int i = 0; i < r->count; i++) free(r->data[i]);
+  free(r);
+}
+
+UnsolicReceiver *unsolic_start(unsigned short libh, const UnsolicOptions *opts,
+                               const Signal *signals, int count, short *err) {
+  IODBUNSOLIC2 prm;
+  UnsolicReceiver *r;
+
+  if (!UNSOLIC_AVAILABLE()) {
+    *err = EW_FUNC;
+    return NULL;
+  }
+  if (count < 1) {
+    *err = EW_NUMBER;
+    return NULL;
+  }
+  if ((r = calloc(1, sizeof(*r))) == NULL) {
+    *err = EW_FUNC;
+    return NULL;
+  }
+  r->libh = libh;
+  r->number = opts->number;
+  // only leading pmc ranges and macro variables can be pushed
+  while (r->count < count && r->count < UNSOLIC_MAX_SIGNALS &&
+         (signals[r->count].kind == SIGNAL_PMC ||
+          signals[r->count].kind == SIGNAL_MACRO))
+    r->count++;
+  if (r->count == 0) {
+    free(r);
+    *err = EW_NUMBER;
+    return NULL;
+  }
+
+  memset(&prm, 0, sizeof(prm));
+  snprintf(prm.ipaddr, sizeof(prm.ipaddr), "%s", opts->ipaddr);
+  prm.port = opts->port;
+  prm.retry = opts->retry;
+  prm.timeout = opts->timeout;
+  prm.alivetime = opts->alivetime;
+  prm.cntrl.type = UNSOLIC_TYPE_PMC;
+  prm.cntrl.prm.pmc.path = opts->ctrl_path;
+  prm.cntrl.prm.pmc.addr = opts->ctrl_addr;
+  prm.cntrl.prm.pmc.no = opts->ctrl_no;
+  prm.cntrl.prm.pmc.size = opts->ctrl_size;
+  prm.transnum = r->count;
+  for (int i = 0; i < r->count; i++) {
+    r->sig[i] = signals[i];
+    r->size[i] = signal_bytes(&signals[i]);
+    if ((r->data[i] = calloc(1, r->size[i] ? r->size[i] : 1)) == NULL) {
+      fprintf(stderr, "Failed to allocate unsolicited message buffers!\n");
+      r->count = i;
+      destroy(r);
+      *err = EW_FUNC;
+      return NULL;
+    }
+    set_trans(&prm.trans[i], &signals[i]);
+  }
+
+  if ((*err = cnc_wrunsolicprm2(libh, opts->number, &prm)) != EW_OK ||
+      (*err = cnc_unsolicstart(libh, opts->number, 0, 0, opts->alivetime > 0,
+                               &r->bill)) != EW_OK) {
+    destroy(r);
+    return NULL;
+  }
+  return r;
+}
+
+short unsolic_stop(UnsolicReceiver *r) {
+  short ret = cnc_unsolicstop(r->libh, r->number);
+  destroy(r);
+  return ret;
+}
+
+int unsolic_signals(const UnsolicReceiver *r) { return r->count; }
+
+short unsolic_read(UnsolicReceiver *r, unsigned *updated) {
+  IDBUNSOLICMSG2 msg;
+  short ret;
+
+  *updated = 0;
+  memset(&msg, 0, sizeof(msg));
+  msg.getnum = r->count;
+  for (int i = 0; i < r->count; i++) {
+    UNSOLICMSG_TYPE_MSG *m = &msg.get[i];
+    if (r->sig[i].kind == SIGNAL_MACRO) {
+      m->type = UNSOLIC_TYPE_MACRO;
+      m->msg.macro.path = r->sig[i].path;
+      m->msg.macro.num = r->sig[i].size;
+      m->msg.macro.data = r->data[i];
+    } else {
+      m->type = UNSOLIC_TYPE_PMC;
+      m->msg.pmc.path = r->sig[i].path;
+      m->msg.pmc.size = r->sig[i].size;
+      m->msg.pmc.data = r->data[i];
+    }
+  }
+
+  ret = cnc_rdunsolicmsg2(r->bill, &msg);
+  // nothing was transmitted since the last read
+  if (ret == EW_BUSY) return EW_OK;
+  if (ret != EW_OK) return ret;
+  for (int i = 0; i < msg.getnum && i < r->count; i++) *updated |= 1u << i;
+  return EW_OK;
+}
+
+const void *unsolic_data(const UnsolicReceiver *r, int signal, size_t *size) {
+  *size = r->size[signal];
+  return r->data[signal];
+}
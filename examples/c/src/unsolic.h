@@ -0,0 +1,43 @@
+#ifndef FW_UNSOLIC_H
+#define FW_UNSOLIC_H
+
+#include "./poller.h"
+
+/* unsolicited messaging receiver (cnc_wrunsolicprm2, cnc_unsolicstart,
+ * cnc_rdunsolicmsg2, cnc_unsolicstop). the cnc is told where to send up to
+ * UNSOLIC_MAX_SIGNALS pmc ranges / macro variables and transmits them
+ * whenever the ladder sets the control area, the library listens on
+ * `port` and the receiver picks the messages up without cnc traffic. */
+
+#define UNSOLIC_MAX_SIGNALS 3  // trans entries of IODBUNSOLIC2
+
+typedef struct unsolic_options {
+  char ipaddr[64];  // this host, as seen from the cnc
+  unsigned long port;
+  short number;  // unsolicited message setting on the cnc, 1 to 3
+  unsigned short retry;
+  unsigned short timeout;    // seconds
+  unsigned short alivetime;  // alive check interval, 0 turns it off
+  unsigned short ctrl_path;  // pmc control area the ladder triggers with
+  short ctrl_addr;
+  unsigned long ctrl_no;
+  unsigned long ctrl_size;
+} UnsolicOptions;
+
+typedef struct unsolic_receiver UnsolicReceiver;
+
+/* configure and start the messages for up to UNSOLIC_MAX_SIGNALS leading
+ * pmc / macro signals. *err is EW_FUNC when the library lacks the
+ * functions, EW_NOOPT when the cnc lacks the option and EW_NUMBER when the
+ * first signal can not be pushed. */
+UnsolicReceiver *unsolic_start(unsigned short libh, const UnsolicOptions *opts,
+                               const Signal *signals, int count, short *err);
+short unsolic_stop(UnsolicReceiver *r);
+int unsolic_signals(const UnsolicReceiver *r);
+
+/* pick up one pending message, sets bit i of *updated for every signal it
+ * carried. returns EW_OK with *updated 0 when nothing arrived. */
+short unsolic_read(UnsolicReceiver *r, unsigned *updated);
+const void *unsolic_data(const UnsolicReceiver *r, int signal, size_t *size);
+
+#endif
@@ -0,0 +1,234 @@
+#include "./upload.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./backoff.h"
+#include "./callstats.h"
+#include "./clock.h"
+#include "fwlib32.h"
+
+const UploadOptions default_upload_options = {65536, 1280, 32768, NULL, NULL};
+
+/* the two halves of the double buffer and the writer thread draining them */
+struct pipeline {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *buf[2];
+  size_t len[2];
+  int full[2];
+  int done;
+  int failed;
+  upload_sink_fn sink;
+  void *sink_ctx;
+};
+
+static void *writer(void *arg) {
+  struct pipeline *p = arg;
+  int i = 0;
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (!p->full[i] && !p->done) pthread_cond_wait(&p->cond, &p->lock);
+    if (!p->full[i]) break;
+    pthread_mutex_unlock(&p->lock);
+    int err = p->sink(p->buf[i], p->len[i], p->sink_ctx);
+    pthread_mutex_lock(&p->lock);
+    p->full[i] = 0;
+    if (err) {
+      p->failed = 1;
+      pthread_cond_signal(&p->cond);
+      break;
+    }
+    pthread_cond_signal(&p->cond);
+    i ^= 1;
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+/* hand buffer `i` to the writer and wait until the other one is free */
+static int hand_off(struct pipeline *p, int i, size_t len) {
+  int failed;
+  pthread_mutex_lock(&p->lock);
+  p->len[i] = len;
+  p->full[i] = 1;
+  pthread_cond_signal(&p->cond);
+  while (p->full[i ^ 1] && !p->failed) pthread_cond_wait(&p->cond, &p->lock);
+  failed = p->failed;
+  pthread_mutex_unlock(&p->lock);
+  return failed;
+}
+
+/* grow the request while the cnc keeps filling it without the rate
+ * dropping, shrink it when responses come back mostly empty */
+static size_t tune_chunk(size_t chunk, size_t want, size_t got, double rate,
+                         double *best, const UploadOptions *opts) {
+  if (got >= chunk && rate >= *best * 0.9) {
+    if (rate > *best) *best = rate;
+    chunk *= 2;
+  } else if (got < want / 2) {
+    chunk /= 2;
+  }
+  if (chunk > opts->max_chunk) chunk = opts->max_chunk;
+  if (chunk < opts->min_chunk) chunk = opts->min_chunk;
+  return chunk;
+}
+
+int upload_stream(unsigned short libh, short type, const char *name,
+                  upload_sink_fn sink, void *sink_ctx,
+                  const UploadOptions *opts, UploadStats *stats) {
+  struct pipeline p;
+  pthread_t thread;
+  UploadStats s;
+  double start, best = 0;
+  unsigned long busy = 0;
+  size_t fill = 0;
+  int cur = 0;
+  int ret = 0;
+  int finished = 0;
+  short err;
+
+  if (opts == NULL) opts = &default_upload_options;
+  if (opts->max_chunk > opts->buffer_size || opts->min_chunk == 0 ||
+      opts->min_chunk > opts->max_chunk) {
+    fprintf(stderr, "invalid upload buffer sizes\n");
+    return 1;
+  }
+
+  memset(&p, 0, sizeof(p));
+  memset(&s, 0, sizeof(s));
+  p.sink = sink;
+  p.sink_ctx = sink_ctx;
+  p.buf[0] = malloc(opts->buffer_size);
+  p.buf[1] = malloc(opts->buffer_size);
+  if (p.buf[0] == NULL || p.buf[1] == NULL) {
+    fprintf(stderr, "Failed to allocate upload buffers!\n");
+    free(p.buf[0]);
+    free(p.buf[1]);
+    return 1;
+  }
+  pthread_mutex_init(&p.lock, NULL);
+  pthread_cond_init(&p.cond, NULL);
+
+  if ((err = cnc_upstart4(libh, type, (char *)name)) != EW_OK) {
+    fprintf(stderr, "Failed to start upload of \"%s\"! (%d)\n", name, err);
+    ret = 1;
+    goto cleanup;
+  }
+  if (pthread_create(&thread, NULL, writer, &p) != 0) {
+    fprintf(stderr, "Failed to start upload writer thread!\n");
+    cnc_upend4(libh);
+    ret = 1;
+    goto cleanup;
+  }
+
+  start = now();
+  s.chunk = opts->min_chunk;
+  while (!finished) {
+    long want = (long)s.chunk;
+    long len;
+    double t0;
+    unsigned long long t;
+
+    if (fill + s.chunk > opts->buffer_size) want = opts->buffer_size - fill;
+    len = want;
+    t0 = now();
+    t = callstats_now();
+    err = cnc_upload4(libh, &len, p.buf[cur] + fill);
+    callstats_record("cnc_upload4", libh, t, err);
+    s.calls++;
+    if (err == EW_BUFFER && busy < BACKOFF_MAX_ATTEMPTS) {
+      s.retries++;
+      backoff_sleep(busy++, 1000, 64000);
+      continue;
+    }
+    if (err != EW_OK) {
+      fprintf(stderr, "Failed to upload \"%s\"! (%d)\n", name, err);
+      ret = 1;
+      break;
+    }
+    busy = 0;
+    s.chunk = tune_chunk(s.chunk, (size_t)want, (size_t)len,
+                         len / (now() - t0 + 1e-9), &best, opts);
+    fill += (size_t)len;
+    s.bytes += (size_t)len;
+    // data ends with '%', the first byte of the program is also '%'
+    finished = len > 0 && s.bytes > 1 && p.buf[cur][fill - 1] == '%';
+
+    if (fill + opts->min_chunk > opts->buffer_size || (finished && fill)) {
+      if (hand_off(&p, cur, fill)) {
+        fprintf(stderr, "Failed to write upload of \"%s\"!\n", name);
+        ret = 1;
+        break;
+      }
+      cur ^= 1;
+      fill = 0;
+      s.elapsed = now() - start;
+      s.rate = s.bytes / (s.elapsed + 1e-9);
+      if (opts->progress) opts->progress(&s, opts->ctx);
+    }
+  }
+
+  pthread_mutex_lock(&p.lock);
+  p.done = 1;
+  pthread_cond_signal(&p.cond);
+  pthread_mutex_unlock(&p.lock);
+  pthread_join(thread, NULL);
+  if (p.failed && !ret) {
+    fprintf(stderr, "Failed to write upload of \"%s\"!\n", name);
+    ret = 1;
+  }
+
+  if ((err = cnc_upend4(libh)) != EW_OK && !ret) {
+    fprintf(stderr, "Failed to end upload of \"%s\"! (%d)\n", name, err);
+    ret = 1;
+  }
+  s.elapsed = now() - start;
+  s.rate = s.bytes / (s.elapsed + 1e-9);
+
+cleanup:
+  if (stats) *stats = s;
+  pthread_cond_destroy(&p.cond);
+  pthread_mutex_destroy(&p.lock);
+  free(p.buf[0]);
+  free(p.buf[1]);
+  return ret;
+}
+
+static int write_fd(const char *buf, size_t len, void *ctx) {
+  int fd = *(int *)ctx;
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+int upload_to_file(unsigned short libh, short type, const char *name,
+                   const char *path, const UploadOptions *opts,
+                   UploadStats *stats) {
+  int ret;
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    fprintf(stderr, "unable to open \"%s\" for writing\n", path);
+    return 1;
+  }
+  ret = upload_stream(libh, type, name, write_fd, &fd, opts, stats);
+  if (close(fd) != 0 && !ret) {
+    fprintf(stderr, "unable to write \"%s\"\n", path);
+    ret = 1;
+  }
+  return ret;
+}
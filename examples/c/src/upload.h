@@ -0,0 +1,41 @@
+#ifndef FW_UPLOAD_H
+#define FW_UPLOAD_H
+
+#include <stddef.h>
+
+/* running totals of a streaming upload, reported through the progress
+ * callback each time a buffer is handed to the writer */
+typedef struct upload_stats {
+  size_t bytes;           // bytes received from the cnc
+  size_t chunk;           // current cnc_upload4 request size
+  unsigned long calls;    // cnc_upload4 calls, including EW_BUFFER retries
+  unsigned long retries;  // EW_BUFFER responses
+  double elapsed;         // seconds since cnc_upstart4
+  double rate;            // bytes per second
+} UploadStats;
+
+/* return non-zero to abort the transfer */
+typedef int (*upload_sink_fn)(const char *buf, size_t len, void *ctx);
+typedef void (*upload_progress_fn)(const UploadStats *stats, void *ctx);
+
+typedef struct upload_options {
+  size_t buffer_size;  // size of each of the two buffers
+  size_t min_chunk;    // cnc_upload4 request size bounds, tuned in between
+  size_t max_chunk;
+  upload_progress_fn progress;
+  void *ctx;
+} UploadOptions;
+
+extern const UploadOptions default_upload_options;
+
+/* stream data of `type` (0 = NC program, 2 = parameter, ...; see cnc_upstart4)
+ * named `name` into `sink`. one buffer is filled by cnc_upload4 while the
+ * other is drained by a writer thread, so memory use is constant. */
+int upload_stream(unsigned short libh, short type, const char *name,
+                  upload_sink_fn sink, void *sink_ctx,
+                  const UploadOptions *opts, UploadStats *stats);
+int upload_to_file(unsigned short libh, short type, const char *name,
+                   const char *path, const UploadOptions *opts,
+                   UploadStats *stats);
+
+#endif
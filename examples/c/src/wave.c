@@ -0,0 +1,156 @@
+#include "./wave.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./backoff.h"
+#include "./clock.h"
+#include "fwlib32.h"
+
+#if defined(__GNUC__) && !defined(_WIN32)
+// libfwlib32-linux does not export cnc_rdwavecount
+#pragma weak cnc_rdwavecount
+#define COUNT_AVAILABLE() (cnc_rdwavecount != NULL)
+#else
+#define COUNT_AVAILABLE() 1
+#endif
+
+// cnc_wavestat: 1 waiting for the trigger, 2 sampling, 0 once done
+#define WAVE_DONE 0
+
+const WaveOptions default_wave_options = {60000, 10000, 500000};
+
+static short arm(unsigned short libh, const WaveConfig *config) {
+  IODBWVPRM prm;
+
+  memset(&prm, 0, sizeof(prm));
+  prm.condition = config->condition;
+  prm.trg_adr = config->trg_adr;
+  prm.trg_bit = config->trg_bit;
+  prm.trg_no = config->trg_no;
+  prm.delay = config->delay;
+  prm.t_range = config->range;
+  for (int i = 0; i < config->channels; i++) {
+    prm.ch[i].kind = config->ch[i].kind;
+    prm.ch[i].u.axis = config->ch[i].axis;
+  }
+  return cnc_wrwaveprm2(libh, &prm);
+}
+
+static short wait_done(unsigned short libh, const WaveOptions *opts,
+                       WaveStats *stats) {
+  double deadline = now() + opts->timeout / 1e3;
+  unsigned long attempt = 0;
+  short stat;
+  short ret;
+
+  for (;;) {
+    stats->polls++;
+    if ((ret = cnc_wavestat(libh, &stat)) != EW_OK) return ret;
+    if (stat == WAVE_DONE) return EW_OK;
+    if (opts->timeout && now() > deadline) {
+      fprintf(stderr, "waveform capture did not finish in %ld ms\n",
+              opts->timeout);
+      cnc_wavestop(libh);
+      return EW_BUSY;
+    }
+    backoff_sleep(attempt++, opts->poll_min_us, opts->poll_max_us);
+  }
+}
+
+static short read_channel(unsigned short libh, short channel, long count,
+                          ODBWVDT *buf, WaveWriter *w, WaveStats *stats) {
+  // data positions and channels are numbered from 1, a count of -1 reads
+  // until a window comes back short
+  for (long pos = 1; count < 0 || pos <= count;) {
+    long want = count < 0 || count - pos + 1 > WAVE_WINDOW ? WAVE_WINDOW
+                                                          : count - pos + 1;
+    long len = want;
+    short ret;
+
+    stats->reads++;
+    ret = cnc_rdwavedata(libh, channel, channel, pos, &len, buf);
+    if (ret != EW_OK) return ret;
+    if (len <= 0) break;
+    if (len > WAVE_WINDOW) len = WAVE_WINDOW;
+
+    if (stats->reads == 1) {
+      // the date fields are chars, a bad clock prints them as up to -128:
+      // 30 bytes, not the 20 of a good date, or -Wformat-truncation warns
+      char started[32];
+      snprintf(started, sizeof(started), "%04d-%02d-%02d %02d:%02d:%02d",
+               buf->year < 100 ? 2000 + buf->year : buf->year, buf->month,
+               buf->day, buf->hour, buf->minute, buf->second);
+      // t_cycle is in ms
+      wavefile_set_period(w, buf->t_cycle * 1000UL, started);
+    }
+    if (wavefile_append(w, channel - 1, buf->data, len)) return EW_FUNC;
+    stats->samples += len;
+    pos += len;
+    if (count < 0 && len < want) break;
+  }
+  return EW_OK;
+}
+
+short wave_capture(unsigned short libh, const WaveConfig *config,
+                   const char *path, const WaveOptions *opts,
+                   WaveStats *stats) {
+  WaveInfo info;
+  WaveWriter *w;
+  ODBWVDT *buf;
+  double start = now();
+  long count = 0;
+  short ret;
+
+  if (opts == NULL) opts = &default_wave_options;
+  memset(stats, 0, sizeof(*stats));
+  if (config->channels < 1 || config->channels > WAVE_PRM_CHANNELS) {
+    fprintf(stderr, "invalid channel count: %d\n", config->channels);
+    return EW_NUMBER;
+  }
+
+  if ((ret = arm(libh, config)) != EW_OK) {
+    fprintf(stderr, "cnc_wrwaveprm2 failed: %d\n", ret);
+    return ret;
+  }
+  if ((ret = cnc_wavestart(libh)) != EW_OK) {
+    fprintf(stderr, "cnc_wavestart failed: %d\n", ret);
+    return ret;
+  }
+  if ((ret = wait_done(libh, opts, stats)) != EW_OK) return ret;
+  if (!COUNT_AVAILABLE()) {
+    count = -1;
+  } else if ((ret = cnc_rdwavecount(libh, 0, &count)) != EW_OK) {
+    fprintf(stderr, "cnc_rdwavecount failed: %d\n", ret);
+    return ret;
+  }
+
+  memset(&info, 0, sizeof(info));
+  info.channels = config->channels;
+  for (int i = 0; i < config->channels; i++) {
+    info.ch[i].kind = config->ch[i].kind;
+    info.ch[i].axis = config->ch[i].axis;
+    memcpy(info.ch[i].unit, config->ch[i].unit, sizeof(info.ch[i].unit));
+  }
+  if ((buf = malloc(sizeof(*buf))) == NULL ||
+      (w = wavefile_create(path, &info)) == NULL) {
+    free(buf);
+    return EW_FUNC;
+  }
+
+  for (short ch = 1; ch <= config->channels && ret == EW_OK; ch++) {
+    if (config->ch[ch - 1].kind == 0) continue;
+    ret = read_channel(libh, ch, count, buf, w, stats);
+  }
+  free(buf);
+
+  if (ret != EW_OK) {
+    fprintf(stderr, "cnc_rdwavedata failed: %d\n", ret);
+    wavefile_abort(w);
+    return ret;
+  }
+  if ((stats->bytes = wavefile_commit(w)) == 0) return EW_FUNC;
+  stats->elapsed = now() - start;
+  return EW_OK;
+}
@@ -0,0 +1,59 @@
+#ifndef FW_WAVE_H
+#define FW_WAVE_H
+
+#include "./wavefile.h"
+
+/* servo waveform diagnosis capture: writes the trigger / channel setup with
+ * cnc_wrwaveprm2, starts it with cnc_wavestart, polls cnc_wavestat until
+ * the capture finished and reads every channel with cnc_rdwavedata in
+ * windows of up to WAVE_WINDOW samples straight into a waveform file.
+ *
+ * cnc_rdwavecount is not exported by the linux libraries. there every
+ * channel is read window by window until one comes back short.
+ * cnc_rdwavedata2 is not exported by any libfwlib32 build here.
+ * cnc_rdwavedata3 reads the captures set up by cnc_wrwaveprm3 (IODBWVPRM3),
+ * which this capture does not write, so neither is used. */
+
+#define WAVE_PRM_CHANNELS 12  // channels of IODBWVPRM
+#define WAVE_WINDOW 8192      // samples of ODBWVDT
+
+typedef struct wave_channel {
+  short kind;  // waveform kind, 0 leaves the channel unused
+  long axis;
+  char unit[16];
+} WaveChannel;
+
+typedef struct wave_config {
+  short condition;  // trigger condition
+  char trg_adr;     // trigger signal address, bit and number
+  char trg_bit;
+  short trg_no;
+  long delay;  // ms after the trigger
+  long range;  // ms of data
+  int channels;
+  WaveChannel ch[WAVE_PRM_CHANNELS];
+} WaveConfig;
+
+typedef struct wave_options {
+  long timeout;      // ms to wait for trigger + capture, 0 waits forever
+  long poll_min_us;  // cnc_wavestat backoff
+  long poll_max_us;
+} WaveOptions;
+
+extern const WaveOptions default_wave_options;
+
+typedef struct wave_stats {
+  unsigned long polls;        // cnc_wavestat calls
+  unsigned long reads;        // cnc_rdwavedata calls
+  unsigned long long samples; // over all channels
+  size_t bytes;               // size of the written file
+  double elapsed;
+} WaveStats;
+
+/* returns EW_OK or the failing FOCAS code, EW_FUNC when the file could not
+ * be written and EW_BUSY when the capture did not finish in time */
+short wave_capture(unsigned short libh, const WaveConfig *config,
+                   const char *path, const WaveOptions *opts,
+                   WaveStats *stats);
+
+#endif
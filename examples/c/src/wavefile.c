@@ -0,0 +1,288 @@
+#include "./wavefile.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WAVE_MAGIC "FWAVE"
+#define WAVE_VERSION 1
+#define HEADER_SIZE 36
+#define CHANNEL_SIZE 48
+// a delta of two shorts fits in 17 bits, 3 varint bytes
+#define MAX_VARINT 3
+
+struct column {
+  uint64_t samples;
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+struct wave_writer {
+  char path[512];
+  char tmp[520];
+  FILE *fp;
+  WaveInfo info;
+  struct column cols[WAVE_MAX_CHANNELS];
+  int current;
+  int prev;
+  uint64_t pos;
+  int failed;
+};
+
+static void put16(unsigned char *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+  for (int i = 0; i < 8; i++) p[i] = v >> (8 * i);
+}
+
+static uint16_t get16(const unsigned char *p) { return p[0] | p[1] << 8; }
+
+static uint32_t get32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const unsigned char *p) {
+  return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static size_t header_size(int channels) {
+  return HEADER_SIZE + (size_t)channels * CHANNEL_SIZE;
+}
+
+WaveWriter *wavefile_create(const char *path, const WaveInfo *info) {
+  WaveWriter *w;
+  int fd;
+
+  if (info->channels < 1 || info->channels > WAVE_MAX_CHANNELS) {
+    fprintf(stderr, "invalid channel count: %d\n", info->channels);
+    return NULL;
+  }
+  if ((w = calloc(1, sizeof(*w))) == NULL) return NULL;
+  snprintf(w->path, sizeof(w->path), "%s", path);
+  snprintf(w->tmp, sizeof(w->tmp), "%s.XXXXXX", path);
+  if ((fd = mkstemp(w->tmp)) < 0 || (w->fp = fdopen(fd, "wb")) == NULL) {
+    fprintf(stderr, "unable to create \"%s\"\n", w->tmp);
+    if (fd >= 0) {
+      close(fd);
+      unlink(w->tmp);
+    }
+    free(w);
+    return NULL;
+  }
+  w->info = *info;
+  w->current = -1;
+  // the header is written last, once the column offsets are known
+  w->pos = header_size(info->channels);
+  if (fseek(w->fp, (long)w->pos, SEEK_SET) != 0) w->failed = 1;
+  return w;
+}
+
+static int encode(WaveWriter *w, const short *samples, size_t count) {
+  unsigned char buf[4096 * MAX_VARINT];
+  struct column *col = &w->cols[w->current];
+
+  while (count) {
+    size_t n = count < 4096 ? count : 4096;
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      int32_t delta = samples[i] - w->prev;
+      uint32_t z = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+      while (z >= 0x80) {
+        buf[len++] = (unsigned char)(z | 0x80);
+        z >>= 7;
+      }
+      buf[len++] = (unsigned char)z;
+      w->prev = samples[i];
+    }
+    if (fwrite(buf, 1, len, w->fp) != len) return 1;
+    col->bytes += len;
+    col->samples += n;
+    w->pos += len;
+    samples += n;
+    count -= n;
+  }
+  return 0;
+}
+
+int wavefile_append(WaveWriter *w, int channel, const short *samples,
+                    size_t count) {
+  if (w->failed) return 1;
+  if (channel < w->current || channel >= w->info.channels) {
+    fprintf(stderr, "columns must be written in order\n");
+    return 1;
+  }
+  while (w->current < channel) {
+    w->current++;
+    w->cols[w->current].offset = w->pos;
+    w->prev = 0;
+  }
+  if (encode(w, samples, count)) {
+    fprintf(stderr, "unable to write \"%s\"\n", w->tmp);
+    return w->failed = 1;
+  }
+  return 0;
+}
+
+void wavefile_set_period(WaveWriter *w, unsigned long period_us,
+                         const char *started) {
+  w->info.period_us = period_us;
+  if (started) snprintf(w->info.started, sizeof(w->info.started), "%s", started);
+}
+
+static int write_header(WaveWriter *w) {
+  unsigned char head[HEADER_SIZE + WAVE_MAX_CHANNELS * CHANNEL_SIZE];
+  size_t len = header_size(w->info.channels);
+
+  memset(head, 0, len);
+  memcpy(head, WAVE_MAGIC, 6);
+  put16(head + 6, WAVE_VERSION);
+  put16(head + 8, w->info.channels);
+  put32(head + 12, w->info.period_us);
+  memcpy(head + 16, w->info.started, sizeof(w->info.started));
+  for (int i = 0; i < w->info.channels; i++) {
+    unsigned char *p = head + HEADER_SIZE + i * CHANNEL_SIZE;
+    const WaveChannelInfo *ch = &w->info.ch[i];
+    // columns never written are empty and start at the end
+    uint64_t offset = i > w->current ? w->pos : w->cols[i].offset;
+
+    put16(p, ch->kind);
+    put32(p + 4, (uint32_t)ch->axis);
+    memcpy(p + 8, ch->unit, sizeof(ch->unit));
+    put64(p + 24, w->cols[i].samples);
+    put64(p + 32, offset);
+    put64(p + 40, w->cols[i].bytes);
+  }
+  if (fseek(w->fp, 0, SEEK_SET) != 0) return 1;
+  return fwrite(head, 1, len, w->fp) != len;
+}
+
+size_t wavefile_commit(WaveWriter *w) {
+  size_t size = w->pos;
+  int ret = w->failed || write_header(w) || fflush(w->fp) != 0 ||
+            fsync(fileno(w->fp)) != 0;
+
+  if (fclose(w->fp) != 0) ret = 1;
+  if (ret == 0 && rename(w->tmp, w->path) != 0) ret = 1;
+  if (ret) {
+    fprintf(stderr, "unable to write \"%s\"\n", w->path);
+    unlink(w->tmp);
+    size = 0;
+  }
+  free(w);
+  return size;
+}
+
+void wavefile_abort(WaveWriter *w) {
+  if (w == NULL) return;
+  fclose(w->fp);
+  unlink(w->tmp);
+  free(w);
+}
+
+static int read_table(FILE *fp, WaveInfo *info, struct column *cols) {
+  unsigned char head[HEADER_SIZE + WAVE_MAX_CHANNELS * CHANNEL_SIZE];
+
+  if (fread(head, 1, HEADER_SIZE, fp) != HEADER_SIZE ||
+      memcmp(head, WAVE_MAGIC, 6) != 0 || get16(head + 6) != WAVE_VERSION)
+    return 1;
+  memset(info, 0, sizeof(*info));
+  info->channels = get16(head + 8);
+  if (info->channels < 1 || info->channels > WAVE_MAX_CHANNELS) return 1;
+  info->period_us = get32(head + 12);
+  memcpy(info->started, head + 16, sizeof(info->started));
+  info->started[sizeof(info->started) - 1] = '\0';
+
+  if (fread(head + HEADER_SIZE, CHANNEL_SIZE, info->channels, fp) !=
+      (size_t)info->channels)
+    return 1;
+  for (int i = 0; i < info->channels; i++) {
+    const unsigned char *p = head + HEADER_SIZE + i * CHANNEL_SIZE;
+    WaveChannelInfo *ch = &info->ch[i];
+
+    ch->kind = (short)get16(p);
+    ch->axis = (int32_t)get32(p + 4);
+    memcpy(ch->unit, p + 8, sizeof(ch->unit));
+    ch->unit[sizeof(ch->unit) - 1] = '\0';
+    ch->samples = get64(p + 24);
+    if (cols) {
+      cols[i].samples = ch->samples;
+      cols[i].offset = get64(p + 32);
+      cols[i].bytes = get64(p + 40);
+    }
+  }
+  return 0;
+}
+
+int wavefile_read_info(const char *path, WaveInfo *info) {
+  FILE *fp = fopen(path, "rb");
+  int ret;
+
+  if (fp == NULL) return 1;
+  ret = read_table(fp, info, NULL);
+  fclose(fp);
+  if (ret) fprintf(stderr, "not a waveform file: \"%s\"\n", path);
+  return ret;
+}
+
+int wavefile_read_column(const char *path, int channel, short **samples,
+                         size_t *count) {
+  struct column cols[WAVE_MAX_CHANNELS];
+  WaveInfo info;
+  unsigned char *buf = NULL;
+  short *out = NULL;
+  FILE *fp = fopen(path, "rb");
+  size_t n = 0;
+  int prev = 0;
+  int ret = 1;
+
+  if (fp == NULL) return 1;
+  if (read_table(fp, &info, cols) || channel < 0 || channel >= info.channels) {
+    fprintf(stderr, "no channel %d in \"%s\"\n", channel, path);
+    goto done;
+  }
+  if ((buf = malloc(cols[channel].bytes + 1)) == NULL ||
+      (out = malloc(cols[channel].samples * sizeof(short) + 1)) == NULL)
+    goto done;
+  if (fseek(fp, (long)cols[channel].offset, SEEK_SET) != 0 ||
+      fread(buf, 1, cols[channel].bytes, fp) != cols[channel].bytes)
+    goto done;
+
+  for (size_t i = 0; i < cols[channel].bytes && n < cols[channel].samples;) {
+    uint32_t z = 0;
+    int shift = 0;
+
+    while (i < cols[channel].bytes && shift <= 14) {
+      z |= (uint32_t)(buf[i] & 0x7f) << shift;
+      shift += 7;
+      if ((buf[i++] & 0x80) == 0) break;
+    }
+    prev += (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+    out[n++] = (short)prev;
+  }
+  if (n != cols[channel].samples) {
+    fprintf(stderr, "truncated column %d in \"%s\"\n", channel, path);
+    goto done;
+  }
+  *samples = out;
+  *count = n;
+  out = NULL;
+  ret = 0;
+
+done:
+  free(out);
+  free(buf);
+  fclose(fp);
+  return ret;
+}
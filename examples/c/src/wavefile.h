@@ -0,0 +1,55 @@
+#ifndef FW_WAVEFILE_H
+#define FW_WAVEFILE_H
+
+#include <stddef.h>
+
+/* columnar waveform file: a fixed header and channel table followed by one
+ * column per channel, each stored as zigzag varint deltas of the samples.
+ * all integers are little endian.
+ *
+ *   "FWAVE\0" u16 version, u16 channels, u16 reserved, u32 period_us,
+ *   char started[20]
+ *   per channel: i16 kind, i16 reserved, i32 axis, char unit[16],
+ *                u64 samples, u64 offset, u64 bytes
+ *   columns
+ *
+ * a reader can seek straight to the column it needs. */
+
+#define WAVE_MAX_CHANNELS 40
+
+typedef struct wave_channel_info {
+  short kind;     // data kind as configured on the cnc
+  long axis;      // axis / spindle number
+  char unit[16];  // free text unit of the raw samples, e.g. "%", "pulse"
+  unsigned long long samples;
+} WaveChannelInfo;
+
+typedef struct wave_info {
+  int channels;
+  unsigned long period_us;  // time between two samples
+  char started[20];         // "YYYY-MM-DD hh:mm:ss" as reported by the cnc
+  WaveChannelInfo ch[WAVE_MAX_CHANNELS];
+} WaveInfo;
+
+typedef struct wave_writer WaveWriter;
+
+/* columns are written in channel order, the file only appears at `path`
+ * after wavefile_commit */
+WaveWriter *wavefile_create(const char *path, const WaveInfo *info);
+/* append samples to column `channel` (0 based), moving to a later column
+ * finishes the earlier ones */
+int wavefile_append(WaveWriter *w, int channel, const short *samples,
+                    size_t count);
+/* metadata only known once the first samples were read */
+void wavefile_set_period(WaveWriter *w, unsigned long period_us,
+                         const char *started);
+/* returns the size of the file or 0 on failure */
+size_t wavefile_commit(WaveWriter *w);
+void wavefile_abort(WaveWriter *w);
+
+int wavefile_read_info(const char *path, WaveInfo *info);
+/* decode one column, *samples must be freed by the caller */
+int wavefile_read_column(const char *path, int channel, short **samples,
+                         size_t *count);
+
+#endif
@@ -0,0 +1,306 @@
+#include "./xfer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./backoff.h"
+#include "./clock.h"
+#include "fwlib32.h"
+
+#if defined(__GNUC__) && !defined(_WIN32)
+// libfwlib32-linux does not export the pdf read and copy / move functions
+#pragma weak cnc_pdf_read_start
+#pragma weak cnc_pdf_read_poll
+#pragma weak cnc_pdf_read_end
+#pragma weak cnc_pdf_cpmv_start
+#pragma weak cnc_pdf_cpmv_poll
+#pragma weak cnc_pdf_cpmv_end
+#define READ_AVAILABLE() (cnc_pdf_read_start && cnc_pdf_read_poll && \
+                          cnc_pdf_read_end)
+#define CPMV_AVAILABLE() (cnc_pdf_cpmv_start && cnc_pdf_cpmv_poll && \
+                          cnc_pdf_cpmv_end)
+#else
+#define READ_AVAILABLE() 1
+#define CPMV_AVAILABLE() 1
+#endif
+
+// status reported by the poll calls while the transfer is still executing,
+// anything else ends it
+#define XFER_EXECUTING 1
+
+// polls start fast and back off while the reported file does not change
+#define POLL_MIN_MS 5
+#define POLL_MAX_MS 500
+#define START_RETRY_MAX_MS 1000
+
+enum xfer_state { XFER_QUEUED, XFER_RUNNING };
+
+struct xfer {
+  XferKind kind;
+  unsigned short libh;
+  char src[256];
+  char dst[256];
+  short option;
+  xfer_done_fn done;
+  void *ctx;
+
+  enum xfer_state state;
+  double start;
+  double due;
+  long interval;
+  unsigned long polls;
+  unsigned long busy;
+  short status;
+  char current[512];
+  struct xfer *next;
+};
+
+/* transfers of one handle, the head is the one being started / polled */
+struct handle_queue {
+  unsigned short libh;
+  struct xfer *head;
+  struct xfer *tail;
+};
+
+struct xfer_manager {
+  struct handle_queue *queues;
+  size_t nqueues;
+  size_t qcap;
+  struct xfer **heap;  // queue heads ordered by due time
+  size_t nheap;
+  size_t hcap;
+  int pending;
+};
+
+static void heap_push(XferManager *m, struct xfer *x) {
+  size_t i = m->nheap++;
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (m->heap[parent]->due <= x->due) break;
+    m->heap[i] = m->heap[parent];
+    i = parent;
+  }
+  m->heap[i] = x;
+}
+
+static struct xfer *heap_pop(XferManager *m) {
+  struct xfer *top = m->heap[0];
+  struct xfer *last = m->heap[--m->nheap];
+  size_t i = 0;
+
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= m->nheap) break;
+    if (child + 1 < m->nheap && m->heap[child + 1]->due < m->heap[child]->due)
+      child++;
+    if (last->due <= m->heap[child]->due) break;
+    m->heap[i] = m->heap[child];
+    i = child;
+  }
+  if (m->nheap) m->heap[i] = last;
+  return top;
+}
+
+static struct handle_queue *find_queue(XferManager *m, unsigned short libh) {
+  for (size_t i = 0; i < m->nqueues; i++) {
+    if (m->queues[i].libh == libh) return &m->queues[i];
+  }
+  if (m->nqueues == m->qcap) {
+    size_t cap = m->qcap ? m->qcap * 2 : 16;
+    struct handle_queue *q = realloc(m->queues, cap * sizeof(*q));
+    struct xfer **h = realloc(m->heap, cap * sizeof(*h));
+    if (q) m->queues = q;
+    if (h) m->heap = h;
+    if (q == NULL || h == NULL) return NULL;
+    m->qcap = m->hcap = cap;
+  }
+  memset(&m->queues[m->nqueues], 0, sizeof(struct handle_queue));
+  m->queues[m->nqueues].libh = libh;
+  return &m->queues[m->nqueues++];
+}
+
+XferManager *xfer_create(void) { return calloc(1, sizeof(XferManager)); }
+
+void xfer_destroy(XferManager *m) {
+  if (m == NULL) return;
+  for (size_t i = 0; i < m->nqueues; i++) {
+    struct xfer *x = m->queues[i].head;
+    while (x) {
+      struct xfer *next = x->next;
+      free(x);
+      x = next;
+    }
+  }
+  free(m->queues);
+  free(m->heap);
+  free(m);
+}
+
+int xfer_pending(const XferManager *m) { return m->pending; }
+
+int xfer_submit(XferManager *m, unsigned short libh, XferKind kind,
+                const char *src, const char *dst, short option,
+                xfer_done_fn done, void *ctx) {
+  struct handle_queue *q = find_queue(m, libh);
+  struct xfer *x;
+
+  if (q == NULL || (x = calloc(1, sizeof(*x))) == NULL) {
+    fprintf(stderr, "Failed to allocate transfer!\n");
+    return 1;
+  }
+  x->kind = kind;
+  x->libh = libh;
+  snprintf(x->src, sizeof(x->src), "%s", src);
+  snprintf(x->dst, sizeof(x->dst), "%s", dst ? dst : "");
+  x->option = option;
+  x->done = done;
+  x->ctx = ctx;
+  x->state = XFER_QUEUED;
+
+  if (q->tail) {
+    q->tail->next = x;
+    q->tail = x;
+  } else {
+    q->head = q->tail = x;
+    x->due = now();
+    heap_push(m, x);
+  }
+  m->pending++;
+  return 0;
+}
+
+static short start(struct xfer *x) {
+  switch (x->kind) {
+    case XFER_READ:
+      if (!READ_AVAILABLE()) return EW_FUNC;
+      return cnc_pdf_read_start(x->libh, 0, x->src, x->dst, x->option);
+    case XFER_COPY:
+    case XFER_MOVE:
+      if (!CPMV_AVAILABLE()) return EW_FUNC;
+      return cnc_pdf_cpmv_start(x->libh, x->kind == XFER_MOVE, x->src, x->dst,
+                                x->option);
+    case XFER_PUNCH:
+      return cnc_start_async_pdf_punch(x->libh, x->option, x->src, x->dst);
+  }
+  return EW_FUNC;
+}
+
+/* poll once, *running is cleared when the transfer reached its end */
+static short poll_once(struct xfer *x, int *running, int *progressed) {
+  char current[512] = "";
+  char extra[512] = "";
+  short ret;
+
+  x->polls++;
+  switch (x->kind) {
+    case XFER_READ:
+      ret = cnc_pdf_read_poll(x->libh, &x->status, current, extra);
+      break;
+    case XFER_COPY:
+    case XFER_MOVE:
+      ret = cnc_pdf_cpmv_poll(x->libh, &x->status, current);
+      break;
+    case XFER_PUNCH:
+      // the end call doubles as the poll, EW_BUSY until the punch finished
+      ret = cnc_end_async_pdf_punch(x->libh, &x->status);
+      *running = ret == EW_BUSY;
+      *progressed = 0;
+      return *running ? EW_OK : ret;
+    default:
+      return EW_FUNC;
+  }
+  *running = ret == EW_OK && x->status == XFER_EXECUTING;
+  *progressed = strcmp(current, x->current) != 0;
+  memcpy(x->current, current, sizeof(current));
+  return ret;
+}
+
+static short end(struct xfer *x) {
+  switch (x->kind) {
+    case XFER_READ:
+      return cnc_pdf_read_end(x->libh);
+    case XFER_COPY:
+    case XFER_MOVE:
+      return cnc_pdf_cpmv_end(x->libh);
+    case XFER_PUNCH:
+      return EW_OK;
+  }
+  return EW_FUNC;
+}
+
+static void finish(XferManager *m, struct xfer *x, short err, double t) {
+  struct handle_queue *q;
+  XferResult r = {x->kind,  x->libh,  x->src,         x->dst, err,
+                  x->status, x->polls, x->start ? t - x->start : 0};
+
+  // the callback may submit more work, which can move the queues
+  if (x->done) x->done(&r, x->ctx);
+  q = find_queue(m, x->libh);
+  q->head = x->next;
+  if (q->head == NULL) q->tail = NULL;
+  free(x);
+  m->pending--;
+  if (q->head) {
+    q->head->due = t;
+    heap_push(m, q->head);
+  }
+}
+
+/* run the next step of `x`, returns non-zero when it was rescheduled */
+static int advance(XferManager *m, struct xfer *x, double t) {
+  short ret;
+
+  if (x->state == XFER_QUEUED) {
+    ret = start(x);
+    if (ret == EW_BUSY && x->busy < BACKOFF_MAX_ATTEMPTS) {
+      long ms = POLL_MIN_MS << (x->busy < 8 ? x->busy : 8);
+      x->busy++;
+      x->due = t + (ms < START_RETRY_MAX_MS ? ms : START_RETRY_MAX_MS) / 1e3;
+      return 1;
+    }
+    if (ret != EW_OK) {
+      finish(m, x, ret, t);
+      return 0;
+    }
+    x->state = XFER_RUNNING;
+    x->start = t;
+    x->interval = POLL_MIN_MS;
+    x->due = t + x->interval / 1e3;
+    return 1;
+  } else {
+    int running = 0;
+    int progressed = 0;
+
+    ret = poll_once(x, &running, &progressed);
+    if (running) {
+      x->interval = progressed ? POLL_MIN_MS : x->interval * 2;
+      if (x->interval > POLL_MAX_MS) x->interval = POLL_MAX_MS;
+      x->due = t + x->interval / 1e3;
+      return 1;
+    }
+    // always end the transfer so the handle is usable again
+    short ended = end(x);
+    finish(m, x, ret != EW_OK ? ret : ended, now());
+    return 0;
+  }
+}
+
+long xfer_step(XferManager *m) {
+  double t = now();
+
+  while (m->nheap && m->heap[0]->due <= t) {
+    struct xfer *x = heap_pop(m);
+    if (advance(m, x, t)) heap_push(m, x);
+  }
+  if (m->nheap == 0) return -1;
+  return (long)((m->heap[0]->due - t) * 1e3) + 1;
+}
+
+int xfer_run(XferManager *m, long timeout_ms) {
+  double deadline = run_deadline(timeout_ms);
+
+  while (run_wait(xfer_step(m), deadline)) {
+  }
+  return m->pending;
+}
@@ -0,0 +1,51 @@
+#ifndef FW_XFER_H
+#define FW_XFER_H
+
+/* drives the asynchronous program file transfers (cnc_pdf_read_start,
+ * cnc_pdf_cpmv_start, cnc_start_async_pdf_punch and their poll / end calls)
+ * of many handles from a single thread. transfers on the same handle run one
+ * after the other, each running transfer is polled with its own backoff.
+ * libfwlib32-linux 1.0.5 does not export cnc_pdf_read_* and cnc_pdf_cpmv_*,
+ * there those transfers end with EW_FUNC. */
+
+typedef enum xfer_kind {
+  XFER_READ,   // cnc_pdf_read_*: device -> data server / memory card
+  XFER_COPY,   // cnc_pdf_cpmv_* mode 0
+  XFER_MOVE,   // cnc_pdf_cpmv_* mode 1
+  XFER_PUNCH,  // cnc_start_async_pdf_punch / cnc_end_async_pdf_punch
+} XferKind;
+
+typedef struct xfer_result {
+  XferKind kind;
+  unsigned short libh;
+  const char *src;
+  const char *dst;
+  short err;            // EW_OK or the failing FOCAS return code
+  short status;         // last status reported by the poll call
+  unsigned long polls;
+  double elapsed;       // seconds from start to end
+} XferResult;
+
+typedef void (*xfer_done_fn)(const XferResult *result, void *ctx);
+
+typedef struct xfer_manager XferManager;
+
+XferManager *xfer_create(void);
+void xfer_destroy(XferManager *m);
+
+/* queue a transfer. `option` is passed to the start call (overwrite / punch
+ * type). src and dst are copied. */
+int xfer_submit(XferManager *m, unsigned short libh, XferKind kind,
+                const char *src, const char *dst, short option,
+                xfer_done_fn done, void *ctx);
+
+/* poll everything that is due, returns milliseconds until the next poll is
+ * due or -1 when no transfers are left */
+long xfer_step(XferManager *m);
+/* step and sleep until every transfer finished, or timeout_ms passed when
+ * timeout_ms >= 0. returns the number of transfers still pending. */
+int xfer_run(XferManager *m, long timeout_ms);
+
+int xfer_pending(const XferManager *m);
+
+#endif
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include "../src/broker.h"
+  #include "../src/callstats.h"
+  #include "../src/download.h"
+  #include "../src/fwabi.h"
+  #include "../src/fwhost.h"
+  #include "../src/fwsim.h"
+  #include "../src/upload.h"
+}
+
+// no fakes here, the simulator is the library
+#include "benchmark/benchmark.h"
+#include "fwlib32.h"
+
+/* the wrappers on their own: no latency, no jitter, no errors */
+static void quiet() {
+  FwsimOptions o = default_fwsim_options;
+  for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = 0;
+  o.jitter_us = 0;
+  fwsim_configure(&o);
+}
+
+static unsigned short open_machine(const char *host) {
+  unsigned short h = 0;
+  quiet();
+  cnc_allclibhndl3(host, 8193, 10, &h);
+  return h;
+}
+
+#define CHECK_OK(state, call)                   \
+  if ((call) != EW_OK) {                        \
+    (state).SkipWithError(#call " failed");     \
+    break;                                      \
+  }
+
+/* per call overhead of the library calls the tools make */
+typedef short (*call_fn)(unsigned short h);
+
+static short read_id(unsigned short h) {
+  unsigned long id[4];
+  return cnc_rdcncid(h, id);
+}
+
+static short read_status(unsigned short h) {
+  ODBST st;
+  return cnc_statinfo(h, &st);
+}
+
+static short read_dynamic(unsigned short h) {
+  Fw32Dy2 dy;
+  return cnc_rddynamic2(h, ALL_AXES, sizeof(dy), (ODBDY2 *)&dy);
+}
+
+static short read_position(unsigned short h) {
+  Fw32Pos pos[FW32_MAX_AXIS];
+  short num = FW32_MAX_AXIS;
+  return cnc_rdposition(h, -1, &num, (ODBPOS *)pos);
+}
+
+static short read_speed(unsigned short h) {
+  Fw32Speed speed;
+  return cnc_rdspeed(h, -1, (ODBSPEED *)&speed);
+}
+
+static short read_program_number(unsigned short h) {
+  ODBPRO prog;
+  return cnc_rdprgnum(h, &prog);
+}
+
+static short read_pmc(unsigned short h) {
+  IODBPMC pmc;
+  return pmc_rdpmcrng(h, 5, 0, 0, 7, 8 + 8, &pmc);
+}
+
+static short read_macro(unsigned short h) {
+  Fw32Macro macro;
+  return cnc_rdmacro(h, 500, sizeof(macro), (ODBM *)&macro);
+}
+
+static short read_param(unsigned short h) {
+  Fw32Param param;
+  return cnc_rdparam(h, 1320, 1, 4 + sizeof(int32_t), (IODBPSD *)&param);
+}
+
+static void BM_Direct(benchmark::State &state, call_fn fn) {
+  unsigned short h = open_machine("10.0.0.1");
+  for (auto _ : state) CHECK_OK(state, fn(h));
+  cnc_freelibhndl(h);
+}
+BENCHMARK_CAPTURE(BM_Direct, rdcncid, read_id);
+BENCHMARK_CAPTURE(BM_Direct, statinfo, read_status);
+BENCHMARK_CAPTURE(BM_Direct, rddynamic2, read_dynamic);
+BENCHMARK_CAPTURE(BM_Direct, rdposition, read_position);
+BENCHMARK_CAPTURE(BM_Direct, rdspeed, read_speed);
+BENCHMARK_CAPTURE(BM_Direct, rdprgnum, read_program_number);
+BENCHMARK_CAPTURE(BM_Direct, rdpmcrng, read_pmc);
+BENCHMARK_CAPTURE(BM_Direct, rdmacro, read_macro);
+BENCHMARK_CAPTURE(BM_Direct, rdparam, read_param);
+
+/* the same calls through focas-broker, nothing served from its cache */
+static void BM_Broker(benchmark::State &state, BrokerOp op) {
+  BrokerOptions opts = default_broker_options;
+  BrokerPmcArgs pmc = {5, 0, 0, 7};
+  short axis = ALL_AXES;
+  char path[64], data[BROKER_MAX_DATA];
+  const void *args = NULL;
+  size_t args_size = 0, got;
+  BrokerClient *c;
+  Broker *b;
+
+  quiet();
+  for (int i = 0; i < BROKER_OPS; i++) opts.stale_ms[i] = 0;
+  snprintf(path, sizeof(path), "/tmp/focas-bench-%d.sock", (int)getpid());
+  if ((b = broker_create(path, &opts)) == NULL) {
+    state.SkipWithError("broker_create failed");
+    return;
+  }
+  std::thread loop([b] { broker_run(b, -1); });
+  c = broker_connect(path, "10.0.0.1", 8193);
+  if (op == BROKER_READ_DYNAMIC || op == BROKER_READ_SPINDLE) {
+    args = &axis;
+    args_size = sizeof(axis);
+  } else if (op == BROKER_READ_PMC) {
+    args = &pmc;
+    args_size = sizeof(pmc);
+  }
+  for (auto _ : state) {
+    if (c == NULL) {
+      state.SkipWithError("broker_connect failed");
+      break;
+    }
+    CHECK_OK(state, broker_call(c, op, args, args_size, data, sizeof(data),
+                                &got));
+  }
+  if (c) broker_close(c);
+  broker_stop(b);
+  loop.join();
+  broker_destroy(b);
+}
+BENCHMARK_CAPTURE(BM_Broker, rdcncid, BROKER_READ_ID)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Broker, statinfo, BROKER_READ_STATUS)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Broker, rddynamic2, BROKER_READ_DYNAMIC)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Broker, rdprgnum, BROKER_READ_PROGRAM_NUMBER)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_Broker, rdpmcrng, BROKER_READ_PMC)->UseRealTime();
+
+/* and through focas-host, in process here so only the slot round trip and
+ * the marshalling are measured */
+static void BM_Fwhost(benchmark::State &state, FwhostOp op) {
+  FwPmcArgs pmc = {5, 0, 0, 7};
+  short axis = ALL_AXES;
+  char name[64], data[FWHOST_SLOT_DATA];
+  const void *args = NULL;
+  size_t args_size = 0, got;
+  unsigned short h = 0;
+  FwClient *c;
+  FwHost *host;
+
+  quiet();
+  snprintf(name, sizeof(name), "/focas-bench-%d", (int)getpid());
+  if ((host = fwhost_create(name, 16)) == NULL) {
+    state.SkipWithError("fwhost_create failed");
+    return;
+  }
+  std::thread serving([host] { fwhost_serve(host, 1); });
+  c = fwclient_open(name);
+  if (c) fw_allclibhndl3(c, "10.0.0.1", 8193, 10, &h);
+  if (op == FWHOST_RDDYNAMIC2) {
+    args = &axis;
+    args_size = sizeof(axis);
+  } else if (op == FWHOST_RDPMCRNG) {
+    args = &pmc;
+    args_size = sizeof(pmc);
+  }
+  for (auto _ : state) {
+    if (h == 0) {
+      state.SkipWithError("fw_allclibhndl3 failed");
+      break;
+    }
+    CHECK_OK(state, fwclient_call(c, op, h, args, args_size, data,
+                                  sizeof(data), &got));
+  }
+  if (c) fwclient_close(c);
+  fwhost_stop(host);
+  serving.join();
+  fwhost_destroy(host);
+}
+BENCHMARK_CAPTURE(BM_Fwhost, rdcncid, FWHOST_RDCNCID)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Fwhost, statinfo, FWHOST_STATINFO)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Fwhost, rddynamic2, FWHOST_RDDYNAMIC2)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Fwhost, rdprgnum, FWHOST_RDPRGNUM)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Fwhost, rdpmcrng, FWHOST_RDPMCRNG)->UseRealTime();
+
+/* one pmc_rdpmcrng of 1 to 10000 bytes of R */
+static void BM_PmcRange(benchmark::State &state) {
+  unsigned short h = open_machine("10.0.0.1");
+  size_t n = state.range(0);
+  std::vector<char> buf(8 + n);
+
+  for (auto _ : state) {
+    CHECK_OK(state, pmc_rdpmcrng(h, 5, 0, 0, n - 1, buf.size(),
+                                 (IODBPMC *)buf.data()));
+  }
+  state.SetBytesProcessed(state.iterations() * n);
+  cnc_freelibhndl(h);
+}
+BENCHMARK(BM_PmcRange)->RangeMultiplier(10)->Range(1, 10000);
+
+/* `n` pmc words read as one range or one call each */
+static void BM_PmcBatched(benchmark::State &state) {
+  unsigned short h = open_machine("10.0.0.1");
+  int n = state.range(0);
+  std::vector<char> buf(8 + 2 * n);
+
+  for (auto _ : state) {
+    CHECK_OK(state, pmc_rdpmcrng(h, 5, 1, 0, 2 * n - 1, buf.size(),
+                                 (IODBPMC *)buf.data()));
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+  cnc_freelibhndl(h);
+}
+BENCHMARK(BM_PmcBatched)->Arg(1)->Arg(8)->Arg(64);
+
+static void BM_PmcUnbatched(benchmark::State &state) {
+  unsigned short h = open_machine("10.0.0.1");
+  int n = state.range(0);
+  IODBPMC pmc;
+  short ret = EW_OK;
+
+  for (auto _ : state) {
+    for (int i = 0; i < n && ret == EW_OK; i++)
+      ret = pmc_rdpmcrng(h, 5, 1, 2 * i, 2 * i + 1, 8 + 2, &pmc);
+    CHECK_OK(state, ret);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+  cnc_freelibhndl(h);
+}
+BENCHMARK(BM_PmcUnbatched)->Arg(1)->Arg(8)->Arg(64);
+
+/* the fields of cnc_rddynamic2 in one call or one call each */
+static void BM_DynamicBatched(benchmark::State &state) {
+  unsigned short h = open_machine("10.0.0.1");
+  for (auto _ : state) CHECK_OK(state, read_dynamic(h));
+  cnc_freelibhndl(h);
+}
+BENCHMARK(BM_DynamicBatched);
+
+static void BM_DynamicUnbatched(benchmark::State &state) {
+  unsigned short h = open_machine("10.0.0.1");
+  Fw32Axis axis;
+  Fw32Act act;
+  Fw32Act seq;
+  ODBPRO prog;
+  int32_t alarm;
+
+  for (auto _ : state) {
+    short ret = cnc_alarm2(h, (long *)&alarm);
+    if (ret == EW_OK) ret = cnc_rdprgnum(h, &prog);
+    if (ret == EW_OK) ret = cnc_rdseqnum(h, (ODBSEQ *)&seq);
+    if (ret == EW_OK) ret = cnc_actf(h, (ODBACT *)&act);
+    if (ret == EW_OK) ret = cnc_acts(h, (ODBACT *)&act);
+    if (ret == EW_OK)
+      ret = cnc_absolute(h, ALL_AXES, sizeof(axis), (ODBAXIS *)&axis);
+    if (ret == EW_OK)
+      ret = cnc_machine(h, ALL_AXES, sizeof(axis), (ODBAXIS *)&axis);
+    if (ret == EW_OK)
+      ret = cnc_relative(h, ALL_AXES, sizeof(axis), (ODBAXIS *)&axis);
+    CHECK_OK(state, ret);
+  }
+  cnc_freelibhndl(h);
+}
+BENCHMARK(BM_DynamicUnbatched);
+
+/* upload_stream of a 256 KiB program with a fixed cnc_upload4 size */
+static int discard(const char *buf, size_t len, void *ctx) { return 0; }
+
+static void BM_UploadChunk(benchmark::State &state) {
+  unsigned short h = open_machine("10.0.0.1");
+  UploadOptions opts = default_upload_options;
+  std::string text = "%\nO2000(BENCH)\n";
+  UploadStats stats;
+
+  while (text.size() < 256 * 1024) {
+    char line[64];
+    snprintf(line, sizeof(line), "N%zu G01 X%zu.000 Y-1.500 F1000.\n",
+             text.size(), text.size() % 997);
+    text += line;
+  }
+  text += "M30\n%";
+  cnc_delete(h, 2000);
+  if (download_buffer(h, 0, "//CNC_MEM/USER/PATH1/", text.data(), text.size(),
+                      &default_download_options, NULL) != 0) {
+    state.SkipWithError("download_buffer failed");
+    cnc_freelibhndl(h);
+    return;
+  }
+
+  opts.min_chunk = opts.max_chunk = state.range(0);
+  if (opts.buffer_size < opts.max_chunk) opts.buffer_size = opts.max_chunk;
+  for (auto _ : state) {
+    if (upload_stream(h, 0, "//CNC_MEM/USER/PATH1/O2000", discard, NULL,
+                      &opts, &stats) != 0) {
+      state.SkipWithError("upload_stream failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+  cnc_delete(h, 2000);
+  cnc_freelibhndl(h);
+}
+BENCHMARK(BM_UploadChunk)->RangeMultiplier(4)->Range(256, 65536)
+    ->UseRealTime();
+
+/* one handle per thread, each to a machine of its own */
+static void BM_Handles(benchmark::State &state) {
+  char host[32];
+  unsigned short h;
+
+  snprintf(host, sizeof(host), "10.0.1.%d", state.thread_index() + 1);
+  h = open_machine(host);
+  for (auto _ : state) CHECK_OK(state, read_status(h));
+  state.SetItemsProcessed(state.iterations());
+  cnc_freelibhndl(h);
+}
+BENCHMARK(BM_Handles)->ThreadRange(1, 64)->UseRealTime();
+
+/* what callstats.h adds to every call it times, on 1 to 1000 machines */
+static void BM_CallStats(benchmark::State &state) {
+  unsigned short machine = 0;
+
+  for (auto _ : state) {
+    unsigned long long t = callstats_now();
+    callstats_record("cnc_statinfo", machine, t, EW_OK);
+    if (++machine == state.range(0)) machine = 0;
+  }
+}
+BENCHMARK(BM_CallStats)->Arg(1)->Arg(1000)->ThreadRange(1, 8);
+
+BENCHMARK_MAIN();
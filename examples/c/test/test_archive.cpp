@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <string>
+
+extern "C" {
+  #include "../src/archive.h"
+  #include "../src/sha256.h"
+}
+
+#include "gtest/gtest.h"
+
+static std::string make_program(int lines, int variant) {
+  std::string p = "%\nO1000\n";
+  char line[64];
+  for (int i = 0; i < lines; i++) {
+    snprintf(line, sizeof(line), "N%d G01 X%d.%03d Y%d.500 F%d.\n", i * 10,
+             i % 97, i % 1000, (i * 7) % 113, i == lines / 2 ? variant : 300);
+    p += line;
+  }
+  return p + "M30\n%";
+}
+
+static std::string store(const std::string &root, const std::string &data,
+                         const std::string &manifest, ArchiveStats *stats) {
+  ArchiveWriter *w = archive_open(root.c_str(), 1);
+  std::string path = root + "/" + manifest;
+  EXPECT_NE(w, nullptr);
+  // feed it in odd sized pieces like cnc_upload4 would
+  for (size_t off = 0; off < data.size(); off += 1279) {
+    size_t n = data.size() - off < 1279 ? data.size() - off : 1279;
+    EXPECT_EQ(archive_write(data.data() + off, n, w), 0);
+  }
+  EXPECT_EQ(archive_commit(w, path.c_str(), stats), 0);
+  return path;
+}
+
+class Archive : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char tmpl[] = "/tmp/focas-archive-XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    root = tmpl;
+  }
+  void TearDown() override {
+    std::string cmd = "rm -rf " + root;
+    system(cmd.c_str());
+  }
+  std::string root;
+};
+
+TEST(Sha256, KnownDigests) {
+  unsigned char digest[SHA256_SIZE];
+  char hex[SHA256_SIZE * 2 + 1];
+  Sha256 ctx;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, "abc", 3);
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, hex);
+  EXPECT_STREQ(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, "abcdbcdecdefdefgefghfghighijhijkijklj", 37);
+  sha256_update(&ctx, "klmklmnlmnomnopnopq", 19);
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, hex);
+  EXPECT_STREQ(hex, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+}
+
+TEST_F(Archive, RoundTrips) {
+  std::string program = make_program(20000, 300);
+  ArchiveStats stats;
+  char *data;
+  size_t len;
+
+  std::string manifest = store(root, program, "O1000", &stats);
+  EXPECT_TRUE(archive_is_manifest(manifest.c_str()));
+  EXPECT_EQ(stats.bytes, program.size());
+  EXPECT_GT(stats.chunks, 4u);
+  EXPECT_EQ(stats.new_chunks, stats.chunks);
+
+  ASSERT_EQ(archive_read(root.c_str(), manifest.c_str(), &data, &len), 0);
+  EXPECT_EQ(std::string(data, len), program);
+  free(data);
+}
+
+TEST_F(Archive, ChunksEndOnLines) {
+  std::string program = make_program(20000, 300);
+  ArchiveStats stats;
+
+  std::string manifest = store(root, program, "O1000", &stats);
+  std::ifstream in(manifest);
+  std::string line;
+  size_t off = 0;
+  for (int i = 0; i < 3; i++) std::getline(in, line);
+  while (std::getline(in, line)) {
+    off += strtoul(line.substr(65).c_str(), NULL, 10);
+    if (off < program.size()) {
+      EXPECT_EQ(program[off - 1], '\n');
+    }
+  }
+  EXPECT_EQ(off, program.size());
+}
+
+TEST_F(Archive, DeduplicatesSharedContent) {
+  ArchiveStats first, second, same;
+
+  store(root, make_program(20000, 300), "a", &first);
+  store(root, make_program(20000, 301), "b", &second);
+  store(root, make_program(20000, 300), "c", &same);
+
+  // a one line edit only changes the chunk holding it
+  EXPECT_LE(second.new_chunks, 2u);
+  EXPECT_EQ(same.new_chunks, 0u);
+  EXPECT_EQ(same.stored, 0u);
+}
+
+TEST_F(Archive, DetectsCorruptChunk) {
+  ArchiveStats stats;
+  std::string manifest = store(root, make_program(100, 300), "O1000", &stats);
+  char *data;
+  size_t len;
+
+  std::string cmd = "for f in $(find " + root +
+                    "/chunks -type f); do printf x >> $f; done";
+  system(cmd.c_str());
+  EXPECT_NE(archive_read(root.c_str(), manifest.c_str(), &data, &len), 0);
+}
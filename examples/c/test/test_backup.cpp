@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+extern "C" {
+  #include "../src/backup.h"
+  #include "../src/fwabi.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, lib_allclibhndl3, const char *, unsigned short, long, unsigned short *);
+FAKE_VALUE_FUNC(short, lib_freelibhndl, unsigned short);
+FAKE_VALUE_FUNC(short, lib_rdprogdir3, unsigned short, short, long *, short *, void *);
+FAKE_VALUE_FUNC(short, lib_upstart4, unsigned short, short, char *);
+FAKE_VALUE_FUNC(short, lib_upload4, unsigned short, long *, char *);
+FAKE_VALUE_FUNC(short, lib_upend4, unsigned short);
+FAKE_VALUE_FUNC(short, lib_dwnstart4, unsigned short, short, char *);
+FAKE_VALUE_FUNC(short, lib_download4, unsigned short, long *, char *);
+FAKE_VALUE_FUNC(short, lib_dwnend4, unsigned short);
+
+/* the jobs call the library from threads of their own and fff keeps its
+ * call history unlocked, so every call reaches the fakes one at a time */
+static std::mutex library;
+
+#define SERIALIZED(name, params, args)         \
+  extern "C" short cnc_##name params {         \
+    std::lock_guard<std::mutex> lock(library); \
+    return lib_##name args;                    \
+  }
+
+SERIALIZED(allclibhndl3,
+           (const char *ip, unsigned short port, long timeout,
+            unsigned short *libh),
+           (ip, port, timeout, libh))
+SERIALIZED(freelibhndl, (unsigned short libh), (libh))
+SERIALIZED(rdprogdir3,
+           (unsigned short libh, short type, long *top, short *num, void *buf),
+           (libh, type, top, num, buf))
+SERIALIZED(upstart4, (unsigned short libh, short type, char *name),
+           (libh, type, name))
+SERIALIZED(upload4, (unsigned short libh, long *len, char *buf),
+           (libh, len, buf))
+SERIALIZED(upend4, (unsigned short libh), (libh))
+SERIALIZED(dwnstart4, (unsigned short libh, short type, char *name),
+           (libh, type, name))
+SERIALIZED(download4, (unsigned short libh, long *len, char *buf),
+           (libh, len, buf))
+SERIALIZED(dwnend4, (unsigned short libh), (libh))
+
+static std::atomic<int> handles;
+static std::string pending[65536];
+
+static short fake_connect(const char *ip, unsigned short port, long timeout,
+                          unsigned short *libh) {
+  *libh = (unsigned short)++handles;
+  return EW_OK;
+}
+
+/* two programs, O0001 and O0002 */
+static short list_programs(unsigned short libh, short type, long *top,
+                           short *num, void *buf) {
+  Fw32Prgdir3 *progs = (Fw32Prgdir3 *)buf;
+  short n = 0;
+  for (long p = *top < 1 ? 1 : *top; p <= 2 && n < *num; p++) {
+    progs[n++].number = p;
+  }
+  *num = n;
+  return EW_OK;
+}
+
+static short start_upload(unsigned short libh, short type, char *name) {
+  std::ostringstream data;
+  data << "%\n" << type << ":" << name << "\n%";
+  pending[libh] = data.str();
+  return EW_OK;
+}
+
+static short upload(unsigned short libh, long *len, char *buf) {
+  std::string &p = pending[libh];
+  size_t n = p.size() < (size_t)*len ? p.size() : (size_t)*len;
+  memcpy(buf, p.data(), n);
+  p.erase(0, n);
+  *len = (long)n;
+  return EW_OK;
+}
+
+static int count_lines(const std::string &path) {
+  std::ifstream in(path);
+  std::string line;
+  int n = 0;
+  while (std::getline(in, line)) n++;
+  return n;
+}
+
+static std::string read_file(const std::string &path) {
+  std::ifstream in(path);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+class Backup : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(lib_allclibhndl3);
+    RESET_FAKE(lib_freelibhndl);
+    RESET_FAKE(lib_rdprogdir3);
+    RESET_FAKE(lib_upstart4);
+    RESET_FAKE(lib_upload4);
+    RESET_FAKE(lib_upend4);
+    RESET_FAKE(lib_dwnstart4);
+    RESET_FAKE(lib_download4);
+    RESET_FAKE(lib_dwnend4);
+    lib_allclibhndl3_fake.custom_fake = fake_connect;
+    lib_rdprogdir3_fake.custom_fake = list_programs;
+    lib_upstart4_fake.custom_fake = start_upload;
+    lib_upload4_fake.custom_fake = upload;
+    handles = 0;
+    for (std::string &p : pending) p.clear();
+
+    char tmpl[] = "/tmp/focas-backup-XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    dir = tmpl;
+    for (int i = 0; i < 3; i++) {
+      snprintf(machines[i].name, sizeof(machines[i].name), "mill-%02d", i);
+      snprintf(machines[i].ip, sizeof(machines[i].ip), "10.0.0.%d", i + 1);
+      machines[i].port = 8193;
+    }
+    opts = default_backup_options;
+    opts.jobs = 3;
+    snprintf(opts.dir, sizeof(opts.dir), "%s", dir.c_str());
+  }
+  void TearDown() override {
+    std::string cmd = "rm -rf " + dir;
+    system(cmd.c_str());
+  }
+  /* the next run starts over instead of resuming */
+  void forget_manifests() {
+    unlink((dir + "/backup.manifest").c_str());
+    unlink((dir + "/restore.manifest").c_str());
+  }
+  std::string dir;
+  Machine machines[3];
+  BackupOptions opts;
+};
+
+TEST(Machines, ReadsMachinesFile) {
+  const char path[] = "./machines_test.txt";
+  Machine *machines;
+  int count;
+
+  std::ofstream(path) << "# fleet\nmill-01 10.0.0.1\n\nlathe-02 10.0.0.2 8194 # cell 2\n";
+  ASSERT_EQ(read_machines(path, &machines, &count), 0);
+  ASSERT_EQ(count, 2);
+  EXPECT_STREQ(machines[0].name, "mill-01");
+  EXPECT_EQ(machines[0].port, 8193);
+  EXPECT_STREQ(machines[1].ip, "10.0.0.2");
+  EXPECT_EQ(machines[1].port, 8194);
+  free(machines);
+
+  std::ofstream(path) << "mill-01\n";
+  EXPECT_NE(read_machines(path, &machines, &count), 0);
+  remove(path);
+}
+
+TEST_F(Backup, BacksUpEveryMachine) {
+  ASSERT_EQ(run_backup(machines, 3, &opts), 0);
+
+  for (int i = 0; i < 3; i++) {
+    std::string m = dir + "/" + machines[i].name;
+    EXPECT_EQ(read_file(m + "/parameters.dat"), "%\n2:\n%");
+    EXPECT_EQ(read_file(m + "/work-offsets.dat"), "%\n5:\n%");
+    EXPECT_EQ(read_file(m + "/programs/O0002.nc"),
+              "%\n0://CNC_MEM/USER/PATH1/O0002\n%");
+    EXPECT_NE(access((m + "/programs/O0002.nc.part").c_str(), F_OK), 0);
+  }
+  // 3 data files and 2 programs per machine
+  EXPECT_EQ(count_lines(dir + "/backup.manifest"), 15);
+  EXPECT_EQ(handles, 3);
+}
+
+TEST_F(Backup, ResumesFromManifest) {
+  ASSERT_EQ(run_backup(machines, 3, &opts), 0);
+  RESET_FAKE(lib_upstart4);
+  lib_upstart4_fake.custom_fake = start_upload;
+
+  ASSERT_EQ(run_backup(machines, 3, &opts), 0);
+  EXPECT_EQ(lib_upstart4_fake.call_count, 0u) << "nothing left to transfer";
+  EXPECT_EQ(count_lines(dir + "/backup.manifest"), 15);
+}
+
+TEST_F(Backup, RestoresBackup) {
+  opts.jobs = 1;
+  ASSERT_EQ(run_backup(machines, 3, &opts), 0);
+
+  opts.restore = 1;
+  opts.bandwidth = 1e6;
+  ASSERT_EQ(run_backup(machines, 3, &opts), 0);
+  EXPECT_EQ(lib_dwnstart4_fake.call_count, 15u);
+  EXPECT_EQ(count_lines(dir + "/restore.manifest"), 15);
+}
+
+TEST_F(Backup, ReportsFailedMachines) {
+  short codes[] = {EW_OK, -16, EW_OK};
+  lib_allclibhndl3_fake.custom_fake = NULL;
+  SET_RETURN_SEQ(lib_allclibhndl3, codes, 3);
+  opts.jobs = 1;
+  opts.items = BACKUP_PARAMETERS;
+
+  EXPECT_EQ(run_backup(machines, 3, &opts), 1);
+}
+
+TEST_F(Backup, ArchivesIdenticalData) {
+  std::string store = dir + "/store";
+  snprintf(opts.archive, sizeof(opts.archive), "%s", store.c_str());
+  opts.items = BACKUP_PARAMETERS | BACKUP_OFFSETS;
+  ASSERT_EQ(run_backup(machines, 3, &opts), 0);
+
+  // every machine uploads the same parameters and offsets
+  std::string cmd = "test $(find " + store + "/chunks -type f | wc -l) -eq 3";
+  EXPECT_EQ(system(cmd.c_str()), 0);
+
+  opts.restore = 1;
+  ASSERT_EQ(run_backup(machines, 3, &opts), 0);
+  EXPECT_EQ(lib_dwnstart4_fake.call_count, 9u);
+
+  opts.archive[0] = '\0';
+  forget_manifests();
+  EXPECT_EQ(run_backup(machines, 3, &opts), 3) << "store is required";
+}
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include "../src/broker.h"
+  #include "../src/fwabi.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_SOCKET (-16)
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_allclibhndl3, const char *, unsigned short, long,
+                unsigned short *);
+FAKE_VALUE_FUNC(short, cnc_freelibhndl, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_rdcncid, unsigned short, unsigned long *);
+FAKE_VALUE_FUNC(short, cnc_statinfo, unsigned short, void *);
+FAKE_VALUE_FUNC(short, cnc_rdposition, unsigned short, short, short *, void *);
+FAKE_VALUE_FUNC(short, cnc_rdspeed, unsigned short, short, void *);
+FAKE_VALUE_FUNC(short, cnc_rddynamic2, unsigned short, short, short, void *);
+FAKE_VALUE_FUNC(short, pmc_rdpmcrng, unsigned short, short, short,
+                unsigned short, unsigned short, unsigned short, void *);
+FAKE_VALUE_FUNC(short, cnc_rdprgnum, unsigned short, void *);
+FAKE_VALUE_FUNC(short, pmc_wrpmcrng, unsigned short, short, void *);
+
+/* the controller, every call fills the result with its own number. while
+ * `held` the calls wait, so the machine thread stays busy until the test
+ * lets it go. */
+static std::atomic<int> calls;
+static std::atomic<bool> held;
+
+static void hold() {
+  while (held) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static short read_dynamic(unsigned short h, short axis, short len, void *buf) {
+  hold();
+  memset(buf, ++calls + axis, len);
+  return EW_OK;
+}
+
+static short read_pmc(unsigned short h, short adr, short type,
+                      unsigned short s, unsigned short e, unsigned short len,
+                      void *buf) {
+  hold();
+  memset(buf, ++calls, len);
+  return EW_OK;
+}
+
+class BrokerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_allclibhndl3);
+    RESET_FAKE(cnc_freelibhndl);
+    RESET_FAKE(cnc_statinfo);
+    RESET_FAKE(cnc_rddynamic2);
+    RESET_FAKE(pmc_rdpmcrng);
+    RESET_FAKE(pmc_wrpmcrng);
+    cnc_rddynamic2_fake.custom_fake = read_dynamic;
+    pmc_rdpmcrng_fake.custom_fake = read_pmc;
+    calls = 0;
+    held = false;
+
+    snprintf(path, sizeof(path), "/tmp/fwbroker-test-%d.sock", (int)getpid());
+    opts = default_broker_options;
+  }
+  void TearDown() override {
+    if (b) {
+      broker_stop(b);
+      loop.join();
+      broker_destroy(b);
+    }
+  }
+  void start() {
+    b = broker_create(path, &opts);
+    ASSERT_NE(b, nullptr);
+    loop = std::thread([this] { broker_run(b, -1); });
+  }
+  BrokerClient *client() { return broker_connect(path, "10.0.0.1", 8193); }
+  /* runs the loop here until `done` */
+  template <typename F>
+  void run_until(F done) {
+    while (!done()) broker_run(b, 5);
+  }
+  BrokerStats stats() {
+    BrokerStats s;
+    broker_stats(b, &s);
+    return s;
+  }
+
+  char path[64];
+  BrokerOptions opts;
+  Broker *b = nullptr;
+  std::thread loop;
+};
+
+TEST_F(BrokerTest, CoalescesReadsInFlight) {
+  std::vector<std::thread> clients;
+  unsigned char got[3][2048];  // Fw32Dy2 holds every axis
+  short err[3];
+
+  opts.stale_ms[BROKER_READ_DYNAMIC] = 0;
+  held = true;
+  start();
+  for (int i = 0; i < 3; i++) {
+    clients.emplace_back([&, i] {
+      BrokerClient *c = client();
+      memset(got[i], 0, sizeof(got[i]));
+      err[i] = c ? broker_read_dynamic(c, 1, got[i]) : EW_SOCKET;
+      broker_close(c);
+    });
+  }
+  // the first read holds the machine until the others joined it
+  while (stats().requests < 3)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  held = false;
+  for (auto &t : clients) t.join();
+
+  EXPECT_EQ(cnc_rddynamic2_fake.call_count, 1u);
+  EXPECT_EQ(cnc_rddynamic2_fake.arg2_val, (short)sizeof(Fw32Dy2));
+  EXPECT_EQ(cnc_allclibhndl3_fake.call_count, 1u);
+  EXPECT_STREQ(cnc_allclibhndl3_fake.arg0_val, "10.0.0.1");
+  EXPECT_EQ(stats().requests, 3u);
+  EXPECT_EQ(stats().coalesced, 2u);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(err[i], EW_OK);
+    EXPECT_EQ(got[i][0], 2) << i;
+  }
+
+  // nothing is kept without a staleness window
+  BrokerClient *c = client();
+  ASSERT_EQ(broker_read_dynamic(c, 1, got[0]), EW_OK);
+  EXPECT_EQ(got[0][0], 3);
+  // another axis is another read
+  ASSERT_EQ(broker_read_dynamic(c, 2, got[0]), EW_OK);
+  EXPECT_EQ(got[0][0], 5);
+  broker_close(c);
+}
+
+TEST_F(BrokerTest, ReusesRecentResults) {
+  unsigned char got[64];
+
+  opts.stale_ms[BROKER_READ_PMC] = 100;
+  start();
+  BrokerClient *c = client();
+  ASSERT_NE(c, nullptr);
+  ASSERT_EQ(broker_read_pmc(c, 0, 0, 0, 9, got, 18), EW_OK);
+  ASSERT_EQ(broker_read_pmc(c, 0, 0, 0, 9, got, 18), EW_OK);
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 1u);
+  EXPECT_EQ(pmc_rdpmcrng_fake.arg5_val, 18);
+  ASSERT_EQ(broker_read_pmc(c, 0, 0, 0, 3, got, 12), EW_OK);
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 2u) << "other range";
+  // byte addresses whatever the type, D0 .. D9 are five words
+  ASSERT_EQ(broker_read_pmc(c, 0, 1, 0, 9, got, 18), EW_OK);
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 3u) << "other type";
+  EXPECT_EQ(pmc_rdpmcrng_fake.arg5_val, 18);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(120));
+  ASSERT_EQ(broker_read_pmc(c, 0, 0, 0, 9, got, 18), EW_OK);
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 4u) << "stale";
+
+  // a write is never merged and the next read goes to the cnc
+  ASSERT_EQ(broker_write_pmc(c, got, 18), EW_OK);
+  ASSERT_EQ(broker_write_pmc(c, got, 18), EW_OK);
+  EXPECT_EQ(pmc_wrpmcrng_fake.call_count, 2u);
+  ASSERT_EQ(broker_read_pmc(c, 0, 0, 0, 9, got, 18), EW_OK);
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 5u);
+
+  BrokerStats stats;
+  broker_stats(b, &stats);
+  EXPECT_EQ(stats.cached, 1u);
+  EXPECT_EQ(stats.calls, 7u);
+  broker_close(c);
+}
+
+TEST_F(BrokerTest, WriteInTheSameBatchMakesReadsStale) {
+  unsigned char got[2][64];
+  short err[2];
+
+  opts.stale_ms[BROKER_READ_PMC] = 60000;
+  held = true;
+  b = broker_create(path, &opts);
+  ASSERT_NE(b, nullptr);
+
+  // the read holds the machine until the write is queued behind it
+  std::thread reader([&] {
+    BrokerClient *c = client();
+    err[0] = c ? broker_read_pmc(c, 0, 0, 0, 9, got[0], 18) : EW_SOCKET;
+    broker_close(c);
+  });
+  run_until([&] { return stats().requests == 1; });
+  std::thread writer([&] {
+    BrokerClient *c = client();
+    err[1] = c ? broker_write_pmc(c, got[1], 18) : EW_SOCKET;
+    broker_close(c);
+  });
+  run_until([&] { return stats().requests == 2; });
+
+  // both finish while the loop is not looking, then come in one batch
+  held = false;
+  while (stats().calls < 2)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  loop = std::thread([this] { broker_run(b, -1); });
+  reader.join();
+  writer.join();
+  EXPECT_EQ(err[0], EW_OK);
+  EXPECT_EQ(err[1], EW_OK);
+
+  BrokerClient *c = client();
+  ASSERT_EQ(broker_read_pmc(c, 0, 0, 0, 9, got[0], 18), EW_OK);
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 2u) << "read before the write";
+  EXPECT_EQ(stats().cached, 0u);
+  broker_close(c);
+}
+
+TEST_F(BrokerTest, ErrorsAreNotReused) {
+  unsigned char got[2048];
+  short codes[] = {EW_SOCKET, EW_OK};
+
+  SET_RETURN_SEQ(cnc_statinfo, codes, 2);
+  start();
+  BrokerClient *c = client();
+  EXPECT_EQ(broker_read_status(c, got), EW_SOCKET);
+  EXPECT_EQ(broker_read_status(c, got), EW_OK);
+  EXPECT_EQ(cnc_statinfo_fake.call_count, 2u);
+  // the broken handle was replaced
+  EXPECT_EQ(cnc_freelibhndl_fake.call_count, 1u);
+  EXPECT_EQ(cnc_allclibhndl3_fake.call_count, 2u);
+  EXPECT_EQ(broker_call(c, BROKER_READ_PMC, got, 3, got, sizeof(got), NULL),
+            2) << "EW_LENGTH";
+  broker_close(c);
+}
+
+TEST_F(BrokerTest, ClientSeesBrokerGo) {
+  unsigned char got[2048];
+
+  start();
+  BrokerClient *c = client();
+  ASSERT_NE(c, nullptr);
+  broker_stop(b);
+  loop.join();
+  broker_destroy(b);
+  b = nullptr;
+  EXPECT_EQ(broker_read_status(c, got), EW_SOCKET);
+  broker_close(c);
+  EXPECT_EQ(broker_connect(path, "10.0.0.1", 8193), nullptr);
+}
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include "../src/callstats.h"
+}
+
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_SOCKET (-16)
+
+// each test uses machines of its own, the histograms live for the process
+static const CallStats *find(const CallStats *rows, int n, const char *function,
+                             unsigned short machine) {
+  for (int i = 0; i < n; i++) {
+    if (strcmp(rows[i].function, function) == 0 && rows[i].machine == machine)
+      return &rows[i];
+  }
+  return nullptr;
+}
+
+TEST(CallStatsTest, CountsPerFunctionAndMachine) {
+  static CallStats rows[8];
+
+  callstats_add("cnc_statinfo", 11, 1000, EW_OK);
+  callstats_add("cnc_statinfo", 11, 3000, EW_OK);
+  callstats_add("cnc_statinfo", 11, 2000, EW_SOCKET);
+  callstats_add("pmc_rdpmcrng", 11, 500, 30000);
+  callstats_add("cnc_statinfo", 12, 1000, EW_OK);
+
+  int n = callstats_collect(rows, 8, 11);
+  ASSERT_EQ(n, 2);
+  const CallStats *s = find(rows, n, "cnc_statinfo", 11);
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->calls, 3u);
+  EXPECT_EQ(s->errors, 1u);
+  EXPECT_EQ(s->total_ns, 6000u);
+  EXPECT_EQ(s->max_ns, 3000u);
+  EXPECT_EQ(s->codes[EW_OK - CALLSTATS_MIN_CODE], 2u);
+  EXPECT_EQ(s->codes[EW_SOCKET - CALLSTATS_MIN_CODE], 1u);
+  EXPECT_EQ(callstats_code(EW_SOCKET - CALLSTATS_MIN_CODE), EW_SOCKET);
+
+  s = find(rows, n, "pmc_rdpmcrng", 11);
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->codes[CALLSTATS_CODES - 1], 1u) << "not an EW_* code";
+
+  n = callstats_collect(rows, 8, -1);
+  EXPECT_NE(find(rows, n, "cnc_statinfo", 12), nullptr);
+  EXPECT_EQ(callstats_collect(rows, 1, 11), 1) << "rows beyond max";
+}
+
+TEST(CallStatsTest, TimesACall) {
+  static CallStats rows[2];
+  struct timespec ms = {0, 2000000};
+
+  unsigned long long t = callstats_now();
+  nanosleep(&ms, NULL);
+  callstats_record("cnc_rdspeed", 41, t, EW_OK);
+  ASSERT_EQ(callstats_collect(rows, 2, 41), 1);
+  EXPECT_GE(rows[0].max_ns, 1900000u);
+  EXPECT_LT(rows[0].max_ns, 200000000u);
+}
+
+TEST(CallStatsTest, QuantilesWithinASixteenth) {
+  static CallStats rows[4];
+
+  // 1 .. 1000 us, one call each
+  for (int us = 1; us <= 1000; us++)
+    callstats_add("cnc_rddynamic2", 21, us * 1000ull, EW_OK);
+  ASSERT_EQ(callstats_collect(rows, 4, 21), 1);
+  double p50 = callstats_quantile(&rows[0], 0.5);
+  double p99 = callstats_quantile(&rows[0], 0.99);
+  EXPECT_GE(p50, 500e3);
+  EXPECT_LE(p50, 500e3 * 17 / 16 + 2000);
+  EXPECT_GE(p99, 990e3);
+  EXPECT_LE(p99, 990e3 * 17 / 16 + 2000);
+  EXPECT_EQ(callstats_quantile(&rows[0], 1.0), rows[0].max_ns);
+
+  CallStats empty;
+  memset(&empty, 0, sizeof(empty));
+  EXPECT_EQ(callstats_quantile(&empty, 0.5), 0);
+}
+
+TEST(CallStatsTest, MergesThreadsAlsoAfterTheyExit) {
+  static CallStats rows[4];
+  const int threads = 8;
+  const int calls = 1000;
+  pthread_barrier_t ready;
+  pthread_barrier_t done;
+  std::vector<std::thread> workers;
+
+  pthread_barrier_init(&ready, NULL, threads + 1);
+  pthread_barrier_init(&done, NULL, threads + 1);
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([&, i] {
+      for (int k = 0; k < calls; k++)
+        callstats_add("cnc_upload4", 31, 1000 + i, k % 10 ? EW_OK : EW_SOCKET);
+      pthread_barrier_wait(&ready);
+      pthread_barrier_wait(&done);
+    });
+  }
+
+  // scraped while the threads are alive
+  pthread_barrier_wait(&ready);
+  ASSERT_EQ(callstats_collect(rows, 4, 31), 1);
+  EXPECT_EQ(rows[0].calls, (unsigned long long)threads * calls);
+  pthread_barrier_wait(&done);
+  for (auto &w : workers) w.join();
+
+  // and once they have exited
+  callstats_add("cnc_upload4", 31, 1000, EW_OK);
+  ASSERT_EQ(callstats_collect(rows, 4, 31), 1);
+  EXPECT_EQ(rows[0].calls, (unsigned long long)threads * calls + 1);
+  EXPECT_EQ(rows[0].errors, (unsigned long long)threads * calls / 10);
+  unsigned long long hist = 0;
+  for (int b = 0; b < CALLSTATS_BUCKETS; b++) hist += rows[0].hist[b];
+  EXPECT_EQ(hist, rows[0].calls);
+  pthread_barrier_destroy(&ready);
+  pthread_barrier_destroy(&done);
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/download.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_BUFFER 10
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_dwnstart4, unsigned short, short, char *);
+FAKE_VALUE_FUNC(short, cnc_download4, unsigned short, long *, char *);
+FAKE_VALUE_FUNC(short, cnc_dwnend4, unsigned short);
+
+static std::string received;
+static const char *expected_ptr;
+static int calls;
+static int copies;
+
+/* accepts at most 1000 bytes per call and is busy every fourth call */
+static short accept_download(unsigned short libh, long *len, char *buf) {
+  if (++calls % 4 == 0) return EW_BUFFER;
+  if (expected_ptr && buf != expected_ptr) copies++;
+  if (*len > 1000) *len = 1000;
+  received.append(buf, (size_t)*len);
+  if (expected_ptr) expected_ptr += *len;
+  return EW_OK;
+}
+
+static void count_chunk(const DownloadChunk *chunk, void *ctx) {
+  (*(unsigned long *)ctx)++;
+  EXPECT_GE(chunk->latency, 0.0);
+}
+
+class Download : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_dwnstart4);
+    RESET_FAKE(cnc_download4);
+    RESET_FAKE(cnc_dwnend4);
+    program = "%\nO5678\n";
+    for (int i = 0; i < 5000; i++) program += "G02 X10. Y10. R5. F200.\n";
+    program += "M30\n%";
+    received.clear();
+    expected_ptr = NULL;
+    calls = 0;
+    copies = 0;
+    cnc_download4_fake.custom_fake = accept_download;
+  }
+  std::string program;
+};
+
+TEST_F(Download, SendsBufferInPlace) {
+  DownloadStats stats;
+  unsigned long chunks = 0;
+  DownloadOptions opts = default_download_options;
+  opts.on_chunk = count_chunk;
+  opts.ctx = &chunks;
+  expected_ptr = program.data();
+
+  ASSERT_EQ(download_buffer(1, 0, "//CNC_MEM/USER/PATH1/", program.data(),
+                            program.size(), &opts, &stats), 0);
+
+  EXPECT_EQ(received, program);
+  EXPECT_EQ(copies, 0) << "cnc should read from the source buffer";
+  EXPECT_EQ(stats.bytes, program.size());
+  EXPECT_EQ(stats.chunks, chunks);
+  EXPECT_GT(stats.retries, 0u);
+  EXPECT_EQ(cnc_dwnend4_fake.call_count, 1u);
+}
+
+TEST_F(Download, SendsMappedFile) {
+  const char path[] = "./download_test.nc";
+  DownloadStats stats;
+  FILE *fp = fopen(path, "wb");
+  ASSERT_NE(fp, nullptr);
+  fwrite(program.data(), 1, program.size(), fp);
+  fclose(fp);
+
+  int ret = download_file(1, 0, "//CNC_MEM/USER/PATH1/", path, NULL, &stats);
+  remove(path);
+
+  ASSERT_EQ(ret, 0);
+  EXPECT_EQ(received, program);
+  EXPECT_EQ(stats.bytes, program.size());
+}
+
+TEST_F(Download, EndsAfterError) {
+  short codes[] = {EW_OK, 5};
+  cnc_download4_fake.custom_fake = NULL;
+  SET_RETURN_SEQ(cnc_download4, codes, 2);
+
+  EXPECT_NE(download_buffer(1, 0, "//CNC_MEM/USER/PATH1/", program.data(),
+                            program.size(), NULL, NULL), 0);
+  EXPECT_EQ(cnc_dwnend4_fake.call_count, 1u);
+}
+
+TEST_F(Download, MissingFileFails) {
+  EXPECT_NE(download_file(1, 0, "//CNC_MEM/USER/PATH1/", "./missing.nc", NULL,
+                          NULL), 0);
+  EXPECT_EQ(cnc_dwnstart4_fake.call_count, 0u);
+}
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+extern "C" {
+  #include "../src/broker.h"
+  #include "../src/download.h"
+  #include "../src/fault.h"
+  #include "../src/fwsim.h"
+  #include "../src/upload.h"
+}
+
+// no fakes here, the simulator is the library
+#include "fwlib32.h"
+#include "gtest/gtest.h"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* codes of `calls` fault_check calls of `function` */
+static int count(FaultPlan *p, const char *function, int calls, short code) {
+  int n = 0;
+  long wait;
+
+  for (int i = 0; i < calls; i++) n += fault_check(p, function, &wait) == code;
+  return n;
+}
+
+TEST(FaultPlan, Parses) {
+  const char *valid[] = {"",
+                         "socket",
+                         "busy:0.5",
+                         "handle@cnc_statinfo:every=3",
+                         "reset@cnc_rd*",
+                         "buffer@cnc_upload4:1,timeout=50:0.01",
+                         "slow=200:0.1,socket:60s/10s",
+                         "socket:2/1"};
+  const char *invalid[] = {"sock",        "busy:1.5",      "busy:-1",
+                           "busy=10",     "slow=x",        "socket:every=0",
+                           "socket:1s/2s", "socket@",       "socket:",
+                           "socket,,busy", "timeout=-1"};
+
+  for (const char *s : valid) {
+    FaultPlan *p = fault_parse(s, 1);
+    EXPECT_NE(p, nullptr) << s;
+    fault_free(p);
+  }
+  for (const char *s : invalid) EXPECT_EQ(fault_parse(s, 1), nullptr) << s;
+}
+
+TEST(FaultPlan, InjectsAtRates) {
+  FaultPlan *p = fault_parse("busy:0.25", 7);
+  FaultPlan *same = fault_parse("busy:0.25", 7);
+  ASSERT_NE(p, nullptr);
+  ASSERT_NE(same, nullptr);
+
+  int n = count(p, "cnc_statinfo", 10000, EW_BUSY);
+  EXPECT_NEAR(n, 2500, 200);
+  EXPECT_EQ(count(same, "cnc_statinfo", 10000, EW_BUSY), n) << "seeded";
+
+  FaultStats s;
+  fault_stats(p, &s);
+  EXPECT_EQ(s.calls, 10000u);
+  EXPECT_EQ(s.injected[FAULT_BUSY], (unsigned long)n);
+  fault_free(p);
+  fault_free(same);
+}
+
+TEST(FaultPlan, MatchesFunctionsAndSchedules) {
+  FaultPlan *p = fault_parse("handle@cnc_statinfo:every=4,reset@pmc_*", 1);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(count(p, "cnc_statinfo", 100, EW_HANDLE), 25);
+  EXPECT_EQ(count(p, "cnc_statinfo2", 100, EW_OK), 100);
+  EXPECT_EQ(count(p, "pmc_rdpmcrng", 10, EW_RESET), 10);
+  EXPECT_EQ(count(p, "cnc_rdpmcrng", 10, EW_OK), 10);
+  fault_free(p);
+}
+
+TEST(FaultPlan, WaitsAddUp) {
+  FaultPlan *p =
+      fault_parse("slow=20,slow=5@cnc_rd*,timeout=100@cnc_rdparam", 1);
+  long wait;
+  ASSERT_NE(p, nullptr);
+
+  EXPECT_EQ(fault_check(p, "cnc_statinfo", &wait), EW_OK);
+  EXPECT_EQ(wait, 20000);
+  EXPECT_EQ(fault_check(p, "cnc_rdspeed", &wait), EW_OK);
+  EXPECT_EQ(wait, 25000);
+  EXPECT_EQ(fault_check(p, "cnc_rdparam", &wait), EW_SOCKET);
+  EXPECT_EQ(wait, 125000);
+
+  double t = now();
+  EXPECT_EQ(fault_apply(p, "cnc_statinfo"), EW_OK);
+  EXPECT_GE(now() - t, 0.02);
+  fault_free(p);
+}
+
+TEST(FaultPlan, OutagesEndEveryPeriod) {
+  FaultPlan *p = fault_parse("socket:1s/0.5s", 1);
+  long wait;
+  ASSERT_NE(p, nullptr);
+
+  EXPECT_EQ(fault_check(p, "cnc_statinfo", &wait), EW_OK);
+  usleep(750000);
+  EXPECT_EQ(fault_check(p, "cnc_statinfo", &wait), EW_SOCKET);
+  fault_free(p);
+}
+
+/* the simulator as the library, without latency */
+class Faults : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fwsim_reset();
+    configure(NULL);
+    snprintf(path, sizeof(path), "/tmp/fwfault-test-%d.sock", (int)getpid());
+  }
+  void TearDown() override {
+    if (b) {
+      broker_stop(b);
+      loop.join();
+      broker_destroy(b);
+    }
+    configure(NULL);
+  }
+
+  void configure(const char *faults) {
+    FwsimOptions o = default_fwsim_options;
+    for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = 0;
+    o.jitter_us = 0;
+    o.faults = faults;
+    ASSERT_EQ(fwsim_configure(&o), 0);
+  }
+
+  void start(const BrokerOptions *opts) {
+    b = broker_create(path, opts);
+    ASSERT_NE(b, nullptr);
+    loop = std::thread([this] { broker_run(b, -1); });
+  }
+
+  /* reads through the broker, returns how many succeeded */
+  int read_status(int n) {
+    BrokerClient *c = broker_connect(path, "10.0.0.1", 8193);
+    ODBST st;
+    int ok = 0;
+
+    if (c == NULL) return -1;
+    for (int i = 0; i < n; i++) ok += broker_read_status(c, &st) == EW_OK;
+    broker_close(c);
+    return ok;
+  }
+
+  char path[64];
+  Broker *b = nullptr;
+  std::thread loop;
+};
+
+static int collect(const char *buf, size_t len, void *ctx) {
+  ((std::string *)ctx)->append(buf, len);
+  return 0;
+}
+
+TEST_F(Faults, SimulatorInjectsThePlan) {
+  unsigned short h;
+  ODBST st;
+  FwsimStats s;
+
+  configure("handle@cnc_statinfo:every=2");
+  ASSERT_EQ(cnc_allclibhndl3("10.0.0.1", 8193, 10, &h), EW_OK);
+  for (int i = 0; i < 10; i++)
+    EXPECT_EQ(cnc_statinfo(h, &st), i % 2 ? EW_HANDLE : EW_OK);
+  fwsim_stats(&s);
+  EXPECT_EQ(s.faults.injected[FAULT_HANDLE], 5u);
+  cnc_freelibhndl(h);
+
+  FwsimOptions o = default_fwsim_options;
+  o.faults = "nonsense";
+  EXPECT_EQ(fwsim_configure(&o), 1);
+}
+
+TEST_F(Faults, TransfersRideOutBufferFaults) {
+  std::string program = "%\nO2000\n";
+  for (int i = 0; i < 5000; i++) program += "G01 X1.000 Y2.000 F100.\n";
+  program += "M30\n%";
+  std::string back;
+  DownloadOptions dopts = default_download_options;
+  UploadOptions uopts = default_upload_options;
+  DownloadStats ds;
+  UploadStats us;
+  unsigned short h;
+
+  configure("buffer@cnc_download4:0.3,buffer@cnc_upload4:0.3");
+  ASSERT_EQ(cnc_allclibhndl3("10.0.0.1", 8193, 10, &h), EW_OK);
+  dopts.chunk = 1024;
+  double t = now();
+  ASSERT_EQ(download_buffer(h, 0, "//CNC_MEM/USER/PATH1/", program.data(),
+                            program.size(), &dopts, &ds),
+            0);
+  EXPECT_GT(ds.retries, 0u);
+  uopts.min_chunk = uopts.max_chunk = 1024;
+  ASSERT_EQ(upload_stream(h, 0, "//CNC_MEM/USER/PATH1/O2000", collect, &back,
+                          &uopts, &us),
+            0);
+  EXPECT_GT(us.retries, 0u);
+  EXPECT_EQ(back, program);
+  // the backoff starts over after every accepted chunk
+  EXPECT_LT(now() - t, 2.0);
+  cnc_freelibhndl(h);
+}
+
+TEST_F(Faults, BrokerReconnectsOnlyForLostHandles) {
+  BrokerOptions opts = default_broker_options;
+  FwsimStats s;
+
+  for (int i = 0; i < BROKER_OPS; i++) opts.stale_ms[i] = 0;
+  configure("socket@cnc_statinfo:0.1,busy@cnc_statinfo:0.1,slow=1:0.2");
+  start(&opts);
+  int ok = read_status(500);
+
+  fwsim_stats(&s);
+  // every request fails with the fault of its call, and only with that
+  EXPECT_EQ(ok, 500 - (int)(s.faults.injected[FAULT_SOCKET] +
+                            s.faults.injected[FAULT_BUSY]));
+  // a new handle per socket error, none for the busy ones
+  unsigned long reconnects = s.faults.injected[FAULT_SOCKET];
+  EXPECT_LE(s.calls[FWSIM_CONNECT], 2 * reconnects + 2);
+  EXPECT_EQ(s.calls[FWSIM_STATUS], 500u) << "no retries of its own";
+}
+
+TEST_F(Faults, BrokerBacksOffFromADeadMachine) {
+  BrokerOptions opts = default_broker_options;
+  FwsimStats s;
+
+  for (int i = 0; i < BROKER_OPS; i++) opts.stale_ms[i] = 0;
+  // long enough that the requests below are all made within the wait
+  opts.retry_ms = 500;
+  configure("timeout=10@cnc_allclibhndl3");
+  start(&opts);
+  EXPECT_EQ(read_status(100), 0);
+  fwsim_stats(&s);
+  EXPECT_EQ(s.faults.injected[FAULT_TIMEOUT], 2u)
+      << "tried twice, the others fail fast while it is down";
+
+  // back up, found again once the wait is over
+  configure(NULL);
+  EXPECT_EQ(read_status(1), 0);
+  usleep(550000);
+  EXPECT_EQ(read_status(10), 10);
+}
+
+TEST_F(Faults, BrokerKeepsUpWithAFlakyMachine) {
+  BrokerOptions opts = default_broker_options;
+  FwsimStats s;
+
+  for (int i = 0; i < BROKER_OPS; i++) opts.stale_ms[i] = 0;
+  opts.retry_ms = 10;
+  configure(
+      "busy:0.02,reset@cnc_statinfo:0.02,handle@cnc_statinfo:0.02,"
+      "timeout=20@cnc_statinfo:0.02,socket@cnc_allclibhndl3:0.1,slow=2:0.1");
+  start(&opts);
+  double t = now();
+  int ok = read_status(300);
+  EXPECT_GT(ok, 240);
+  // 300 calls of 0.2 ms on average plus 6 timeouts and the reconnects
+  EXPECT_LT(now() - t, 2.0);
+
+  // at most one status read per request and a handle per lost one
+  fwsim_stats(&s);
+  EXPECT_LE(s.calls[FWSIM_STATUS], 300u);
+  EXPECT_LE(s.calls[FWSIM_CONNECT],
+            3 * (s.faults.injected[FAULT_HANDLE] +
+                 s.faults.injected[FAULT_TIMEOUT]) + 3);
+}
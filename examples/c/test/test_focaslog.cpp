@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/focaslog.h"
+  #include "../src/focasreplay.h"
+}
+
+#include "fwlib32.h"
+#include "gtest/gtest.h"
+
+class FocasLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    snprintf(path, sizeof(path), "/tmp/focaslog-test-%d.fwlog", (int)getpid());
+  }
+  void TearDown() override { unlink(path); }
+
+  /* cnc_statinfo(handle, &st) that read `run` */
+  void statinfo(FocasLog *log, unsigned short h, short run, short rc,
+                unsigned long long duration_ns) {
+    ODBST st;
+    FocasLogCall c = {"cnc_statinfo", h, rc, 7, 0, duration_ns, 2, NULL};
+    memset(&st, 0, sizeof(st));
+    st.run = run;
+    FocasLogArg args[] = {{FOCASLOG_VALUE, sizeof(h), &h},
+                          {FOCASLOG_OUT, sizeof(st), &st}};
+    ASSERT_EQ(focaslog_write(log, 3, &c, args), 0);
+  }
+
+  /* pmc_rdpmcrng(handle, .., start, end, length, &buf) that read `value` */
+  void rdpmcrng(FocasLog *log, unsigned short h, unsigned short start,
+                char value) {
+    short adr = 5, type = 0;
+    unsigned short end = start, length = 9;
+    IODBPMC buf;
+    FocasLogCall c = {"pmc_rdpmcrng", h, EW_OK, 7, 0, 0, 7, NULL};
+    memset(&buf, 0, sizeof(buf));
+    buf.u.cdata[0] = value;
+    FocasLogArg args[] = {
+        {FOCASLOG_VALUE, sizeof(h), &h},         {FOCASLOG_VALUE, sizeof(adr), &adr},
+        {FOCASLOG_VALUE, sizeof(type), &type},   {FOCASLOG_VALUE, sizeof(start), &start},
+        {FOCASLOG_VALUE, sizeof(end), &end},     {FOCASLOG_VALUE, sizeof(length), &length},
+        {FOCASLOG_OUT, length, &buf}};
+    ASSERT_EQ(focaslog_write(log, 9, &c, args), 0);
+  }
+
+  char path[64];
+};
+
+TEST_F(FocasLogTest, ReadsWhatWasWritten) {
+  FocasLog *log = focaslog_create(path);
+  ASSERT_NE(log, nullptr);
+  statinfo(log, 1, 3, EW_OK, 1500);
+  statinfo(log, 2, 0, EW_SOCKET, 2500);
+  focaslog_close(log);
+
+  ASSERT_NE(log = focaslog_open(path), nullptr);
+  EXPECT_EQ(focaslog_pid(log), (int)getpid());
+  EXPECT_GT(focaslog_started(log), 0);
+  int n;
+  const FocasLogCall *calls = focaslog_calls(log, &n);
+  ASSERT_EQ(n, 2);
+  EXPECT_STREQ(calls[0].function, "cnc_statinfo");
+  EXPECT_STREQ(calls[1].function, "cnc_statinfo");
+  EXPECT_EQ(calls[1].handle, 2);
+  EXPECT_EQ(calls[1].rc, EW_SOCKET);
+  EXPECT_EQ(calls[1].thread, 7u);
+  EXPECT_EQ(calls[1].duration_ns, 2500u);
+
+  FocasLogArg arg;
+  ASSERT_EQ(focaslog_arg(&calls[0], 1, &arg), 0);
+  EXPECT_EQ(arg.kind, FOCASLOG_OUT);
+  ASSERT_EQ(arg.size, sizeof(ODBST));
+  EXPECT_EQ(((const ODBST *)arg.data)->run, 3);
+  EXPECT_NE(focaslog_arg(&calls[0], 2, &arg), 0);
+  focaslog_close(log);
+}
+
+TEST_F(FocasLogTest, StopsAtACutRecord) {
+  FocasLog *log = focaslog_create(path);
+  ASSERT_NE(log, nullptr);
+  statinfo(log, 1, 3, EW_OK, 0);
+  statinfo(log, 1, 3, EW_OK, 0);
+  focaslog_close(log);
+
+  FILE *f = fopen(path, "rb");
+  ASSERT_NE(f, nullptr);
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  ASSERT_EQ(truncate(path, size - 3), 0);
+
+  ASSERT_NE(log = focaslog_open(path), nullptr);
+  int n;
+  focaslog_calls(log, &n);
+  EXPECT_EQ(n, 1);
+  focaslog_close(log);
+}
+
+TEST_F(FocasLogTest, ReplaysInRecordedOrder) {
+  FocasLog *log = focaslog_create(path);
+  ASSERT_NE(log, nullptr);
+  statinfo(log, 1, 1, EW_OK, 0);
+  statinfo(log, 1, 2, EW_OK, 0);
+  statinfo(log, 2, 3, EW_SOCKET, 0);
+  focaslog_close(log);
+
+  Replay *r = replay_open(path, 0);
+  ASSERT_NE(r, nullptr);
+  unsigned short h = 1;
+  ODBST st;
+  FocasLogArg args[] = {{FOCASLOG_VALUE, sizeof(h), &h},
+                        {FOCASLOG_OUT, sizeof(st), &st}};
+  for (short want : {1, 2, 1}) {
+    memset(&st, 0, sizeof(st));
+    EXPECT_EQ(replay_serve(r, "cnc_statinfo", h, args, 2), EW_OK);
+    EXPECT_EQ(st.run, want);
+  }
+  h = 2;
+  EXPECT_EQ(replay_serve(r, "cnc_statinfo", h, args, 2), EW_SOCKET);
+  EXPECT_EQ(replay_serve(r, "cnc_rddynamic2", h, args, 2), EW_FUNC);
+  h = 3;
+  EXPECT_EQ(replay_serve(r, "cnc_statinfo", h, args, 2), EW_FUNC);
+  replay_close(r);
+}
+
+TEST_F(FocasLogTest, MatchesArgumentsByValue) {
+  FocasLog *log = focaslog_create(path);
+  ASSERT_NE(log, nullptr);
+  rdpmcrng(log, 1, 100, 'a');
+  rdpmcrng(log, 1, 200, 'b');
+  focaslog_close(log);
+
+  Replay *r = replay_open(path, 0);
+  ASSERT_NE(r, nullptr);
+  unsigned short h = 1, start = 200, end = 200, length = 9;
+  short adr = 5, type = 0;
+  IODBPMC buf;
+  FocasLogArg args[] = {
+      {FOCASLOG_VALUE, sizeof(h), &h},         {FOCASLOG_VALUE, sizeof(adr), &adr},
+      {FOCASLOG_VALUE, sizeof(type), &type},   {FOCASLOG_VALUE, sizeof(start), &start},
+      {FOCASLOG_VALUE, sizeof(end), &end},     {FOCASLOG_VALUE, sizeof(length), &length},
+      {FOCASLOG_OUT, length, &buf}};
+  for (int i = 0; i < 2; i++) {
+    memset(&buf, 0, sizeof(buf));
+    EXPECT_EQ(replay_serve(r, "pmc_rdpmcrng", h, args, 7), EW_OK);
+    EXPECT_EQ(buf.u.cdata[0], 'b') << "the call with the same range";
+  }
+
+  // a range that was not recorded gets the next call of the function
+  start = end = 300;
+  memset(&buf, 0, sizeof(buf));
+  EXPECT_EQ(replay_serve(r, "pmc_rdpmcrng", h, args, 7), EW_OK);
+  EXPECT_EQ(buf.u.cdata[0], 'a');
+
+  // no more than the caller has room for
+  args[6].size = 8;
+  buf.u.cdata[0] = 'x';
+  EXPECT_EQ(replay_serve(r, "pmc_rdpmcrng", h, args, 7), EW_OK);
+  EXPECT_EQ(buf.u.cdata[0], 'x');
+  replay_close(r);
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/focastrace.h"
+}
+
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_SOCKET (-16)
+#define EW_NUMBER 3
+
+class FocasTraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    snprintf(name, sizeof(name), "/focastrace-test-%d", (int)getpid());
+    t = trace_create(name, 8, "test");
+    ASSERT_NE(t, nullptr);
+  }
+  void TearDown() override {
+    trace_close(t);
+    shm_unlink(name);
+  }
+
+  const TraceStats *find(const char *function, unsigned short handle) {
+    n = trace_read(t, stats, 8);
+    for (int i = 0; i < n; i++) {
+      if (strcmp(stats[i].function, function) == 0 &&
+          stats[i].handle == handle)
+        return &stats[i];
+    }
+    return nullptr;
+  }
+
+  char name[64];
+  TraceRegion *t;
+  TraceStats stats[8];
+  int n = 0;
+};
+
+TEST_F(FocasTraceTest, CountsPerFunctionAndHandle) {
+  trace_record(t, 3, "cnc_statinfo", 1, EW_OK, 500, 32);
+  trace_record(t, 3, "cnc_statinfo", 1, EW_OK, 3000, 32);
+  trace_record(t, 3, "cnc_statinfo", 2, EW_SOCKET, 20000, 0);
+  trace_record(t, 7, "pmc_rdpmcrng", 1, EW_NUMBER, 1500, 64);
+
+  const TraceStats *s = find("cnc_statinfo", 1);
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(n, 3);
+  EXPECT_EQ(s->calls, 2u);
+  EXPECT_EQ(s->errors, 0u);
+  EXPECT_EQ(s->total_ns, 3500u);
+  EXPECT_EQ(s->max_ns, 3000u);
+  EXPECT_EQ(s->bytes, 64u);
+  EXPECT_EQ(s->hist[hist_bucket(500)], 1u);
+  EXPECT_EQ(s->hist[hist_bucket(3000)], 1u);
+  EXPECT_NE(hist_bucket(500), hist_bucket(3000));
+  EXPECT_EQ(s->codes[EW_OK - TRACE_MIN_CODE], 2u);
+
+  s = find("cnc_statinfo", 2);
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->errors, 1u);
+  EXPECT_EQ(s->codes[EW_SOCKET - TRACE_MIN_CODE], 1u);
+  EXPECT_EQ(trace_code(EW_SOCKET - TRACE_MIN_CODE), EW_SOCKET);
+
+  s = find("pmc_rdpmcrng", 1);
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->codes[EW_NUMBER - TRACE_MIN_CODE], 1u);
+  EXPECT_EQ(find("pmc_rdpmcrng", 2), nullptr);
+}
+
+TEST_F(FocasTraceTest, UnknownCodesAndFullTable) {
+  trace_record(t, 0, "cnc_rdcncid", 1, 1000, 10, 0);
+  const TraceStats *s = find("cnc_rdcncid", 1);
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->codes[TRACE_CODES - 1], 1u);
+
+  // eight slots, the ninth pair is dropped
+  for (int h = 2; h <= 9; h++) trace_record(t, 0, "cnc_rdcncid", h, 0, 10, 0);
+  EXPECT_EQ(trace_read(t, stats, 8), 8);
+  EXPECT_EQ(trace_dropped(t), 1u);
+  // known pairs still count
+  trace_record(t, 0, "cnc_rdcncid", 1, EW_OK, 10, 0);
+  EXPECT_EQ(find("cnc_rdcncid", 1)->calls, 2u);
+}
+
+TEST_F(FocasTraceTest, QuantilesFromTheHistogram) {
+  TraceStats s;
+
+  memset(&s, 0, sizeof(s));
+  EXPECT_EQ(trace_quantile(&s, 0.99), 0);
+  for (int i = 0; i < 99; i++) trace_record(t, 1, "cnc_rddynamic2", 1, 0, 100000, 0);
+  trace_record(t, 1, "cnc_rddynamic2", 1, 0, 5000000, 0);
+  s = *find("cnc_rddynamic2", 1);
+  // the buckets of callstats.h, within 1/16
+  EXPECT_NEAR(trace_quantile(&s, 0.5), 100, 100 / 16.0);
+  EXPECT_NEAR(trace_quantile(&s, 0.99), 100, 100 / 16.0);
+  EXPECT_EQ(trace_quantile(&s, 1.0), 5000) << "the slowest call bounds it";
+}
+
+TEST_F(FocasTraceTest, ReadFromAnotherProcess) {
+  trace_record(t, 5, "cnc_rdposition", 4, EW_OK, 2000, 0);
+
+  pid_t child = fork();
+  if (child == 0) {
+    TraceRegion *r = trace_open(name);
+    TraceStats s[8];
+    int good = r && trace_read(r, s, 8) == 1 && s[0].handle == 4 &&
+               s[0].calls == 1 && strcmp(s[0].function, "cnc_rdposition") == 0 &&
+               trace_pid(r) == (int)getppid() &&
+               strcmp(trace_process(r), "test") == 0 && trace_started(r) > 0;
+    _exit(good ? 0 : 1);
+  }
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  EXPECT_EQ(trace_open("/focastrace-test-missing"), nullptr);
+}
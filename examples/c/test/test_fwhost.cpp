@@ -0,0 +1,224 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include "../src/fwabi.h"
+  #include "../src/fwhost.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_NUMBER 3
+
+/* same layout as ODBST of fwlib32.h */
+struct odbst {
+  short hdck, tmmode, aut, run, motion, mstb, emergency, alarm, edit;
+};
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_allclibhndl3, const char *, unsigned short, long,
+                unsigned short *);
+FAKE_VALUE_FUNC(short, cnc_freelibhndl, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_rdcncid, unsigned short, unsigned long *);
+FAKE_VALUE_FUNC(short, cnc_rdposition, unsigned short, short, short *, void *);
+FAKE_VALUE_FUNC(short, cnc_rdspeed, unsigned short, short, void *);
+FAKE_VALUE_FUNC(short, cnc_rddynamic2, unsigned short, short, short, void *);
+FAKE_VALUE_FUNC(short, pmc_rdpmcrng, unsigned short, short, short,
+                unsigned short, unsigned short, unsigned short, void *);
+FAKE_VALUE_FUNC(short, cnc_rdprgnum, unsigned short, void *);
+FAKE_VALUE_FUNC(short, pmc_wrpmcrng, unsigned short, short, void *);
+
+static short open_handle(const char *host, unsigned short port, long timeout,
+                         unsigned short *libh) {
+  *libh = strcmp(host, "10.0.0.1") == 0 && port == 8193 ? 7 : 0;
+  return EW_OK;
+}
+
+/* the workers call it at the same time, which the call history of an fff
+ * fake does not survive, so it is a stub of its own */
+static std::atomic<int> statinfos;
+
+extern "C" short cnc_statinfo(unsigned short h, void *buf) {
+  struct odbst *st = (struct odbst *)buf;
+  st->tmmode = 1;
+  st->aut = h;
+  st->alarm = 2;
+  st->edit = 3;
+  statinfos++;
+  return EW_OK;
+}
+
+static short read_dynamic(unsigned short h, short axis, short len, void *buf) {
+  // the library fills 32 bit longs, also in a 64 bit process
+  Fw32Dy2 *dy = (Fw32Dy2 *)buf;
+  dy->axis = axis;
+  dy->prgnum = 1234;
+  dy->acts = -5000;
+  if (axis == -1) {
+    for (int i = 0; i < FW32_MAX_AXIS; i++) dy->pos.faxis.distance[i] = i * 10;
+  } else {
+    dy->pos.oaxis.machine = 42;
+  }
+  return EW_OK;
+}
+
+static short read_id(unsigned short h, unsigned long *ids) {
+  uint32_t words[4] = {0x11111111, 0x22222222, 0x33333333, 0x44444444};
+  memcpy(ids, words, sizeof(words));
+  return EW_OK;
+}
+
+static short read_pmc(unsigned short h, short adr, short type,
+                      unsigned short s, unsigned short e, unsigned short len,
+                      void *buf) {
+  for (unsigned short i = 8; i < len; i++) ((unsigned char *)buf)[i] = i;
+  return EW_OK;
+}
+
+static short crash(unsigned short h, short adr, short type, unsigned short s,
+                   unsigned short e, unsigned short len, void *buf) {
+  abort();
+}
+
+class FwhostTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_allclibhndl3);
+    RESET_FAKE(cnc_rdcncid);
+    RESET_FAKE(cnc_rddynamic2);
+    RESET_FAKE(pmc_rdpmcrng);
+    RESET_FAKE(pmc_wrpmcrng);
+    cnc_allclibhndl3_fake.custom_fake = open_handle;
+    cnc_rdcncid_fake.custom_fake = read_id;
+    cnc_rddynamic2_fake.custom_fake = read_dynamic;
+    pmc_rdpmcrng_fake.custom_fake = read_pmc;
+    statinfos = 0;
+    snprintf(name, sizeof(name), "/fwhost-test-%d", (int)getpid());
+  }
+  void TearDown() override {
+    if (h) {
+      fwhost_stop(h);
+      serving.join();
+      fwhost_destroy(h);
+    }
+  }
+  void start(int slots, int workers) {
+    h = fwhost_create(name, slots);
+    ASSERT_NE(h, nullptr);
+    serving = std::thread([this, workers] { fwhost_serve(h, workers); });
+  }
+
+  char name[64];
+  FwHost *h = nullptr;
+  std::thread serving;
+};
+
+TEST_F(FwhostTest, MarshalsFixedWidthResults) {
+  unsigned short libh = 0;
+  FwStatus st;
+  FwDynamic dy;
+  FwPmc pmc;
+
+  start(2, 1);
+  FwClient *c = fwclient_open(name);
+  ASSERT_NE(c, nullptr);
+  ASSERT_EQ(fw_allclibhndl3(c, "10.0.0.1", 8193, 10, &libh), EW_OK);
+  EXPECT_EQ(libh, 7);
+
+  uint32_t ids[4];
+  ASSERT_EQ(fw_rdcncid(c, libh, ids), EW_OK);
+  EXPECT_EQ(ids[0], 0x11111111u);
+  EXPECT_EQ(ids[3], 0x44444444u);
+
+  ASSERT_EQ(fw_statinfo(c, libh, &st), EW_OK);
+  EXPECT_EQ(st.tmmode, 1);
+  EXPECT_EQ(st.aut, 7);
+  EXPECT_EQ(st.alarm, 2);
+  EXPECT_EQ(st.edit, 3);
+
+  ASSERT_EQ(fw_rddynamic2(c, libh, -1, &dy), EW_OK);
+  EXPECT_EQ(cnc_rddynamic2_fake.arg2_val, (short)sizeof(Fw32Dy2));
+  EXPECT_EQ(dy.prgnum, 1234);
+  EXPECT_EQ(dy.acts, -5000);
+  EXPECT_EQ(dy.distance[31], 310);
+  ASSERT_EQ(fw_rddynamic2(c, libh, 2, &dy), EW_OK);
+  EXPECT_EQ(cnc_rddynamic2_fake.arg2_val,
+            (short)(offsetof(Fw32Dy2, pos) + 4 * sizeof(int32_t)));
+  EXPECT_EQ(dy.axis, 2);
+  EXPECT_EQ(dy.machine[0], 42);
+
+  // byte addresses, D10 .. D19 are five words
+  ASSERT_EQ(fw_rdpmcrng(c, libh, 0, 1, 10, 19, &pmc), EW_OK);
+  EXPECT_EQ(pmc_rdpmcrng_fake.arg5_val, 8 + 10);
+  EXPECT_EQ(pmc.data[0], 8);
+  EXPECT_EQ(pmc.data[9], 17);
+  pmc.data_type = 2;
+  pmc.start = 4;
+  pmc.end = 7;
+  ASSERT_EQ(fw_wrpmcrng(c, libh, &pmc), EW_OK);
+  EXPECT_EQ(pmc_wrpmcrng_fake.arg1_val, 12);
+
+  short num = 0;
+  FwPosition pos[1];
+  EXPECT_EQ(fw_rdposition(c, libh, -1, &num, pos), EW_NUMBER);
+  fwclient_close(c);
+}
+
+TEST_F(FwhostTest, SharesSlotsBetweenCallers) {
+  std::vector<std::thread> callers;
+  std::atomic<int> failed(0);
+
+  start(2, 2);
+  for (int t = 0; t < 6; t++) {
+    callers.emplace_back([&, t] {
+      FwClient *c = fwclient_open(name);
+      FwStatus st;
+      for (int i = 0; c && i < 200; i++) {
+        if (fw_statinfo(c, t, &st) != EW_OK || st.aut != t) failed++;
+      }
+      if (!c) failed++;
+      fwclient_close(c);
+    });
+  }
+  for (auto &t : callers) t.join();
+  EXPECT_EQ(failed.load(), 0);
+  EXPECT_EQ(statinfos.load(), 1200);
+}
+
+TEST_F(FwhostTest, LibraryCrashStaysInTheHost) {
+  FwClient *c = NULL;
+  FwPmc pmc;
+  FwStatus st;
+  int status;
+
+  pmc_rdpmcrng_fake.custom_fake = crash;
+  pid_t child = fork();
+  if (child == 0) {
+    FwHost *host = fwhost_create(name, 2);
+    if (host) fwhost_serve(host, 1);
+    _exit(1);
+  }
+  for (int i = 0; i < 200 && c == NULL; i++) {
+    usleep(5000);
+    c = fwclient_open(name);
+  }
+  ASSERT_NE(c, nullptr);
+  ASSERT_EQ(fw_statinfo(c, 1, &st), EW_OK);
+  EXPECT_EQ(fw_rdpmcrng(c, 1, 0, 0, 0, 3, &pmc), FWHOST_GONE);
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFSIGNALED(status));
+  EXPECT_EQ(fw_statinfo(c, 1, &st), FWHOST_GONE);
+  fwclient_close(c);
+  shm_unlink(name);
+}
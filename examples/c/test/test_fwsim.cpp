@@ -0,0 +1,272 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/fwabi.h"
+  #include "../src/fwsim.h"
+}
+
+// no fakes here, the simulator is the library
+#include "fwlib32.h"
+#include "gtest/gtest.h"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class FwsimTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    FwsimOptions o = default_fwsim_options;
+    for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = 0;
+    o.jitter_us = 0;
+    fwsim_configure(&o);
+    fwsim_reset();
+    ASSERT_EQ(cnc_allclibhndl3("10.0.0.1", 8193, 10, &h), EW_OK);
+  }
+  void TearDown() override { cnc_freelibhndl(h); }
+
+  unsigned short h;
+};
+
+TEST_F(FwsimTest, MachineRunsAProgram) {
+  ODBST st;
+  Fw32Dy2 dy;
+  ODBPRO prog;
+  uint32_t id[4], other[4];
+  unsigned short h2;
+
+  ASSERT_EQ(cnc_statinfo(h, &st), EW_OK);
+  EXPECT_EQ(st.aut, 1);
+  EXPECT_EQ(st.run, 3);
+  EXPECT_EQ(st.alarm, 0);
+  ASSERT_EQ(cnc_rdprgnum(h, &prog), EW_OK);
+  EXPECT_EQ(prog.mdata, 1000);
+
+  // the 32 bit layout of the library, also in a 64 bit build
+  ASSERT_EQ(cnc_rddynamic2(h, -1, sizeof(dy), (ODBDY2 *)&dy), EW_OK);
+  EXPECT_EQ(dy.prgnum, 1000);
+  EXPECT_EQ(dy.prgmnum, 1000);
+  EXPECT_GT(dy.acts, 7000);
+  EXPECT_EQ(cnc_rddynamic2(h, 4, sizeof(dy), (ODBDY2 *)&dy), EW_ATTRIB);
+  EXPECT_EQ(cnc_rddynamic2(h, -1, 8, (ODBDY2 *)&dy), EW_LENGTH);
+
+  // the same machine for the same ip and port
+  ASSERT_EQ(cnc_rdcncid(h, (unsigned long *)id), EW_OK);
+  ASSERT_EQ(cnc_allclibhndl3("10.0.0.1", 8193, 10, &h2), EW_OK);
+  ASSERT_EQ(cnc_rdcncid(h2, (unsigned long *)other), EW_OK);
+  EXPECT_EQ(memcmp(id, other, sizeof(id)), 0);
+  cnc_freelibhndl(h2);
+  ASSERT_EQ(cnc_allclibhndl3("10.0.0.2", 8193, 10, &h2), EW_OK);
+  ASSERT_EQ(cnc_rdcncid(h2, (unsigned long *)other), EW_OK);
+  EXPECT_NE(memcmp(id, other, sizeof(id)), 0);
+  cnc_freelibhndl(h2);
+  EXPECT_EQ(cnc_statinfo(h2, &st), EW_HANDLE);
+}
+
+TEST_F(FwsimTest, KeepsPmcMacrosAndParameters) {
+  struct {
+    IODBPMC pmc;
+    char more[64];
+  } buf;
+  Fw32Macro macro;
+  Fw32Param param;
+  double values[2] = {1.5, -2.25}, read[3];
+  unsigned long num = 2;
+
+  memset(&buf, 0, sizeof(buf));
+  buf.pmc.type_a = 5;  // R
+  buf.pmc.type_d = 1;  // word
+  buf.pmc.datano_s = 100;  // byte addresses, three words
+  buf.pmc.datano_e = 105;
+  buf.pmc.u.idata[0] = 1;
+  buf.pmc.u.idata[2] = -3;
+  ASSERT_EQ(pmc_wrpmcrng(h, 8 + 3 * 2, &buf.pmc), EW_OK);
+  memset(&buf, 0, sizeof(buf));
+  ASSERT_EQ(pmc_rdpmcrng(h, 5, 1, 100, 105, 8 + 3 * 2, &buf.pmc), EW_OK);
+  EXPECT_EQ(buf.pmc.u.idata[0], 1);
+  EXPECT_EQ(buf.pmc.u.idata[2], -3);
+  EXPECT_EQ(pmc_rdpmcrng(h, 5, 1, 104, 105, 8 + 2, &buf.pmc), EW_OK);
+  EXPECT_EQ(buf.pmc.u.idata[0], -3);
+  EXPECT_EQ(pmc_rdpmcrng(h, 5, 1, 100, 105, 8, &buf.pmc), EW_LENGTH);
+
+  ASSERT_EQ(cnc_wrmacror2(h, 500, &num, values), EW_OK);
+  num = 3;
+  ASSERT_EQ(cnc_rdmacror2(h, 500, &num, read), EW_OK);
+  EXPECT_EQ(read[1], -2.25);
+  EXPECT_EQ(read[2], 0);
+  ASSERT_EQ(cnc_rdmacro(h, 500, sizeof(macro), (ODBM *)&macro), EW_OK);
+  EXPECT_EQ(macro.mcr_val, 1500);
+  EXPECT_EQ(macro.dec_val, 3);
+  ASSERT_EQ(cnc_rdmacro(h, 502, sizeof(macro), (ODBM *)&macro), EW_OK);
+  EXPECT_EQ(macro.dec_val, -1);
+
+  memset(&param, 0, sizeof(param));
+  param.datano = 1320;
+  param.type = -1;
+  for (int i = 0; i < 3; i++) param.u.ldatas[i] = 1000 * (i + 1);
+  ASSERT_EQ(cnc_wrparam(h, 4 + 3 * sizeof(int32_t), (IODBPSD *)&param),
+            EW_OK);
+  memset(&param, 0, sizeof(param));
+  ASSERT_EQ(cnc_rdparam(h, 1320, 2, 4 + sizeof(int32_t), (IODBPSD *)&param),
+            EW_OK);
+  EXPECT_EQ(param.u.ldata, 2000);
+  EXPECT_EQ(cnc_rdparam(h, 1320, 2, 7, (IODBPSD *)&param), EW_LENGTH);
+}
+
+TEST_F(FwsimTest, MacroAlarmStopsTheMachine) {
+  ODBST st;
+  Fw32Almmsg2 msg[4];
+  short num = 4;
+  int32_t alarms;
+
+  ASSERT_EQ(cnc_wrmacro(h, 3000, 10, 12, 0), EW_OK);
+  ASSERT_EQ(cnc_statinfo(h, &st), EW_OK);
+  EXPECT_EQ(st.alarm, 1);
+  EXPECT_EQ(st.run, 0);
+  ASSERT_EQ(cnc_alarm2(h, (long *)&alarms), EW_OK);
+  EXPECT_NE(alarms, 0);
+  ASSERT_EQ(cnc_rdalmmsg2(h, -1, &num, (ODBALMMSG2 *)msg), EW_OK);
+  ASSERT_EQ(num, 1);
+  EXPECT_EQ(msg[0].alm_no, 3012);
+  EXPECT_EQ(std::string(msg[0].alm_msg, msg[0].msg_len), "MACRO ALARM 12");
+
+  ASSERT_EQ(cnc_reset(h), EW_OK);
+  ASSERT_EQ(cnc_statinfo(h, &st), EW_OK);
+  EXPECT_EQ(st.alarm, 0);
+}
+
+TEST_F(FwsimTest, RunsAScript) {
+  FwsimOptions o = default_fwsim_options;
+  char path[64];
+  IODBPMC pmc;
+  Fw32Macro macro;
+  ODBST st;
+  Fw32Almmsg2 msg[4];
+  short num = 4;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/tmp/fwsim-script-%d", (int)getpid());
+  ASSERT_NE(f = fopen(path, "w"), nullptr);
+  fputs("# spindle overheats right away\n"
+        "0 macro 500 1.5\n"
+        "0 pmc 5 10 7\n"
+        "0 alarm 3100 SPINDLE OVERHEAT\n"
+        "1000 reset  # not within the test\n"
+        "repeat 2000\n",
+        f);
+  fclose(f);
+  for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = 0;
+  o.jitter_us = 0;
+  o.script = path;
+  ASSERT_EQ(fwsim_configure(&o), 0);
+
+  ASSERT_EQ(cnc_rdmacro(h, 500, sizeof(macro), (ODBM *)&macro), EW_OK);
+  EXPECT_EQ(macro.mcr_val, 1500);
+  ASSERT_EQ(pmc_rdpmcrng(h, 5, 0, 10, 10, 8 + 1, &pmc), EW_OK);
+  EXPECT_EQ(pmc.u.cdata[0], 7);
+  ASSERT_EQ(cnc_statinfo(h, &st), EW_OK);
+  EXPECT_EQ(st.alarm, 1);
+  ASSERT_EQ(cnc_rdalmmsg2(h, -1, &num, (ODBALMMSG2 *)msg), EW_OK);
+  ASSERT_EQ(num, 1);
+  EXPECT_EQ(msg[0].alm_no, 3100);
+  EXPECT_EQ(std::string(msg[0].alm_msg, msg[0].msg_len), "SPINDLE OVERHEAT");
+
+  // steps out of order or past the repeat are refused
+  f = fopen(path, "w");
+  fputs("5 macro 500 1\n1 macro 500 2\n", f);
+  fclose(f);
+  EXPECT_EQ(fwsim_configure(&o), 1);
+  f = fopen(path, "w");
+  fputs("5 macro 500 1\nrepeat 5\n", f);
+  fclose(f);
+  EXPECT_EQ(fwsim_configure(&o), 1);
+  f = fopen(path, "w");
+  fputs("0 spindle 1\n", f);
+  fclose(f);
+  EXPECT_EQ(fwsim_configure(&o), 1);
+  unlink(path);
+}
+
+TEST_F(FwsimTest, DownloadsAndUploadsPrograms) {
+  const char text[] = "%\nO1234(BRACKET)\nG0X0.\nM30\n%";
+  char buf[16];
+  std::string got;
+  Fw32Prgdir3 dir[4];
+  long top = 0, len;
+  short num = 4;
+
+  ASSERT_EQ(cnc_dwnstart4(h, 0, (char *)"//CNC_MEM/USER/PATH1/"), EW_OK);
+  for (size_t off = 0; off < sizeof(text) - 1; off += len) {
+    len = sizeof(text) - 1 - off < 10 ? sizeof(text) - 1 - off : 10;
+    ASSERT_EQ(cnc_download4(h, &len, (char *)text + off), EW_OK);
+  }
+  ASSERT_EQ(cnc_dwnend4(h), EW_OK);
+
+  ASSERT_EQ(cnc_rdprogdir3(h, 2, &top, &num, (PRGDIR3 *)dir), EW_OK);
+  ASSERT_EQ(num, 2);
+  EXPECT_EQ(dir[0].number, 1000);
+  EXPECT_EQ(dir[1].number, 1234);
+  EXPECT_EQ(dir[1].length, (int32_t)sizeof(text) - 1);
+  EXPECT_STREQ(dir[1].comment, "(BRACKET)");
+
+  ASSERT_EQ(cnc_upstart4(h, 0, (char *)"//CNC_MEM/USER/PATH1/O1234"), EW_OK);
+  do {
+    len = sizeof(buf);
+    ASSERT_EQ(cnc_upload4(h, &len, buf), EW_OK);
+    got.append(buf, len);
+  } while (len > 0 && !(got.size() > 1 && got.back() == '%'));
+  ASSERT_EQ(cnc_upend4(h), EW_OK);
+  EXPECT_EQ(got, text);
+
+  ASSERT_EQ(cnc_delete(h, 1234), EW_OK);
+  EXPECT_EQ(cnc_upstart4(h, 0, (char *)"O1234"), EW_DATA);
+}
+
+TEST_F(FwsimTest, InjectsLatencyAndErrors) {
+  FwsimOptions o = default_fwsim_options;
+  FwsimStats stats;
+  ODBST st;
+  double t;
+  int failed = 0;
+
+  for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = 0;
+  o.latency_us[FWSIM_STATUS] = 5000;
+  o.jitter_us = 0;
+  o.error_rate[FWSIM_STATUS] = 0.5;
+  o.error = EW_BUSY;
+  fwsim_configure(&o);
+
+  t = now();
+  for (int i = 0; i < 40; i++) {
+    short ret = cnc_statinfo(h, &st);
+    EXPECT_TRUE(ret == EW_OK || ret == EW_BUSY);
+    failed += ret == EW_BUSY;
+  }
+  EXPECT_GE(now() - t, 40 * 0.005);
+  EXPECT_GT(failed, 5);
+  EXPECT_LT(failed, 35);
+  fwsim_stats(&stats);
+  EXPECT_EQ(stats.calls[FWSIM_STATUS], 40u);
+  EXPECT_EQ(stats.errors[FWSIM_STATUS], (unsigned long)failed);
+  EXPECT_EQ(stats.errors[FWSIM_CONNECT], 0u);
+}
+
+TEST(FwsimParse, FamilyValues) {
+  double v[FWSIM_FAMILIES] = {0};
+
+  ASSERT_EQ(fwsim_parse("2000,pmc:500,program:0", v), 0);
+  EXPECT_EQ(v[FWSIM_CONNECT], 2000);
+  EXPECT_EQ(v[FWSIM_PMC], 500);
+  EXPECT_EQ(v[FWSIM_PROGRAM], 0);
+  EXPECT_NE(fwsim_parse("pmc:fast", v), 0);
+  EXPECT_NE(fwsim_parse("spindle:1", v), 0);
+}
@@ -0,0 +1,271 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include "../src/fwsim.h"
+  #include "../src/fwwire.h"
+}
+
+// no fakes here, the simulator is the library
+#include "fwlib32.h"
+#include "gtest/gtest.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+static void put16(Bytes &b, unsigned v) {
+  b.push_back(v >> 8);
+  b.push_back(v);
+}
+
+static void put32(Bytes &b, uint32_t v) {
+  put16(b, v >> 16);
+  put16(b, v);
+}
+
+static unsigned get16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+
+static uint32_t get32(const unsigned char *p) {
+  return (uint32_t)get16(p) << 16 | get16(p + 2);
+}
+
+/* a request block as the library sends it */
+static void block(Bytes &b, unsigned cls, unsigned cmd,
+                  std::vector<int32_t> args, const Bytes &data = Bytes()) {
+  put16(b, 28 + data.size());
+  put16(b, cls);
+  put16(b, 1);
+  put16(b, cmd);
+  args.resize(5);
+  for (int32_t a : args) put32(b, a);
+  b.insert(b.end(), data.begin(), data.end());
+}
+
+class FwwireTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    FwsimOptions o = default_fwsim_options;
+    for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = 0;
+    o.jitter_us = 0;
+    fwsim_configure(&o);
+    fwsim_reset();
+
+    port = 20000 + getpid() % 20000;
+    w = fwwire_create(addrs, 2, port, 1, &default_fwwire_options);
+    ASSERT_NE(w, nullptr);
+    loop = std::thread([this] { fwwire_run(w, -1); });
+  }
+  void TearDown() override {
+    for (int fd : fds) close(fd);
+    if (w) {
+      fwwire_stop(w);
+      loop.join();
+      fwwire_destroy(w);
+    }
+  }
+
+  int dial(const char *host) {
+    struct sockaddr_in sa = {};
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    inet_pton(AF_INET, host, &sa.sin_addr);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+      close(fd);
+      return -1;
+    }
+    fds.push_back(fd);
+    return fd;
+  }
+  /* sends a pdu and returns the body of the answer, empty if it closed */
+  Bytes pdu(int fd, unsigned type, const Bytes &body, unsigned *reply) {
+    Bytes b = {0xa0, 0xa0, 0xa0, 0xa0, 0, 1};
+    unsigned char h[10];
+    size_t got = 0;
+    ssize_t n;
+
+    put16(b, type);
+    put16(b, body.size());
+    b.insert(b.end(), body.begin(), body.end());
+    if (write(fd, b.data(), b.size()) != (ssize_t)b.size()) return Bytes();
+    while (got < sizeof(h) && (n = read(fd, h + got, sizeof(h) - got)) > 0)
+      got += n;
+    if (got < sizeof(h)) return Bytes();
+    *reply = get16(h + 6);
+    b.assign(get16(h + 8), 0);
+    for (got = 0; got < b.size(); got += n)
+      if ((n = read(fd, b.data() + got, b.size() - got)) <= 0) return Bytes();
+    return b;
+  }
+  /* the data connection of a handle to the machine at `host` */
+  int handle(const char *host) {
+    unsigned reply = 0;
+    int fd = dial(host);
+    Bytes body;
+
+    put16(body, 2);
+    if (fd < 0 || pdu(fd, 0x0101, body, &reply).size() < 18) return -1;
+    return reply == 0x0102 ? fd : -1;
+  }
+
+  const char *addrs[2] = {"127.0.0.1", "127.0.0.2"};
+  unsigned short port;
+  Fwwire *w = nullptr;
+  std::thread loop;
+  std::vector<int> fds;
+};
+
+TEST_F(FwwireTest, AnnouncesTheMachine) {
+  unsigned reply = 0;
+  Bytes body, r;
+  int fd;
+
+  // the first connection of a handle gets an empty answer
+  ASSERT_GE(fd = dial("127.0.0.1"), 0);
+  put16(body, 1);
+  r = pdu(fd, 0x0101, body, &reply);
+  EXPECT_EQ(reply, 0x0102u);
+  EXPECT_EQ(r, Bytes(16, 0));
+
+  ASSERT_GE(fd = dial("127.0.0.1"), 0);
+  body.clear();
+  put16(body, 2);
+  r = pdu(fd, 0x0101, body, &reply);
+  ASSERT_EQ(r.size(), 24u);
+  EXPECT_EQ(get16(&r[4]), (unsigned)fwsim_axes());
+  EXPECT_EQ(get16(&r[8]), 1u);  // paths
+  EXPECT_EQ(get16(&r[20]), (unsigned)fwsim_axes());
+
+  r = pdu(fd, 0x0201, Bytes(), &reply);
+  EXPECT_EQ(reply, 0x0202u);
+  EXPECT_TRUE(r.empty());
+}
+
+TEST_F(FwwireTest, AnswersEachBlock) {
+  unsigned reply = 0;
+  FwwireStats stats;
+  Bytes body, r;
+  int fd;
+
+  ASSERT_GE(fd = handle("127.0.0.1"), 0);
+  put16(body, 3);
+  block(body, 1, 0x19, {});
+  block(body, 1, 0x1c, {});
+  block(body, 1, 0x01, {});  // not simulated
+  r = pdu(fd, 0x2101, body, &reply);
+  EXPECT_EQ(reply, 0x2102u);
+  ASSERT_GE(r.size(), 2u);
+  ASSERT_EQ(get16(&r[0]), 3u);
+
+  // statinfo: 7 words, automatic mode 1, running 3
+  const unsigned char *b = &r[2];
+  ASSERT_EQ(get16(b), 16u + 14);
+  EXPECT_EQ(get16(b + 6), 0x19u);
+  EXPECT_EQ(get16(b + 8), (unsigned)EW_OK);
+  EXPECT_EQ(get16(b + 14), 14u);
+  EXPECT_EQ(get16(b + 16), 1u);
+  EXPECT_EQ(get16(b + 18), 3u);
+
+  // the running program and the main program
+  b += get16(b);
+  ASSERT_EQ(get16(b + 14), 8u);
+  EXPECT_EQ(get32(b + 16), 1000u);
+
+  b += get16(b);
+  EXPECT_EQ(get16(b), 16u);
+  EXPECT_EQ(get16(b + 8), (unsigned)EW_FUNC);
+
+  fwwire_stats(w, &stats);
+  EXPECT_EQ(stats.pdus, 1u);
+  EXPECT_EQ(stats.blocks, 3u);
+  EXPECT_EQ(stats.unsupported, 1u);
+}
+
+TEST_F(FwwireTest, MachinePerAddress) {
+  unsigned reply = 0;
+  Bytes body, r1, r2, r3;
+  int fd;
+
+  put16(body, 1);
+  block(body, 1, 0xe8, {});
+  ASSERT_GE(fd = handle("127.0.0.1"), 0);
+  r1 = pdu(fd, 0x2101, body, &reply);
+  ASSERT_GE(fd = handle("127.0.0.1"), 0);
+  r2 = pdu(fd, 0x2101, body, &reply);
+  ASSERT_GE(fd = handle("127.0.0.2"), 0);
+  r3 = pdu(fd, 0x2101, body, &reply);
+  ASSERT_EQ(r1.size(), 2u + 16 + 16);
+  EXPECT_EQ(r1, r2);
+  EXPECT_NE(r1, r3);
+}
+
+TEST_F(FwwireTest, WritesAndReadsThePmc) {
+  unsigned reply = 0;
+  Bytes body, data, r;
+  int fd;
+
+  ASSERT_GE(fd = handle("127.0.0.1"), 0);
+  put16(data, 1);
+  put16(data, 0xfffd);
+  put16(body, 2);
+  // byte addresses, two words
+  block(body, 2, 0x8002, {100, 103, 5, 1, 4}, data);
+  block(body, 2, 0x8001, {100, 103, 5, 1});
+  r = pdu(fd, 0x2101, body, &reply);
+  ASSERT_EQ(get16(&r[0]), 2u);
+  const unsigned char *b = &r[2];
+  EXPECT_EQ(get16(b + 8), (unsigned)EW_OK);
+  b += get16(b);
+  EXPECT_EQ(get16(b + 8), (unsigned)EW_OK);
+  ASSERT_EQ(get16(b + 14), 4u);
+  EXPECT_EQ(Bytes(b + 16, b + 20), data);
+}
+
+TEST_F(FwwireTest, WritesAndReadsMacros) {
+  unsigned reply = 0;
+  Bytes body, data, r;
+  int fd;
+
+  ASSERT_GE(fd = handle("127.0.0.1"), 0);
+  // 1.5 and -2.25, big endian doubles
+  put32(data, 0x3ff80000);
+  put32(data, 0);
+  put32(data, 0xc0020000);
+  put32(data, 0);
+  put16(body, 2);
+  block(body, 1, 0xa8, {500, 2}, data);
+  block(body, 1, 0xa7, {500, 2});
+  r = pdu(fd, 0x2101, body, &reply);
+  ASSERT_EQ(get16(&r[0]), 2u);
+  const unsigned char *b = &r[2];
+  EXPECT_EQ(get16(b + 8), (unsigned)EW_OK);
+  ASSERT_EQ(get16(b + 14), 4u) << "the count written";
+  EXPECT_EQ(get32(b + 16), 2u);
+  b += get16(b);
+  EXPECT_EQ(get16(b + 8), (unsigned)EW_OK);
+  ASSERT_EQ(get16(b + 14), 16u);
+  EXPECT_EQ(Bytes(b + 16, b + 32), data);
+}
+
+TEST_F(FwwireTest, InjectedSocketErrorDrops) {
+  FwsimOptions o = default_fwsim_options;
+  unsigned reply = 0;
+  Bytes body;
+  int fd;
+
+  ASSERT_GE(fd = handle("127.0.0.1"), 0);
+  for (int i = 0; i < FWSIM_FAMILIES; i++) o.latency_us[i] = 0;
+  o.jitter_us = 0;
+  o.error_rate[FWSIM_PMC] = 1;
+  o.error = EW_SOCKET;
+  fwsim_configure(&o);
+  put16(body, 1);
+  block(body, 2, 0x8001, {100, 101, 5, 1});
+  EXPECT_TRUE(pdu(fd, 0x2101, body, &reply).empty());
+}
@@ -0,0 +1,70 @@
+#include <string.h>
+
+extern "C" {
+  #include "../src/fwsim.h"
+  #include "../src/loadgen.h"
+}
+
+// no fakes here, the simulator is the library
+#include "fwlib32.h"
+#include "gtest/gtest.h"
+
+class LoadgenTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (int i = 0; i < FWSIM_FAMILIES; i++) sim.latency_us[i] = 0;
+    sim.jitter_us = 0;
+    fwsim_configure(&sim);
+    fwsim_reset();
+    opts.interval_ms = 50;
+    opts.seconds = 0.5;
+  }
+  void TearDown() override { fwsim_reset(); }
+
+  FwsimOptions sim = default_fwsim_options;
+  LoadOptions opts = default_load_options;
+};
+
+TEST_F(LoadgenTest, KeepsUpWithAFastFleet) {
+  LoadResult r;
+
+  ASSERT_EQ(loadgen_run(20, &opts, &r), 0);
+  EXPECT_EQ(r.connected, 20);
+  EXPECT_DOUBLE_EQ(r.target_rate, 20 * 20.0);
+  // 10 or 11 cycles per machine in half a second
+  EXPECT_GE(r.cycles, 20u * 10);
+  EXPECT_LE(r.cycles, 20u * 11);
+  EXPECT_EQ(r.misses, 0u);
+  EXPECT_EQ(r.errors, 0u);
+  EXPECT_GT(r.bytes_per_handle, 0);
+}
+
+TEST_F(LoadgenTest, SlowControllersMissDeadlines) {
+  LoadResult r;
+
+  // one thread, 8 machines x 4 signals x 5 ms is 160 ms per 50 ms interval
+  for (int i = 0; i < FWSIM_FAMILIES; i++) sim.latency_us[i] = 5000;
+  fwsim_configure(&sim);
+  ASSERT_EQ(loadgen_run(8, &opts, &r), 0);
+  EXPECT_LT(r.cycle_rate, r.target_rate / 2);
+  EXPECT_GT(r.misses, 0u);
+  EXPECT_GT(r.max_late_ms, 50);
+
+  // four pollers share the calls
+  opts.threads = 4;
+  LoadResult more;
+  ASSERT_EQ(loadgen_run(8, &opts, &more), 0);
+  EXPECT_GT(more.cycle_rate, r.cycle_rate * 2);
+}
+
+TEST_F(LoadgenTest, CountsFailedReads) {
+  LoadResult r;
+
+  sim.error_rate[FWSIM_PMC] = 1;
+  sim.error = EW_BUSY;
+  fwsim_configure(&sim);
+  ASSERT_EQ(loadgen_run(4, &opts, &r), 0);
+  EXPECT_EQ(r.connected, 4);
+  // one pmc signal of 4 in every cycle
+  EXPECT_EQ(r.errors, r.cycles);
+}
@@ -0,0 +1,178 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/callstats.h"
+  #include "../src/fwabi.h"
+  #include "../src/metrics.h"
+  #include "../src/state.h"
+}
+
+#include "fwlib32.h"
+#include "gtest/gtest.h"
+
+class MetricsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const size_t sizes[METRICS_SLOTS] = {sizeof(ODBST), sizeof(Fw32Dy2),
+                                         sizeof(Fw32Spload)};
+    const char *names[] = {"lathe-1", "mill \"2\""};
+    state = state_create(2, METRICS_SLOTS, sizes);
+    ASSERT_NE(state, nullptr);
+    m = metrics_create(names, 2, state);
+    ASSERT_NE(m, nullptr);
+  }
+  void TearDown() override {
+    metrics_destroy(m);
+    state_destroy(state);
+  }
+
+  std::string render() {
+    size_t len;
+    const char *text = metrics_render(m, &len);
+    return text ? std::string(text, len) : std::string();
+  }
+
+  bool has(const std::string &text, const std::string &line) {
+    return text.find(line + "\n") != std::string::npos;
+  }
+
+  StateTable *state;
+  Metrics *m;
+};
+
+TEST_F(MetricsTest, RendersMachines) {
+  ODBST st;
+  Fw32Dy2 dy;
+  Fw32Spload sp;
+  MachineStats stats;
+
+  memset(&st, 0, sizeof(st));
+  memset(&dy, 0, sizeof(dy));
+  memset(&sp, 0, sizeof(sp));
+  st.run = 3;
+  st.aut = 1;
+  dy.actf = 1200;
+  dy.acts = 8000;
+  sp.spload.data = 455;
+  sp.spload.dec = 1;
+  state_write(state, 0, METRICS_STATUS, &st, sizeof(st), EW_OK, 1.0);
+  state_write(state, 0, METRICS_DYNAMIC, &dy, sizeof(dy), EW_OK, 1.0);
+  state_write(state, 0, METRICS_SPINDLE, &sp, sizeof(sp), EW_OK, 1.0);
+  state_write(state, 1, METRICS_STATUS, &st, sizeof(st), EW_SOCKET, 1.0);
+
+  metrics_connect(m, 0, EW_OK);
+  metrics_disconnect(m, 0);
+  metrics_connect(m, 0, EW_OK);
+  metrics_connect(m, 1, EW_SOCKET);
+  memset(&stats, 0, sizeof(stats));
+  stats.cycles = 10;
+  stats.skipped = 2;
+  stats.late = 0.5;
+  stats.max_late = 0.25;
+  metrics_poller(m, 0, &stats);
+
+  std::string text = render();
+  EXPECT_TRUE(has(text, "fanuc_connected{machine=\"lathe-1\"} 1"));
+  EXPECT_TRUE(has(text, "fanuc_connected{machine=\"mill \\\"2\\\"\"} 0"));
+  EXPECT_TRUE(has(text, "fanuc_reconnects_total{machine=\"lathe-1\"} 1"));
+  EXPECT_TRUE(has(text, "fanuc_disconnects_total{machine=\"lathe-1\"} 1"));
+  EXPECT_TRUE(
+      has(text, "fanuc_connect_failures_total{machine=\"mill \\\"2\\\"\"} 1"));
+  EXPECT_TRUE(has(text, "fanuc_poll_lateness_seconds_count{machine=\"lathe-1\"} 10"));
+  EXPECT_TRUE(has(text, "fanuc_poll_lateness_seconds_sum{machine=\"lathe-1\"} 0.5"));
+  EXPECT_TRUE(has(text, "fanuc_poll_max_lateness_seconds{machine=\"lathe-1\"} 0.25"));
+  EXPECT_TRUE(has(text, "fanuc_poll_skipped_cycles_total{machine=\"lathe-1\"} 2"));
+  EXPECT_TRUE(has(text, "fanuc_run_state{machine=\"lathe-1\"} 3"));
+  EXPECT_TRUE(has(text, "fanuc_automatic_mode{machine=\"lathe-1\"} 1"));
+  EXPECT_TRUE(has(text, "fanuc_feed_rate{machine=\"lathe-1\"} 1200"));
+  EXPECT_TRUE(has(text, "fanuc_spindle_speed_rpm{machine=\"lathe-1\"} 8000"));
+  EXPECT_TRUE(has(text, "fanuc_spindle_load_percent{machine=\"lathe-1\"} 45.5"));
+  EXPECT_EQ(text.find("fanuc_run_state{machine=\"mill"), std::string::npos)
+      << "a failed read exports no value";
+  EXPECT_TRUE(has(text, "# TYPE fanuc_reconnects counter"));
+  EXPECT_TRUE(has(text, "# UNIT fanuc_spindle_speed_rpm rpm"));
+  ASSERT_GE(text.size(), 6u);
+  EXPECT_EQ(text.substr(text.size() - 6), "# EOF\n");
+}
+
+TEST_F(MetricsTest, RendersCallHistogramsAndCodes) {
+  for (int i = 0; i < 3; i++) callstats_add("cnc_statinfo", 0, 300000, EW_OK);
+  callstats_add("cnc_statinfo", 0, 2000000, EW_SOCKET);
+  callstats_add("cnc_statinfo", 0, 20000000000ull, 30000);
+
+  std::string text = render();
+  const std::string labels = "machine=\"lathe-1\",function=\"cnc_statinfo\"";
+  EXPECT_TRUE(has(text, "# TYPE fanuc_focas_call_seconds histogram"));
+  EXPECT_TRUE(has(text, "fanuc_focas_call_seconds_bucket{" + labels + ",le=\"0.00025\"} 0"));
+  EXPECT_TRUE(has(text, "fanuc_focas_call_seconds_bucket{" + labels + ",le=\"0.0005\"} 3"));
+  EXPECT_TRUE(has(text, "fanuc_focas_call_seconds_bucket{" + labels + ",le=\"0.0025\"} 4"));
+  EXPECT_TRUE(has(text, "fanuc_focas_call_seconds_bucket{" + labels + ",le=\"10\"} 4"));
+  EXPECT_TRUE(has(text, "fanuc_focas_call_seconds_bucket{" + labels + ",le=\"+Inf\"} 5"));
+  EXPECT_TRUE(has(text, "fanuc_focas_call_seconds_count{" + labels + "} 5"));
+  EXPECT_TRUE(has(text, "fanuc_focas_call_seconds_sum{" + labels + "} 20.0029"));
+  EXPECT_TRUE(has(text, "fanuc_focas_returns_total{" + labels + ",code=\"0\"} 3"));
+  EXPECT_TRUE(has(text, "fanuc_focas_returns_total{" + labels + ",code=\"-16\"} 1"));
+  EXPECT_TRUE(has(text, "fanuc_focas_returns_total{" + labels + ",code=\"other\"} 1"));
+  // the codes follow the whole histogram family
+  EXPECT_GT(text.find("# TYPE fanuc_focas_returns"),
+            text.rfind("fanuc_focas_call_seconds_sum"));
+}
+
+TEST_F(MetricsTest, GrowsTheBuffer) {
+  static const char *functions[] = {
+      "cnc_rdspeed",  "cnc_rdaxisname", "cnc_rdposition", "cnc_absolute",
+      "cnc_machine",  "cnc_relative",   "cnc_actf",       "cnc_acts"};
+
+  for (const char *f : functions) callstats_add(f, 1, 1000, EW_OK);
+  std::string text = render();
+  for (const char *f : functions) {
+    EXPECT_NE(text.find(std::string("function=\"") + f + "\",le=\"+Inf\"} 1"),
+              std::string::npos)
+        << f;
+  }
+  EXPECT_EQ(text.substr(text.size() - 6), "# EOF\n");
+}
+
+static std::string get(unsigned short port, const char *path) {
+  struct sockaddr_in addr;
+  std::string response;
+  char buf[4096];
+  ssize_t n;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return response;
+  }
+  std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: x\r\n\r\n";
+  send(fd, req.data(), req.size(), 0);
+  while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) response.append(buf, n);
+  close(fd);
+  return response;
+}
+
+TEST_F(MetricsTest, ServesOverHttp) {
+  ASSERT_EQ(metrics_listen(m, "127.0.0.1", 0), 0);
+  ASSERT_NE(metrics_port(m), 0);
+
+  std::string r = get(metrics_port(m), "/metrics");
+  EXPECT_EQ(r.find("HTTP/1.1 200 OK\r\n"), 0u);
+  EXPECT_NE(r.find("Content-Type: application/openmetrics-text; version=1.0.0"),
+            std::string::npos);
+  size_t body = r.find("\r\n\r\n");
+  ASSERT_NE(body, std::string::npos);
+  EXPECT_EQ(r.substr(body + 4, 7), "# TYPE ");
+  EXPECT_EQ(r.substr(r.size() - 6), "# EOF\n");
+
+  EXPECT_EQ(get(metrics_port(m), "/").find("HTTP/1.1 404"), 0u);
+}
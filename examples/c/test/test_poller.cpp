@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+  #include "../src/callstats.h"
+  #include "../src/fwabi.h"
+  #include "../src/poller.h"
+  #include "../src/unsolic.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_BUSY (-1)
+#define EW_SOCKET (-16)
+#define EW_NOOPT 6
+
+/* same layout as IDBUNSOLICMSG2 */
+struct unsolicmsg_type_msg {
+  unsigned short type;
+  char dummy1[2];
+  union {
+    struct {
+      unsigned short path;
+      char dummy2[2];
+      unsigned long size;
+      void *data;
+    } pmc;
+    struct {
+      unsigned short path;
+      char dummy3[2];
+      unsigned long num;
+      void *data;
+    } macro;
+  } msg;
+};
+
+struct idbunsolicmsg2 {
+  unsigned short getnum;
+  char dummy[2];
+  struct unsolicmsg_type_msg get[3];
+};
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, pmc_rdpmcrng, unsigned short, short, short,
+                unsigned short, unsigned short, unsigned short, void *);
+FAKE_VALUE_FUNC(short, cnc_rdmacror2, unsigned short, unsigned long,
+                unsigned long *, double *);
+FAKE_VALUE_FUNC(short, cnc_wrunsolicprm2, unsigned short, short, void *);
+FAKE_VALUE_FUNC(short, cnc_unsolicstart, unsigned short, short, int,
+                unsigned long, short, short *);
+FAKE_VALUE_FUNC(short, cnc_unsolicstop, unsigned short, short);
+FAKE_VALUE_FUNC(short, cnc_rdunsolicmsg2, short, void *);
+FAKE_VALUE_FUNC(short, cnc_statinfo, unsigned short, void *);
+FAKE_VALUE_FUNC(short, cnc_rddynamic2, unsigned short, short, short, void *);
+FAKE_VALUE_FUNC(short, cnc_rdspmeter, unsigned short, short, short *, void *);
+
+/* pmc byte n holds n % 251, macro n holds n + 0.5 */
+static short read_pmc(unsigned short libh, short adr, short type,
+                      unsigned short s, unsigned short e, unsigned short len,
+                      void *data) {
+  unsigned char *bytes = (unsigned char *)data + 8;
+  if (len != 8 + e - s + 1) return 2;
+  for (unsigned n = s; n <= e; n++) bytes[n - s] = (unsigned char)(n % 251);
+  return EW_OK;
+}
+
+static short read_macro(unsigned short libh, unsigned long no,
+                        unsigned long *num, double *data) {
+  for (unsigned long i = 0; i < *num; i++) data[i] = no + i + 0.5;
+  return EW_OK;
+}
+
+/* the cnc pushes `pending` messages carrying every signal, filled with
+ * `pushed_byte` */
+static int pending;
+static unsigned char pushed_byte;
+
+static short read_message(short bill, void *data) {
+  struct idbunsolicmsg2 *msg = (struct idbunsolicmsg2 *)data;
+  if (pending == 0) return EW_BUSY;
+  pending--;
+  for (int i = 0; i < msg->getnum; i++) {
+    // the size and the num fields share their place in the union
+    memset(msg->get[i].msg.pmc.data, pushed_byte,
+           msg->get[i].type == 1 ? msg->get[i].msg.macro.num * sizeof(double)
+                                 : msg->get[i].msg.pmc.size);
+  }
+  return EW_OK;
+}
+
+struct Update {
+  int signal;
+  short err;
+  int pushed;
+  std::string data;
+};
+static std::vector<Update> updates;
+
+static void collect(const ValueUpdate *u, void *ctx) {
+  updates.push_back({u->signal, u->err, u->pushed,
+                     u->data ? std::string((const char *)u->data, u->size)
+                             : std::string()});
+}
+
+class PollerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(pmc_rdpmcrng);
+    RESET_FAKE(cnc_rdmacror2);
+    RESET_FAKE(cnc_wrunsolicprm2);
+    RESET_FAKE(cnc_unsolicstart);
+    RESET_FAKE(cnc_unsolicstop);
+    RESET_FAKE(cnc_rdunsolicmsg2);
+    RESET_FAKE(cnc_statinfo);
+    RESET_FAKE(cnc_rddynamic2);
+    RESET_FAKE(cnc_rdspmeter);
+    pmc_rdpmcrng_fake.custom_fake = read_pmc;
+    cnc_rdmacror2_fake.custom_fake = read_macro;
+    cnc_rdunsolicmsg2_fake.custom_fake = read_message;
+    pending = 0;
+    pushed_byte = 0x5a;
+    updates.clear();
+
+    memset(&push, 0, sizeof(push));
+    snprintf(push.ipaddr, sizeof(push.ipaddr), "192.168.0.10");
+    push.port = 8196;
+    push.number = 1;
+    opts = default_machine_options;
+    opts.interval_ms = 10;
+    opts.push = &push;
+    opts.push_check_ms = 1;
+    opts.push_retry_ms = 30;
+
+    memset(signals, 0, sizeof(signals));
+    signals[0] = {SIGNAL_PMC, 0, 0, 0, 600};  // G0-G599, three reads
+    signals[1] = {SIGNAL_MACRO, 0, 0, 500, 10};
+    signals[2] = {SIGNAL_PMC, 0, 1, 0, 4};
+    signals[3] = {SIGNAL_PMC, 0, 2, 100, 8};
+    p = poller_create();
+  }
+  void TearDown() override { poller_destroy(p); }
+
+  size_t count(int signal, int pushed) {
+    size_t n = 0;
+    for (auto &u : updates) n += u.signal == signal && u.pushed == pushed;
+    return n;
+  }
+  Poller *p;
+  UnsolicOptions push;
+  MachineOptions opts;
+  Signal signals[4];
+};
+
+TEST_F(PollerTest, PollsPmcAndMacros) {
+  opts.mode = POLL_ONLY;
+  ASSERT_EQ(poller_add(p, 1, signals, 2, &opts, collect, NULL), 0);
+  EXPECT_EQ(poller_add(p, 1, signals, 2, &opts, collect, NULL), 1);
+  poller_run(p, 55);
+
+  EXPECT_EQ(cnc_wrunsolicprm2_fake.call_count, 0u);
+  EXPECT_GE(count(0, 0), 5u);
+  EXPECT_LE(count(0, 0), 7u);
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 3 * count(0, 0));
+  ASSERT_EQ(updates[0].data.size(), 600u);
+  for (int n = 0; n < 600; n++)
+    ASSERT_EQ((unsigned char)updates[0].data[n], n % 251) << n;
+  ASSERT_EQ(updates[1].data.size(), 10 * sizeof(double));
+  EXPECT_EQ(((const double *)updates[1].data.data())[9], 509.5);
+}
+
+TEST_F(PollerTest, PushedValuesJoinTheStream) {
+  MachineStats stats;
+
+  pending = 2;
+  ASSERT_EQ(poller_add(p, 1, signals, 4, &opts, collect, NULL), 0);
+  poller_run(p, 25);
+  ASSERT_EQ(poller_stats(p, 1, &stats), 0);
+
+  EXPECT_TRUE(stats.pushing);
+  EXPECT_EQ(stats.pushes, 6u);
+  // the first three signals are pushed, the fourth one is still polled
+  EXPECT_EQ(count(0, 1), 2u);
+  EXPECT_EQ(count(0, 0), 0u);
+  EXPECT_EQ(count(1, 1), 2u);
+  EXPECT_GE(count(3, 0), 2u);
+  EXPECT_EQ(cnc_rdmacror2_fake.call_count, 0u);
+  for (auto &u : updates) {
+    if (u.pushed && u.signal == 0) {
+      ASSERT_EQ(u.data.size(), 600u);
+      EXPECT_EQ(u.data[599], 0x5a);
+    }
+  }
+  EXPECT_EQ(cnc_unsolicstart_fake.arg1_val, 1);
+  poller_remove(p, 1);
+  poller_step(p);
+  EXPECT_EQ(cnc_unsolicstop_fake.call_count, 1u);
+}
+
+TEST_F(PollerTest, PollsWithoutTheOption) {
+  MachineStats stats;
+
+  cnc_wrunsolicprm2_fake.return_val = EW_NOOPT;
+  ASSERT_EQ(poller_add(p, 1, signals, 2, &opts, collect, NULL), 0);
+  poller_run(p, 80);
+  ASSERT_EQ(poller_stats(p, 1, &stats), 0);
+
+  EXPECT_FALSE(stats.pushing);
+  EXPECT_EQ(stats.push_err, EW_NOOPT);
+  EXPECT_EQ(cnc_wrunsolicprm2_fake.call_count, 1u) << "retried a missing option";
+  EXPECT_GE(count(0, 0), 7u);
+  EXPECT_EQ(count(0, 1), 0u);
+}
+
+TEST_F(PollerTest, FallsBackWhenPushBreaks) {
+  MachineStats stats;
+  short codes[] = {EW_BUSY, EW_BUSY, EW_SOCKET};
+
+  cnc_rdunsolicmsg2_fake.custom_fake = NULL;
+  SET_RETURN_SEQ(cnc_rdunsolicmsg2, codes, 3);
+  opts.push_retry_ms = 1000;
+  ASSERT_EQ(poller_add(p, 1, signals, 2, &opts, collect, NULL), 0);
+  poller_run(p, 40);
+  ASSERT_EQ(poller_stats(p, 1, &stats), 0);
+
+  EXPECT_FALSE(stats.pushing);
+  EXPECT_EQ(stats.fallbacks, 1u);
+  EXPECT_EQ(stats.push_err, EW_SOCKET);
+  EXPECT_EQ(cnc_unsolicstop_fake.call_count, 1u);
+  // polled right after push stopped working
+  EXPECT_GE(count(0, 0), 3u);
+  EXPECT_GE(count(1, 0), 3u);
+}
+
+TEST_F(PollerTest, RetriesPush) {
+  MachineStats stats;
+  short codes[] = {EW_SOCKET, EW_OK};
+
+  SET_RETURN_SEQ(cnc_unsolicstart, codes, 2);
+  ASSERT_EQ(poller_add(p, 1, signals, 2, &opts, collect, NULL), 0);
+  poller_run(p, 20);
+  ASSERT_EQ(poller_stats(p, 1, &stats), 0);
+  EXPECT_FALSE(stats.pushing);
+  EXPECT_GE(count(0, 0), 1u);
+
+  poller_run(p, 30);
+  ASSERT_EQ(poller_stats(p, 1, &stats), 0);
+  EXPECT_TRUE(stats.pushing);
+  EXPECT_EQ(cnc_unsolicstart_fake.call_count, 2u);
+}
+
+TEST_F(PollerTest, PushOnlyReportsErrors) {
+  cnc_unsolicstart_fake.return_val = EW_SOCKET;
+  opts.mode = PUSH_ONLY;
+  ASSERT_EQ(poller_add(p, 1, signals, 2, &opts, collect, NULL), 0);
+  poller_run(p, 40);
+
+  EXPECT_EQ(pmc_rdpmcrng_fake.call_count, 0u);
+  EXPECT_EQ(cnc_rdmacror2_fake.call_count, 0u);
+  ASSERT_GE(updates.size(), 4u);
+  EXPECT_EQ(updates[0].err, EW_SOCKET);
+  EXPECT_EQ(updates[2].signal, 0) << "errors reported on every retry";
+}
+
+TEST_F(PollerTest, PollsStatusAndDynamicData) {
+  Signal state[] = {{SIGNAL_PMC, 0, 0, 0, 4},
+                    {SIGNAL_STATUS, 0, 0, 0, 0},
+                    {SIGNAL_DYNAMIC, 0, -1, 0, 0}};
+
+  ASSERT_EQ(poller_add(p, 1, state, 3, &opts, collect, NULL), 0);
+  poller_run(p, 5);
+
+  // only the pmc range is pushed
+  EXPECT_EQ(cnc_wrunsolicprm2_fake.call_count, 1u);
+  EXPECT_GE(cnc_statinfo_fake.call_count, 1u);
+  EXPECT_GE(cnc_rddynamic2_fake.call_count, 1u);
+  EXPECT_EQ(cnc_rddynamic2_fake.arg1_val, -1);
+  // the 32 bit layout of the library, also in a 64 bit build
+  EXPECT_EQ(cnc_rddynamic2_fake.arg2_val, (short)sizeof(Fw32Dy2));
+  EXPECT_GE(count(1, 0), 1u);
+  EXPECT_EQ(count(0, 0), 0u);
+  for (auto &u : updates) {
+    if (u.signal == 2) {
+      EXPECT_EQ(u.data.size(), (size_t)cnc_rddynamic2_fake.arg2_val);
+    }
+  }
+}
+
+static short slow_status(unsigned short libh, void *st) {
+  usleep(25000);
+  return EW_OK;
+}
+
+TEST_F(PollerTest, CountsLateAndSkippedCycles) {
+  static CallStats rows[4];
+  Signal state[] = {{SIGNAL_STATUS, 0, 0, 0, 0}, {SIGNAL_SPINDLE, 0, 0, 0, 0}};
+  MachineStats stats;
+
+  cnc_statinfo_fake.custom_fake = slow_status;
+  opts.mode = POLL_ONLY;
+  opts.calls_key = 77;
+  ASSERT_EQ(poller_add(p, 1, state, 2, &opts, collect, NULL), 0);
+  poller_run(p, 60);
+  ASSERT_EQ(poller_stats(p, 1, &stats), 0);
+
+  // every 25 ms cycle of a 10 ms interval starts late and drops the next
+  EXPECT_GE(stats.cycles, 2u);
+  EXPECT_LE(stats.cycles, 4u);
+  EXPECT_GE(stats.skipped, stats.cycles - 1);
+  EXPECT_GT(stats.max_late, 0.01);
+  EXPECT_LE(stats.late, stats.cycles * stats.max_late);
+  EXPECT_EQ(cnc_rdspmeter_fake.arg1_val, -1);
+  EXPECT_EQ(callstats_collect(rows, 4, 77), 2) << "counted under calls_key";
+}
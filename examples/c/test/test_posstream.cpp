@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
+extern "C" {
+  #include "../src/posstream.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_SOCKET (-16)
+
+/* same layout as ODBRENPLT */
+struct odbrenplt {
+  short delay_time;
+  unsigned short data_flag;
+  short pos_data[6];
+};
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_stpossmpl, unsigned short, short, char *);
+FAKE_VALUE_FUNC(short, cnc_rdpossmpl, unsigned short, long *, void *);
+FAKE_VALUE_FUNC(short, cnc_endpossmpl, unsigned short);
+
+/* the cnc side: samples every 2 ticks, up to 50 per read until `total`,
+ * skips 3 samples at `gap_at` and fails one read at `fail_at` */
+static std::atomic<long> produced;
+static long total;
+static long gap_at;
+static long fail_at;
+
+static short read_positions(unsigned short libh, long *num, void *data) {
+  struct odbrenplt *buf = (struct odbrenplt *)data;
+  long n = total - produced < 50 ? total - produced : 50;
+
+  if (fail_at && produced >= fail_at) {
+    fail_at = 0;
+    return EW_SOCKET;
+  }
+  if (n > *num) n = *num;
+  for (long i = 0; i < n; i++) {
+    long seq = produced + i;
+    buf[i].delay_time = seq == gap_at ? 8 : 2;
+    buf[i].data_flag = 1;
+    for (int a = 0; a < 6; a++) buf[i].pos_data[a] = (short)(seq * 10 + a);
+  }
+  produced += n;
+  *num = n;
+  return EW_OK;
+}
+
+class PosStreamTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_stpossmpl);
+    RESET_FAKE(cnc_rdpossmpl);
+    RESET_FAKE(cnc_endpossmpl);
+    cnc_rdpossmpl_fake.custom_fake = read_positions;
+    produced = 0;
+    total = 0;
+    gap_at = 0;
+    fail_at = 0;
+    opts = default_pos_options;
+    opts.interval = 2;
+    opts.idle_us = 100;
+  }
+
+  /* read everything the stream produces until it has been quiet */
+  size_t drain(PosStream *p, PosSample *out, size_t max) {
+    const PosSample *s;
+    size_t read = 0;
+    size_t n;
+    while ((n = posstream_peek(p, &s, 200)) > 0) {
+      for (size_t i = 0; i < n && read < max; i++) out[read++] = s[i];
+      posstream_release(p, n);
+    }
+    return read;
+  }
+  PosOptions opts;
+};
+
+TEST_F(PosStreamTest, TimestampsOnControllerClock) {
+  static PosSample out[5000];
+  PosStats stats;
+  short err;
+
+  total = 5000;
+  PosStream *p = posstream_start(1, &opts, &err);
+  ASSERT_NE(p, nullptr);
+  ASSERT_EQ(drain(p, out, 5000), 5000u);
+  posstream_stop(p, &stats);
+
+  EXPECT_EQ(stats.samples, 5000u);
+  EXPECT_EQ(stats.gaps, 0u);
+  EXPECT_EQ(cnc_endpossmpl_fake.call_count, 1u);
+  for (int i = 0; i < 5000; i++) {
+    ASSERT_EQ(out[i].seq, (unsigned long long)i);
+    ASSERT_EQ(out[i].events, 0);
+    ASSERT_EQ(out[i].pos[3], (short)(i * 10 + 3));
+  }
+  // 2 ticks of 1 ms between samples
+  EXPECT_NEAR(out[4999].time, 4999 * 0.002, 1e-9);
+}
+
+TEST_F(PosStreamTest, FlagsGaps) {
+  static PosSample out[1000];
+  PosStats stats;
+  short err;
+
+  total = 1000;
+  gap_at = 600;
+  PosStream *p = posstream_start(1, &opts, &err);
+  ASSERT_NE(p, nullptr);
+  ASSERT_EQ(drain(p, out, 1000), 1000u);
+  posstream_stop(p, &stats);
+
+  EXPECT_EQ(stats.gaps, 1u);
+  EXPECT_EQ(out[600].events, POS_GAP);
+  EXPECT_EQ(out[599].events, 0);
+  EXPECT_NEAR(out[600].time - out[599].time, 0.008, 1e-9);
+}
+
+TEST_F(PosStreamTest, RestartsAfterFailedRead) {
+  static PosSample out[1000];
+  PosStats stats;
+  short err;
+
+  total = 1000;
+  fail_at = 300;
+  PosStream *p = posstream_start(1, &opts, &err);
+  ASSERT_NE(p, nullptr);
+  ASSERT_EQ(drain(p, out, 1000), 1000u);
+  posstream_stop(p, &stats);
+
+  EXPECT_EQ(stats.restarts, 1u);
+  EXPECT_EQ(stats.err, EW_OK);
+  EXPECT_EQ(cnc_stpossmpl_fake.call_count, 2u);
+  EXPECT_EQ(out[300].events, POS_RESTART | POS_GAP);
+}
+
+TEST_F(PosStreamTest, CountsOverruns) {
+  PosStats stats;
+  const PosSample *s;
+  short err;
+
+  total = 3000;
+  opts.capacity = 1024;
+  PosStream *p = posstream_start(1, &opts, &err);
+  ASSERT_NE(p, nullptr);
+  while (produced < total) usleep(100);
+  usleep(1000);
+
+  // the ring filled up once, the rest was dropped
+  posstream_stats(p, &stats);
+  EXPECT_EQ(stats.samples, 1024u);
+  EXPECT_EQ(stats.dropped, 3000u - 1024u);
+  EXPECT_EQ(stats.overruns, 1u);
+  ASSERT_EQ(posstream_peek(p, &s, 0), 1024u);
+  EXPECT_EQ(s[1023].seq, 1023u);
+  posstream_release(p, 1024);
+
+  // the next sample after the overrun carries the event
+  total = 3001;
+  ASSERT_EQ(posstream_peek(p, &s, 1000), 1u);
+  EXPECT_EQ(s[0].seq, 3000u);
+  EXPECT_TRUE(s[0].events & POS_OVERRUN);
+  posstream_stop(p, NULL);
+}
+
+TEST_F(PosStreamTest, ReportsErrorWhenStoppedDuringRestart) {
+  PosStats stats;
+  short err;
+  short codes[] = {EW_OK, EW_SOCKET};
+
+  SET_RETURN_SEQ(cnc_stpossmpl, codes, 2);
+  cnc_rdpossmpl_fake.custom_fake = NULL;
+  cnc_rdpossmpl_fake.return_val = EW_SOCKET;
+  PosStream *p = posstream_start(1, &opts, &err);
+  ASSERT_NE(p, nullptr);
+  // the cnc never comes back, stop while the restart is backing off
+  usleep(20000);
+  EXPECT_TRUE(posstream_running(p));
+  posstream_stop(p, &stats);
+  EXPECT_GT(cnc_stpossmpl_fake.call_count, 2u);
+  EXPECT_EQ(stats.err, EW_SOCKET);
+  EXPECT_EQ(stats.samples, 0u);
+}
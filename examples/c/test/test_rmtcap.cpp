@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+  #include "../src/rmtcap.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_BUSY (-1)
+#define EW_SOCKET (-16)
+
+/* same layout as ODBRMTDT */
+struct odbrmtdt {
+  short channel;
+  short kind;
+  char year, month, day, hour, minute, second;
+  short t_intrvl;
+  short trg_data;
+  long ins_ptr;
+  short t_delta;
+  short data[1917];
+};
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_wrrmtwaveprm, unsigned short, void *);
+FAKE_VALUE_FUNC(short, cnc_rmtwavestart, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_rmtwavestop, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_rmtwavestat, unsigned short, short *);
+FAKE_VALUE_FUNC(short, cnc_rdrmtwavedt, unsigned short, short, long, long *,
+                void *);
+
+#define HANDLES 4
+#define RECORD 1000
+
+/* the cnc side: handle h triggers after `waiting[h]` polls, then hands out
+ * two channels of three records each, interleaved */
+static int waiting[HANDLES];
+static int polls[HANDLES];
+static int early_reads;
+
+static short wave_stat(unsigned short libh, short *stat) {
+  *stat = polls[libh] < waiting[libh] ? 1 : 0;
+  polls[libh]++;
+  return EW_OK;
+}
+
+static short wave_data(unsigned short libh, short type, long rec, long *len,
+                       void *data) {
+  struct odbrmtdt *buf = (struct odbrmtdt *)data;
+
+  if (polls[libh] <= waiting[libh]) early_reads++;
+  if (type != 0 || rec > 6) {
+    *len = 0;
+    return EW_OK;
+  }
+  buf->channel = (short)((rec - 1) % 2 + 1);
+  buf->kind = 7;
+  buf->year = 26;
+  buf->month = 10;
+  buf->day = 18;
+  buf->hour = buf->minute = buf->second = 0;
+  buf->t_intrvl = 2;
+  for (long i = 0; i < RECORD; i++)
+    buf->data[i] = (short)(libh * 1000 + buf->channel * 100 + (rec - 1) / 2);
+  *len = RECORD;
+  return EW_OK;
+}
+
+static std::vector<RmtCapResult> results;
+static std::vector<std::string> paths;
+
+static void record(const RmtCapResult *r, void *ctx) {
+  results.push_back(*r);
+  paths.push_back(r->path ? r->path : "");
+}
+
+class RmtCap : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_wrrmtwaveprm);
+    RESET_FAKE(cnc_rmtwavestart);
+    RESET_FAKE(cnc_rmtwavestop);
+    RESET_FAKE(cnc_rmtwavestat);
+    RESET_FAKE(cnc_rdrmtwavedt);
+    cnc_rmtwavestat_fake.custom_fake = wave_stat;
+    cnc_rdrmtwavedt_fake.custom_fake = wave_data;
+    memset(waiting, 0, sizeof(waiting));
+    memset(polls, 0, sizeof(polls));
+    early_reads = 0;
+    results.clear();
+    paths.clear();
+
+    char tmpl[] = "/tmp/focas-rmtcap-XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    dir = tmpl;
+    memset(&job, 0, sizeof(job));
+    job.config.alm_no = 410;
+    prefix = dir + "/spindle";
+    job.prefix = prefix.c_str();
+    opts.poll_min_ms = 1;
+    opts.poll_max_ms = 20;
+    s = rmtcap_create(&opts);
+  }
+  void TearDown() override {
+    rmtcap_destroy(s);
+    std::string cmd = "rm -rf " + dir;
+    system(cmd.c_str());
+  }
+  RmtCapService *s;
+  RmtCapOptions opts;
+  RmtCapJob job;
+  std::string dir;
+  std::string prefix;
+};
+
+TEST_F(RmtCap, MultiplexesMachines) {
+  waiting[1] = 2;
+  waiting[2] = 10;
+  waiting[3] = 5;
+  for (unsigned short h = 1; h < HANDLES; h++) {
+    std::string p = prefix + std::to_string(h);
+    job.prefix = p.c_str();
+    ASSERT_EQ(rmtcap_add(s, h, &job, record, NULL), 0);
+  }
+  EXPECT_EQ(rmtcap_add(s, 2, &job, record, NULL), 1) << "one job per handle";
+
+  EXPECT_EQ(rmtcap_run(s, 5000), 0);
+  ASSERT_EQ(results.size(), 3u);
+  EXPECT_EQ(early_reads, 0) << "data read before the capture finished";
+  EXPECT_EQ(cnc_rmtwavestart_fake.call_count, 3u);
+  // finished in trigger order
+  EXPECT_EQ(results[0].libh, 1);
+  EXPECT_EQ(results[1].libh, 3);
+  EXPECT_EQ(results[2].libh, 2);
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const RmtCapResult &r = results[i];
+    WaveInfo info;
+    short *samples;
+    size_t count;
+
+    ASSERT_EQ(r.err, EW_OK);
+    EXPECT_EQ(r.capture, 1u);
+    EXPECT_EQ(r.samples, 6u * RECORD);
+    EXPECT_EQ(paths[i], prefix + std::to_string(r.libh) + "-1.fwave");
+    ASSERT_EQ(wavefile_read_info(paths[i].c_str(), &info), 0);
+    EXPECT_EQ(info.channels, 2);
+    EXPECT_EQ(info.period_us, 2000u);
+    EXPECT_EQ(info.ch[1].kind, 7);
+    EXPECT_STREQ(info.started, "2026-10-18 00:00:00");
+    ASSERT_EQ(wavefile_read_column(paths[i].c_str(), 1, &samples, &count), 0);
+    ASSERT_EQ(count, 3u * RECORD);
+    EXPECT_EQ(samples[0], r.libh * 1000 + 200);
+    EXPECT_EQ(samples[count - 1], r.libh * 1000 + 202);
+    free(samples);
+  }
+}
+
+TEST_F(RmtCap, BacksOffWhileWaiting) {
+  waiting[1] = 1000000;
+  ASSERT_EQ(rmtcap_add(s, 1, &job, record, NULL), 0);
+  EXPECT_EQ(rmtcap_run(s, 200), 1);
+  // 1, 2, 4, 8, 16 ms and then every 20 ms instead of 200 polls
+  EXPECT_LT(polls[1], 20);
+  EXPECT_GT(polls[1], 5);
+  EXPECT_EQ(cnc_rdrmtwavedt_fake.call_count, 0u);
+  EXPECT_EQ(rmtcap_remove(s, 1), 0);
+  EXPECT_EQ(cnc_rmtwavestop_fake.call_count, 1u);
+  EXPECT_EQ(rmtcap_step(s), -1);
+}
+
+TEST_F(RmtCap, RearmsRepeatingJobs) {
+  job.every_ms = 5;
+  ASSERT_EQ(rmtcap_add(s, 1, &job, record, NULL), 0);
+  while (results.size() < 3) rmtcap_run(s, 10);
+  EXPECT_EQ(rmtcap_jobs(s), 1);
+  EXPECT_EQ(results[2].capture, 3u);
+  EXPECT_EQ(paths[2], prefix + "-3.fwave");
+  EXPECT_GE(cnc_wrrmtwaveprm_fake.call_count, 3u);
+  EXPECT_EQ(rmtcap_remove(s, 1), 0);
+  EXPECT_EQ(rmtcap_jobs(s), 0);
+}
+
+TEST_F(RmtCap, TimesOutWaitingForTrigger) {
+  struct stat st;
+
+  waiting[1] = 1000000;
+  job.timeout_ms = 30;
+  ASSERT_EQ(rmtcap_add(s, 1, &job, record, NULL), 0);
+  EXPECT_EQ(rmtcap_run(s, 5000), 0);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_EQ(results[0].err, EW_BUSY);
+  EXPECT_EQ(results[0].path, nullptr);
+  EXPECT_EQ(cnc_rmtwavestop_fake.call_count, 1u);
+  EXPECT_NE(stat((prefix + "-1.fwave").c_str(), &st), 0);
+}
+
+TEST_F(RmtCap, ReportsReadError) {
+  cnc_rdrmtwavedt_fake.custom_fake = NULL;
+  cnc_rdrmtwavedt_fake.return_val = EW_SOCKET;
+  ASSERT_EQ(rmtcap_add(s, 1, &job, record, NULL), 0);
+  EXPECT_EQ(rmtcap_run(s, 5000), 0);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_EQ(results[0].err, EW_SOCKET);
+  std::string cmd = "test -z \"$(ls " + dir + ")\"";
+  EXPECT_EQ(system(cmd.c_str()), 0) << "file left behind";
+}
+
+TEST_F(RmtCap, RetriesBusyArm) {
+  short codes[] = {EW_BUSY, EW_BUSY, EW_OK};
+  SET_RETURN_SEQ(cnc_rmtwavestart, codes, 3);
+  ASSERT_EQ(rmtcap_add(s, 1, &job, record, NULL), 0);
+  EXPECT_EQ(rmtcap_run(s, 5000), 0);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_EQ(results[0].err, EW_OK);
+  EXPECT_EQ(results[0].capture, 1u);
+  EXPECT_EQ(cnc_rmtwavestart_fake.call_count, 3u);
+}
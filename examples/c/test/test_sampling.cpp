@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <set>
+
+extern "C" {
+  #include "../src/sampling.h"
+  #include "../src/spsc.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_NUMBER 3
+#define EW_SOCKET (-16)
+
+/* same layout as ODBSD */
+struct odbsd {
+  unsigned short *chadata;
+  long *count;
+};
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_sdtsetchnl, unsigned short, short, long, void *);
+FAKE_VALUE_FUNC(short, cnc_sdtstartsmpl, unsigned short, short, long);
+FAKE_VALUE_FUNC(short, cnc_sdtreadsmpl, unsigned short, short *, long, void *);
+FAKE_VALUE_FUNC(short, cnc_sdtendsmpl, unsigned short);
+
+#define CHANNELS 3
+
+/* the cnc side: hands out up to 64 frames per call until `total` frames
+ * were sampled, every value encodes its frame and channel number */
+static std::atomic<long> produced;
+static long total;
+static long fail_after;
+static std::set<unsigned short *> targets;
+
+static short read_samples(unsigned short libh, short *stat, long want,
+                          void *data) {
+  struct odbsd *sd = (struct odbsd *)data;
+  long n = total - produced < 64 ? total - produced : 64;
+
+  if (fail_after && produced >= fail_after) return EW_SOCKET;
+  if (n > want) n = want;
+  for (long i = 0; i < n; i++) {
+    for (int c = 0; c < CHANNELS; c++) {
+      sd->chadata[i * CHANNELS + c] = (unsigned short)((produced + i) * 4 + c);
+    }
+  }
+  if (n) targets.insert(sd->chadata);
+  produced += n;
+  *sd->count = n;
+  *stat = 1;
+  return EW_OK;
+}
+
+static const SamplerChannel channels[CHANNELS] = {
+    {0, 1, 1, 0}, {0, 2, 2, 0}, {1, 3, 1, 0}};
+
+class Sampling : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_sdtsetchnl);
+    RESET_FAKE(cnc_sdtstartsmpl);
+    RESET_FAKE(cnc_sdtreadsmpl);
+    RESET_FAKE(cnc_sdtendsmpl);
+    cnc_sdtreadsmpl_fake.custom_fake = read_samples;
+    produced = 0;
+    total = 0;
+    fail_after = 0;
+    targets.clear();
+    opts = default_sampler_options;
+    opts.idle_us = 100;
+  }
+  SamplerOptions opts;
+};
+
+TEST(Spsc, WrapsInContiguousRegions) {
+  SpscRing *r = spsc_create(6, sizeof(int));
+  void *w;
+  const void *rd;
+
+  ASSERT_NE(r, nullptr);
+  EXPECT_EQ(spsc_capacity(r), 8u);
+  EXPECT_EQ(spsc_write_region(r, &w), 8u);
+  spsc_commit(r, 6);
+  EXPECT_EQ(spsc_write_region(r, &w), 2u);
+  EXPECT_EQ(spsc_read_region(r, &rd), 6u);
+  spsc_release(r, 5);
+  // the free space wraps, only the part up to the end is contiguous
+  EXPECT_EQ(spsc_write_region(r, &w), 2u);
+  spsc_commit(r, 2);
+  EXPECT_EQ(spsc_write_region(r, &w), 5u);
+  EXPECT_EQ(spsc_used(r), 3u);
+  EXPECT_EQ(spsc_read_region(r, &rd), 3u);
+  spsc_destroy(r);
+}
+
+TEST_F(Sampling, StreamsEveryFrameInOrder) {
+  short err;
+  long next = 0;
+  SamplerStats stats;
+
+  total = 200000;
+  opts.capacity = 4096;
+  Sampler *s = sampler_start(1, channels, CHANNELS, &opts, &err);
+  ASSERT_NE(s, nullptr);
+  ASSERT_EQ(err, EW_OK);
+  EXPECT_EQ(cnc_sdtsetchnl_fake.arg1_val, CHANNELS);
+  EXPECT_EQ(sampler_channels(s), CHANNELS);
+
+  while (next < total) {
+    const unsigned short *frames;
+    size_t n = sampler_peek(s, &frames, 1000);
+    ASSERT_GT(n, 0u) << "stalled at frame " << next;
+    for (size_t i = 0; i < n; i++, next++) {
+      ASSERT_EQ(frames[i * CHANNELS], (unsigned short)(next * 4));
+      ASSERT_EQ(frames[i * CHANNELS + 2], (unsigned short)(next * 4 + 2));
+    }
+    sampler_release(s, n);
+  }
+
+  EXPECT_EQ(sampler_stop(s, &stats), EW_OK);
+  EXPECT_EQ(cnc_sdtendsmpl_fake.call_count, 1u);
+  EXPECT_EQ(stats.dropped, 0u);
+  EXPECT_EQ(stats.frames, (unsigned long long)total);
+  EXPECT_EQ(stats.err, EW_OK);
+}
+
+TEST_F(Sampling, ReadsInPlace) {
+  short err;
+  const unsigned short *frames;
+
+  total = 10;
+  Sampler *s = sampler_start(1, channels, CHANNELS, &opts, &err);
+  ASSERT_NE(s, nullptr);
+  ASSERT_EQ(sampler_peek(s, &frames, 1000), 10u);
+  sampler_stop(s, NULL);
+  // the cnc wrote straight into the memory the consumer reads
+  EXPECT_EQ(targets.count((unsigned short *)frames), 1u);
+}
+
+TEST_F(Sampling, DropsWhileRingIsFull) {
+  short err;
+  SamplerStats stats;
+
+  total = 5000;
+  opts.capacity = 256;
+  Sampler *s = sampler_start(1, channels, CHANNELS, &opts, &err);
+  ASSERT_NE(s, nullptr);
+  while (produced < total) usleep(100);
+  sampler_stats(s, &stats);
+  sampler_stop(s, NULL);
+
+  EXPECT_EQ(stats.frames, 256u);
+  EXPECT_EQ(stats.frames + stats.dropped, (unsigned long long)total);
+}
+
+TEST_F(Sampling, StopsOnError) {
+  short err;
+  const unsigned short *frames;
+  SamplerStats stats;
+  size_t read = 0;
+  size_t n;
+
+  total = 1000;
+  fail_after = 128;
+  Sampler *s = sampler_start(1, channels, CHANNELS, &opts, &err);
+  ASSERT_NE(s, nullptr);
+  while ((n = sampler_peek(s, &frames, 1000)) > 0) {
+    read += n;
+    sampler_release(s, n);
+  }
+  EXPECT_EQ(read, 128u);
+  EXPECT_FALSE(sampler_running(s));
+  sampler_stop(s, &stats);
+  EXPECT_EQ(stats.err, EW_SOCKET);
+}
+
+TEST_F(Sampling, ReportsRefusedSetup) {
+  short err;
+
+  cnc_sdtstartsmpl_fake.return_val = EW_NUMBER;
+  EXPECT_EQ(sampler_start(1, channels, CHANNELS, &opts, &err), nullptr);
+  EXPECT_EQ(err, EW_NUMBER);
+  EXPECT_EQ(cnc_sdtreadsmpl_fake.call_count, 0u);
+}
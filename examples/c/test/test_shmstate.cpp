@@ -0,0 +1,224 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/shmstate.h"
+}
+
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_SOCKET (-16)
+
+class ShmStateTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    snprintf(name, sizeof(name), "/fwstate-test-%d", (int)getpid());
+    opts = default_shm_options;
+    opts.ring_frames = 4;
+    opts.frame_bytes = 16;
+    pub = shmpub_create(name, 2, 2, sizes, &opts);
+    ASSERT_NE(pub, nullptr);
+  }
+  void TearDown() override { shmpub_destroy(pub); }
+
+  /* what the go and python readers are checked against: "mill" with
+   * handle 7 in row 1, 42.5 in its slot 0 */
+  void publish_table() {
+    static Signal sig = {SIGNAL_MACRO, 0, 0, 100, 1};
+    static double v = 42.5;
+    ShmSink sink = {pub, 1};
+    ValueUpdate ok = {7, 0, &sig, &v, sizeof(v), EW_OK, 0, 1.0};
+
+    ASSERT_EQ(shmpub_set_machine(pub, 0, 3, "lathe"), 0);
+    ASSERT_EQ(shmpub_set_machine(pub, 1, 7, "mill"), 0);
+    shmpub_value_fn(&ok, &sink);
+  }
+  /* output of a shell command, *status its exit status */
+  std::string run(const std::string &cmd, int *status) {
+    std::string out;
+    char buf[256];
+    size_t n;
+    FILE *p = popen(cmd.c_str(), "r");
+
+    if (p == NULL) {
+      *status = -1;
+      return out;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), p)) > 0) out.append(buf, n);
+    *status = pclose(p);
+    return out;
+  }
+
+  char name[64];
+  size_t sizes[2] = {8, 100};
+  ShmOptions opts;
+  ShmPublisher *pub;
+};
+
+TEST_F(ShmStateTest, ReaderSeesTheTable) {
+  Signal sig = {SIGNAL_MACRO, 0, 0, 100, 1};
+  double v = 42.5;
+  double out = 0;
+  StateInfo info;
+  ShmSink sink = {pub, 1};
+  ValueUpdate ok = {7, 0, &sig, &v, sizeof(v), EW_OK, 0, 1.0};
+
+  ASSERT_EQ(shmpub_set_machine(pub, 0, 3, "lathe"), 0);
+  ASSERT_EQ(shmpub_set_machine(pub, 1, 7, "mill"), 0);
+  EXPECT_EQ(shmpub_set_machine(pub, 2, 9, "none"), 1);
+  shmpub_value_fn(&ok, &sink);
+
+  // a separate process only maps the segment
+  pid_t child = fork();
+  if (child == 0) {
+    ShmReader *r = shmread_open(name);
+    int m = r ? shmread_find(r, 7) : -1;
+    int good = m == 1 && shmread_machines(r) == 2 && shmread_slots(r) == 2 &&
+               strcmp(shmread_name(r, m), "mill") == 0 &&
+               shmread_value(r, m, 0, &out, sizeof(out), &info) == 0 &&
+               out == 42.5 && info.version == 1 && info.time == 1.0 &&
+               shmread_value(r, 0, 0, &out, sizeof(out), &info) == 1;
+    _exit(good ? 0 : 1);
+  }
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  ShmReader *r = shmread_open(name);
+  ASSERT_NE(r, nullptr);
+  EXPECT_EQ(shmread_find(r, 4), -1);
+  v = 1.5;
+  shmpub_value_fn(&ok, &sink);
+  ASSERT_EQ(shmread_value(r, 1, 0, &out, sizeof(out), &info), 0);
+  EXPECT_EQ(out, 1.5);
+  EXPECT_EQ(info.version, 2u);
+  shmread_close(r);
+}
+
+TEST_F(ShmStateTest, ReadsEventsAndCountsLost) {
+  ShmReader *r = shmread_open(name);
+  ShmEvent ev;
+  char data[32];
+  unsigned long long lost = 0;
+
+  ASSERT_NE(r, nullptr);
+  EXPECT_EQ(shmread_event(r, &ev, data, sizeof(data), &lost), 0);
+
+  shmpub_event(pub, 1, 0, "first", 6, EW_OK, 1.0);
+  shmpub_event(pub, 1, 1, "a value longer than a frame", 28, EW_SOCKET, 2.0);
+  ASSERT_EQ(shmread_event(r, &ev, data, sizeof(data), &lost), 1);
+  EXPECT_EQ(ev.seq, 0u);
+  EXPECT_STREQ(data, "first");
+  ASSERT_EQ(shmread_event(r, &ev, data, sizeof(data), &lost), 1);
+  EXPECT_EQ(ev.slot, 1);
+  EXPECT_EQ(ev.err, EW_SOCKET);
+  EXPECT_EQ(ev.time, 2.0);
+  EXPECT_EQ(ev.size, 16u);
+  EXPECT_EQ(shmread_event(r, &ev, data, sizeof(data), &lost), 0);
+
+  // the ring holds four events, the reader fell six behind
+  for (int i = 0; i < 10; i++)
+    shmpub_event(pub, 0, 0, &i, sizeof(i), EW_OK, 3.0 + i);
+  int n = 0;
+  while (shmread_event(r, &ev, data, sizeof(data), &lost)) {
+    int i;
+    memcpy(&i, data, sizeof(i));
+    EXPECT_EQ(i, 6 + n);
+    n++;
+  }
+  EXPECT_EQ(n, 4);
+  EXPECT_EQ(lost, 6u);
+  shmread_close(r);
+}
+
+TEST_F(ShmStateTest, ReportsADeadPublisher) {
+  char other[80];
+  double v = 42.5;
+  double out = 0;
+  StateInfo info;
+  int status;
+
+  snprintf(other, sizeof(other), "%s-dead", name);
+  pid_t child = fork();
+  if (child == 0) {
+    ShmPublisher *p = shmpub_create(other, 1, 1, sizes, &opts);
+    if (p == NULL) _exit(1);
+    state_write(shmpub_table(p), 0, 0, &v, sizeof(v), EW_OK, 1.0);
+    _exit(0);  // without shmpub_destroy, the segment stays
+  }
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  ShmReader *r = shmread_open(other);
+  ASSERT_NE(r, nullptr);
+  ASSERT_EQ(shmread_value(r, 0, 0, &out, sizeof(out), &info), 0);
+  EXPECT_EQ(out, 42.5);
+
+  // as if it died while writing: the count of the slot is odd
+  int fd = shm_open(other, O_RDWR, 0);
+  ASSERT_GE(fd, 0);
+  char *mem = (char *)mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           fd, 0);
+  close(fd);
+  ASSERT_NE(mem, MAP_FAILED);
+  uint64_t table, slot;
+  memcpy(&table, mem + 32, sizeof(table));  // table_offset
+  memcpy(&slot, mem + 64, sizeof(slot));    // offset of slot 0
+  ++*(uint64_t *)(mem + table + slot);
+  EXPECT_EQ(shmread_value(r, 0, 0, &out, sizeof(out), &info), SHM_GONE);
+  munmap(mem, 4096);
+  shmread_close(r);
+
+  // the segment of the dead publisher is taken over, a running one is not
+  EXPECT_EQ(shmpub_create(name, 1, 1, sizes, &opts), nullptr);
+  ShmPublisher *p = shmpub_create(other, 1, 1, sizes, &opts);
+  ASSERT_NE(p, nullptr);
+  shmpub_destroy(p);
+}
+
+TEST_F(ShmStateTest, RejectsMissingSegments) {
+  EXPECT_EQ(shmread_open("/fwstate-test-missing"), nullptr);
+  shmpub_destroy(pub);
+  EXPECT_EQ(shmread_open(name), nullptr) << "unlinked";
+  pub = shmpub_create(name, 1, 1, sizes, NULL);
+  ASSERT_NE(pub, nullptr);
+}
+
+/* the readers of the other examples, on a segment of this one */
+TEST_F(ShmStateTest, PythonReaderSeesTheTable) {
+  int status;
+
+  if (system("python3 --version > /dev/null 2>&1") != 0)
+    GTEST_SKIP() << "no python3";
+  publish_table();
+  std::string out = run(
+      std::string("python3 ../../python/focas_state.py --name=") + name,
+      &status);
+  EXPECT_EQ(status, 0);
+  // 42.5 as a little endian double
+  EXPECT_EQ(out, "mill slot 0: err 0 version 1 0000000000404540\n");
+}
+
+TEST_F(ShmStateTest, GoReaderSeesTheTable) {
+  int status;
+
+  if (system("go version > /dev/null 2>&1") != 0) GTEST_SKIP() << "no go";
+  publish_table();
+  std::string out = run(std::string("cd ../../go && FWSTATE_TEST_NAME=") +
+                            name +
+                            " go test -count=1 -v -run TestPublishedSegment "
+                            "./shmstate 2>&1",
+                        &status);
+  EXPECT_EQ(status, 0) << out;
+  EXPECT_NE(out.find("--- PASS: TestPublishedSegment"), std::string::npos)
+      << out;
+}
@@ -0,0 +1,216 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
+extern "C" {
+  #include "../src/socwave.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_NUMBER 3
+#define EW_SOCKET (-16)
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_soc_wave_setchnl, unsigned short, short *);
+FAKE_VALUE_FUNC(short, cnc_rdsoc_wave_start, unsigned short, short);
+FAKE_VALUE_FUNC(short, cnc_rdsoc_wave, unsigned short, long *, unsigned short *);
+FAKE_VALUE_FUNC(short, cnc_rdsoc_wave_end, unsigned short);
+
+/* the cnc side: two channels, frame i holds (i, 1000 + i % 4), up to 64
+ * frames per read until `total` */
+static std::atomic<long> produced;
+static long total;
+static short selected[2];
+
+static short read_wave(unsigned short libh, long *num, unsigned short *data) {
+  long n = total - produced < 64 ? total - produced : 64;
+
+  if (n > *num) n = *num;
+  for (long i = 0; i < n; i++) {
+    long seq = produced + i;
+    data[i * 2] = (unsigned short)seq;
+    data[i * 2 + 1] = (unsigned short)(1000 + seq % 4);
+  }
+  produced += n;
+  *num = n;
+  return EW_OK;
+}
+
+static short set_channels(unsigned short libh, short *select) {
+  memcpy(selected, select, sizeof(selected));
+  return EW_OK;
+}
+
+class SocWaveTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_soc_wave_setchnl);
+    RESET_FAKE(cnc_rdsoc_wave_start);
+    RESET_FAKE(cnc_rdsoc_wave);
+    RESET_FAKE(cnc_rdsoc_wave_end);
+    cnc_rdsoc_wave_fake.custom_fake = read_wave;
+    cnc_soc_wave_setchnl_fake.custom_fake = set_channels;
+    produced = 0;
+    total = 0;
+    opts = default_soc_options;
+    opts.channels = 2;
+    opts.select[0] = 3;
+    opts.select[1] = 5;
+    opts.idle_us = 100;
+  }
+
+  /* read everything the stream produces until it has been quiet */
+  size_t drain(SocWave *w, float *out, size_t max) {
+    size_t read = 0;
+    size_t n;
+    while (read < max && (n = socwave_read(w, &out[read * 2], max - read, 200)) > 0)
+      read += n;
+    return read;
+  }
+  SocOptions opts;
+};
+
+TEST_F(SocWaveTest, PassesRawFramesThrough) {
+  static float out[5000 * 2];
+  SocStats stats;
+  short err;
+
+  total = 5000;
+  SocWave *w = socwave_start(1, &opts, &err);
+  ASSERT_NE(w, nullptr);
+  ASSERT_EQ(drain(w, out, 5000), 5000u);
+  EXPECT_EQ(socwave_stop(w, &stats), EW_OK);
+
+  EXPECT_EQ(selected[0], 3);
+  EXPECT_EQ(selected[1], 5);
+  EXPECT_EQ(cnc_rdsoc_wave_start_fake.arg1_val, 1);
+  EXPECT_EQ(cnc_rdsoc_wave_end_fake.call_count, 1u);
+  EXPECT_EQ(stats.sampled, 5000u);
+  EXPECT_EQ(stats.stored, 5000u);
+  EXPECT_EQ(stats.dropped, 0u);
+  for (int i = 0; i < 5000; i++) {
+    ASSERT_EQ(out[i * 2], (float)i);
+    ASSERT_EQ(out[i * 2 + 1], (float)(1000 + i % 4));
+  }
+}
+
+TEST_F(SocWaveTest, DropOldestKeepsNewestFrames) {
+  static float out[1024 * 2];
+  SocStats stats;
+  short err;
+
+  total = 3000;
+  opts.capacity = 1024;
+  SocWave *w = socwave_start(1, &opts, &err);
+  ASSERT_NE(w, nullptr);
+  while (produced < total) usleep(100);
+  usleep(2000);
+
+  ASSERT_EQ(socwave_read(w, out, 1024, 0), 1024u);
+  socwave_stop(w, &stats);
+  EXPECT_EQ(stats.dropped, 3000u - 1024u);
+  EXPECT_EQ(out[0], (float)(3000 - 1024));
+  EXPECT_EQ(out[1023 * 2], 2999.0f);
+}
+
+TEST_F(SocWaveTest, BlockLosesNothing) {
+  static float out[4000 * 2];
+  SocStats stats;
+  short err;
+
+  total = 4000;
+  opts.capacity = 100;
+  opts.overflow = SOC_BLOCK;
+  SocWave *w = socwave_start(1, &opts, &err);
+  ASSERT_NE(w, nullptr);
+  // let the producer run into the full ring before reading
+  usleep(20000);
+  EXPECT_LE(produced, 100 + 64);
+
+  ASSERT_EQ(drain(w, out, 4000), 4000u);
+  socwave_stop(w, &stats);
+  EXPECT_EQ(stats.dropped, 0u);
+  EXPECT_GT(stats.blocked, 0.0);
+  for (int i = 0; i < 4000; i++) ASSERT_EQ(out[i * 2], (float)i);
+}
+
+TEST_F(SocWaveTest, StopsWhileBlocked) {
+  SocStats stats;
+  short err;
+
+  total = 1000;
+  opts.capacity = 10;
+  opts.overflow = SOC_BLOCK;
+  SocWave *w = socwave_start(1, &opts, &err);
+  ASSERT_NE(w, nullptr);
+  usleep(10000);
+  EXPECT_EQ(socwave_stop(w, &stats), EW_OK);
+  EXPECT_EQ(stats.stored, 10u);
+}
+
+TEST_F(SocWaveTest, MeanDecimates) {
+  static float out[250 * 2];
+  short err;
+
+  total = 1000;
+  opts.reduce = SOC_MEAN;
+  opts.window = 4;
+  SocWave *w = socwave_start(1, &opts, &err);
+  ASSERT_NE(w, nullptr);
+  ASSERT_EQ(drain(w, out, 250), 250u);
+  socwave_stop(w, NULL);
+
+  for (int i = 0; i < 250; i++) {
+    ASSERT_FLOAT_EQ(out[i * 2], i * 4 + 1.5f);
+    ASSERT_FLOAT_EQ(out[i * 2 + 1], 1001.5f);
+  }
+}
+
+TEST_F(SocWaveTest, RmsAroundOffset) {
+  static float out[250 * 2];
+  short err;
+
+  total = 1000;
+  opts.reduce = SOC_RMS;
+  opts.window = 4;
+  opts.offset = 1000;
+  SocWave *w = socwave_start(1, &opts, &err);
+  ASSERT_NE(w, nullptr);
+  ASSERT_EQ(drain(w, out, 250), 250u);
+  socwave_stop(w, NULL);
+
+  // the second channel cycles through 0, 1, 2, 3 above the offset
+  for (int i = 0; i < 250; i++)
+    ASSERT_FLOAT_EQ(out[i * 2 + 1], sqrtf((0 + 1 + 4 + 9) / 4.0f));
+}
+
+TEST_F(SocWaveTest, RejectsBadOptions) {
+  short err;
+
+  opts.channels = SOC_MAX_CHANNELS + 1;
+  EXPECT_EQ(socwave_start(1, &opts, &err), nullptr);
+  EXPECT_EQ(err, EW_NUMBER);
+  EXPECT_EQ(cnc_rdsoc_wave_start_fake.call_count, 0u);
+}
+
+TEST_F(SocWaveTest, ReportsReadError) {
+  float out[2];
+  SocStats stats;
+  short err;
+
+  cnc_rdsoc_wave_fake.custom_fake = NULL;
+  cnc_rdsoc_wave_fake.return_val = EW_SOCKET;
+  SocWave *w = socwave_start(1, &opts, &err);
+  ASSERT_NE(w, nullptr);
+  EXPECT_EQ(socwave_read(w, out, 1, 1000), 0u);
+  EXPECT_FALSE(socwave_running(w));
+  socwave_stop(w, &stats);
+  EXPECT_EQ(stats.err, EW_SOCKET);
+}
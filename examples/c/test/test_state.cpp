@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include "../src/state.h"
+}
+
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_SOCKET (-16)
+
+TEST(State, ReadsLatestValue) {
+  size_t sizes[] = {16, 100};
+  StateTable *t = state_create(2, 2, sizes);
+  StateInfo info;
+  char buf[128];
+
+  ASSERT_NE(t, nullptr);
+  EXPECT_EQ(state_read(t, 1, 1, buf, sizeof(buf), &info), 1) << "never written";
+  EXPECT_EQ(state_read(t, 2, 0, buf, sizeof(buf), &info), 1) << "no machine 2";
+
+  state_write(t, 1, 1, "first", 6, EW_OK, 1.0);
+  state_write(t, 1, 1, "second", 7, EW_OK, 2.0);
+  ASSERT_EQ(state_read(t, 1, 1, buf, sizeof(buf), &info), 0);
+  EXPECT_STREQ(buf, "second");
+  EXPECT_EQ(info.version, 2u);
+  EXPECT_EQ(info.time, 2.0);
+  EXPECT_EQ(info.size, 7u);
+  EXPECT_EQ(state_read(t, 0, 1, buf, sizeof(buf), &info), 1) << "other machine";
+
+  // larger than the slot
+  memset(buf, 'x', sizeof(buf));
+  state_write(t, 0, 0, buf, sizeof(buf), EW_OK, 3.0);
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ(state_read(t, 0, 0, buf, sizeof(buf), &info), 0);
+  EXPECT_EQ(info.size, 16u);
+  EXPECT_EQ(buf[15], 'x');
+  EXPECT_EQ(buf[16], 0);
+  state_destroy(t);
+}
+
+TEST(State, ReadersNeverSeeTornValues) {
+  size_t sizes[] = {8, 256, 8};
+  StateTable *t = state_create(1, 3, sizes);
+  std::atomic<bool> stop(false);
+  std::atomic<unsigned long> reads(0);
+  std::atomic<unsigned long> torn(0);
+  std::vector<std::thread> readers;
+
+  ASSERT_NE(t, nullptr);
+  std::thread writer([&] {
+    unsigned char value[256];
+    for (unsigned long n = 1; !stop; n++) {
+      memset(value, (int)(n & 0xff), sizeof(value));
+      state_write(t, 0, 1, value, sizeof(value), EW_OK, (double)(n & 0xff));
+    }
+  });
+  for (int r = 0; r < 3; r++) {
+    readers.emplace_back([&] {
+      unsigned char value[256];
+      StateInfo info;
+      while (!stop) {
+        if (state_read(t, 0, 1, value, sizeof(value), &info)) continue;
+        for (size_t i = 1; i < sizeof(value); i++) {
+          if (value[i] != value[0] || info.time != value[0]) {
+            torn++;
+            break;
+          }
+        }
+        reads++;
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  stop = true;
+  writer.join();
+  for (auto &r : readers) r.join();
+
+  EXPECT_GT(reads.load(), 1000u);
+  EXPECT_EQ(torn.load(), 0u);
+  state_destroy(t);
+}
+
+TEST(State, GivesUpOnALockedSlot) {
+  size_t sizes[] = {8};
+  size_t bytes = state_bytes(1, 1, sizes);
+  void *mem = aligned_alloc(STATE_CACHE_LINE, bytes);
+  StateTable *t = state_attach(mem, 1, 1, sizes, 1);
+  double v = 42.5;
+  double out = 0;
+  StateInfo info;
+
+  ASSERT_NE(t, nullptr);
+  state_write(t, 0, 0, &v, sizeof(v), EW_OK, 1.0);
+  // a writer that died in the middle leaves the count odd
+  uint64_t *seq = (uint64_t *)((char *)mem + state_slot_offset(t, 0));
+  ++*seq;
+  EXPECT_EQ(state_read(t, 0, 0, &out, sizeof(out), &info), STATE_BUSY);
+  ++*seq;
+  ASSERT_EQ(state_read(t, 0, 0, &out, sizeof(out), &info), 0);
+  EXPECT_EQ(out, 42.5);
+  state_destroy(t);
+  free(mem);
+}
+
+TEST(State, SinkKeepsLastGoodValue) {
+  size_t sizes[] = {8, 8};
+  StateTable *t = state_create(3, 2, sizes);
+  StateSink sink = {t, 2};
+  Signal sig = {SIGNAL_MACRO, 0, 0, 100, 1};
+  double v = 42.5;
+  double out = 0;
+  StateInfo info;
+
+  ValueUpdate ok = {7, 1, &sig, &v, sizeof(v), EW_OK, 0, 1.0};
+  ValueUpdate failed = {7, 1, &sig, NULL, 0, EW_SOCKET, 0, 2.0};
+  state_value_fn(&ok, &sink);
+  state_value_fn(&failed, &sink);
+
+  ASSERT_EQ(state_read(t, 2, 1, &out, sizeof(out), &info), 0);
+  EXPECT_EQ(out, 42.5);
+  EXPECT_EQ(info.err, EW_SOCKET);
+  EXPECT_EQ(info.time, 2.0);
+  EXPECT_EQ(info.version, 2u);
+
+  // an error before any value still shows up
+  failed.signal = 0;
+  state_value_fn(&failed, &sink);
+  ASSERT_EQ(state_read(t, 2, 0, &out, sizeof(out), &info), 0);
+  EXPECT_EQ(info.err, EW_SOCKET);
+  EXPECT_EQ(info.size, 0u);
+  state_destroy(t);
+}
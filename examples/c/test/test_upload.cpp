@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/upload.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_BUFFER 10
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_upstart4, unsigned short, short, char *);
+FAKE_VALUE_FUNC(short, cnc_upload4, unsigned short, long *, char *);
+FAKE_VALUE_FUNC(short, cnc_upend4, unsigned short);
+
+static std::string program;
+static size_t offset;
+static int calls;
+static long largest;  // request seen
+
+/* serves `program` in pieces, answering EW_BUFFER every third call. a
+ * round trip of 1 ms outweighs the copy, so a larger request moves more
+ * bytes per second, as on a cnc, and the tuning has a reason to grow it
+ * that scheduling noise of a few 100 us does not take away. */
+static short serve_upload(unsigned short libh, long *len, char *buf) {
+  if (++calls % 3 == 0) return EW_BUFFER;
+  if (*len > largest) largest = *len;
+  usleep(1000);
+  size_t n = program.size() - offset;
+  if (n > (size_t)*len) n = (size_t)*len;
+  memcpy(buf, program.data() + offset, n);
+  offset += n;
+  *len = (long)n;
+  return EW_OK;
+}
+
+static int collect(const char *buf, size_t len, void *ctx) {
+  ((std::string *)ctx)->append(buf, len);
+  return 0;
+}
+
+static void count_progress(const UploadStats *stats, void *ctx) {
+  (*(int *)ctx)++;
+}
+
+class Upload : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_upstart4);
+    RESET_FAKE(cnc_upload4);
+    RESET_FAKE(cnc_upend4);
+    program = "%\nO1234\n";
+    for (int i = 0; i < 20000; i++) program += "G01 X1.000 Y2.000 F100.\n";
+    program += "M30\n%";
+    offset = 0;
+    calls = 0;
+    largest = 0;
+    cnc_upload4_fake.custom_fake = serve_upload;
+  }
+};
+
+TEST_F(Upload, StreamsWholeProgram) {
+  std::string out;
+  UploadStats stats;
+  int progress = 0;
+  UploadOptions opts = default_upload_options;
+  opts.buffer_size = 16384;
+  opts.max_chunk = 8192;
+  opts.progress = count_progress;
+  opts.ctx = &progress;
+
+  ASSERT_EQ(upload_stream(1, 0, "O1234", collect, &out, &opts, &stats), 0);
+
+  EXPECT_EQ(out, program);
+  EXPECT_EQ(stats.bytes, program.size());
+  EXPECT_GT(stats.retries, 0u);
+  EXPECT_GT(largest, (long)opts.min_chunk) << "chunk size should grow";
+  EXPECT_GT(progress, 1);
+  EXPECT_STREQ(cnc_upstart4_fake.arg2_val, "O1234");
+  EXPECT_EQ(cnc_upend4_fake.call_count, 1u);
+}
+
+TEST_F(Upload, WritesFile) {
+  const char path[] = "./upload_test.nc";
+  char buf[64];
+
+  program = "%\nO1\nM30\n%";
+  ASSERT_EQ(upload_to_file(1, 0, "O1", path, NULL, NULL), 0);
+
+  FILE *fp = fopen(path, "rb");
+  ASSERT_NE(fp, nullptr);
+  size_t n = fread(buf, 1, sizeof(buf), fp);
+  fclose(fp);
+  remove(path);
+  EXPECT_EQ(std::string(buf, n), program);
+}
+
+TEST_F(Upload, StopsOnCncError) {
+  std::string out;
+  short codes[] = {EW_OK, -16};
+  cnc_upload4_fake.custom_fake = NULL;
+  SET_RETURN_SEQ(cnc_upload4, codes, 2);
+
+  EXPECT_NE(upload_stream(1, 0, "O1", collect, &out, NULL, NULL), 0);
+  EXPECT_EQ(cnc_upend4_fake.call_count, 1u) << "upload must be ended";
+}
+
+TEST_F(Upload, StartFailureSkipsEnd) {
+  std::string out;
+  cnc_upstart4_fake.return_val = 5;
+
+  EXPECT_NE(upload_stream(1, 0, "O1", collect, &out, NULL, NULL), 0);
+  EXPECT_EQ(cnc_upload4_fake.call_count, 0u);
+  EXPECT_EQ(cnc_upend4_fake.call_count, 0u);
+}
@@ -0,0 +1,197 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+  #include "../src/wave.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_BUSY (-1)
+#define EW_SOCKET (-16)
+
+/* same layout as ODBWVDT */
+struct odbwvdt {
+  short channel;
+  short kind;
+  short axis;
+  short io;
+  char year, month, day, hour, minute, second;
+  short t_cycle;
+  short data[8192];
+};
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_wrwaveprm2, unsigned short, void *);
+FAKE_VALUE_FUNC(short, cnc_wavestart, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_wavestop, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_wavestat, unsigned short, short *);
+FAKE_VALUE_FUNC(short, cnc_rdwavecount, unsigned short, short, long *);
+FAKE_VALUE_FUNC(short, cnc_rdwavedata, unsigned short, short, short, long,
+                long *, void *);
+
+#define SAMPLES 20000
+
+static short sample(int channel, long pos) {
+  return (short)(3000 * sin(pos / (50.0 * channel)) + channel * 100);
+}
+
+static short stat_seq[] = {1, 1, 2, 2, 0};
+
+static short wave_count(unsigned short libh, short type, long *count) {
+  *count = SAMPLES;
+  return EW_OK;
+}
+
+/* hands out at most 5000 samples per call */
+static short wave_data(unsigned short libh, short s, short e, long start,
+                       long *len, void *data) {
+  struct odbwvdt *buf = (struct odbwvdt *)data;
+  if (*len > 5000) *len = 5000;
+  buf->channel = s;
+  buf->year = 26;
+  buf->month = 10;
+  buf->day = 18;
+  buf->hour = 8;
+  buf->t_cycle = 1;
+  for (long i = 0; i < *len; i++) buf->data[i] = sample(s, start + i);
+  return EW_OK;
+}
+
+class Wave : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_wrwaveprm2);
+    RESET_FAKE(cnc_wavestart);
+    RESET_FAKE(cnc_wavestop);
+    RESET_FAKE(cnc_wavestat);
+    RESET_FAKE(cnc_rdwavecount);
+    RESET_FAKE(cnc_rdwavedata);
+    cnc_wavestat_fake.custom_fake = [](unsigned short, short *stat) -> short {
+      unsigned n = cnc_wavestat_fake.call_count - 1;
+      *stat = stat_seq[n < 4 ? n : 4];
+      return EW_OK;
+    };
+    cnc_rdwavecount_fake.custom_fake = wave_count;
+    cnc_rdwavedata_fake.custom_fake = wave_data;
+
+    memset(&config, 0, sizeof(config));
+    config.range = 20000;
+    config.channels = 3;
+    for (int i = 0; i < 3; i++) {
+      config.ch[i].kind = 1;
+      config.ch[i].axis = i + 1;
+      snprintf(config.ch[i].unit, sizeof(config.ch[i].unit), "%%");
+    }
+    opts = default_wave_options;
+    opts.poll_min_us = 100;
+    opts.poll_max_us = 1000;
+
+    char tmpl[] = "/tmp/focas-wave-XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    dir = tmpl;
+    path = dir + "/capture.fwave";
+  }
+  void TearDown() override {
+    std::string cmd = "rm -rf " + dir;
+    system(cmd.c_str());
+  }
+  WaveConfig config;
+  WaveOptions opts;
+  std::string dir;
+  std::string path;
+};
+
+TEST_F(Wave, CapturesColumns) {
+  WaveStats stats;
+  WaveInfo info;
+
+  ASSERT_EQ(wave_capture(1, &config, path.c_str(), &opts, &stats), EW_OK);
+  EXPECT_EQ(cnc_wavestat_fake.call_count, 5u);
+  EXPECT_EQ(stats.reads, 12u);
+  EXPECT_EQ(stats.samples, 3u * SAMPLES);
+  // slow moving signals need about one byte per sample instead of two
+  EXPECT_LT(stats.bytes, stats.samples * sizeof(short) * 6 / 10);
+
+  ASSERT_EQ(wavefile_read_info(path.c_str(), &info), 0);
+  EXPECT_EQ(info.channels, 3);
+  EXPECT_EQ(info.period_us, 1000u);
+  EXPECT_STREQ(info.started, "2026-10-18 08:00:00");
+  EXPECT_EQ(info.ch[2].axis, 3);
+  EXPECT_STREQ(info.ch[2].unit, "%");
+
+  for (int ch = 0; ch < 3; ch++) {
+    short *samples;
+    size_t count;
+    ASSERT_EQ(wavefile_read_column(path.c_str(), ch, &samples, &count), 0);
+    ASSERT_EQ(count, (size_t)SAMPLES);
+    for (size_t i = 0; i < count; i++) {
+      ASSERT_EQ(samples[i], sample(ch + 1, i + 1)) << "sample " << i;
+    }
+    free(samples);
+  }
+}
+
+TEST(WaveFile, EncodesFullRange) {
+  char tmpl[] = "/tmp/focas-wavefile-XXXXXX";
+  int fd = mkstemp(tmpl);
+  short extremes[] = {-32768, 32767, -32768, 0, 1, -1, 32767};
+  WaveInfo info;
+  short *samples;
+  size_t count;
+
+  ASSERT_GE(fd, 0);
+  close(fd);
+  memset(&info, 0, sizeof(info));
+  info.channels = 2;
+  WaveWriter *w = wavefile_create(tmpl, &info);
+  ASSERT_NE(w, nullptr);
+  // channel 0 stays empty
+  ASSERT_EQ(wavefile_append(w, 1, extremes, 7), 0);
+  EXPECT_EQ(wavefile_append(w, 0, extremes, 1), 1) << "columns go in order";
+  ASSERT_GT(wavefile_commit(w), 0u);
+
+  ASSERT_EQ(wavefile_read_column(tmpl, 0, &samples, &count), 0);
+  EXPECT_EQ(count, 0u);
+  free(samples);
+  ASSERT_EQ(wavefile_read_column(tmpl, 1, &samples, &count), 0);
+  ASSERT_EQ(count, 7u);
+  EXPECT_EQ(memcmp(samples, extremes, sizeof(extremes)), 0);
+  free(samples);
+  unlink(tmpl);
+}
+
+TEST_F(Wave, TimesOutWaitingForTrigger) {
+  WaveStats stats;
+  struct stat st;
+
+  cnc_wavestat_fake.custom_fake = [](unsigned short, short *stat) -> short {
+    *stat = 1;
+    return EW_OK;
+  };
+  opts.timeout = 50;
+  EXPECT_EQ(wave_capture(1, &config, path.c_str(), &opts, &stats), EW_BUSY);
+  EXPECT_EQ(cnc_wavestop_fake.call_count, 1u);
+  EXPECT_GT(stats.polls, 1u);
+  EXPECT_NE(stat(path.c_str(), &st), 0);
+}
+
+TEST_F(Wave, LeavesNoFileOnReadError) {
+  WaveStats stats;
+  struct stat st;
+
+  cnc_rdwavedata_fake.custom_fake = NULL;
+  cnc_rdwavedata_fake.return_val = EW_SOCKET;
+  EXPECT_EQ(wave_capture(1, &config, path.c_str(), &opts, &stats), EW_SOCKET);
+  EXPECT_NE(stat(path.c_str(), &st), 0);
+  std::string cmd = "test -z \"$(ls " + dir + ")\"";
+  EXPECT_EQ(system(cmd.c_str()), 0) << "temporary file left behind";
+}
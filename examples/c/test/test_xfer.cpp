@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+  #include "../src/xfer.h"
+}
+
+#include "../extern/fff/fff.h"
+#include "gtest/gtest.h"
+
+#define EW_OK 0
+#define EW_BUSY (-1)
+
+DEFINE_FFF_GLOBALS;
+FAKE_VALUE_FUNC(short, cnc_pdf_read_start, unsigned short, short, char *, char *, short);
+FAKE_VALUE_FUNC(short, cnc_pdf_read_poll, unsigned short, short *, char *, char *);
+FAKE_VALUE_FUNC(short, cnc_pdf_read_end, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_pdf_cpmv_start, unsigned short, short, char *, char *, short);
+FAKE_VALUE_FUNC(short, cnc_pdf_cpmv_poll, unsigned short, short *, char *);
+FAKE_VALUE_FUNC(short, cnc_pdf_cpmv_end, unsigned short);
+FAKE_VALUE_FUNC(short, cnc_start_async_pdf_punch, unsigned short, long, char *, char *);
+FAKE_VALUE_FUNC(short, cnc_end_async_pdf_punch, unsigned short, short *);
+
+/* polls left per handle, -1 when no transfer is active on it */
+static std::map<unsigned short, int> active;
+static int overlaps;
+
+static short start_cpmv(unsigned short libh, short mode, char *src, char *dst,
+                        short option) {
+  if (active.count(libh) && active[libh] >= 0) overlaps++;
+  active[libh] = 3;
+  return EW_OK;
+}
+
+static short poll_cpmv(unsigned short libh, short *status, char *file) {
+  int left = active[libh]--;
+  snprintf(file, 16, "file%d", left);
+  *status = left > 0 ? 1 : 0;
+  return EW_OK;
+}
+
+static short end_cpmv(unsigned short libh) {
+  active[libh] = -1;
+  return EW_OK;
+}
+
+struct Done {
+  std::vector<XferResult> results;
+  std::vector<std::string> sources;
+};
+
+static void record(const XferResult *r, void *ctx) {
+  Done *d = (Done *)ctx;
+  d->results.push_back(*r);
+  d->sources.push_back(r->src);
+}
+
+class Xfer : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    RESET_FAKE(cnc_pdf_read_start);
+    RESET_FAKE(cnc_pdf_read_poll);
+    RESET_FAKE(cnc_pdf_read_end);
+    RESET_FAKE(cnc_pdf_cpmv_start);
+    RESET_FAKE(cnc_pdf_cpmv_poll);
+    RESET_FAKE(cnc_pdf_cpmv_end);
+    RESET_FAKE(cnc_start_async_pdf_punch);
+    RESET_FAKE(cnc_end_async_pdf_punch);
+    cnc_pdf_cpmv_start_fake.custom_fake = start_cpmv;
+    cnc_pdf_cpmv_poll_fake.custom_fake = poll_cpmv;
+    cnc_pdf_cpmv_end_fake.custom_fake = end_cpmv;
+    active.clear();
+    overlaps = 0;
+    m = xfer_create();
+    ASSERT_NE(m, nullptr);
+  }
+  void TearDown() override { xfer_destroy(m); }
+  XferManager *m;
+  Done done;
+};
+
+TEST_F(Xfer, DrivesManyHandlesFromOneThread) {
+  char src[64];
+  for (unsigned short h = 1; h <= 50; h++) {
+    for (int i = 0; i < 3; i++) {
+      snprintf(src, sizeof(src), "//CNC_MEM/USER/PATH1/O%d", h * 10 + i);
+      ASSERT_EQ(xfer_submit(m, h, XFER_COPY, src, "//DATA_SV/", 0, record,
+                            &done), 0);
+    }
+  }
+  EXPECT_EQ(xfer_pending(m), 150);
+
+  ASSERT_EQ(xfer_run(m, 10000), 0);
+  ASSERT_EQ(done.results.size(), 150u);
+  EXPECT_EQ(overlaps, 0) << "one transfer per handle at a time";
+  EXPECT_EQ(cnc_pdf_cpmv_end_fake.call_count, 150u);
+  std::map<unsigned short, int> last;
+  for (size_t i = 0; i < done.results.size(); i++) {
+    const XferResult &r = done.results[i];
+    int number = atoi(done.sources[i].c_str() + strlen("//CNC_MEM/USER/PATH1/O"));
+    EXPECT_EQ(r.err, EW_OK);
+    EXPECT_EQ(r.polls, 4u);
+    // transfers of a handle run in submission order
+    EXPECT_GT(number, last[r.libh]);
+    last[r.libh] = number;
+  }
+}
+
+TEST_F(Xfer, RetriesBusyStart) {
+  short codes[] = {EW_BUSY, EW_BUSY, EW_OK};
+  cnc_pdf_cpmv_start_fake.custom_fake = NULL;
+  SET_RETURN_SEQ(cnc_pdf_cpmv_start, codes, 3);
+  cnc_pdf_cpmv_poll_fake.custom_fake = NULL;
+
+  xfer_submit(m, 1, XFER_MOVE, "a", "b", 0, record, &done);
+  ASSERT_EQ(xfer_run(m, 5000), 0);
+  EXPECT_EQ(cnc_pdf_cpmv_start_fake.call_count, 3u);
+  EXPECT_EQ(cnc_pdf_cpmv_start_fake.arg1_val, 1) << "move mode";
+  ASSERT_EQ(done.results.size(), 1u);
+  EXPECT_EQ(done.results[0].err, EW_OK);
+}
+
+TEST_F(Xfer, EndsTransferAfterPollError) {
+  cnc_pdf_read_poll_fake.return_val = -16;
+
+  xfer_submit(m, 7, XFER_READ, "//CNC_MEM/USER/PATH1/O1", "//DATA_SV/", 1,
+              record, &done);
+  ASSERT_EQ(xfer_run(m, 5000), 0);
+  EXPECT_EQ(cnc_pdf_read_end_fake.call_count, 1u);
+  ASSERT_EQ(done.results.size(), 1u);
+  EXPECT_EQ(done.results[0].err, -16);
+}
+
+TEST_F(Xfer, PollsPunchUntilDone) {
+  short codes[] = {EW_BUSY, EW_BUSY, EW_BUSY, EW_OK};
+  SET_RETURN_SEQ(cnc_end_async_pdf_punch, codes, 4);
+
+  xfer_submit(m, 2, XFER_PUNCH, "//CNC_MEM/USER/PATH1/O1", "", 0, record,
+              &done);
+  ASSERT_EQ(xfer_run(m, 5000), 0);
+  EXPECT_EQ(cnc_end_async_pdf_punch_fake.call_count, 4u);
+  ASSERT_EQ(done.results.size(), 1u);
+  EXPECT_EQ(done.results[0].err, EW_OK);
+}
+
+TEST_F(Xfer, RunTimesOut) {
+  cnc_pdf_read_poll_fake.custom_fake = [](unsigned short, short *status,
+                                          char *, char *) -> short {
+    *status = 1;
+    return EW_OK;
+  };
+  xfer_submit(m, 3, XFER_READ, "a", "b", 0, record, &done);
+  xfer_submit(m, 3, XFER_READ, "c", "d", 0, record, &done);
+
+  EXPECT_EQ(xfer_run(m, 50), 2);
+  EXPECT_EQ(cnc_pdf_read_start_fake.call_count, 1u);
+  EXPECT_TRUE(done.results.empty());
+}
@@ -0,0 +1,4 @@
+// cgo only compiles C files of the package directory, pull in the sampling
+// engine of the C example
+#include "../c/src/sampling.c"
+#include "../c/src/spsc.c"
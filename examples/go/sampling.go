@@ -0,0 +1,133 @@
+package main
+
+/*
+#cgo CFLAGS: -I../c/src -I../..
+#cgo LDFLAGS: -lpthread
+#include <stdlib.h>
+#include "../../fwlib32.h"
+#include "sampling.h"
+*/
+import "C"
+
+import (
+	"fmt"
+	"time"
+	"unsafe"
+)
+
+// SamplerChannel selects one servo / spindle signal, same layout as IDBSDTCHAN
+type SamplerChannel struct {
+	Type  int16
+	Chno  int8
+	Axis  int8
+	Shift uint16
+}
+
+// SamplerOptions, the zero value of a field keeps the library default
+type SamplerOptions struct {
+	Type     int16
+	Period   int
+	Capacity int
+	Batch    int
+}
+
+type SamplerStats struct {
+	Frames  uint64
+	Dropped uint64
+	Reads   uint64
+	Status  int16
+	Err     int16
+}
+
+// Sampler drains cnc_sdtreadsmpl on a C thread into a lock-free ring
+type Sampler struct {
+	s        *C.Sampler
+	channels int
+}
+
+func StartSampling(libh C.ushort, channels []SamplerChannel, opts SamplerOptions) (*Sampler, error) {
+	var ret C.short
+
+	if len(channels) == 0 {
+		return nil, fmt.Errorf("no channels")
+	}
+	o := C.default_sampler_options
+	if opts.Type != 0 {
+		o._type = C.short(opts.Type)
+	}
+	if opts.Period != 0 {
+		o.period = C.long(opts.Period)
+	}
+	if opts.Capacity != 0 {
+		o.capacity = C.size_t(opts.Capacity)
+	}
+	if opts.Batch != 0 {
+		o.batch = C.long(opts.Batch)
+	}
+
+	chans := (*C.SamplerChannel)(C.malloc(C.size_t(len(channels)) * C.sizeof_SamplerChannel))
+	defer C.free(unsafe.Pointer(chans))
+	for i, ch := range channels {
+		c := (*C.SamplerChannel)(unsafe.Pointer(uintptr(unsafe.Pointer(chans)) + uintptr(i)*C.sizeof_SamplerChannel))
+		c._type = C.short(ch.Type)
+		c.chno = C.char(ch.Chno)
+		c.axis = C.char(ch.Axis)
+		c.shift = C.ushort(ch.Shift)
+	}
+
+	s := C.sampler_start(libh, chans, C.short(len(channels)), &o, &ret)
+	if s == nil {
+		return nil, fmt.Errorf("sampler_start failed (%d)", ret)
+	}
+	return &Sampler{s: s, channels: len(channels)}, nil
+}
+
+// Channels is the number of values in each frame
+func (s *Sampler) Channels() int {
+	return s.channels
+}
+
+// Read waits up to timeout for frames and returns them in place, frame i
+// channel c is at [i*Channels()+c]. The slice points into the ring and is
+// only valid until Release.
+func (s *Sampler) Read(timeout time.Duration) []uint16 {
+	var frames *C.ushort
+
+	n := int(C.sampler_peek(s.s, &frames, C.long(timeout/time.Millisecond)))
+	if n == 0 {
+		return nil
+	}
+	n *= s.channels
+	return (*[1 << 28]uint16)(unsafe.Pointer(frames))[:n:n]
+}
+
+// Release hands the first `frames` frames returned by Read back to the ring
+func (s *Sampler) Release(frames int) {
+	C.sampler_release(s.s, C.size_t(frames))
+}
+
+func (s *Sampler) Running() bool {
+	return C.sampler_running(s.s) != 0
+}
+
+func (s *Sampler) Stats() SamplerStats {
+	var st C.SamplerStats
+
+	C.sampler_stats(s.s, &st)
+	return SamplerStats{uint64(st.frames), uint64(st.dropped), uint64(st.reads),
+		int16(st.status), int16(st.err)}
+}
+
+// Stop ends sampling, slices returned by Read must not be used afterwards
+func (s *Sampler) Stop() (SamplerStats, error) {
+	var st C.SamplerStats
+
+	ret := C.sampler_stop(s.s, &st)
+	s.s = nil
+	stats := SamplerStats{uint64(st.frames), uint64(st.dropped), uint64(st.reads),
+		int16(st.status), int16(st.err)}
+	if ret != C.EW_OK {
+		return stats, fmt.Errorf("cnc_sdtendsmpl failed (%d)", ret)
+	}
+	return stats, nil
+}
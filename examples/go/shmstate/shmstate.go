@@ -0,0 +1,251 @@
+// Package shmstate reads the machine state the C poller publishes in POSIX
+// shared memory (examples/c/src/shmstate.h), without cgo or a FOCAS handle.
+package shmstate
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"math"
+	"os"
+	"runtime"
+	"strings"
+	"sync/atomic"
+	"syscall"
+	"unsafe"
+)
+
+const (
+	magic       = "FWSTATE\x00"
+	version     = 1
+	cacheLine   = 64
+	slotHeader  = 32
+	frameHeader = 32
+	headerSize  = 64
+	nameLen     = 28
+	// reads of a slot its writer holds before Value gives up, as state_read
+	readTries = 1000
+)
+
+var (
+	// ErrNotWritten is returned by Value for a slot that was never written
+	ErrNotWritten = errors.New("slot was never written")
+	// ErrBusy is returned by Value for a slot its writer holds
+	ErrBusy = errors.New("slot stays locked by its writer")
+	// ErrGone is returned by Value for a slot that stays locked because the
+	// publisher died while writing it
+	ErrGone = errors.New("publisher died while writing the slot")
+)
+
+// Info of a value, same as StateInfo
+type Info struct {
+	Version uint64
+	Time    float64
+	Err     int16
+	Size    int
+}
+
+// Event of the ring, Lost counts the events overwritten before this one
+type Event struct {
+	Seq     uint64
+	Time    float64
+	Machine int
+	Slot    int
+	Err     int16
+	Lost    uint64
+	Data    []byte
+}
+
+type slotEntry struct {
+	offset uint64
+	size   uint64
+}
+
+// Reader maps a published segment read-only, not safe for concurrent Events
+type Reader struct {
+	mem        []byte
+	Machines   int
+	Slots      int
+	Pid        int
+	handles    []uint16
+	names      []string
+	slots      []slotEntry
+	stride     uint64
+	table      uint64
+	ring       uint64
+	frames     uint64
+	frameBytes uint64
+	next       uint64
+}
+
+var le = binary.LittleEndian
+
+func roundLine(n uint64) uint64 {
+	return (n + cacheLine - 1) &^ (cacheLine - 1)
+}
+
+// Open maps the segment of name, e.g. "/fwstate"
+func Open(name string) (*Reader, error) {
+	f, err := os.Open("/dev/shm/" + strings.TrimPrefix(name, "/"))
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	st, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if st.Size() < headerSize {
+		return nil, fmt.Errorf("%s is not a state segment", name)
+	}
+	mem, err := syscall.Mmap(int(f.Fd()), 0, int(st.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, err
+	}
+	r := &Reader{mem: mem}
+	if string(mem[:8]) != magic || le.Uint32(mem[8:]) != version {
+		r.Close()
+		return nil, fmt.Errorf("%s is not a version %d state segment", name, version)
+	}
+	r.Machines = int(le.Uint32(mem[16:]))
+	r.Slots = int(le.Uint32(mem[20:]))
+	r.stride = le.Uint64(mem[24:])
+	r.table = le.Uint64(mem[32:])
+	r.ring = le.Uint64(mem[40:])
+	r.frames = uint64(le.Uint32(mem[48:]))
+	r.frameBytes = uint64(le.Uint32(mem[52:]))
+	r.Pid = int(le.Uint32(mem[56:]))
+	if r.ring+cacheLine+r.frames*roundLine(frameHeader+r.frameBytes) > uint64(len(mem)) {
+		r.Close()
+		return nil, fmt.Errorf("%s is truncated", name)
+	}
+	at := uint64(headerSize)
+	for i := 0; i < r.Slots; i++ {
+		r.slots = append(r.slots, slotEntry{le.Uint64(mem[at:]), le.Uint64(mem[at+8:])})
+		at += 16
+	}
+	for i := 0; i < r.Machines; i++ {
+		r.handles = append(r.handles, uint16(le.Uint32(mem[at:])))
+		name := mem[at+4 : at+4+nameLen]
+		if n := strings.IndexByte(string(name), 0); n >= 0 {
+			name = name[:n]
+		}
+		r.names = append(r.names, string(name))
+		at += 4 + nameLen
+	}
+	if r.frames > 0 {
+		r.next = r.load(r.ring)
+	}
+	return r, nil
+}
+
+func (r *Reader) Close() error {
+	return syscall.Munmap(r.mem)
+}
+
+func (r *Reader) load(at uint64) uint64 {
+	return atomic.LoadUint64((*uint64)(unsafe.Pointer(&r.mem[at])))
+}
+
+// Find returns the machine row of a handle, -1 when it is not published
+func (r *Reader) Find(libh uint16) int {
+	for i, h := range r.handles {
+		if h == libh {
+			return i
+		}
+	}
+	return -1
+}
+
+func (r *Reader) Name(machine int) string {
+	return r.names[machine]
+}
+
+// Alive is false once the publishing process is gone
+func (r *Reader) Alive() bool {
+	return r.Pid != 0 && syscall.Kill(r.Pid, 0) != syscall.ESRCH
+}
+
+// Value copies the latest value of a slot
+func (r *Reader) Value(machine, slot int) (data []byte, info Info, err error) {
+	if machine < 0 || machine >= r.Machines || slot < 0 || slot >= r.Slots {
+		return nil, info, fmt.Errorf("no slot %d of machine %d", slot, machine)
+	}
+	s := r.slots[slot]
+	at := r.table + uint64(machine)*r.stride + s.offset
+	for tries := 0; tries < readTries; tries++ {
+		if tries > 0 {
+			runtime.Gosched()
+		}
+		before := r.load(at)
+		if before&1 != 0 {
+			continue
+		}
+		if before == 0 {
+			return nil, info, ErrNotWritten
+		}
+		info.Version = before / 2
+		info.Time = math.Float64frombits(le.Uint64(r.mem[at+8:]))
+		size := uint64(le.Uint32(r.mem[at+16:]))
+		info.Err = int16(le.Uint16(r.mem[at+20:]))
+		if size > s.size {
+			size = s.size
+		}
+		data = append(data[:0], r.mem[at+slotHeader:at+slotHeader+size]...)
+		info.Size = int(size)
+		if r.load(at) == before {
+			return data, info, nil
+		}
+	}
+	if !r.Alive() {
+		return nil, info, ErrGone
+	}
+	return nil, info, ErrBusy
+}
+
+// Events returns the events published since the last call
+func (r *Reader) Events() []Event {
+	var events []Event
+	var lost uint64
+
+	if r.frames == 0 {
+		return nil
+	}
+	stride := roundLine(frameHeader + r.frameBytes)
+	for {
+		head := r.load(r.ring)
+		if r.next == head {
+			return events
+		}
+		if head-r.next > r.frames {
+			lost += head - r.frames - r.next
+			r.next = head - r.frames
+		}
+		at := r.ring + cacheLine + (r.next%r.frames)*stride
+		before := r.load(at)
+		if before == 2*r.next+2 {
+			size := uint64(le.Uint32(r.mem[at+28:]))
+			if size > r.frameBytes {
+				size = 0
+			}
+			ev := Event{
+				Seq:     r.next,
+				Time:    math.Float64frombits(le.Uint64(r.mem[at+8:])),
+				Machine: int(le.Uint32(r.mem[at+16:])),
+				Slot:    int(le.Uint32(r.mem[at+20:])),
+				Err:     int16(le.Uint16(r.mem[at+24:])),
+				Lost:    lost,
+				Data:    append([]byte(nil), r.mem[at+frameHeader:at+frameHeader+size]...),
+			}
+			if r.load(at) == before {
+				events = append(events, ev)
+				lost = 0
+				r.next++
+				continue
+			}
+		}
+		// overwritten while it was read
+		lost++
+		r.next++
+	}
+}
@@ -0,0 +1,40 @@
+package shmstate
+
+import (
+	"math"
+	"os"
+	"testing"
+)
+
+// TestPublishedSegment reads the segment that test_shmstate of examples/c
+// publishes and names in FWSTATE_TEST_NAME: machine "mill" with handle 7 in
+// row 1, 42.5 in its slot 0, nothing written for row 0
+func TestPublishedSegment(t *testing.T) {
+	name := os.Getenv("FWSTATE_TEST_NAME")
+	if name == "" {
+		t.Skip("FWSTATE_TEST_NAME is not set, run by test_shmstate")
+	}
+	r, err := Open(name)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer r.Close()
+
+	if r.Machines != 2 || r.Slots != 2 {
+		t.Fatalf("%d machines and %d slots, want 2 and 2", r.Machines, r.Slots)
+	}
+	m := r.Find(7)
+	if m != 1 || r.Name(m) != "mill" {
+		t.Fatalf("handle 7 is row %d %q, want 1 \"mill\"", m, r.Name(m))
+	}
+	data, info, err := r.Value(m, 0)
+	if err != nil || len(data) != 8 || info.Version != 1 || info.Time != 1.0 {
+		t.Fatalf("value %x %+v %v", data, info, err)
+	}
+	if v := math.Float64frombits(le.Uint64(data)); v != 42.5 {
+		t.Errorf("value %v, want 42.5", v)
+	}
+	if _, _, err := r.Value(0, 0); err != ErrNotWritten {
+		t.Errorf("row 0 was never written, got %v", err)
+	}
+}
@@ -1,5 +1,7 @@
 #include <Python.h>
 #include "fwlib32.h"
+#include "callstats.h"
+#include "sampling.h"
 #include <stdlib.h> // Added for malloc/free
 #include <string.h> // Added for memcpy/memset
 
@@ -10,6 +12,14 @@
 #define MACHINE_PORT_DEFAULT 8193
 #define TIMEOUT_DEFAULT 10
 
+// Times a FOCAS call of the context into the per-thread histograms of callstats.h
+#define FOCAS_TIMED(ret, fn, args)                      \
+    do {                                                \
+        unsigned long long start_ = callstats_now();    \
+        ret = fn args;                                  \
+        callstats_record(#fn, self->libh, start_, ret); \
+    } while (0)
+
 typedef struct {
     PyObject_HEAD
     unsigned short libh;
@@ -55,7 +65,7 @@ static int Context_init(Context* self, PyObject* args, PyObject* kwds) {
     }
 #endif
 
-    ret = cnc_allclibhndl3(host, port, timeout, &self->libh);
+    FOCAS_TIMED(ret, cnc_allclibhndl3, (host, port, timeout, &self->libh));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_ConnectionError, "Failed to connect to CNC: %d", ret);
         return -1;
@@ -83,7 +93,7 @@ static PyObject* Context_read_id(Context* self, PyObject* Py_UNUSED(ignored)) {
     char cnc_id[40] = "";
     int ret;
 
-    ret = cnc_rdcncid(self->libh, (unsigned long*) cnc_ids);
+    FOCAS_TIMED(ret, cnc_rdcncid, (self->libh, (unsigned long*) cnc_ids));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to read CNC ID: %d", ret);
         return NULL;
@@ -99,7 +109,7 @@ static PyObject* Context_read_status(Context* self, PyObject* Py_UNUSED(ignored)
     ODBST status;
     int ret;
 
-    ret = cnc_statinfo(self->libh, &status);
+    FOCAS_TIMED(ret, cnc_statinfo, (self->libh, &status));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to read status info: %d", ret);
         return NULL;
@@ -136,17 +146,19 @@ static PyObject* Context_read_status(Context* self, PyObject* Py_UNUSED(ignored)
 }
 
 static PyObject* Context_read_position(Context* self, PyObject* Py_UNUSED(ignored)) {
+    ODBPOS axes[4];  // cnc_rdposition fills one per axis read
     ODBPOS pos;
     short s4 = 4;  // Number of axes to read
     int ret;
 
-    memset(&pos, 0, sizeof(ODBPOS));  // Initialize the structure to zero
+    memset(axes, 0, sizeof(axes));  // Initialize the structures to zero
 
-    ret = cnc_rdposition(self->libh, -1, &s4, &pos);
+    FOCAS_TIMED(ret, cnc_rdposition, (self->libh, -1, &s4, axes));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to read position: %d", ret);
         return NULL;
     }
+    pos = axes[0];
 
     PyObject* dict = PyDict_New();
     if (!dict) {
@@ -196,7 +208,7 @@ static PyObject* Context_read_spindle(Context* self, PyObject* Py_UNUSED(ignored
     ODBSPEED speed;
     int ret;
 
-    ret = cnc_rdspeed(self->libh, -1, &speed);
+    FOCAS_TIMED(ret, cnc_rdspeed, (self->libh, -1, &speed));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to read spindle speed: %d", ret);
         return NULL;
@@ -254,7 +266,8 @@ static PyObject* Context_read_pmc(Context* self, PyObject* args) {
     }
     
     // Read PMC data
-    int ret = pmc_rdpmcrng(self->libh, adr_type, data_type, start_num, end_num, length, buf);
+    int ret;
+    FOCAS_TIMED(ret, pmc_rdpmcrng, (self->libh, adr_type, data_type, start_num, end_num, length, buf));
     if (ret != EW_OK) {
         free(buf);
         PyErr_Format(PyExc_RuntimeError, "Failed to read PMC data: %d", ret);
@@ -330,7 +343,8 @@ static PyObject* Context_read_pmc_bit(Context* self, PyObject* args) {
     }
     
     // Read PMC data (single byte)
-    int ret = pmc_rdpmcrng(self->libh, adr_type, data_type, adr_num, adr_num, length, buf);
+    int ret;
+    FOCAS_TIMED(ret, pmc_rdpmcrng, (self->libh, adr_type, data_type, adr_num, adr_num, length, buf));
     if (ret != EW_OK) {
         free(buf);
         PyErr_Format(PyExc_RuntimeError, "Failed to read PMC data: %d", ret);
@@ -462,7 +476,8 @@ static PyObject* Context_write_pmc(Context* self, PyObject* args) {
     }
 
     // Write PMC data
-    int ret = pmc_wrpmcrng(self->libh, length, buf);
+    int ret;
+    FOCAS_TIMED(ret, pmc_wrpmcrng, (self->libh, length, buf));
     free(buf); // Free memory after the call
 
     if (ret != EW_OK) {
@@ -482,7 +497,7 @@ static PyObject* Context_wrmdiprog(Context* self, PyObject* args) {
         return NULL;
     }
 
-    ret = cnc_wrmdiprog(self->libh, length, (char*)command);
+    FOCAS_TIMED(ret, cnc_wrmdiprog, (self->libh, length, (char*)command));
     return PyLong_FromLong(ret);
 }
 
@@ -494,7 +509,7 @@ static PyObject* Context_wrjogmdi(Context* self, PyObject* args) {
         return NULL;
     }
 
-    ret = cnc_wrjogmdi(self->libh, (char*)command);
+    FOCAS_TIMED(ret, cnc_wrjogmdi, (self->libh, (char*)command));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to write JOG MDI command: %d", ret);
         return NULL;
@@ -529,7 +544,7 @@ static PyObject* Context_set_mode(Context* self, PyObject* args) {
         return NULL;
     }
 
-    ret = cnc_wropnlsgnl(self->libh, &sgnl);
+    FOCAS_TIMED(ret, cnc_wropnlsgnl, (self->libh, &sgnl));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to set operation mode: %d", ret);
         return NULL;
@@ -559,7 +574,7 @@ static PyObject* Context_exit(Context* self, PyObject* exc_type, PyObject* exc_v
 static PyObject* Context_cycle_start(Context* self, PyObject* Py_UNUSED(ignored)) {
     int ret;
 
-    ret = cnc_start(self->libh);
+    FOCAS_TIMED(ret, cnc_start, (self->libh));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to send cycle start command: %d", ret);
         return NULL;
@@ -574,7 +589,7 @@ static PyObject* Context_read_program_number(Context* self, PyObject* Py_UNUSED(
 
     memset(&prog_num, 0, sizeof(ODBPRO));
 
-    ret = cnc_rdprgnum(self->libh, &prog_num);
+    FOCAS_TIMED(ret, cnc_rdprgnum, (self->libh, &prog_num));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to read program number: %d", ret);
         return NULL;
@@ -603,7 +618,7 @@ static PyObject* Context_read_main_program_path(Context* self, PyObject* Py_UNUS
     memset(path_buffer, 0, sizeof(path_buffer)); // Zero out the buffer
 
     // cnc_pdf_rdmain expects a char* buffer, not an ODBMAIN struct pointer
-    ret = cnc_pdf_rdmain(self->libh, path_buffer);
+    FOCAS_TIMED(ret, cnc_pdf_rdmain, (self->libh, path_buffer));
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to read main program path: %d", ret);
         return NULL;
@@ -625,7 +640,7 @@ static PyObject* Context_select_main_program(Context* self, PyObject* args) {
         return NULL; // Error parsing arguments
     }
 
-    ret = cnc_pdf_slctmain(self->libh, (char*)path); // Cast needed as API expects char*
+    FOCAS_TIMED(ret, cnc_pdf_slctmain, (self->libh, (char*)path)); // Cast needed as API expects char*
     if (ret != EW_OK) {
         PyErr_Format(PyExc_RuntimeError, "Failed to select main program '%s': %d", path, ret);
         return NULL;
@@ -641,7 +656,7 @@ static PyObject* Context_get_detailed_error(Context* self, PyObject* Py_UNUSED(i
     memset(&err_info, 0, sizeof(ODBERR));
 
     // Call the FOCAS function to get detailed error info
-    ret = cnc_getdtailerr(self->libh, &err_info);
+    FOCAS_TIMED(ret, cnc_getdtailerr, (self->libh, &err_info));
     if (ret != EW_OK) {
         // This function itself failed, perhaps invalid handle or communication issue
         PyErr_Format(PyExc_RuntimeError, "Failed to execute cnc_getdtailerr: %d", ret);
@@ -664,6 +679,281 @@ static PyObject* Context_get_detailed_error(Context* self, PyObject* Py_UNUSED(i
     return dict;
 }
 
+#define STATS_MAX_FUNCTIONS 64
+
+static int set_item(PyObject* dict, const char* key, PyObject* value) {
+    int ret = value ? PyDict_SetItemString(dict, key, value) : -1;
+    Py_XDECREF(value);
+    return ret;
+}
+
+// One dict per FOCAS function: calls, errors, latency quantiles and the count of each return code
+static PyObject* stats_dict(const CallStats* s) {
+    PyObject* dict = PyDict_New();
+    PyObject* codes = PyDict_New();
+    int failed = !dict || !codes;
+
+    for (int i = 0; !failed && i < CALLSTATS_CODES; i++) {
+        PyObject *code, *count;
+        if (s->codes[i] == 0) continue;
+        // the last index counts codes outside of the EW_* range
+        code = i == CALLSTATS_CODES - 1 ? PyUnicode_FromString("other")
+                                        : PyLong_FromLong(callstats_code(i));
+        count = PyLong_FromUnsignedLongLong(s->codes[i]);
+        failed = !code || !count || PyDict_SetItem(codes, code, count) != 0;
+        Py_XDECREF(code);
+        Py_XDECREF(count);
+    }
+    if (!failed) {
+        failed = set_item(dict, "calls", PyLong_FromUnsignedLongLong(s->calls)) ||
+                 set_item(dict, "errors", PyLong_FromUnsignedLongLong(s->errors)) ||
+                 set_item(dict, "mean_us", PyFloat_FromDouble(s->calls ? s->total_ns / 1e3 / s->calls : 0)) ||
+                 set_item(dict, "p50_us", PyFloat_FromDouble(callstats_quantile(s, 0.5) / 1e3)) ||
+                 set_item(dict, "p99_us", PyFloat_FromDouble(callstats_quantile(s, 0.99) / 1e3)) ||
+                 set_item(dict, "max_us", PyFloat_FromDouble(s->max_ns / 1e3)) ||
+                 PyDict_SetItemString(dict, "codes", codes);
+    }
+    Py_XDECREF(codes);
+    if (failed) {
+        Py_XDECREF(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+static PyObject* Context_stats(Context* self, PyObject* Py_UNUSED(ignored)) {
+    CallStats* rows = malloc(STATS_MAX_FUNCTIONS * sizeof(*rows));
+    PyObject* dict;
+    int n;
+
+    if (!rows) return PyErr_NoMemory();
+    // Merging the threads' histograms takes a lock, let other threads call meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    n = callstats_collect(rows, STATS_MAX_FUNCTIONS, self->libh);
+    Py_END_ALLOW_THREADS
+
+    if ((dict = PyDict_New()) == NULL) {
+        free(rows);
+        return NULL;
+    }
+    for (int i = 0; i < n; i++) {
+        if (set_item(dict, rows[i].function, stats_dict(&rows[i])) != 0) {
+            Py_DECREF(dict);
+            free(rows);
+            return NULL;
+        }
+    }
+    free(rows);
+    return dict;
+}
+
+typedef struct {
+    PyObject_HEAD
+    PyObject* context;  // keeps the handle alive while sampling
+    Sampler* sampler;
+    const unsigned short* batch;  // frames handed out by the last read()
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    int exports;
+} SamplerObject;
+
+static int SamplerObject_release_batch(SamplerObject* self) {
+    if (self->exports > 0) {
+        PyErr_SetString(PyExc_BufferError, "Release the memoryview of the last batch first");
+        return -1;
+    }
+    if (self->batch) {
+        sampler_release(self->sampler, self->shape[0]);
+        self->batch = NULL;
+    }
+    return 0;
+}
+
+static PyObject* SamplerObject_read(SamplerObject* self, PyObject* args, PyObject* kwds) {
+    double timeout = 1.0;
+    const unsigned short* frames;
+    size_t n;
+
+    static char* kwlist[] = {"timeout", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|d", kwlist, &timeout)) {
+        return NULL;
+    }
+    if (self->sampler == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Sampling was stopped");
+        return NULL;
+    }
+    if (SamplerObject_release_batch(self) < 0) return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    n = sampler_peek(self->sampler, &frames, (long) (timeout * 1000));
+    Py_END_ALLOW_THREADS
+
+    self->batch = frames;
+    self->shape[0] = n;
+    // the memoryview points into the ring and holds a reference to us
+    return PyMemoryView_FromObject((PyObject*) self);
+}
+
+static PyObject* SamplerObject_release(SamplerObject* self, PyObject* Py_UNUSED(ignored)) {
+    if (self->sampler && SamplerObject_release_batch(self) < 0) return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* SamplerObject_stats(SamplerObject* self, PyObject* Py_UNUSED(ignored)) {
+    SamplerStats stats;
+
+    if (self->sampler == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Sampling was stopped");
+        return NULL;
+    }
+    sampler_stats(self->sampler, &stats);
+    return Py_BuildValue("{s:K,s:K,s:k,s:h,s:h,s:O}",
+                         "frames", stats.frames, "dropped", stats.dropped,
+                         "reads", stats.reads, "status", stats.status,
+                         "error", stats.err,
+                         "running", sampler_running(self->sampler) ? Py_True : Py_False);
+}
+
+static PyObject* SamplerObject_stop(SamplerObject* self, PyObject* Py_UNUSED(ignored)) {
+    int ret;
+
+    if (self->sampler == NULL) Py_RETURN_NONE;
+    if (self->exports > 0) {
+        PyErr_SetString(PyExc_BufferError, "Release the memoryview of the last batch first");
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    ret = sampler_stop(self->sampler, NULL);
+    Py_END_ALLOW_THREADS
+    self->sampler = NULL;
+    self->batch = NULL;
+    if (ret != EW_OK) {
+        PyErr_Format(PyExc_RuntimeError, "Failed to end sampling: %d", ret);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* SamplerObject_exit(SamplerObject* self, PyObject* args) {
+    return SamplerObject_stop(self, NULL);
+}
+
+static int SamplerObject_getbuffer(SamplerObject* self, Py_buffer* view, int flags) {
+    if (self->sampler == NULL || self->batch == NULL) {
+        PyErr_SetString(PyExc_BufferError, "No batch was read");
+        return -1;
+    }
+    view->obj = (PyObject*) self;
+    Py_INCREF(self);
+    view->buf = (void*) self->batch;
+    view->len = self->shape[0] * self->strides[0];
+    view->readonly = 1;
+    view->itemsize = sizeof(unsigned short);
+    view->format = (flags & PyBUF_FORMAT) ? "H" : NULL;
+    view->ndim = 2;
+    view->shape = self->shape;
+    view->strides = self->strides;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    self->exports++;
+    return 0;
+}
+
+static void SamplerObject_releasebuffer(SamplerObject* self, Py_buffer* view) {
+    self->exports--;
+}
+
+static void SamplerObject_dealloc(SamplerObject* self) {
+    // no memoryview can be left, each one holds a reference
+    if (self->sampler) sampler_stop(self->sampler, NULL);
+    Py_XDECREF(self->context);
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static PyBufferProcs SamplerObject_as_buffer = {
+    (getbufferproc) SamplerObject_getbuffer,
+    (releasebufferproc) SamplerObject_releasebuffer,
+};
+
+static PyMethodDef SamplerObject_methods[] = {
+    {"read", (PyCFunction)SamplerObject_read, METH_VARARGS | METH_KEYWORDS, "Wait for frames and return them as a (frames, channels) memoryview into the ring"},
+    {"release", (PyCFunction)SamplerObject_release, METH_NOARGS, "Hand the last batch back to the ring"},
+    {"stats", (PyCFunction)SamplerObject_stats, METH_NOARGS, "Read sampling counters"},
+    {"stop", (PyCFunction)SamplerObject_stop, METH_NOARGS, "Stop sampling"},
+    {"__enter__", (PyCFunction)Context_enter, METH_NOARGS, "Enter the context."},
+    {"__exit__", (PyCFunction)SamplerObject_exit, METH_VARARGS, "Stop sampling."},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject SamplerType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fwlib.Sampler",
+    .tp_doc = "Servo data sampling started by Context.start_sampling",
+    .tp_basicsize = sizeof(SamplerObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) SamplerObject_dealloc,
+    .tp_as_buffer = &SamplerObject_as_buffer,
+    .tp_methods = SamplerObject_methods,
+};
+
+static PyObject* Context_start_sampling(Context* self, PyObject* args, PyObject* kwds) {
+    PyObject* channels;
+    SamplerOptions opts = default_sampler_options;
+    SamplerChannel chans[32];
+    Py_ssize_t count;
+    SamplerObject* obj;
+    Sampler* sampler;
+    short ret;
+
+    static char* kwlist[] = {"channels", "period", "type", "capacity", "batch", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|lhnl", kwlist, &channels,
+                                     &opts.period, &opts.type, &opts.capacity, &opts.batch)) {
+        return NULL;
+    }
+    channels = PySequence_Fast(channels, "channels must be a sequence of (type, chno, axis, shift)");
+    if (channels == NULL) return NULL;
+    count = PySequence_Fast_GET_SIZE(channels);
+    if (count < 1 || count > 32) {
+        Py_DECREF(channels);
+        PyErr_SetString(PyExc_ValueError, "Between 1 and 32 channels are supported");
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject* item = PySequence_Fast_GET_ITEM(channels, i);
+        int type, chno, axis, shift = 0;
+        if (!PyArg_ParseTuple(item, "iii|i", &type, &chno, &axis, &shift)) {
+            Py_DECREF(channels);
+            return NULL;
+        }
+        chans[i].type = type;
+        chans[i].chno = chno;
+        chans[i].axis = axis;
+        chans[i].shift = shift;
+    }
+    Py_DECREF(channels);
+
+    sampler = sampler_start(self->libh, chans, count, &opts, &ret);
+    if (sampler == NULL) {
+        PyErr_Format(PyExc_RuntimeError, "Failed to start sampling: %d", ret);
+        return NULL;
+    }
+    obj = PyObject_New(SamplerObject, &SamplerType);
+    if (obj == NULL) {
+        sampler_stop(sampler, NULL);
+        return NULL;
+    }
+    Py_INCREF(self);
+    obj->context = (PyObject*) self;
+    obj->sampler = sampler;
+    obj->batch = NULL;
+    obj->shape[0] = 0;
+    obj->shape[1] = count;
+    obj->strides[0] = count * sizeof(unsigned short);
+    obj->strides[1] = sizeof(unsigned short);
+    obj->exports = 0;
+    return (PyObject*) obj;
+}
+
 static PyMethodDef Context_methods[] = {
     {"read_id", (PyCFunction)Context_read_id, METH_NOARGS, "Read CNC ID"},
     {"read_status", (PyCFunction)Context_read_status, METH_NOARGS, "Read CNC status"},
@@ -680,6 +970,8 @@ static PyMethodDef Context_methods[] = {
     {"wrjogmdi", (PyCFunction)Context_wrjogmdi, METH_VARARGS, "Write JOG MDI command"},
     {"set_mode", (PyCFunction)Context_set_mode, METH_VARARGS, "Set operation mode (mdi/auto/jog)"},
     {"cycle_start", (PyCFunction)Context_cycle_start, METH_NOARGS, "Send cycle start command to CNC"},
+    {"start_sampling", (PyCFunction)Context_start_sampling, METH_VARARGS | METH_KEYWORDS, "Start servo data sampling (cnc_sdt*) on a background thread"},
+    {"stats", (PyCFunction)Context_stats, METH_NOARGS, "Latency (p50/p99/max) and return codes of the FOCAS calls on this handle"},
     {"__enter__", (PyCFunction)Context_enter, METH_NOARGS, "Enter the context."},
     {"__exit__", (PyCFunction)Context_exit, METH_VARARGS, "Exit the context."},
     {NULL}  /* Sentinel */
@@ -709,6 +1001,8 @@ PyMODINIT_FUNC PyInit_fwlib(void) {
     PyObject* m;
     if (PyType_Ready(&ContextType) < 0)
         return NULL;
+    if (PyType_Ready(&SamplerType) < 0)
+        return NULL;
 
     m = PyModule_Create(&fwlibmodule);
     if (m == NULL)
@@ -721,6 +1015,13 @@ PyMODINIT_FUNC PyInit_fwlib(void) {
         return NULL;
     }
 
+    Py_INCREF(&SamplerType);
+    if (PyModule_AddObject(m, "Sampler", (PyObject*) &SamplerType) < 0) {
+        Py_DECREF(&SamplerType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
     return m;
 }
 
@@ -2,7 +2,7 @@ from setuptools import setup, Extension
 
 module = Extension(
     "fwlib",
-    sources=["fwlib.c"],
+    sources=["fwlib.c", "sampling.c", "spsc.c", "callstats.c"],
     libraries=["fwlib32"],
 )
 
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""Benchmarks of the fwlib extension against the simulated library.
+
+The simulated libfwlib32 (examples/c, target fwlib32-sim) runs without
+latency here, so the numbers are the cost of the binding itself:
+
+    LD_LIBRARY_PATH=examples/c/build/sim python3 bench_fwlib.py --output=before.json
+    # change fwlib.c, rebuild
+    LD_LIBRARY_PATH=examples/c/build/sim python3 bench_fwlib.py --compare=before.json
+"""
+
+import os
+
+# read by the simulated library on its first call
+os.environ.setdefault("FWSIM_LATENCY", "0")
+os.environ.setdefault("FWSIM_JITTER", "0")
+
+import argparse
+import contextlib
+import gc
+import io
+import json
+import platform
+import statistics
+import sys
+import threading
+import time
+import tracemalloc
+
+import fwlib
+import read_status
+
+PMC_ADDR_R = 5
+PMC_TYPE_BYTE = 0
+PMC_TYPE_WORD = 1
+
+
+def measure(fn, calls, repeat):
+    """Nanoseconds per call of the best, median and worst of `repeat` runs"""
+    fn()
+    runs = []
+    for _ in range(repeat):
+        start = time.perf_counter_ns()
+        for _ in range(calls):
+            fn()
+        runs.append((time.perf_counter_ns() - start) / calls)
+    return {"ns": statistics.median(runs), "min_ns": min(runs), "max_ns": max(runs)}
+
+
+def allocations(fn, calls):
+    """Bytes allocated per call and bytes still held afterwards, per call"""
+    fn()
+    gc.collect()
+    tracemalloc.start()
+    before = tracemalloc.take_snapshot()
+    tracemalloc.reset_peak()
+    for _ in range(calls):
+        fn()
+    peak = tracemalloc.get_traced_memory()[1]
+    gc.collect()
+    after = tracemalloc.take_snapshot()
+    tracemalloc.stop()
+    stats = after.compare_to(before, "filename")
+    held = sum(s.size_diff for s in stats)
+    blocks = sum(s.count_diff for s in stats)
+    return {"peak_bytes": peak, "held_bytes_per_call": held / calls,
+            "held_blocks_per_call": blocks / calls}
+
+
+def poll_cycle(cnc):
+    """One refresh of read_status.py, printed into a buffer"""
+    out = io.StringIO()
+    with contextlib.redirect_stdout(out):
+        read_status.print_dict("Machine Status", cnc.read_status())
+        read_status.print_dict("Position Information", cnc.read_position())
+        read_status.print_dict("Spindle Information", cnc.read_spindle())
+
+
+def calls(cnc):
+    """name -> call, for every case measured on a single Context"""
+    cases = {
+        "read_status": cnc.read_status,
+        "read_position": cnc.read_position,
+        "read_spindle": cnc.read_spindle,
+    }
+    for n in (1, 10, 100, 1000, 10000):
+        cases[f"read_pmc/byte/{n}"] = (
+            lambda n=n: cnc.read_pmc(PMC_ADDR_R, PMC_TYPE_BYTE, 0, n - 1))
+    for n in (1, 10, 100, 1000):
+        cases[f"read_pmc/word/{n}"] = (
+            lambda n=n: cnc.read_pmc(PMC_ADDR_R, PMC_TYPE_WORD, 0, n - 1))
+    for n in (1, 10, 100, 1000):
+        values = list(range(n))
+        cases[f"write_pmc/word/{n}"] = (
+            lambda n=n, v=values: cnc.write_pmc(PMC_ADDR_R, PMC_TYPE_WORD, 0, n - 1, v))
+    cases["poll_cycle"] = lambda: poll_cycle(cnc)
+    return cases
+
+
+def scaling(host, port, threads, duration):
+    """read_status calls per second of `threads` threads, each with its own
+    Context to a machine of its own"""
+    done = threading.Event()
+    counts = [0] * threads
+    ready = threading.Barrier(threads + 1)
+
+    def worker(i):
+        with fwlib.Context(host=f"{host}.{i + 1}", port=port) as cnc:
+            ready.wait()
+            while not done.is_set():
+                cnc.read_status()
+                counts[i] += 1
+
+    workers = [threading.Thread(target=worker, args=(i,)) for i in range(threads)]
+    for t in workers:
+        t.start()
+    ready.wait()
+    start = time.perf_counter()
+    time.sleep(duration)
+    done.set()
+    for t in workers:
+        t.join()
+    return {"calls_per_second": sum(counts) / (time.perf_counter() - start)}
+
+
+def compare(results, baseline):
+    print(f"{'case':<28}{'ns':>12}{'baseline':>12}{'change':>9}")
+    for name, r in results.items():
+        key = "ns" if "ns" in r else "calls_per_second"
+        old = baseline.get(name, {}).get(key)
+        change = f"{(r[key] - old) / old * 100:+8.1f}%" if old else ""
+        print(f"{name:<28}{r[key]:>12.0f}{old or 0:>12.0f}{change:>9}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="fwlib extension benchmarks")
+    parser.add_argument("--host", default="10.0.0.1", help="simulated machine")
+    parser.add_argument("--port", type=int, default=8193)
+    parser.add_argument("--calls", type=int, default=2000, help="calls per run")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per case")
+    parser.add_argument("--threads", default="1,2,4,8", help="thread counts")
+    parser.add_argument("--duration", type=float, default=1.0,
+                        help="seconds per thread count")
+    parser.add_argument("--output", help="write the results as json")
+    parser.add_argument("--compare", help="json of an earlier run")
+    args = parser.parse_args()
+
+    results = {}
+    with fwlib.Context(host=args.host, port=args.port) as cnc:
+        for name, fn in calls(cnc).items():
+            results[name] = measure(fn, args.calls, args.repeat)
+            results[name].update(allocations(fn, args.calls))
+
+    # "10.0.0.1" -> machines 10.0.0.1, 10.0.0.2, ... for the threads
+    prefix = args.host.rsplit(".", 1)[0]
+    for n in (int(t) for t in args.threads.split(",")):
+        results[f"threads/{n}"] = scaling(prefix, args.port, n, args.duration)
+
+    if args.compare:
+        with open(args.compare) as f:
+            compare(results, json.load(f)["results"])
+    else:
+        json.dump(results, sys.stdout, indent=2)
+        print()
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"python": platform.python_version(),
+                       "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+                       "results": results}, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+
+"""
+Reader for the shared memory state published by the C poller
+(examples/c/src/shmstate.h). Needs no FOCAS library, only mmap.
+
+    with StateReader("/fwstate") as state:
+        machine = state.find(libh)
+        value, info = state.value(machine, 0)
+        for event, data in state.events():
+            ...
+"""
+
+import argparse
+import mmap
+import os
+import struct
+import time
+
+MAGIC = b"FWSTATE\0"
+VERSION = 1
+CACHE_LINE = 64
+SLOT_HEADER = 32
+FRAME_HEADER = 32
+
+HEADER = struct.Struct("<8sIIIIQQQIIII")
+SLOT_ENTRY = struct.Struct("<QQ")
+MACHINE_ENTRY = struct.Struct("<I28s")
+SLOT = struct.Struct("<QdIhH")
+FRAME = struct.Struct("<QdIIhHI")
+U64 = struct.Struct("<Q")
+# reads of a slot its writer holds before value() gives up, as state_read
+READ_TRIES = 1000
+
+
+def _round_line(n):
+    return (n + CACHE_LINE - 1) & ~(CACHE_LINE - 1)
+
+
+class StateReader:
+    """Read-only view of a published segment"""
+
+    def __init__(self, name="/fwstate"):
+        fd = os.open("/dev/shm/" + name.lstrip("/"), os.O_RDONLY)
+        try:
+            self._mem = mmap.mmap(fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+        finally:
+            os.close(fd)
+        (magic, version, _, self.machines, self.slots, self._stride,
+         self._table, self._ring, self._frames, self._frame_bytes,
+         self.pid, _) = HEADER.unpack_from(self._mem, 0)
+        if magic != MAGIC or version != VERSION:
+            self._mem.close()
+            raise ValueError(f"{name} is not a version {VERSION} state segment")
+        entries = HEADER.size
+        self._slot_dir = [SLOT_ENTRY.unpack_from(self._mem, entries + i * SLOT_ENTRY.size)
+                          for i in range(self.slots)]
+        entries += self.slots * SLOT_ENTRY.size
+        self.names = {}
+        for m in range(self.machines):
+            libh, name = MACHINE_ENTRY.unpack_from(self._mem, entries + m * MACHINE_ENTRY.size)
+            self.names[m] = (libh, name.split(b"\0", 1)[0].decode())
+        self._frame_stride = _round_line(FRAME_HEADER + self._frame_bytes)
+        self._next = self._head()
+
+    def close(self):
+        self._mem.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def find(self, libh):
+        """machine row of a handle, None when it is not published"""
+        for m, (h, _) in self.names.items():
+            if h == libh:
+                return m
+        return None
+
+    def alive(self):
+        """False once the publishing process is gone"""
+        try:
+            os.kill(self.pid, 0)
+        except ProcessLookupError:
+            return False
+        except PermissionError:
+            pass
+        return True
+
+    def value(self, machine, slot):
+        """(bytes, info) of the latest value, None when never written.
+        info holds version, time, err and size like StateInfo. raises
+        ProcessLookupError when the slot stays locked because the publisher
+        died while writing it, TimeoutError when it stays locked otherwise."""
+        offset, size = self._slot_dir[slot]
+        at = self._table + machine * self._stride + offset
+        for tries in range(READ_TRIES):
+            if tries:
+                os.sched_yield()
+            before = U64.unpack_from(self._mem, at)[0]
+            if before & 1:
+                continue
+            if before == 0:
+                return None
+            _, t, n, err, _ = SLOT.unpack_from(self._mem, at)
+            data = self._mem[at + SLOT_HEADER:at + SLOT_HEADER + min(n, size)]
+            if U64.unpack_from(self._mem, at)[0] == before:
+                return data, {"version": before // 2, "time": t, "err": err, "size": len(data)}
+        if not self.alive():
+            raise ProcessLookupError(f"publisher {self.pid} died writing slot {slot} of machine {machine}")
+        raise TimeoutError(f"slot {slot} of machine {machine} stays locked")
+
+    def _head(self):
+        return U64.unpack_from(self._mem, self._ring)[0] if self._frames else 0
+
+    def events(self):
+        """yield (event, bytes) published since the last call. event holds
+        seq, time, machine, slot, err and lost, the events overwritten
+        before they were read."""
+        lost = 0
+        while self._frames:
+            head = self._head()
+            if self._next == head:
+                return
+            if head - self._next > self._frames:
+                lost += head - self._frames - self._next
+                self._next = head - self._frames
+            at = (self._ring + CACHE_LINE
+                  + (self._next % self._frames) * self._frame_stride)
+            seq, t, machine, slot, err, _, n = FRAME.unpack_from(self._mem, at)
+            data = self._mem[at + FRAME_HEADER:at + FRAME_HEADER + min(n, self._frame_bytes)]
+            if seq == 2 * self._next + 2 and U64.unpack_from(self._mem, at)[0] == seq:
+                yield {"seq": self._next, "time": t, "machine": machine,
+                       "slot": slot, "err": err, "lost": lost}, data
+                lost = 0
+            else:
+                lost += 1  # overwritten while it was read
+            self._next += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Print the published machine state")
+    parser.add_argument("--name", default="/fwstate", help="shared memory name")
+    parser.add_argument("--follow", action="store_true", help="print events as they arrive")
+    args = parser.parse_args()
+
+    with StateReader(args.name) as state:
+        for m, (libh, name) in state.names.items():
+            for slot in range(state.slots):
+                got = state.value(m, slot)
+                if got:
+                    data, info = got
+                    print(f"{name or libh} slot {slot}: err {info['err']} "
+                          f"version {info['version']} {data.hex()}")
+        while args.follow:
+            for event, data in state.events():
+                print(event, data.hex())
+            time.sleep(0.1)
+
+
+if __name__ == "__main__":
+    main()
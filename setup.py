@@ -2,8 +2,10 @@ from setuptools import setup, Extension
 
 module = Extension(
     'fwlib',
-    sources=['examples/python-c-extension/fwlib.c'],
-    include_dirs=['.'],  # Look in current directory for fwlib32.h
+    sources=['examples/python-c-extension/fwlib.c',
+             'examples/c/src/sampling.c', 'examples/c/src/spsc.c',
+             'examples/c/src/callstats.c'],
+    include_dirs=['.', 'examples/c/src'],  # Look in current directory for fwlib32.h
     library_dirs=['.'],  # Look in current directory for the library
     libraries=['fwlib32-linux-x64'],  # Name without 'lib' prefix and .so suffix
     runtime_library_dirs=['.']  # Add this line